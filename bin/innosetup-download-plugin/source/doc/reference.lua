@@ -130,6 +130,50 @@ idpDownloadAfter = {
     seealso = { "idpAddFile", "idpAddFtpDir" }
 }
 
+idpPrefetch = {
+    proto  = "procedure idpPrefetch(components: String);",
+    desc   = [[Starts downloading files in background, while user is still on earlier wizard pages. Files without
+               components and files of given components are prefetched; sizes of files are determined too.
+               Call it again when component selection changes: transfers of deselected files are cancelled
+               (downloaded part is kept on disk) and newly selected files are added. Files, prefetched completely,
+               are not downloaded again by download page or @idpDownloadFilesComp.]],
+    params = {
+        { "components", "A comma separated list of selected components, as returned by <tt>WizardSelectedComponents(false)</tt>" }
+    },
+    seealso = { "idpAddFile", "idpDownloadAfter" },
+    example = [[
+procedure <b>InitializeWizard</b>();
+begin
+  idpAddFile('http://www.example.com/base.zip', ExpandConstant('{tmp}\base.zip'));
+  idpAddFileComp('http://www.example.com/extra.zip', ExpandConstant('{tmp}\extra.zip'), 'extra');
+
+  idpDownloadAfter(wpReady);
+  idpPrefetch(WizardSelectedComponents(false));
+end;
+
+function <b>NextButtonClick</b>(CurPageID: Integer): Boolean;
+begin
+  if CurPageID = wpSelectComponents then
+    idpPrefetch(WizardSelectedComponents(false));
+
+  Result := True;
+end;
+]]
+}
+
+idpDumpTrace = {
+    proto   = "function idpDumpTrace(filename: String): Boolean;",
+    desc    = [[Writes trace of last network events to text file. IDP always records events of download (connects,
+               responses, reads &amp; writes, progress updates, mirror switches, stalls &amp; retries) in fixed-size
+               memory buffer, so trace is available even in release builds. Each line contains time in nanoseconds,
+               thread, file id (see list of files at the beginning), event name &amp; value.]],
+    params  = {
+        { "filename", "Name of trace file" }
+    },
+    returns = "True if file was written",
+    seealso = { "idpSetOption" }
+}
+
 idpGetFileSize = {
     proto  = "function idpGetFileSize(url: String; var size: Int64{note-1}): Boolean;",
     desc   = "Gets size of file at given URL.",
@@ -174,6 +218,71 @@ idpSetOption = {
         { "StopOnError",      [[If one file cannot be downloaded, do not try to download other files. When <tt>AllowContinue</tt> 
                               is set to <tt>1</tt>, this option automatically sets to <tt>0</tt> and vise versa.]],       "<b>not</b> AllowContinue" },
         { "PreserveFtpDirs",  "Preserve FTP directory structure when using @idpAddFtpDir",                                "1" },
+        { "FtpSnapshot",      [[Save list of downloaded files with their sizes and modification times when using @idpAddFtpDir.
+                              Files, not changed on server since they were downloaded, are not downloaded again]],              "1" },
+        { "FtpScanConnections", [[Maximum number of FTP connections, used to list subdirectories concurrently, when 
+                              recursive @idpAddFtpDir is used]],                                                          "4" },
+        { "ExtractThreads",   [[Number of threads, used by @idpExtract to extract archives. <tt>auto</tt> - one thread
+                              per processor (up to 16)]],                                                                 "auto" },
+        { "HostConnections",  [[Maximum number of connections to one host, used by all downloads at once (including
+                              <tt>FtpSegments</tt>, <tt>FtpScanConnections</tt> and hedged requests). Extra connections are
+                              only opened, if host has free ones. Limits of some hosts can be given after default one:
+                              <tt>4; github.com=2; ftp.example.org=1</tt>. <tt>0</tt> - no limit]],                        "4" },
+        { "AdaptiveConcurrency", [[Tune number of simultaneous streams (file transfers and <tt>FtpSegments</tt>) to measured
+                              throughput: while total download speed grows, one more stream is allowed every 2 seconds,
+                              on failed or stalled transfers, falling speed or rising connect time the number is halved.
+                              Segmented file uses as many segments, as are allowed when its download starts]],              "0" },
+        { "MaxStreams",       "Upper limit of streams for <tt>AdaptiveConcurrency</tt>",                                   "16" },
+        { "AsyncTransfers",   [[Number of files, which are downloaded at once by asynchronous engine: few threads drive
+                              all connections without blocking calls, so hundreds of small files don't wait for each other.
+                              File sizes are queried the same way. Files with zip members, piece hashes or FTP segments, and
+                              files which failed, are then downloaded one by one as usual (with mirrors and retries).
+                              Connections to one host are still limited by <tt>HostConnections</tt>.
+                              With <tt>wininet</tt> transport only HTTP(S) files are downloaded this way.
+                              <tt>0</tt> - files are downloaded one by one]],                                               "0" },
+        { "AsyncThreads",     "Number of threads of asynchronous engine (see <tt>AsyncTransfers</tt>)",                  "2" },
+        { "BufferMemory",     [[Memory budget (in bytes) of read buffers of all simultaneous transfers. When it is used up,
+                              new transfers read with smaller buffers or wait, until other transfers finish.
+                              Peak use is written to <tt>PerfReport</tt>. <tt>0</tt> - no limit]],                           "67108864" },
+        { "FtpSegments",      [[Number of simultaneous FTP connections, used to download one large file. 
+                              Space for whole file is allocated before download, and each connection writes directly 
+                              into memory-mapped part of it. Set to <tt>1</tt> to download files over single connection]],     "4" },
+        { "FtpSegmentMinSize", "Minimum size of file (in bytes), which is downloaded over several FTP connections",       "8388608" },
+        { "StallTimeout",     [[Time, in milliseconds, after which slow transfer is considered stalled. Stalled transfer is 
+                              continued at current offset from next mirror (see @idpAddMirror). It's also used as receive timeout of
+                              transfers, unless <tt>ReceiveTimeout</tt> is set. <tt>0</tt> turns stall detection off]], "15000" },
+        { "StallSpeed",       "Transfer is stalled, if its speed during <tt>StallTimeout</tt> is below this value (in bytes per second)", "512" },
+        { "StallRatio",       [[... or below this percent of median speed of files, already downloaded during this
+                              session. <tt>0</tt> disables comparison with other files]],                                "10" },
+        { "Hedge",            [[If set to <tt>1</tt>, request, which got no response in 90th percentile of response times
+                              of this session, is repeated to mirror (or over second connection), first response is used]], "0" },
+        { "HedgeDelay",       "Fixed time, in milliseconds, before request is repeated. <tt>0</tt> - use measured response times", "0" },
+        { "HedgeBudget",      "Maximum number of bytes, which cancelled repeated requests may waste",                     "1048576" },
+        { "RetryAttempts",    [[Number of attempts to download each file (including first one). Download is retried after
+                              timeouts, dropped connections and HTTP errors 408, 429 & 5xx, continuing from where it
+                              stopped. <tt>1</tt> turns automatic retries off]],                                         "3" },
+        { "RetryDelay",       "Delay, in milliseconds, before first retry. Each next delay is doubled, with random jitter", "500" },
+        { "RetryMaxDelay",    [[Maximum delay, in milliseconds, between retries. If server asks (in <tt>Retry-After</tt> header)
+                              to wait longer, download is not retried]],                                                 "30000" },
+        { "ResumeJournal",    [[Keep journal of downloaded parts next to each file (<tt>&lt;file&gt;.idpjournal</tt>), updated
+                              every 2 seconds after data is flushed to disk. If setup was killed or cancelled, next download
+                              continues from data, which is already on disk. Journal is deleted when file is complete]],  "1" },
+        { "PieceSidecar",     [[Before downloading file, look for its piece hashes at file URL + <tt>.pieces</tt>. First line
+                              of this text file is hash type &amp; piece size (<tt>sha-256 1048576</tt>), then hash of each
+                              piece follows on its own line. Pieces are checked during download, corrupted ones are downloaded
+                              again with range requests (from mirrors first), instead of whole file. Piece hashes from
+                              Metalink (@idpAddMetalink) are used in same way]],                                          "0" },
+        { "Location",         [[ISO 3166-1 country code (<tt>de</tt>, <tt>us</tt>, ...). Mirrors in this country, listed in
+                              Metalink documents, are tried first. <tt>auto</tt> - country from Windows regional settings,
+                              <tt>none</tt> - only priority of mirrors is used]],                                        "auto" },
+        { "TraceFile",        [[If download fails, IDP writes here trace of last network events (connects, reads, writes,
+                              mirror switches, retries) with nanosecond timestamps, to find out why download is slow or fails.
+                              Trace can also be written at any time with @idpDumpTrace]],                              "" },
+        { "PerfReport",       [[After download, IDP writes here JSON report with timings of each file: DNS lookup, connect,
+                              TLS handshake, request sent &amp; first byte (ms from start of request), transfer time, bytes,
+                              retries, source URL (mirror) &amp; HTTP status, and peak memory of read buffers. Reports can be collected to find slow mirrors &amp; hosts]], "" },
+        { "Transport",        [[Network library, used to download files: <tt>WinINet</tt> or <tt>curl</tt>. 
+                              <tt>curl</tt> is available only if IDP was built with libcurl (<tt>IDP_CURL</tt>)]],       "WinINet" },
         { "DetailedMode",     "If set to <tt>1</tt>, download details will be visible by default",                        "0" },
         { "DetailsButton",    "Controls availability of 'Details' button",                                                "1" },
         { "RetryButton",      [[Controls availability of 'Retry' button on wizard form. If set to <tt>0</tt>,
@@ -325,6 +434,99 @@ idpAddFtpDir('ftp://ftpserver.com/pub/myfiles', '*.dll', ExpandConstant('{tmp}')
 
 idpAddFtpDirComp = idpAddFtpDir;
 
+idpAddMetalink = {
+    title = "idpAddMetalink, idpAddMetalinkComp",
+    proto = [[
+function idpAddMetalink(source, destdir: String): Boolean;
+function idpAddMetalinkComp(source, destdir, components: String): Boolean;
+]],
+    desc = [[Adds all files, listed in Metalink document (<tt>.meta4</tt>, RFC 5854, or Metalink 3 <tt>.metalink</tt>),
+             to download list. For each file, URL with best priority becomes file URL and other URLs are added as mirrors,
+             URLs in user's country (see <a href="idpSetOption.htm"><tt>Location</tt> option</a>) go first.
+             File sizes are taken from document, downloaded files are checked with SHA-256 or SHA-1 hash, if it is given,
+             and downloaded again, if hash doesn't match. If document has piece hashes, only corrupted pieces are
+             downloaded again (see <a href="idpSetOption.htm"><tt>PieceSidecar</tt> option</a>). Subdirectories in file names are created in <tt>destdir</tt>,
+             names, which point outside of it, are ignored.]],
+    params = {
+        { "source",     "Metalink file name on the local disk or its URL. Downloaded document is not kept" },
+        { "destdir",    "Destination directory on the local disk" },
+        { "components", "A space separated list of component names, telling IDP to which components the files belong" }
+    },
+    returns  = "<tt>True</tt> if document was read, <tt>False</tt> if it couldn't be downloaded or isn't Metalink",
+    keywords = { "metalink", "mirror", "hash" },
+    seealso  = { "idpAddFile", "idpAddMirror" },
+    example  = [[
+idpAddMetalink('http://www.example.com/files.meta4', ExpandConstant('{tmp}'));
+]]
+}
+
+idpAddMetalinkComp = idpAddMetalink;
+
+idpAddZipMembers = {
+    title = "idpAddZipMembers, idpAddZipMembersComp",
+    proto = [[
+procedure idpAddZipMembers(url, filename, include, exclude, extractdir: String);
+procedure idpAddZipMembersComp(url, filename, include, exclude, extractdir, components: String);
+]],
+    desc = [[Adds zip archive, of which only some members are needed, to download list. End of archive and its central directory
+             are read with range requests, then only members, matching <tt>include</tt> and not matching <tt>exclude</tt> masks,
+             are downloaded. Members, which lie close to each other, are fetched with one request. Selected members are written to
+             <tt>filename</tt> as smaller zip archive, or extracted to <tt>extractdir</tt>. If server doesn't support range requests,
+             whole archive is downloaded and reduced after download.<br>
+             Stored and deflated members are supported, encrypted members and self-extracting archives are not.]],
+    params = {
+        { "url",        "Full file URL of zip archive" },
+        { "filename",   "File name of reduced archive on the local disk" },
+        { "include",    "Semicolon separated list of member name masks, like <tt>bin/*;*.ini</tt>. Empty string selects all members" },
+        { "exclude",    "Semicolon separated list of member name masks, which are not downloaded. May be empty" },
+        { "extractdir", "If not empty, members are extracted to this directory, subdirectories included, and reduced archive is deleted" },
+        { "components", "A space separated list of component names, telling IDP to which components the file belongs" }
+    },
+    keywords = { "zip", "range" },
+    seealso  = { "idpAddFile" },
+    example  = [[
+//Download only PHP extensions from big archive
+idpAddZipMembers('http://www.example.com/php.zip', ExpandConstant('{tmp}\php-ext.zip'), 'ext/*.dll', '*debug*', '');
+
+//Download and extract documentation
+idpAddZipMembers('http://www.example.com/php.zip', ExpandConstant('{tmp}\php.zip'), 'doc/*', '', ExpandConstant('{app}\doc'));
+]]
+}
+
+idpAddZipMembersComp = idpAddZipMembers;
+
+idpExtract = {
+    proto  = "procedure idpExtract(archive, destdir: String);",
+    desc   = [[Adds zip archive to list of archives, which are extracted by IDP. If <tt>archive</tt> is also added to download list
+             (with @idpAddFile), its extraction starts as soon as it is downloaded, while other files are still downloading.
+             Archives are extracted on several threads (see <a href="idpSetOption.htm"><tt>ExtractThreads</tt> option</a>),
+             members of big archive are divided between threads too. Stored and deflated members are supported, extracted data
+             is checked with CRC-32. 7z and other formats are not supported.]],
+    params = {
+        { "archive", "Zip archive file name on the local disk" },
+        { "destdir", "Destination directory, created if needed. Subdirectories of archive are created inside it" }
+    },
+    keywords = { "zip", "extract", "unzip" },
+    seealso  = { "idpExtractAll", "idpAddFile" },
+    example  = [[
+idpAddFile('http://www.example.com/php.zip', ExpandConstant('{tmp}\php.zip'));
+idpExtract(ExpandConstant('{tmp}\php.zip'), ExpandConstant('{app}\bin\php'));
+idpDownloadAfter(wpReady);
+...
+//In CurStepChanged(ssInstall):
+if not idpExtractAll then
+    MsgBox('Cannot extract files', mbError, MB_OK);
+]]
+}
+
+idpExtractAll = {
+    proto   = "function idpExtractAll: Boolean;",
+    desc    = [[Starts extraction of all archives, added with @idpExtract, which are not started yet, and waits until all of them
+              are extracted, showing progress on download page. List of archives is cleared after that.]],
+    returns = "<tt>True</tt> if all archives were extracted, <tt>False</tt> otherwise",
+    seealso = { "idpExtract" }
+}
+
 group "Support functions"
 
 StrToBool = {
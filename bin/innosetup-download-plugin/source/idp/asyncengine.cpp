@@ -0,0 +1,326 @@
+#include <algorithm>
+#include <process.h>
+#include "asyncengine.h"
+#include "hostscheduler.h"
+#include "concurrency.h"
+#include "trace.h"
+
+AsyncTransfer::AsyncTransfer(NetFile *file, tstring address, bool querySize): url(address)
+{
+    netFile      = file;
+    sizeOnly     = querySize;
+    state        = AS_QUEUED;
+    bytes        = 0;
+    size         = FILE_SIZE_UNKNOWN;
+    httpStatus   = 0;
+    retryAfter   = 0;
+    error        = 0;
+    transferTime = 0;
+    request      = NULL;
+    engine       = NULL;
+    responded    = false;
+
+    url.internetOptions = file->url.internetOptions;
+    url.traceId         = file->url.traceId;
+}
+
+bool AsyncTransfer::response(int status, DWORDLONG contentLength, DWORD retryAfterSec)
+{
+    responded  = true;
+    httpStatus = status;
+    size       = contentLength;
+    retryAfter = retryAfterSec;
+
+    traceEvent(TE_RESPONSE, url.traceId, 1);
+
+    if((status == 429) || (status == 503))
+        concurrency.addLoss(_T("server busy"));
+
+    if(status && (status != HTTP_STATUS_OK))
+    {
+        TRACE(_T("HTTP status %d of %s"), status, url.urlString.c_str());
+        error = ERROR_INTERNET_EXTENDED_ERROR;
+        return false;
+    }
+
+    if(sizeOnly)
+        return true;
+
+    if(!file.open(netFile->name))
+    {
+        TRACE(_T("Cannot create file %s"), netFile->name.c_str());
+        error = ERROR_OPEN_FAILED;
+        return false;
+    }
+
+    return true;
+}
+
+bool AsyncTransfer::received(const BYTE *data, DWORD n)
+{
+    if(engine->cancelled)
+    {
+        error = ERROR_INTERNET_OPERATION_CANCELLED;
+        return false;
+    }
+
+    if(sizeOnly)
+        return true;
+
+    if(!bytes)
+        traceEvent(TE_FIRST_BYTE, url.traceId, 0);
+
+    if(file.write((BYTE *)data, n) != n)
+    {
+        error = ERROR_DISK_FULL;
+        return false;
+    }
+
+    traceEvent(TE_READ, url.traceId, n);
+    bytes += n;
+    engine->addBytes(n);
+    return true;
+}
+
+void AsyncTransfer::finished(DWORD errorCode)
+{
+    if(!error)
+        error = errorCode;
+
+    // Connection closed before whole file was received
+    if(!error && !sizeOnly && !(size == FILE_SIZE_UNKNOWN) && (bytes != size))
+        error = ERROR_INTERNET_CONNECTION_RESET;
+
+    file.close();
+    transferTime = timer.totalElapsed();
+    state        = error ? AS_FAILED : AS_DONE;
+
+    if((error == ERROR_INTERNET_TIMEOUT) || (error == ERROR_INTERNET_CONNECTION_RESET) || (error == ERROR_INTERNET_CANNOT_CONNECT))
+        concurrency.addLoss((error == ERROR_INTERNET_TIMEOUT) ? _T("timeout") : _T("connection failure"));
+}
+
+AsyncEngine::AsyncEngine()
+{
+    threads      = DEFAULT_ASYNC_THREADS;
+    maxTransfers = MAX_ASYNC_TRANSFERS;
+    session      = NULL;
+    running      = 0;
+    bytes        = 0;
+    cancelled    = false;
+
+    InitializeCriticalSection(&lock);
+}
+
+AsyncEngine::~AsyncEngine()
+{
+    cancel();
+    wait(INFINITE);
+
+    for(vector<AsyncTransfer *>::iterator i = transfers.begin(); i != transfers.end(); i++)
+        delete *i;
+
+    DeleteCriticalSection(&lock);
+}
+
+unsigned __stdcall asyncThreadProc(void *param)
+{
+    ((AsyncEngine *)param)->worker();
+    return 0;
+}
+
+void AsyncEngine::add(NetFile *file, tstring url, bool querySize)
+{
+    AsyncTransfer *transfer = new AsyncTransfer(file, url, querySize);
+
+    transfer->engine = this;
+    queue.push_back(transfers.size());
+    transfers.push_back(transfer);
+}
+
+bool AsyncEngine::start(HINTERNET internet)
+{
+    AsyncDriver *driver = defaultTransport()->createAsyncDriver(internet);
+
+    if(!driver)
+        return false;
+
+    // Transfers, which driver can't do, stay queued and are left to usual download
+    for(vector<size_t>::iterator i = queue.begin(); i != queue.end(); )
+        if(driver->supports(&transfers[*i]->url))
+            i++;
+        else
+            i = queue.erase(i);
+
+    delete driver;
+
+    if(queue.empty())
+        return true;
+
+    session      = internet;
+    maxTransfers = max(1, min(maxTransfers, MAX_ASYNC_TRANSFERS));
+    threads      = max(1, min(min(threads, MAX_ASYNC_THREADS), (int)queue.size()));
+
+    TRACE(_T("Starting %d transfers on %d threads, up to %d at once"), (int)transfers.size(), threads, maxTransfers);
+
+    for(int i = 0; i < threads; i++)
+    {
+        HANDLE thread = (HANDLE)_beginthreadex(NULL, 0, &asyncThreadProc, (void *)this, 0, NULL);
+
+        if(thread)
+            workers.push_back(thread);
+    }
+
+    threads = (int)workers.size();
+    return !workers.empty();
+}
+
+bool AsyncEngine::wait(DWORD msec)
+{
+    if(workers.empty())
+        return true;
+
+    if(WaitForMultipleObjects((DWORD)workers.size(), &workers[0], TRUE, msec) == WAIT_TIMEOUT)
+        return false;
+
+    for(vector<HANDLE>::iterator i = workers.begin(); i != workers.end(); i++)
+        CloseHandle(*i);
+
+    workers.clear();
+    return true;
+}
+
+void AsyncEngine::cancel()
+{
+    cancelled = true;
+}
+
+DWORDLONG AsyncEngine::bytesDownloaded()
+{
+    EnterCriticalSection(&lock);
+    DWORDLONG res = bytes;
+    LeaveCriticalSection(&lock);
+    return res;
+}
+
+tstring AsyncEngine::current()
+{
+    EnterCriticalSection(&lock);
+    tstring res = lastStarted;
+    LeaveCriticalSection(&lock);
+    return res;
+}
+
+void AsyncEngine::addBytes(DWORDLONG n)
+{
+    EnterCriticalSection(&lock);
+    bytes += n;
+    LeaveCriticalSection(&lock);
+
+    concurrency.addBytes(n);
+}
+
+// Queued transfer of host, which was served longest ago, if engine, concurrency controller and
+// host allow one more connection. NULL, if there is none.
+AsyncTransfer *AsyncEngine::next()
+{
+    AsyncTransfer *res = NULL;
+
+    EnterCriticalSection(&lock);
+
+    if(!queue.empty() && (running < maxTransfers) && concurrency.tryAcquire(1))
+    {
+        vector<tstring> hosts;
+
+        for(size_t i = 0; i < min(queue.size(), (size_t)ASYNC_PICK_WINDOW); i++)
+            hosts.push_back(transfers[queue[i]]->url.hostName);
+
+        size_t picked = hostScheduler.pick(hosts);
+
+        if((picked < hosts.size()) && hostScheduler.tryAcquire(hosts[picked], 1))
+        {
+            res = transfers[queue[picked]];
+            queue.erase(queue.begin() + picked);
+            running++;
+            lastStarted = res->netFile->getShortName();
+        }
+        else
+            concurrency.release(1);
+    }
+
+    LeaveCriticalSection(&lock);
+    return res;
+}
+
+void AsyncEngine::release(AsyncTransfer *transfer)
+{
+    hostScheduler.release(transfer->url.hostName, 1);
+    concurrency.release(1);
+
+    EnterCriticalSection(&lock);
+    running--;
+    LeaveCriticalSection(&lock);
+}
+
+// Each thread keeps up to its share of maxTransfers running in own driver. Driver calls back
+// transfers from poll(), so all state changes of transfer happen on thread, which started it.
+void AsyncEngine::worker()
+{
+    AsyncDriver            *driver = defaultTransport()->createAsyncDriver(session);
+    vector<AsyncTransfer *> active;
+    int                     share  = max(1, (maxTransfers + threads - 1) / threads);
+    AsyncTransfer          *transfer;
+
+    for(;;)
+    {
+        while(!cancelled && ((int)active.size() < share) && ((transfer = next()) != NULL))
+        {
+            traceEvent(TE_REQUEST, transfer->url.traceId, 0);
+            transfer->timer.start(0);
+            transfer->state = AS_RUNNING;
+
+            if(driver->start(transfer))
+                active.push_back(transfer);
+            else
+            {
+                transfer->finished(transfer->error ? transfer->error : ERROR_INTERNET_CANNOT_CONNECT);
+                release(transfer);
+            }
+        }
+
+        if(active.empty())
+        {
+            EnterCriticalSection(&lock);
+            bool queued = !queue.empty();
+            LeaveCriticalSection(&lock);
+
+            if(cancelled || !queued)
+                break;
+
+            // Hosts of queued transfers have no free connections, other threads will release them
+            Sleep(ASYNC_POLL_INTERVAL);
+            continue;
+        }
+
+        driver->poll(ASYNC_POLL_INTERVAL);
+
+        for(size_t i = 0; i < active.size(); )
+        {
+            transfer = active[i];
+
+            if(cancelled && (transfer->state == AS_RUNNING))
+                transfer->finished(ERROR_INTERNET_OPERATION_CANCELLED);
+
+            if(transfer->state == AS_RUNNING)
+            {
+                i++;
+                continue;
+            }
+
+            driver->remove(transfer);
+            release(transfer);
+            active.erase(active.begin() + i);
+        }
+    }
+
+    delete driver;
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <windows.h>
+#include <vector>
+#include "tstring.h"
+#include "netfile.h"
+#include "file.h"
+
+#define DEFAULT_ASYNC_THREADS 2
+#define MAX_ASYNC_THREADS     16
+#define MAX_ASYNC_TRANSFERS   1024
+#define ASYNC_POLL_INTERVAL   100 // ms, threads check for cancel & new transfers this often
+#define ASYNC_PICK_WINDOW     256 // Queued transfers, whose hosts are considered for next start
+
+using namespace std;
+
+class AsyncEngine;
+
+enum AsyncState
+{
+    AS_QUEUED,  // Waiting for free connection of host, stream & engine slot
+    AS_RUNNING, // Request started by driver
+    AS_DONE,
+    AS_FAILED
+};
+
+// File transfer or size query, run by AsyncEngine as state machine: QUEUED -> RUNNING -> DONE or
+// FAILED. While RUNNING, its driver calls response() once, when response headers are received,
+// then received() for each block of data and finished() at end.
+class AsyncTransfer
+{
+public:
+    AsyncTransfer(NetFile *file, tstring address, bool querySize);
+
+    bool response(int status, DWORDLONG contentLength, DWORD retryAfterSec); // false - transfer is aborted
+    bool received(const BYTE *data, DWORD size); // false - transfer is aborted
+    void finished(DWORD errorCode);
+
+    NetFile     *netFile;
+    Url          url;        // Primary url of file or its mirror
+    bool         sizeOnly;   // Size query (HEAD or FTP SIZE), nothing is written
+    AsyncState   state;
+    File         file;
+    DWORDLONG    bytes;      // Received
+    DWORDLONG    size;       // From response, FILE_SIZE_UNKNOWN if not sent
+    int          httpStatus; // 0 - none or FTP
+    DWORD        retryAfter;
+    DWORD        error;      // Windows error code, 0 - none
+    DWORD        transferTime;
+    void        *request;    // Driver's data of running request
+    AsyncEngine *engine;
+
+protected:
+    Timer        timer;
+    bool         responded;
+
+    friend class AsyncEngine;
+};
+
+// Runs many transfers on few threads. Each thread drives its share of running transfers through
+// one AsyncDriver of transport (libcurl multi handle or asynchronous WinINet session), so hundreds of connections don't need
+// hundreds of threads. Transfers are started in round-robin order of hosts, as far as
+// HostConnections, adaptive concurrency & maxTransfers allow.
+// Engine does only plain whole-file transfers; mirrors, retries, resuming, segments & hash
+// checks are left to Downloader, which downloads files, failed here, in usual way.
+class AsyncEngine
+{
+public:
+    AsyncEngine();
+    ~AsyncEngine();
+
+    void      add(NetFile *file, tstring url, bool querySize = false);
+    bool      start(HINTERNET session); // false, if transport has no asynchronous driver. Transfers, not
+                                        // supported by driver, stay AS_QUEUED
+    bool      wait(DWORD msec);         // true, if all transfers are finished
+    void      cancel();
+    DWORDLONG bytesDownloaded();
+    tstring   current();                // File of last started transfer
+
+    int  threads;
+    int  maxTransfers; // Running at once in all threads
+
+    vector<AsyncTransfer *> transfers;
+
+protected:
+    void           worker();
+    AsyncTransfer *next();
+    void           release(AsyncTransfer *transfer);
+    void           addBytes(DWORDLONG n);
+
+    HINTERNET        session;
+    vector<size_t>   queue;   // Transfers, not started yet, in order of adding
+    vector<HANDLE>   workers;
+    int              running;
+    DWORDLONG        bytes;
+    tstring          lastStarted;
+    volatile bool    cancelled;
+    CRITICAL_SECTION lock;
+
+    friend class AsyncTransfer;
+    friend unsigned __stdcall asyncThreadProc(void *param);
+};
@@ -0,0 +1,176 @@
+#include <algorithm>
+#include "bufferpool.h"
+#include "trace.h"
+
+BufferPool bufferPool;
+
+BufferPool::BufferPool()
+{
+    budget      = DEFAULT_BUFFER_BUDGET;
+    used        = 0;
+    peakUsed    = 0;
+    cached      = 0;
+    waitCount   = 0;
+    shrinkCount = 0;
+    released    = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+    InitializeCriticalSection(&lock);
+}
+
+BufferPool::~BufferPool()
+{
+    for(multimap<DWORD, BYTE *>::iterator i = cache.begin(); i != cache.end(); i++)
+        delete[] i->second;
+
+    CloseHandle(released);
+    DeleteCriticalSection(&lock);
+}
+
+BYTE *BufferPool::acquire(DWORD wanted, DWORD *size, bool *cancelled)
+{
+    bool waited = false;
+
+    for(;;)
+    {
+        EnterCriticalSection(&lock);
+
+        DWORD n       = wanted;
+        DWORD minimum = min(wanted, (DWORD)BUFFER_POOL_MIN);
+
+        if(budget && (used + wanted > budget))
+        {
+            DWORDLONG available = (budget > used) ? budget - used : 0;
+            n = (DWORD)min((DWORDLONG)wanted, available);
+
+            // Single reader always gets minimum buffer, even if budget is smaller
+            if(!used)
+                n = max(n, minimum);
+        }
+
+        if(n >= minimum)
+        {
+            BYTE *buffer = NULL;
+            multimap<DWORD, BYTE *>::iterator i = cache.find(n);
+
+            if(i != cache.end())
+            {
+                buffer  = i->second;
+                cached -= n;
+                cache.erase(i);
+            }
+            else
+                trim(n);
+
+            used     += n;
+            peakUsed  = max(peakUsed, used);
+
+            if(n < wanted)
+                shrinkCount++;
+
+            LeaveCriticalSection(&lock);
+
+            if(n < wanted)
+                TRACE(_T("Buffer budget is short, reading with %u bytes instead of %u"), n, wanted);
+
+            if(!buffer)
+                buffer = new BYTE[n];
+
+            *size = n;
+            return buffer;
+        }
+
+        if(!waited)
+            waitCount++;
+
+        ResetEvent(released);
+        LeaveCriticalSection(&lock);
+
+        if(cancelled && *cancelled)
+            return NULL;
+
+        if(!waited)
+        {
+            TRACE(_T("Buffer budget of %I64u bytes is used, waiting"), budget);
+            waited = true;
+        }
+
+        WaitForSingleObject(released, BUFFER_WAIT_INTERVAL);
+    }
+}
+
+void BufferPool::release(BYTE *buffer, DWORD size)
+{
+    if(!buffer)
+        return;
+
+    EnterCriticalSection(&lock);
+    used -= size;
+
+    if((cache.size() < BUFFER_POOL_CACHE) && (!budget || (used + cached + size <= budget)))
+    {
+        cache.insert(pair<DWORD, BYTE *>(size, buffer));
+        cached += size;
+        buffer  = NULL;
+    }
+
+    SetEvent(released);
+    LeaveCriticalSection(&lock);
+
+    delete[] buffer;
+}
+
+// Cached buffers of other sizes are freed, until needed bytes fit into budget with them
+void BufferPool::trim(DWORDLONG needed)
+{
+    while(!cache.empty() && budget && (used + cached + needed > budget))
+    {
+        multimap<DWORD, BYTE *>::iterator i = cache.begin();
+
+        cached -= i->first;
+        delete[] i->second;
+        cache.erase(i);
+    }
+}
+
+DWORDLONG BufferPool::inUse()
+{
+    EnterCriticalSection(&lock);
+    DWORDLONG res = used;
+    LeaveCriticalSection(&lock);
+    return res;
+}
+
+DWORDLONG BufferPool::peak()
+{
+    EnterCriticalSection(&lock);
+    DWORDLONG res = peakUsed;
+    LeaveCriticalSection(&lock);
+    return res;
+}
+
+DWORD BufferPool::waits()
+{
+    EnterCriticalSection(&lock);
+    DWORD res = waitCount;
+    LeaveCriticalSection(&lock);
+    return res;
+}
+
+DWORD BufferPool::shrinks()
+{
+    EnterCriticalSection(&lock);
+    DWORD res = shrinkCount;
+    LeaveCriticalSection(&lock);
+    return res;
+}
+
+PoolBuffer::PoolBuffer(DWORD wanted, bool *cancelled)
+{
+    size = 0;
+    data = bufferPool.acquire(wanted, &size, cancelled);
+}
+
+PoolBuffer::~PoolBuffer()
+{
+    bufferPool.release(data, size);
+}
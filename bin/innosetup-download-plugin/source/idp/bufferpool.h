@@ -0,0 +1,57 @@
+#pragma once
+
+#include <windows.h>
+#include <map>
+#include "tstring.h"
+
+#define DEFAULT_BUFFER_BUDGET 67108864 // Bytes, 0 - unlimited
+#define BUFFER_POOL_MIN       1024     // Buffers are shrunk down to this size, when budget is short
+#define BUFFER_POOL_CACHE     16       // Released buffers, kept for reuse
+#define BUFFER_WAIT_INTERVAL  100      // ms, waiting threads check for cancel this often
+
+using namespace std;
+
+// Memory budget of all in-flight transfer buffers in process (read buffers of all downloaders,
+// idpget jobs, piece & range requests). Buffer, which doesn't fit into budget, is shrunk to free
+// part of it; if even BUFFER_POOL_MIN bytes are not free, reader waits, until other transfers
+// release theirs. Released buffers are cached for reuse, cache is counted in budget too.
+class BufferPool
+{
+public:
+    BufferPool();
+    ~BufferPool();
+
+    BYTE     *acquire(DWORD wanted, DWORD *size, bool *cancelled); // NULL, if cancelled while waiting
+    void      release(BYTE *buffer, DWORD size);
+    DWORDLONG inUse();
+    DWORDLONG peak();  // Of bytes in use since start of process
+    DWORD     waits(); // Number of readers, which had to wait for memory
+    DWORD     shrinks();
+
+    DWORDLONG budget; // 0 - unlimited
+
+protected:
+    void trim(DWORDLONG needed); // Frees cached buffers to make room, called with lock held
+
+    DWORDLONG                used;
+    DWORDLONG                peakUsed;
+    DWORDLONG                cached;
+    DWORD                    waitCount;
+    DWORD                    shrinkCount;
+    multimap<DWORD, BYTE *>  cache;
+    CRITICAL_SECTION         lock;
+    HANDLE                   released;
+};
+
+// Buffer from bufferPool, released at end of scope. data is NULL, if cancelled while waiting
+class PoolBuffer
+{
+public:
+    PoolBuffer(DWORD wanted, bool *cancelled);
+    ~PoolBuffer();
+
+    BYTE  *data;
+    DWORD  size;
+};
+
+extern BufferPool bufferPool;
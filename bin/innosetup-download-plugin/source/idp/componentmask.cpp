@@ -0,0 +1,63 @@
+#include "componentmask.h"
+
+#define MASK_WORD_BITS (sizeof(unsigned long) * 8)
+
+ComponentMask::ComponentMask()
+{
+}
+
+void ComponentMask::set(int id)
+{
+    size_t word = id / MASK_WORD_BITS;
+
+    if(bits.size() <= word)
+        bits.resize(word + 1, 0);
+
+    bits[word] |= 1UL << (id % MASK_WORD_BITS);
+}
+
+bool ComponentMask::empty() const
+{
+    return bits.empty();
+}
+
+bool ComponentMask::intersects(const ComponentMask &mask) const
+{
+    size_t words = bits.size() < mask.bits.size() ? bits.size() : mask.bits.size();
+
+    for(size_t i = 0; i < words; i++)
+        if(bits[i] & mask.bits[i])
+            return true;
+
+    return false;
+}
+
+ComponentRegistry::ComponentRegistry()
+{
+}
+
+int ComponentRegistry::id(tstring name)
+{
+    map<tstring, int>::iterator i = ids.find(name);
+
+    if(i != ids.end())
+        return i->second;
+
+    int newId = (int)ids.size();
+    ids[name] = newId;
+    return newId;
+}
+
+ComponentMask ComponentRegistry::mask(tstring names, _TCHAR sep)
+{
+    ComponentMask res;
+    set<tstring>  nameSet;
+
+    tstringtoset(nameSet, names, sep);
+
+    for(set<tstring>::iterator i = nameSet.begin(); i != nameSet.end(); i++)
+        if(!i->empty())
+            res.set(id(*i));
+
+    return res;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <map>
+#include <vector>
+#include "tstring.h"
+
+using namespace std;
+
+// Set of component ids, stored as bitmask
+class ComponentMask
+{
+public:
+    ComponentMask();
+
+    void set(int id);
+    bool empty() const;
+    bool intersects(const ComponentMask &mask) const;
+
+protected:
+    vector<unsigned long> bits;
+};
+
+// Assigns small integer ids to component names
+class ComponentRegistry
+{
+public:
+    ComponentRegistry();
+
+    int           id(tstring name);
+    ComponentMask mask(tstring names, _TCHAR sep);
+
+protected:
+    map<tstring, int> ids;
+};
@@ -0,0 +1,223 @@
+#include <algorithm>
+#include "concurrency.h"
+#include "trace.h"
+
+ConcurrencyController concurrency;
+
+ConcurrencyController::ConcurrencyController()
+{
+    enabled     = false;
+    minStreams  = 1;
+    maxStreams  = DEFAULT_MAX_STREAMS;
+    streams     = CONCURRENCY_INITIAL;
+    active      = 0;
+    peakActive  = 0;
+    hold        = 0;
+    probing     = false;
+    bytes       = 0;
+    goodput     = 0;
+    baseGoodput = 0;
+    sampleStart = GetTickCount();
+    srtt        = 0;
+    minRtt      = 0;
+    loss        = NULL;
+    released    = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+    InitializeCriticalSection(&lock);
+}
+
+ConcurrencyController::~ConcurrencyController()
+{
+    CloseHandle(released);
+    DeleteCriticalSection(&lock);
+}
+
+bool ConcurrencyController::acquire(bool *cancelled)
+{
+    for(;;)
+    {
+        EnterCriticalSection(&lock);
+        decide();
+
+        if(!enabled || (active < streams))
+        {
+            active++;
+            peakActive = max(peakActive, active);
+            LeaveCriticalSection(&lock);
+            return true;
+        }
+
+        ResetEvent(released);
+        LeaveCriticalSection(&lock);
+
+        if(cancelled && *cancelled)
+            return false;
+
+        WaitForSingleObject(released, 100);
+    }
+}
+
+int ConcurrencyController::tryAcquire(int count)
+{
+    int n = 0;
+
+    EnterCriticalSection(&lock);
+
+    while((n < count) && (!enabled || (active < streams)))
+    {
+        active++;
+        n++;
+    }
+
+    peakActive = max(peakActive, active);
+    LeaveCriticalSection(&lock);
+    return n;
+}
+
+void ConcurrencyController::release(int count)
+{
+    if(!count)
+        return;
+
+    EnterCriticalSection(&lock);
+    active -= count;
+    SetEvent(released);
+    LeaveCriticalSection(&lock);
+}
+
+void ConcurrencyController::addBytes(DWORDLONG n)
+{
+    EnterCriticalSection(&lock);
+    bytes += n;
+    decide();
+    LeaveCriticalSection(&lock);
+}
+
+void ConcurrencyController::addRtt(DWORD msec)
+{
+    EnterCriticalSection(&lock);
+    srtt   = srtt ? (srtt * 7 + msec) / 8 : msec;
+    minRtt = minRtt ? min(minRtt, msec) : msec;
+    LeaveCriticalSection(&lock);
+}
+
+void ConcurrencyController::addLoss(const _TCHAR *reason)
+{
+    EnterCriticalSection(&lock);
+
+    if(!loss)
+        loss = reason;
+
+    LeaveCriticalSection(&lock);
+}
+
+int ConcurrencyController::window()
+{
+    EnterCriticalSection(&lock);
+    int res = streams;
+    LeaveCriticalSection(&lock);
+    return res;
+}
+
+void ConcurrencyController::decide()
+{
+    DWORD elapsed = GetTickCount() - sampleStart;
+
+    if(elapsed < CONCURRENCY_INTERVAL)
+        return;
+
+    DWORDLONG current = bytes * 1000 / elapsed;
+    int       old     = streams;
+    bool      busy    = peakActive >= streams;
+
+    if(!loss && srtt && (srtt > minRtt * CONCURRENCY_RTT_FACTOR) && (srtt > minRtt + CONCURRENCY_RTT_MARGIN))
+        loss = _T("connect time rising");
+
+    if(!loss && busy && goodput && (current * 100 < goodput * (100 - CONCURRENCY_DROP)))
+        loss = _T("goodput falling");
+
+    if(!peakActive && !bytes)
+    {
+        // Idle: nothing to measure
+    }
+    else if(loss)
+    {
+        streams = max(minStreams, streams / 2);
+        probing = false;
+        hold    = 0;
+    }
+    else if(probing && (current * 100 < baseGoodput * (100 + CONCURRENCY_GAIN)))
+    {
+        streams = max(minStreams, streams - 1);
+        probing = false;
+        hold    = CONCURRENCY_HOLD;
+    }
+    else if(hold)
+    {
+        hold--;
+    }
+    else if(busy && (streams < maxStreams))
+    {
+        streams++;
+        probing     = true;
+        baseGoodput = current;
+    }
+    else
+        probing = false;
+
+    if(enabled && (streams != old))
+    {
+        TRACE(_T("Concurrency: %d -> %d streams, goodput %I64u B/s, connect time %u ms (min %u), %s"), old, streams, current, srtt, minRtt,
+              (streams > old) ? _T("probing") : loss ? loss : _T("added stream gave no gain"));
+        traceEvent(TE_CONCURRENCY, 0, streams);
+
+        if(streams > old)
+            SetEvent(released);
+    }
+
+    goodput     = (peakActive || bytes) ? current : goodput;
+    bytes       = 0;
+    peakActive  = active;
+    loss        = NULL;
+    sampleStart = GetTickCount();
+
+    // Connect time of new connections is compared with fresh minimum after each change
+    if(streams != old)
+    {
+        srtt   = 0;
+        minRtt = 0;
+    }
+}
+
+StreamSlots::StreamSlots()
+{
+    count = 0;
+}
+
+StreamSlots::~StreamSlots()
+{
+    release();
+}
+
+bool StreamSlots::acquire(bool *cancelled)
+{
+    if(!concurrency.acquire(cancelled))
+        return false;
+
+    count++;
+    return true;
+}
+
+int StreamSlots::tryAcquire(int n)
+{
+    int got = (n > 0) ? concurrency.tryAcquire(n) : 0;
+
+    count += got;
+    return got;
+}
+
+void StreamSlots::release()
+{
+    concurrency.release(count);
+    count = 0;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <windows.h>
+#include "tstring.h"
+
+#define DEFAULT_MAX_STREAMS     16
+#define CONCURRENCY_INITIAL     2    // Streams, allowed before first decision
+#define CONCURRENCY_INTERVAL    2000 // ms, goodput is measured & window changed this often
+#define CONCURRENCY_GAIN        5    // Percent, by which goodput must grow to keep added stream
+#define CONCURRENCY_DROP        20   // Percent of goodput fall, treated as loss
+#define CONCURRENCY_RTT_FACTOR  2    // Smoothed connect time above this multiple of minimum is treated as loss
+#define CONCURRENCY_RTT_MARGIN  50   // ms, ...and above minimum by this much
+#define CONCURRENCY_HOLD        5    // Intervals without probing after added stream didn't help
+
+using namespace std;
+
+// AIMD controller of number of concurrent streams (file transfers & FTP segments) in process.
+// Every interval aggregate goodput is compared with previous one: while it grows, one more
+// stream is allowed (additive increase); on loss signal (failed or stalled transfer, falling
+// goodput, rising connect time) allowed number is halved (multiplicative decrease). Stream,
+// which gave no gain, is taken back and probing pauses for few intervals. Decisions are
+// written to TRACE output and event trace (TE_CONCURRENCY).
+// When controller is disabled, streams are not limited and only statistics are collected.
+class ConcurrencyController
+{
+public:
+    ConcurrencyController();
+    ~ConcurrencyController();
+
+    bool acquire(bool *cancelled); // Waits for stream, false if cancelled
+    int  tryAcquire(int count);    // Extra streams, returns number of acquired ones
+    void release(int count);
+    void addBytes(DWORDLONG bytes);
+    void addRtt(DWORD msec);       // Connect & request time of transfer
+    void addLoss(const _TCHAR *reason);
+    int  window();
+
+    bool enabled;
+    int  minStreams;
+    int  maxStreams;
+
+protected:
+    void decide(); // Called with lock held
+
+    int              streams;     // Allowed now
+    int              active;
+    int              peakActive;  // During current interval
+    int              hold;        // Intervals left without probing
+    bool             probing;     // Last decision added stream
+    DWORDLONG        bytes;       // In current interval
+    DWORDLONG        goodput;     // B/s in previous interval
+    DWORDLONG        baseGoodput; // Before stream was added
+    DWORD            sampleStart;
+    DWORD            srtt;
+    DWORD            minRtt;
+    const _TCHAR    *loss;        // Reason of loss in current interval, NULL - none
+    CRITICAL_SECTION lock;
+    HANDLE           released;
+};
+
+// Streams, acquired from concurrency controller, released at end of scope
+class StreamSlots
+{
+public:
+    StreamSlots();
+    ~StreamSlots();
+
+    bool acquire(bool *cancelled);
+    int  tryAcquire(int n);
+    void release();
+
+    int count;
+};
+
+extern ConcurrencyController concurrency;
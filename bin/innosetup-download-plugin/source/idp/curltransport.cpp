@@ -0,0 +1,783 @@
+#ifdef IDP_CURL
+
+#include <string.h>
+#include <curl/curl.h>
+#include "curltransport.h"
+#include "url.h"
+#include "asyncengine.h"
+#include "trace.h"
+
+#define CURL_POLL_TIMEOUT      1000
+#define CURL_OPEN_POLL_TIMEOUT 100 // Url::cancelled is checked with this interval
+
+// Base class of all objects, returned by CurlTransport as HINTERNET
+class CurlHandle
+{
+public:
+    virtual ~CurlHandle() {};
+};
+
+class CurlSession: public CurlHandle
+{
+public:
+    CurlSession(InternetOptions &opt);
+    ~CurlSession();
+
+    CURLSH          *share;
+    InternetOptions  options;
+    CRITICAL_SECTION locks[CURL_LOCK_DATA_LAST];
+};
+
+class CurlConnection: public CurlHandle
+{
+public:
+    CurlConnection(CurlSession *s, const _TCHAR *user, const _TCHAR *pass);
+    ~CurlConnection();
+
+    CurlSession *session;
+    CURL        *easy;
+    string       userName;
+    string       password;
+    curl_slist  *headers; // Extra request headers, must live until request is done
+};
+
+// One transfer. Owns multi handle, which drives easy handle of connection.
+class CurlRequest: public CurlHandle
+{
+public:
+    CurlRequest(CurlConnection *conn);
+    ~CurlRequest();
+
+    void   perform(DWORD wait = CURL_POLL_TIMEOUT);
+    size_t write(const char *ptr, size_t len);
+    size_t pending();
+
+    CurlConnection *connection;
+    CURLM          *multi;
+    string          data;       // Received data, not yet returned by read()
+    size_t          dataPos;
+    char           *target;     // Buffer of current read() call, data is copied here directly
+    size_t          targetSize;
+    size_t          targetUsed;
+    DWORD           readTimeout; // ms, 0 - wait until transfer is done
+    bool            done;
+    CURLcode        result;
+};
+
+static inline HINTERNET handle(CurlHandle *h)
+{
+    return (HINTERNET)h;
+}
+
+static void curlLock(CURL *easy, curl_lock_data data, curl_lock_access access, void *userptr)
+{
+    EnterCriticalSection(&((CurlSession *)userptr)->locks[data]);
+}
+
+static void curlUnlock(CURL *easy, curl_lock_data data, void *userptr)
+{
+    LeaveCriticalSection(&((CurlSession *)userptr)->locks[data]);
+}
+
+CurlSession::CurlSession(InternetOptions &opt)
+{
+    options = opt;
+
+    for(int i = 0; i < CURL_LOCK_DATA_LAST; i++)
+        InitializeCriticalSection(&locks[i]);
+
+    share = curl_share_init();
+    curl_share_setopt(share, CURLSHOPT_LOCKFUNC,   curlLock);
+    curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, curlUnlock);
+    curl_share_setopt(share, CURLSHOPT_USERDATA,   this);
+    curl_share_setopt(share, CURLSHOPT_SHARE,      CURL_LOCK_DATA_DNS);
+    curl_share_setopt(share, CURLSHOPT_SHARE,      CURL_LOCK_DATA_CONNECT);
+    curl_share_setopt(share, CURLSHOPT_SHARE,      CURL_LOCK_DATA_SSL_SESSION);
+}
+
+CurlSession::~CurlSession()
+{
+    curl_share_cleanup(share);
+
+    for(int i = 0; i < CURL_LOCK_DATA_LAST; i++)
+        DeleteCriticalSection(&locks[i]);
+}
+
+CurlConnection::CurlConnection(CurlSession *s, const _TCHAR *user, const _TCHAR *pass)
+{
+    session  = s;
+    easy     = curl_easy_init();
+    userName = toutf8(user);
+    password = toutf8(pass);
+    headers  = NULL;
+}
+
+CurlConnection::~CurlConnection()
+{
+    curl_easy_cleanup(easy);
+    curl_slist_free_all(headers);
+}
+
+static size_t curlWrite(char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+    return ((CurlRequest *)userdata)->write(ptr, size * nmemb);
+}
+
+CurlRequest::CurlRequest(CurlConnection *conn)
+{
+    connection = conn;
+    dataPos    = 0;
+    target     = NULL;
+    targetSize = 0;
+    targetUsed  = 0;
+    readTimeout = 0;
+    done        = false;
+    result      = CURLE_OK;
+
+    curl_easy_setopt(connection->easy, CURLOPT_WRITEFUNCTION, curlWrite);
+    curl_easy_setopt(connection->easy, CURLOPT_WRITEDATA,     this);
+
+    multi = curl_multi_init();
+    curl_multi_add_handle(multi, connection->easy);
+}
+
+CurlRequest::~CurlRequest()
+{
+    curl_multi_remove_handle(multi, connection->easy);
+    curl_multi_cleanup(multi);
+}
+
+size_t CurlRequest::write(const char *ptr, size_t len)
+{
+    size_t n = 0;
+
+    if(target && (targetUsed < targetSize))
+    {
+        n = (len < targetSize - targetUsed) ? len : targetSize - targetUsed;
+        memcpy(target + targetUsed, ptr, n);
+        targetUsed += n;
+    }
+
+    if(n < len)
+        data.append(ptr + n, len - n);
+
+    return len;
+}
+
+size_t CurlRequest::pending()
+{
+    return data.length() - dataPos + targetUsed;
+}
+
+void CurlRequest::perform(DWORD wait)
+{
+    int      running = 0;
+    int      left;
+    CURLMsg *msg;
+
+    curl_multi_perform(multi, &running);
+
+    while((msg = curl_multi_info_read(multi, &left)) != NULL)
+    {
+        if(msg->msg == CURLMSG_DONE)
+        {
+            done   = true;
+            result = msg->data.result;
+        }
+    }
+
+    if(!running)
+        done = true;
+    else if(!pending())
+        curl_multi_wait(multi, NULL, 0, (int)wait, NULL);
+}
+
+static DWORD curlerror(CURLcode code)
+{
+    switch(code)
+    {
+    case CURLE_OK                    : return 0;
+    case CURLE_UNSUPPORTED_PROTOCOL  :
+    case CURLE_URL_MALFORMAT         : return ERROR_INTERNET_INVALID_URL;
+    case CURLE_COULDNT_RESOLVE_PROXY :
+    case CURLE_COULDNT_RESOLVE_HOST  : return ERROR_INTERNET_NAME_NOT_RESOLVED;
+    case CURLE_COULDNT_CONNECT       : return ERROR_INTERNET_CANNOT_CONNECT;
+    case CURLE_OPERATION_TIMEDOUT    : return ERROR_INTERNET_TIMEOUT;
+    case CURLE_LOGIN_DENIED          : return ERROR_INTERNET_LOGIN_FAILURE;
+    case CURLE_PEER_FAILED_VERIFICATION:
+    case CURLE_SSL_CACERT_BADFILE    : return ERROR_INTERNET_INVALID_CA;
+    case CURLE_PARTIAL_FILE          :
+    case CURLE_GOT_NOTHING           :
+    case CURLE_SEND_ERROR            :
+    case CURLE_RECV_ERROR            : return ERROR_INTERNET_CONNECTION_RESET;
+    case CURLE_ABORTED_BY_CALLBACK   : return ERROR_INTERNET_OPERATION_CANCELLED;
+    case CURLE_REMOTE_ACCESS_DENIED  :
+    case CURLE_REMOTE_FILE_NOT_FOUND :
+    case CURLE_FTP_COULDNT_RETR_FILE :
+    case CURLE_FTP_COULDNT_USE_REST  :
+    case CURLE_BAD_DOWNLOAD_RESUME   : return ERROR_INTERNET_EXTENDED_ERROR;
+    default                          : return ERROR_INTERNET_INTERNAL_ERROR;
+    }
+}
+
+// Builds URL for libcurl from normalized parts of url. FTP paths are absolute,
+// like in WinINet, so they are prefixed by %2F.
+static string curlurl(Url *url, tstring path)
+{
+    string host = toutf8(url->hostName);
+    string p    = toutf8(path);
+
+    if(host.find(':') != string::npos)
+        host = "[" + host + "]"; // IPv6 literal
+
+    string res = toutf8(url->scheme) + "://" + host + ":" + dwtostr(url->parts.portNumber);
+
+    if(url->service == INTERNET_SERVICE_FTP)
+    {
+        res += "/%2F";
+
+        if(!p.empty() && (p[0] == '/'))
+            p.erase(0, 1);
+    }
+
+    size_t len = urlnormalize(p.c_str(), p.length(), (char *)NULL, URLN_ENCODE);
+    string encoded(len, ' ');
+
+    if(len)
+        urlnormalize(p.c_str(), p.length(), &encoded[0], URLN_ENCODE);
+
+    return res + encoded;
+}
+
+// Resets easy handle of connection (live connections are kept) and sets options for new transfer
+static void setup(CurlConnection *connection, Url *url, tstring path)
+{
+    CURL            *easy    = connection->easy;
+    InternetOptions &session = connection->session->options;
+    InternetOptions &opt     = url->internetOptions;
+
+    curl_easy_reset(easy);
+    curl_easy_setopt(easy, CURLOPT_URL,            curlurl(url, path).c_str());
+    curl_easy_setopt(easy, CURLOPT_SHARE,          connection->session->share);
+    curl_easy_setopt(easy, CURLOPT_NOSIGNAL,       1L);
+    curl_easy_setopt(easy, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(easy, CURLOPT_USERAGENT,      toutf8(session.userAgent).c_str());
+
+    if(!connection->userName.empty() || !connection->password.empty())
+    {
+        curl_easy_setopt(easy, CURLOPT_USERNAME, connection->userName.c_str());
+        curl_easy_setopt(easy, CURLOPT_PASSWORD, connection->password.c_str());
+    }
+
+    if(session.accessType == INTERNET_OPEN_TYPE_DIRECT)
+        curl_easy_setopt(easy, CURLOPT_PROXY, "");
+    else if(session.accessType == INTERNET_OPEN_TYPE_PROXY)
+        curl_easy_setopt(easy, CURLOPT_PROXY, toutf8(session.proxyName).c_str());
+
+    if(opt.hasProxyLoginInfo())
+    {
+        curl_easy_setopt(easy, CURLOPT_PROXYUSERNAME, toutf8(opt.proxyLogin).c_str());
+        curl_easy_setopt(easy, CURLOPT_PROXYPASSWORD, toutf8(opt.proxyPassword).c_str());
+    }
+
+    if(opt.hasReferer())
+        curl_easy_setopt(easy, CURLOPT_REFERER, toutf8(opt.referer).c_str());
+
+    // No certificate dialog here, INVC_SHOWDLG works as INVC_STOP
+    if(opt.invalidCert == INVC_IGNORE)
+    {
+        curl_easy_setopt(easy, CURLOPT_SSL_VERIFYPEER, 0L);
+        curl_easy_setopt(easy, CURLOPT_SSL_VERIFYHOST, 0L);
+    }
+
+    if((session.connectTimeout != TIMEOUT_DEFAULT) && (session.connectTimeout != TIMEOUT_INFINITE))
+        curl_easy_setopt(easy, CURLOPT_CONNECTTIMEOUT_MS, (long)session.connectTimeout);
+
+    // Receive timeout: transfer is aborted, if no data received during this time
+    if((session.receiveTimeout != TIMEOUT_DEFAULT) && (session.receiveTimeout != TIMEOUT_INFINITE))
+    {
+        curl_easy_setopt(easy, CURLOPT_LOW_SPEED_LIMIT, 1L);
+        curl_easy_setopt(easy, CURLOPT_LOW_SPEED_TIME,  (long)((session.receiveTimeout + 999) / 1000));
+    }
+
+    if(url->service == INTERNET_SERVICE_FTP)
+        curl_easy_setopt(easy, CURLOPT_FTP_FILEMETHOD, (long)CURLFTPMETHOD_NOCWD);
+}
+
+// Runs transfer to the end, collecting received data
+static CURLcode transfer(CurlConnection *connection, string &data)
+{
+    CurlRequest request(connection);
+
+    while(!request.done)
+        request.perform();
+
+    data = request.data;
+    return request.result;
+}
+
+CurlTransport::CurlTransport()
+{
+    initialized = false;
+}
+
+CurlTransport::~CurlTransport()
+{
+    if(initialized)
+        curl_global_cleanup();
+}
+
+const _TCHAR *CurlTransport::name()
+{
+    return _T("curl");
+}
+
+HINTERNET CurlTransport::openSession(InternetOptions &opt)
+{
+    if(!initialized)
+    {
+        if(curl_global_init(CURL_GLOBAL_ALL) != CURLE_OK)
+        {
+            SetLastError(ERROR_INTERNET_INTERNAL_ERROR);
+            return NULL;
+        }
+
+        initialized = true;
+        TRACE(_T("libcurl %s"), tocurenc(curl_version()).c_str());
+    }
+
+    return handle(new CurlSession(opt));
+}
+
+HINTERNET CurlTransport::connect(HINTERNET session, Url *url, const _TCHAR *user, const _TCHAR *pass)
+{
+    // libcurl connects on first transfer, and reuses connections of the session
+    return handle(new CurlConnection((CurlSession *)(CurlHandle *)session, user, pass));
+}
+
+// libcurl times phases from start of transfer, phases skipped on reused connection are 0
+static void curlTiming(CURL *easy, CURLINFO info, DWORD start, DWORD *timing)
+{
+    curl_off_t t = 0;
+
+    if((curl_easy_getinfo(easy, info, &t) == CURLE_OK) && (t > 0))
+        *timing = start + (DWORD)t;
+}
+
+HINTERNET CurlTransport::openFile(Url *url, const _TCHAR *httpVerb, DWORDLONG offset)
+{
+    CurlConnection *connection = (CurlConnection *)(CurlHandle *)url->connection;
+    CURL           *easy       = connection->easy;
+    DWORD           start      = url->elapsed();
+
+    setup(connection, url, url->urlPath);
+
+    if(httpVerb && (_tcscmp(httpVerb, _T("HEAD")) == 0))
+        curl_easy_setopt(easy, CURLOPT_NOBODY, 1L);
+
+    // CURLOPT_RESUME_FROM fails transfer, if HTTP server ignores range, so plain Range is used for HTTP
+    if(offset && (url->service == INTERNET_SERVICE_FTP))
+        curl_easy_setopt(easy, CURLOPT_RESUME_FROM_LARGE, (curl_off_t)offset);
+    else if(url->rangeEnd)
+        curl_easy_setopt(easy, CURLOPT_RANGE, (u64tostr(offset) + "-" + u64tostr(url->rangeEnd - 1)).c_str());
+    else if(offset)
+        curl_easy_setopt(easy, CURLOPT_RANGE, (u64tostr(offset) + "-").c_str());
+
+    curl_slist_free_all(connection->headers);
+    connection->headers = NULL;
+
+    if((offset || url->rangeEnd) && (url->service == INTERNET_SERVICE_HTTP) && !url->ifRange.empty())
+    {
+        connection->headers = curl_slist_append(NULL, ("If-Range: " + toutf8(url->ifRange)).c_str());
+        curl_easy_setopt(easy, CURLOPT_HTTPHEADER, connection->headers);
+    }
+
+    CurlRequest *request = new CurlRequest(connection);
+    url->filehandle = handle(request);
+
+    // Wait for response, so errors & HTTP status are reported here, like in WinINet backend
+    while(!request->done && !request->pending())
+    {
+        if(url->cancelled)
+        {
+            TRACE(_T("Request to %s cancelled"), url->urlString.c_str());
+            SetLastError(ERROR_INTERNET_OPERATION_CANCELLED);
+            return NULL;
+        }
+
+        request->perform(CURL_OPEN_POLL_TIMEOUT);
+    }
+
+    // Transfer may fail right after first data, then error is reported by read() after the data
+    if(request->done && (request->result != CURLE_OK) && !request->pending())
+    {
+        TRACE(_T("libcurl error %d: %s"), (int)request->result, tocurenc(curl_easy_strerror(request->result)).c_str());
+        SetLastError(curlerror(request->result));
+        return NULL;
+    }
+
+    curlTiming(easy, CURLINFO_NAMELOOKUP_TIME_T,    start, &url->timings.dns);
+    curlTiming(easy, CURLINFO_CONNECT_TIME_T,       start, &url->timings.connect);
+    curlTiming(easy, CURLINFO_APPCONNECT_TIME_T,    start, &url->timings.tls);
+    curlTiming(easy, CURLINFO_PRETRANSFER_TIME_T,   start, &url->timings.requestSent);
+    curlTiming(easy, CURLINFO_STARTTRANSFER_TIME_T, start, &url->timings.firstByte);
+
+    if((url->timings.tls != TIMING_UNKNOWN) && (url->timings.connect != TIMING_UNKNOWN))
+        traceEvent(TE_TLS, url->traceId, (DWORDLONG)(url->timings.tls - url->timings.connect) * 1000);
+
+    if(url->service == INTERNET_SERVICE_HTTP)
+    {
+        long status = 0;
+        curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &status);
+        TRACE(_T("HTTP Status code: %d"), (int)status);
+        url->httpStatus = (int)status;
+
+        if(status == HTTP_STATUS_PROXY_AUTH_REQ)
+        {
+            url->close();
+            throw FatalNetworkError("407");
+        }
+
+        if((offset || url->rangeEnd) && (status == HTTP_STATUS_PARTIAL_CONTENT))
+            url->startOffset = offset;
+        else if((status != HTTP_STATUS_OK) && (status != HTTP_STATUS_CREATED))
+        {
+            curl_off_t retryAfter = 0;
+
+            if(curl_easy_getinfo(easy, CURLINFO_RETRY_AFTER, &retryAfter) != CURLE_OK)
+                retryAfter = 0;
+
+            url->close();
+            throw HTTPError(dwtostr(status), (DWORD)retryAfter);
+        }
+
+        // Validator is used for If-Range, when interrupted download is continued (see ResumeJournal)
+#if LIBCURL_VERSION_NUM >= 0x075300
+        curl_header *header;
+
+        if((curl_easy_header(easy, "ETag", 0, CURLH_HEADER, -1, &header) == CURLHE_OK) ||
+           (curl_easy_header(easy, "Last-Modified", 0, CURLH_HEADER, -1, &header) == CURLHE_OK))
+            url->validator = fromutf8(header->value);
+#endif
+    }
+    else
+        url->startOffset = offset;
+
+    return url->filehandle;
+}
+
+bool CurlTransport::read(HINTERNET file, void *buffer, DWORD size, DWORD *bytesRead)
+{
+    CurlRequest *request = (CurlRequest *)(CurlHandle *)file;
+    size_t       n       = request->data.length() - request->dataPos;
+
+    *bytesRead = 0;
+
+    if(n)
+    {
+        // Data, received by previous perform() calls
+        if(n > size)
+            n = size;
+
+        memcpy(buffer, request->data.data() + request->dataPos, n);
+        request->dataPos += n;
+
+        if(request->dataPos == request->data.length())
+        {
+            request->data.clear();
+            request->dataPos = 0;
+        }
+
+        *bytesRead = (DWORD)n;
+        return true;
+    }
+
+    request->target     = (char *)buffer;
+    request->targetSize = size;
+    request->targetUsed = 0;
+
+    DWORD startTime = GetTickCount();
+    DWORD elapsed   = 0;
+
+    while(!request->done && !request->targetUsed)
+    {
+        if(request->readTimeout && ((elapsed = GetTickCount() - startTime) >= request->readTimeout))
+            break;
+
+        DWORD wait = request->readTimeout ? request->readTimeout - elapsed : CURL_POLL_TIMEOUT;
+        request->perform((wait < CURL_POLL_TIMEOUT) ? wait : CURL_POLL_TIMEOUT);
+    }
+
+    *bytesRead = (DWORD)request->targetUsed;
+    request->target     = NULL;
+    request->targetUsed = 0;
+
+    if(!*bytesRead && !request->done)
+    {
+        TRACE(_T("No data received in %u ms"), request->readTimeout);
+        SetLastError(ERROR_INTERNET_TIMEOUT);
+        return false;
+    }
+
+    if(*bytesRead || (request->result == CURLE_OK))
+        return true;
+
+    TRACE(_T("libcurl error %d: %s"), (int)request->result, tocurenc(curl_easy_strerror(request->result)).c_str());
+    SetLastError(curlerror(request->result));
+    return false;
+}
+
+void CurlTransport::setReadTimeout(HINTERNET file, DWORD timeout)
+{
+    ((CurlRequest *)(CurlHandle *)file)->readTimeout = timeout;
+}
+
+DWORDLONG CurlTransport::fileSize(Url *url)
+{
+    CurlRequest *request = (CurlRequest *)(CurlHandle *)url->filehandle;
+    curl_off_t   size    = -1;
+
+    if(curl_easy_getinfo(request->connection->easy, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &size) != CURLE_OK)
+        return FILE_SIZE_UNKNOWN;
+
+    return (size < 0) ? FILE_SIZE_UNKNOWN : (DWORDLONG)size;
+}
+
+static long curlListChunk(const void *transferInfo, void *ptr, int remains)
+{
+    const curl_fileinfo *info    = (const curl_fileinfo *)transferInfo;
+    vector<FtpDirEntry> *entries = (vector<FtpDirEntry> *)ptr;
+
+    if((info->filetype == CURLFILETYPE_FILE) || (info->filetype == CURLFILETYPE_DIRECTORY))
+    {
+        FtpDirEntry entry;
+        entry.name      = fromutf8(info->filename);
+        entry.directory = info->filetype == CURLFILETYPE_DIRECTORY;
+        entry.size      = (info->flags & CURLFINFOFLAG_KNOWN_SIZE) ? (DWORDLONG)info->size : 0;
+        entry.modified  = 0; // LIST times are not precise enough
+
+        if(!(entry.directory && ((entry.name.compare(_T(".")) == 0) || (entry.name.compare(_T("..")) == 0))))
+        {
+            TRACE(_T("    (%s) %s"), entry.directory ? _T("D") : _T("F"), entry.name.c_str());
+            entries->push_back(entry);
+        }
+    }
+
+    return CURL_CHUNK_BGN_FUNC_SKIP; // Only listing is needed
+}
+
+static long curlListChunkEnd(void *ptr)
+{
+    return CURL_CHUNK_END_FUNC_OK;
+}
+
+bool CurlTransport::listDir(Url *url, tstring path, tstring mask, vector<FtpDirEntry> &entries, bool *useMlsd)
+{
+    CurlConnection *connection = (CurlConnection *)(CurlHandle *)url->connection;
+    CURL           *easy       = connection->easy;
+    string          listing;
+    CURLcode        res;
+
+    entries.clear();
+
+    if(*useMlsd)
+    {
+        setup(connection, url, addslash(path));
+        curl_easy_setopt(easy, CURLOPT_CUSTOMREQUEST, "MLSD");
+
+        if((res = transfer(connection, listing)) == CURLE_OK)
+            return parseMlsd(listing, mask, entries);
+
+        long code = 0;
+        curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &code);
+        TRACE(_T("MLSD failed: %d (libcurl error %d)"), (int)code, (int)res);
+
+        if(code < 500)
+        {
+            SetLastError(curlerror(res));
+            return false;
+        }
+
+        TRACE(_T("MLSD not supported, using LIST"));
+        *useMlsd = false;
+    }
+
+    // LIST output is parsed by libcurl wildcard matching, files themselves are skipped
+    setup(connection, url, addslash(path) + (mask.empty() ? _T("*") : mask));
+    curl_easy_setopt(easy, CURLOPT_FTP_FILEMETHOD,      (long)CURLFTPMETHOD_MULTICWD);
+    curl_easy_setopt(easy, CURLOPT_WILDCARDMATCH,       1L);
+    curl_easy_setopt(easy, CURLOPT_CHUNK_BGN_FUNCTION,  curlListChunk);
+    curl_easy_setopt(easy, CURLOPT_CHUNK_END_FUNCTION,  curlListChunkEnd);
+    curl_easy_setopt(easy, CURLOPT_CHUNK_DATA,          &entries);
+
+    res = transfer(connection, listing);
+
+    if((res == CURLE_OK) || (res == CURLE_REMOTE_FILE_NOT_FOUND)) // No matching files
+        return true;
+
+    SetLastError(curlerror(res));
+    return false;
+}
+
+void CurlTransport::closeHandle(HINTERNET h)
+{
+    delete (CurlHandle *)h;
+}
+
+// Request of asynchronous transfer: own easy handle, added to multi handle of driver
+struct CurlAsyncRequest
+{
+    CurlConnection *connection;
+    bool            responded;
+};
+
+// All transfers of one AsyncEngine thread in one multi handle. libcurl waits for events of all
+// their sockets at once (poll/epoll, select on Windows) and connections are reused through share
+// handle of session.
+class CurlAsyncDriver: public AsyncDriver
+{
+public:
+    CurlAsyncDriver(CurlSession *s);
+    ~CurlAsyncDriver();
+
+    bool start(AsyncTransfer *transfer);
+    void poll(DWORD wait);
+    void remove(AsyncTransfer *transfer);
+
+protected:
+    CurlSession *session;
+    CURLM       *multi;
+};
+
+// Status & size are passed to transfer before first data, or at end, if there was no data (HEAD)
+static bool asyncResponse(AsyncTransfer *transfer, CURL *easy)
+{
+    long       status     = 0;
+    curl_off_t length     = -1;
+    curl_off_t retryAfter = 0;
+
+    ((CurlAsyncRequest *)transfer->request)->responded = true;
+
+    if(transfer->url.service == INTERNET_SERVICE_HTTP)
+    {
+        curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &status);
+
+        if(curl_easy_getinfo(easy, CURLINFO_RETRY_AFTER, &retryAfter) != CURLE_OK)
+            retryAfter = 0;
+    }
+
+    if(curl_easy_getinfo(easy, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length) != CURLE_OK)
+        length = -1;
+
+    return transfer->response((int)status, (length >= 0) ? (DWORDLONG)length : FILE_SIZE_UNKNOWN, (DWORD)retryAfter);
+}
+
+static size_t curlAsyncWrite(char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+    AsyncTransfer    *transfer = (AsyncTransfer *)userdata;
+    CurlAsyncRequest *request  = (CurlAsyncRequest *)transfer->request;
+    size_t            len      = size * nmemb;
+
+    if(!request->responded && !asyncResponse(transfer, request->connection->easy))
+        return 0;
+
+    return transfer->received((const BYTE *)ptr, (DWORD)len) ? len : 0;
+}
+
+CurlAsyncDriver::CurlAsyncDriver(CurlSession *s)
+{
+    session = s;
+    multi   = curl_multi_init();
+}
+
+CurlAsyncDriver::~CurlAsyncDriver()
+{
+    curl_multi_cleanup(multi);
+}
+
+bool CurlAsyncDriver::start(AsyncTransfer *transfer)
+{
+    Url              *url     = &transfer->url;
+    CurlAsyncRequest *request = new CurlAsyncRequest;
+    bool              own     = (_tcslen(url->userName) > 0) || (_tcslen(url->password) > 0);
+
+    request->connection = new CurlConnection(session, own ? url->userName : url->internetOptions.login.c_str(),
+                                                      own ? url->password : url->internetOptions.password.c_str());
+    request->responded  = false;
+    transfer->request   = request;
+
+    CURL *easy = request->connection->easy;
+
+    setup(request->connection, url, url->urlPath);
+    curl_easy_setopt(easy, CURLOPT_WRITEFUNCTION, curlAsyncWrite);
+    curl_easy_setopt(easy, CURLOPT_WRITEDATA,     transfer);
+    curl_easy_setopt(easy, CURLOPT_PRIVATE,       transfer);
+
+    if(transfer->sizeOnly)
+        curl_easy_setopt(easy, CURLOPT_NOBODY, 1L);
+
+    if(curl_multi_add_handle(multi, easy) != CURLM_OK)
+    {
+        transfer->error = ERROR_INTERNET_INTERNAL_ERROR;
+        remove(transfer);
+        return false;
+    }
+
+    return true;
+}
+
+void CurlAsyncDriver::poll(DWORD wait)
+{
+    int      running = 0;
+    int      left;
+    CURLMsg *msg;
+
+    curl_multi_perform(multi, &running);
+
+    while((msg = curl_multi_info_read(multi, &left)) != NULL)
+    {
+        AsyncTransfer *transfer = NULL;
+
+        if(msg->msg != CURLMSG_DONE)
+            continue;
+
+        curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&transfer);
+
+        if(!transfer || (transfer->state != AS_RUNNING))
+            continue;
+
+        CURLcode result = msg->data.result;
+
+        if((result == CURLE_OK) && !((CurlAsyncRequest *)transfer->request)->responded && !asyncResponse(transfer, msg->easy_handle))
+            result = CURLE_WRITE_ERROR;
+
+        // Transfer, aborted by AsyncTransfer itself, has its own error
+        if((result != CURLE_OK) && !transfer->error)
+            TRACE(_T("libcurl error %d: %s (%s)"), (int)result, tocurenc(curl_easy_strerror(result)).c_str(), transfer->url.urlString.c_str());
+
+        transfer->finished(curlerror(result));
+    }
+
+    if(running)
+        curl_multi_wait(multi, NULL, 0, (int)wait, NULL);
+}
+
+void CurlAsyncDriver::remove(AsyncTransfer *transfer)
+{
+    CurlAsyncRequest *request = (CurlAsyncRequest *)transfer->request;
+
+    if(!request)
+        return;
+
+    curl_multi_remove_handle(multi, request->connection->easy);
+    delete request->connection;
+    delete request;
+    transfer->request = NULL;
+}
+
+AsyncDriver *CurlTransport::createAsyncDriver(HINTERNET session)
+{
+    return new CurlAsyncDriver((CurlSession *)(CurlHandle *)session);
+}
+
+#endif
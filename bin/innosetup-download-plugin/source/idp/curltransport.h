@@ -0,0 +1,33 @@
+#pragma once
+
+#ifdef IDP_CURL
+
+#include "transport.h"
+
+// Transport, based on libcurl multi interface. Default backend on systems without
+// WinINet (Linux build of tests & benchmarks), optional on Windows (IDP_CURL).
+// Connections & DNS cache are shared between all connections of one session.
+class CurlTransport: public Transport
+{
+public:
+    CurlTransport();
+    ~CurlTransport();
+
+    const _TCHAR *name();
+
+    HINTERNET openSession(InternetOptions &opt);
+    HINTERNET connect(HINTERNET session, Url *url, const _TCHAR *user, const _TCHAR *pass);
+    HINTERNET openFile(Url *url, const _TCHAR *httpVerb, DWORDLONG offset);
+    bool      read(HINTERNET file, void *buffer, DWORD size, DWORD *bytesRead);
+    void      setReadTimeout(HINTERNET file, DWORD timeout);
+    DWORDLONG fileSize(Url *url);
+    bool      listDir(Url *url, tstring path, tstring mask, vector<FtpDirEntry> &entries, bool *useMlsd);
+    void      closeHandle(HINTERNET handle);
+
+    AsyncDriver *createAsyncDriver(HINTERNET session);
+
+protected:
+    bool initialized;
+};
+
+#endif
@@ -1,15 +1,36 @@
+#include <algorithm>
 #include <process.h>
 #include <direct.h>
 #include "downloader.h"
 #include "file.h"
 #include "trace.h"
 
+#ifdef _WIN32
+#define PATH_SEPARATOR _T('\\')
+#else
+#define PATH_SEPARATOR _T('/')
+#endif
+
+#define METALINK_TEMP_FILE _T(".idpmetalink")
+
 Downloader::Downloader()
 {
     stopOnError         = true;
     ownMsgLoop          = false;
     preserveFtpDirs     = true;
+    ftpSnapshots        = true;
+    resumeJournal       = true;
+    pieceSidecar        = false;
     readBufferSize      = DEFAULT_READ_BUFSIZE;
+    ftpScanConnections  = DEFAULT_FTP_SCAN_CONNECTIONS;
+    ftpSegments         = DEFAULT_FTP_SEGMENTS;
+    ftpSegmentMinSize   = DEFAULT_FTP_SEGMENT_MIN_SIZE;
+    asyncTransfers      = 0;
+    asyncThreads        = DEFAULT_ASYNC_THREADS;
+    stallTimeout        = DEFAULT_STALL_TIMEOUT;
+    stallSpeed          = DEFAULT_STALL_SPEED;
+    stallRatio          = DEFAULT_STALL_RATIO;
+    hedging             = false;
     filesSize           = 0;
     downloadedFilesSize = 0;
     ui                  = NULL;
@@ -19,6 +40,8 @@ Downloader::Downloader()
     downloadCancelled   = false;
     downloadPaused      = false;
     finishedCallback    = NULL;
+    prefetcher          = NULL;
+    extractor           = NULL;
 }
 
 Downloader::~Downloader()
@@ -26,6 +49,14 @@ Downloader::~Downloader()
     clearFiles();
     clearMirrors();
     clearFtpDirs();
+
+    // Prefetch thread can still run, when setup was cancelled. It can't be waited for
+    // while DLL is unloaded, so it is only cancelled and ends together with process.
+    if(prefetcher)
+        prefetcher->downloadCancelled = true;
+
+    if(downloadThread)
+        CloseHandle(downloadThread);
 }
 
 void Downloader::setUi(Ui *newUi)
@@ -46,14 +77,117 @@ void Downloader::setInternetOptions(InternetOptions opt)
 
 void Downloader::setOptions(Downloader *d)
 {
-    stopOnError     = d->stopOnError;
-    preserveFtpDirs = d->preserveFtpDirs;
-    readBufferSize  = d->readBufferSize;
+    stopOnError        = d->stopOnError;
+    preserveFtpDirs    = d->preserveFtpDirs;
+    ftpSnapshots       = d->ftpSnapshots;
+    resumeJournal      = d->resumeJournal;
+    pieceSidecar       = d->pieceSidecar;
+    readBufferSize     = d->readBufferSize;
+    ftpScanConnections = d->ftpScanConnections;
+    ftpSegments        = d->ftpSegments;
+    ftpSegmentMinSize  = d->ftpSegmentMinSize;
+    asyncTransfers     = d->asyncTransfers;
+    asyncThreads       = d->asyncThreads;
+    stallTimeout       = d->stallTimeout;
+    stallSpeed         = d->stallSpeed;
+    stallRatio         = d->stallRatio;
+    hedging            = d->hedging;
+    hedger.fixedDelay  = d->hedger.fixedDelay;
+    hedger.budget      = d->hedger.budget;
+    retryPolicy        = d->retryPolicy;
+    location           = d->location;
 }
 
 void Downloader::setComponents(tstring comp)
 {
-    tstringtoset(components, comp, _T(','));
+    components = componentRegistry.mask(comp, _T(','));
+}
+
+// Starts downloading files without components and files of selected components in background,
+// while user is still on previous wizard pages. When called again with changed selection,
+// transfers of deselected files are cancelled (partial data is kept) and new files are added.
+// Results are taken by next downloadFiles call, so prefetched files are not downloaded again.
+void Downloader::startPrefetch(tstring comp)
+{
+    ComponentMask mask = componentRegistry.mask(comp, _T(','));
+
+    if(prefetcher)
+    {
+        prefetcher->stopDownload(INFINITE);
+        takePrefetched();
+        prefetcher->clearFiles();
+    }
+    else
+        prefetcher = new Downloader();
+
+    prefetcher->setOptions(this);
+    prefetcher->setMirrorList(this);
+    prefetcher->setInternetOptions(internetOptions);
+    prefetcher->stopOnError = false;
+
+    for(map<tstring, NetFile *>::iterator i = files.begin(); i != files.end(); i++)
+    {
+        NetFile *file = i->second;
+
+        if(file->downloaded || !file->selected(mask))
+            continue;
+
+        prefetcher->addFile(i->first, file->name, file->size, ComponentMask());
+
+        NetFile *f = prefetcher->files[i->first];
+        f->bytesDownloaded = file->bytesDownloaded;
+        f->mirrorUsed      = file->mirrorUsed;
+        f->hashAlgorithm   = file->hashAlgorithm;
+        f->hash            = file->hash;
+        f->pieces          = file->pieces;
+        f->zip             = file->zip;
+    }
+
+    TRACE(_T("Prefetching %d files"), prefetcher->filesCount());
+
+    if(prefetcher->filesCount())
+        prefetcher->startDownload();
+}
+
+void Downloader::stopPrefetch()
+{
+    if(!prefetcher)
+        return;
+
+    // Prefetched files are taken & freed below, so its thread must end first
+    prefetcher->stopDownload(INFINITE);
+    takePrefetched();
+    prefetcher->clearFiles();
+}
+
+void Downloader::takePrefetched()
+{
+    for(map<tstring, NetFile *>::iterator i = prefetcher->files.begin(); i != prefetcher->files.end(); i++)
+    {
+        NetFile *f = i->second;
+
+        if(!files.count(i->first))
+            continue;
+
+        NetFile *file = files[i->first];
+
+        if(file->downloaded)
+            continue;
+
+        if(file->size == FILE_SIZE_UNKNOWN)
+            file->size = f->size;
+
+        file->bytesDownloaded = f->bytesDownloaded;
+        file->mirrorUsed      = f->mirrorUsed;
+        file->downloaded      = f->downloaded;
+        file->stats.add(f->stats);
+
+        if(file->downloaded)
+        {
+            TRACE(_T("%s prefetched"), file->getShortName().c_str());
+            downloadedFilesSize += file->bytesDownloaded;
+        }
+    }
 }
 
 void Downloader::setFinishedCallback(FinishedCallback callback)
@@ -62,6 +196,11 @@ void Downloader::setFinishedCallback(FinishedCallback callback)
 }
 
 void Downloader::addFile(tstring url, tstring filename, DWORDLONG size, tstring comp)
+{
+    addFile(url, filename, size, componentRegistry.mask(comp, _T(' ')));
+}
+
+void Downloader::addFile(tstring url, tstring filename, DWORDLONG size, ComponentMask comp)
 {
     if(!files.count(url))
     {
@@ -75,6 +214,118 @@ void Downloader::addMirror(tstring url, tstring mirror)
     mirrors.insert(pair<tstring, tstring>(url, mirror));
 }
 
+// Joins destination directory and '/' separated relative name, creating subdirectories
+static tstring destPath(tstring destdir, tstring name)
+{
+    tstring path = destdir;
+
+    if(!path.empty() && (path[path.length() - 1] != PATH_SEPARATOR))
+        path += PATH_SEPARATOR;
+
+    for(size_t i = 0; i < name.length(); i++)
+    {
+        if(name[i] == _T('/'))
+        {
+            _tmkdir(path.c_str());
+            path += PATH_SEPARATOR;
+        }
+        else
+            path += name[i];
+    }
+
+    return path;
+}
+
+// Mirrors in user's country first, then by Metalink priority. Sort is stable, so document order breaks ties.
+class MetalinkUrlOrder
+{
+public:
+    MetalinkUrlOrder(tstring loc): location(loc) {}
+
+    bool operator()(const MetalinkUrl &a, const MetalinkUrl &b) const
+    {
+        bool localA = !location.empty() && (a.location.compare(location) == 0);
+        bool localB = !location.empty() && (b.location.compare(location) == 0);
+
+        if(localA != localB)
+            return localA;
+
+        return a.priority < b.priority;
+    }
+
+protected:
+    tstring location;
+};
+
+// Adds files, listed in Metalink document (local file or URL), to destdir. Most preferred URL
+// becomes file URL, other URLs are added as its mirrors in order of preference.
+bool Downloader::addMetalink(tstring source, tstring destdir, tstring comp)
+{
+    Metalink metalink;
+    tstring  scheme = tstrlower(source.substr(0, source.find(_T(':'))).c_str());
+    bool     res;
+
+    if((scheme.compare(_T("http")) == 0) || (scheme.compare(_T("https")) == 0) || (scheme.compare(_T("ftp")) == 0))
+    {
+        Downloader d;
+        tstring    temp = destPath(destdir, METALINK_TEMP_FILE);
+
+        d.setOptions(this);
+        d.setInternetOptions(internetOptions);
+        d.resumeJournal = false;
+        d.addFile(source, temp);
+
+        res = d.downloadFiles(false) && metalink.load(temp);
+
+        if(!d.filesDownloaded())
+            storeError(d.getLastErrorStr(), d.getLastError());
+
+        _tremove(temp.c_str());
+    }
+    else
+        res = metalink.load(source);
+
+    if(!res)
+    {
+        TRACE(_T("Cannot read Metalink %s"), source.c_str());
+        return false;
+    }
+
+    for(vector<MetalinkFile>::iterator i = metalink.files.begin(); i != metalink.files.end(); i++)
+    {
+        stable_sort(i->urls.begin(), i->urls.end(), MetalinkUrlOrder(tstrlower(location.c_str())));
+
+        tstring url = i->urls[0].url;
+
+        addFile(url, destPath(destdir, i->name), i->size, comp);
+
+        NetFile *file = files[url];
+        file->hashAlgorithm = i->hashAlgorithm;
+        file->hash          = i->hash;
+        file->pieces        = i->pieces;
+
+        for(size_t j = 1; j < i->urls.size(); j++)
+            addMirror(url, i->urls[j].url);
+    }
+
+    return true;
+}
+
+// Adds zip archive, of which only members matching include masks and not matching exclude masks
+// are downloaded (see downloadZipMembers). Reduced archive is written to filename; if extractDir
+// is not empty, members are extracted there and reduced archive is deleted.
+void Downloader::addZipMembers(tstring url, tstring filename, tstring include, tstring exclude, tstring extractDir, tstring comp)
+{
+    addFile(url, filename, FILE_SIZE_UNKNOWN, comp);
+
+    ZipMembers *zip = &files[url]->zip;
+
+    zip->enabled    = true;
+    zip->include    = include;
+    zip->exclude    = exclude;
+    zip->extractDir = extractDir;
+}
+
 void Downloader::setMirrorList(Downloader *d)
 {
     mirrors = d->mirrors;
@@ -82,6 +333,11 @@ void Downloader::setMirrorList(Downloader *d)
 
 void Downloader::clearFiles()
 {
+    for(list<FtpSnapshot *>::iterator i = ftpSnapshotList.begin(); i != ftpSnapshotList.end(); i++)
+        delete *i;
+
+    ftpSnapshotList.clear();
+
     if(files.empty())
         return;
 
@@ -186,68 +442,49 @@ bool Downloader::openInternet()
     TRACE(_T("Opening internet..."));
     TRACE(_T("    access type: %s"), atype);
     TRACE(_T("    proxy name : %s"), internetOptions.proxyName.empty() ? _T("(none)") : internetOptions.proxyName.c_str());
+    TRACE(_T("    transport  : %s"), defaultTransport()->name());
 #endif
 
-    if(!internet)
-        if(!(internet = InternetOpen(internetOptions.userAgent.c_str(), internetOptions.accessType, 
-                                     internetOptions.proxyName.empty() ? NULL : internetOptions.proxyName.c_str(), 
-                                     NULL, 0)))
-            return false;
-
-    TRACE(_T("Setting timeouts..."));
-
-    if(internetOptions.connectTimeout != TIMEOUT_DEFAULT)
-        InternetSetOption(internet, INTERNET_OPTION_CONNECT_TIMEOUT, &internetOptions.connectTimeout, sizeof(DWORD));
-
-    if(internetOptions.sendTimeout    != TIMEOUT_DEFAULT)
-        InternetSetOption(internet, INTERNET_OPTION_SEND_TIMEOUT,    &internetOptions.sendTimeout,    sizeof(DWORD));
-
-    if(internetOptions.receiveTimeout != TIMEOUT_DEFAULT)
-        InternetSetOption(internet, INTERNET_OPTION_RECEIVE_TIMEOUT, &internetOptions.receiveTimeout, sizeof(DWORD));
-
-#ifdef _DEBUG
-    DWORD connectTimeout, sendTimeout, receiveTimeout, bufSize = sizeof(DWORD);
-
-    InternetQueryOption(internet, INTERNET_OPTION_CONNECT_TIMEOUT, &connectTimeout, &bufSize);
-    InternetQueryOption(internet, INTERNET_OPTION_SEND_TIMEOUT,    &sendTimeout,    &bufSize);
-    InternetQueryOption(internet, INTERNET_OPTION_RECEIVE_TIMEOUT, &receiveTimeout, &bufSize);
-
-    TRACE(_T("Internet options:"));
-    TRACE(_T("    Connect timeout: %d"), connectTimeout);
-    TRACE(_T("    Send timeout   : %d"), sendTimeout);
-    TRACE(_T("    Receive timeout: %d"), receiveTimeout);
-#endif
-
-    return true;
+    return (internet = defaultTransport()->openSession(internetOptions)) != NULL;
 }
 
 bool Downloader::closeInternet()
 {
     if(internet)
     {
-        bool res = InternetCloseHandle(internet) != NULL;
+        // Cancelled hedged requests still use session
+        hedger.wait();
+        TRACE(_T("Hedged requests: %d sent, %d won, %I64u bytes wasted"), hedger.hedges, hedger.wins, hedger.wasted);
+
+        defaultTransport()->closeHandle(internet);
         internet = NULL;
-        return res;
+        return true;
     }
     else
         return true;
 }
 
-void downloadThreadProc(void *param)
+unsigned __stdcall downloadThreadProc(void *param)
 {
     Downloader *d = (Downloader *)param;
     bool res = d->downloadFiles();
 
     if((!d->downloadCancelled) && d->finishedCallback)
         d->finishedCallback(d, res);
+
+    return 0;
 }
 
 void Downloader::startDownload()
 {
-    downloadThread = (HANDLE)_beginthread(&downloadThreadProc, 0, (void *)this);
+    if(downloadThread)
+        CloseHandle(downloadThread);
+
+    downloadThread = (HANDLE)_beginthreadex(NULL, 0, &downloadThreadProc, (void *)this, 0, NULL);
 }
 
-void Downloader::stopDownload()
+// Files may be freed after return only when thread has ended: prefetcher is stopped with INFINITE timeout
+void Downloader::stopDownload(DWORD timeout)
 {
     if(ownMsgLoop)
     {
@@ -258,7 +495,7 @@ void Downloader::stopDownload()
     Ui *uitmp = ui;
     ui = NULL;
     downloadCancelled = true;
-    WaitForSingleObject(downloadThread, DOWNLOAD_CANCEL_TIMEOUT);
+    WaitForSingleObject(downloadThread, timeout);
     downloadCancelled = false;
     ui = uitmp;
 }
@@ -293,6 +530,10 @@ DWORDLONG Downloader::getFileSizes(bool useComponents)
     filesSize = 0;
     bool sizeUnknown = false;
 
+    // Sizes of plain files are queried all at once, failed ones are tried again below with mirrors
+    if(asyncTransfers)
+        getFileSizesAsync(useComponents);
+
     for(map<tstring, NetFile *>::iterator i = files.begin(); i != files.end(); i++)
     {
         updateStatus(msg("Getting file information..."));
@@ -364,9 +605,12 @@ bool Downloader::downloadFiles(bool useComponents)
     if(ownMsgLoop)
         downloadCancelled = false;
 
+    stopPrefetch();
+
     if(files.empty() && ftpDirs.empty())
         return true;
 
+    downloadTimer.start(0);
     setMarquee(true);
 
     processFtpDirs();
@@ -384,7 +628,7 @@ bool Downloader::downloadFiles(bool useComponents)
     {
         storeError();
         setMarquee(false);
-        return false;
+        return finishDownload(false, useComponents);
     }
 
     sizeTimeTimer.start(500);
@@ -396,6 +640,9 @@ bool Downloader::downloadFiles(bool useComponents)
 
     processMessages();
 
+    if(asyncTransfers)
+        downloadFilesAsync(useComponents);
+
     for(map<tstring, NetFile *>::iterator i = files.begin(); i != files.end(); i++)
     {
         NetFile *file = i->second;
@@ -409,202 +656,1394 @@ bool Downloader::downloadFiles(bool useComponents)
 
         if(!file->downloaded)
         {
-            // If mirror was used in getFileSizes() function, check mirror first:
-            if(file->mirrorUsed.length())
+            if(downloadFileRetrying(i->first, file))
+                downloadedFilesSize += file->bytesDownloaded;
+            else
             {
-                NetFile newFile(file->mirrorUsed, file->name, file->size);
-
-                if(downloadFile(&newFile))
+                if(stopOnError)
                 {
-                    file->downloaded = newFile.downloaded;
-                    file->bytesDownloaded = newFile.bytesDownloaded;
-                    downloadedFilesSize += file->bytesDownloaded;
-                    continue;
+                    closeInternet();
+                    return finishDownload(false, useComponents);
                 }
-            }
-
-            if(!downloadFile(file))
-            {
-                TRACE(_T("File was not downloaded."));
-
-                if(checkMirrors(i->first, true))
-                    downloadedFilesSize += file->bytesDownloaded;
                 else
                 {
-                    if(stopOnError)
-                    {
-                        closeInternet();
-                        return false;
-                    }
-                    else
-                    {
-                        TRACE(_T("Ignoring file %s"), file->name.c_str());
-                    }
+                    TRACE(_T("Ignoring file %s"), file->name.c_str());
                 }
             }
-            else
-                downloadedFilesSize += file->bytesDownloaded;
         }
 
+        if(file->downloaded && extractor)
+            extractor->fileReady(file->name);
+
         processMessages();
     }
 
     closeInternet();
-    return filesDownloaded();
+    return finishDownload(filesDownloaded(), useComponents);
 }
 
-bool Downloader::checkMirrors(tstring url, bool download/* or get size */)
+// Plain transfer of whole file, which AsyncEngine can do: not started yet, without zip members,
+// piece hashes & FTP segments
+bool Downloader::asyncEligible(NetFile *file)
 {
-    TRACE(_T("Checking mirrors for %s (%s)..."), url.c_str(), download ? _T("download") : _T("get size"));
-    pair<multimap<tstring, tstring>::iterator, multimap<tstring, tstring>::iterator> fileMirrors = mirrors.equal_range(url);
-    
-    for(multimap<tstring, tstring>::iterator i = fileMirrors.first; i != fileMirrors.second; ++i)
+    if(file->downloaded || file->bytesDownloaded || file->zip.enabled || file->pieces.covers(file->size))
+        return false;
+
+    if((file->url.parts.schemeId == URL_SCHEME_FTP) && (ftpSegments > 1) && !(file->size == FILE_SIZE_UNKNOWN) && (file->size >= ftpSegmentMinSize))
+        return false;
+
+    return !(resumeJournal && File::exists(file->name + RESUME_JOURNAL_EXT));
+}
+
+void Downloader::getFileSizesAsync(bool useComponents)
+{
+    AsyncEngine engine;
+
+    engine.threads      = asyncThreads;
+    engine.maxTransfers = asyncTransfers;
+
+    for(map<tstring, NetFile *>::iterator i = files.begin(); i != files.end(); i++)
     {
-        tstring mirror = i->second;
-        TRACE(_T("Checking mirror %s:"), mirror.c_str());
-        NetFile f(mirror, files[url]->name, files[url]->size);
+        NetFile *file = i->second;
 
-        if(download)
-        {
-            if(downloadFile(&f))
-            {
-                files[url]->downloaded = true;
-                return true;
-            }
-        }
-        else // get size
-        {
-            try
-            {
-                DWORDLONG size = f.url.getSize(internet);
+        if((file->size == FILE_SIZE_UNKNOWN) && asyncEligible(file) && (!useComponents || file->selected(components)))
+            engine.add(file, i->first, true);
+    }
 
-                if(size != FILE_SIZE_UNKNOWN)
-                {
-                    files[url]->size = size;
-                    files[url]->mirrorUsed = mirror;
-                    return true;
-                }
-            }
-            catch(HTTPError &e)
-            {
-                updateStatus(msg(e.what()));
-            }
-        }
+    if(engine.transfers.empty() || !engine.start(internet))
+        return;
+
+    while(!engine.wait(100))
+    {
+        if(downloadCancelled)
+            engine.cancel();
 
+        updateFileName(engine.current());
         processMessages();
     }
 
-    return false;
+    for(vector<AsyncTransfer *>::iterator i = engine.transfers.begin(); i != engine.transfers.end(); i++)
+        if((*i)->state == AS_DONE)
+            (*i)->netFile->size = (*i)->size;
 }
 
-bool Downloader::downloadFile(NetFile *netFile)
+// Plain files are downloaded at once by AsyncEngine. Files, failed there, are left to usual download
+// loop, which continues them from received part, tries mirrors & retries.
+void Downloader::downloadFilesAsync(bool useComponents)
 {
-    BYTE  *buffer = new BYTE[readBufferSize];
-    DWORD bytesRead;
-    File  file;
+    AsyncEngine engine;
 
-    updateFileName(netFile);
-    updateStatus(msg("Connecting..."));
-    setMarquee(true, false);
+    engine.threads      = asyncThreads;
+    engine.maxTransfers = asyncTransfers;
 
-    try
-    {
-        netFile->open(internet);
-    }
-    catch(exception &e)
+    for(map<tstring, NetFile *>::iterator i = files.begin(); i != files.end(); i++)
     {
-        setMarquee(false, stopOnError ? (netFile->size == FILE_SIZE_UNKNOWN) : false);
-        updateStatus(msg(e.what()));
-        storeError(msg(e.what()));
-        delete[] buffer;
-        return false;
+        NetFile *file = i->second;
+
+        if(asyncEligible(file) && (!useComponents || file->selected(components)))
+            engine.add(file, file->mirrorUsed.empty() ? i->first : file->mirrorUsed);
     }
 
-    if(!netFile->handle)
+    if(engine.transfers.empty())
+        return;
+
+    if(!engine.start(internet))
     {
-        setMarquee(false, stopOnError ? (netFile->size == FILE_SIZE_UNKNOWN) : false);
-        updateStatus(msg("Cannot connect"));
-        storeError();
-        delete[] buffer;
-        return false;
+        TRACE(_T("Transport %s has no asynchronous driver"), defaultTransport()->name());
+        return;
     }
 
-    if(!file.open(netFile->name))
+    updateStatus(msg("Downloading..."));
+
+    while(!engine.wait(100))
     {
-        setMarquee(false, stopOnError ? (netFile->size == FILE_SIZE_UNKNOWN) : false);
-        tstring errstr = msg("Cannot create file") + _T(" ") + netFile->name;
-        updateStatus(errstr);
-        storeError(errstr);
-        delete[] buffer;
-        return false;
+        if(downloadCancelled)
+            engine.cancel();
+
+        if(ui)
+            ui->setProgressInfo(filesSize, downloadedFilesSize + engine.bytesDownloaded(), FILE_SIZE_UNKNOWN, 0);
+
+        updateFileName(engine.current());
+        processMessages();
     }
 
-    Timer progressTimer(100);
-    Timer speedTimer(1000);
+    int done = 0;
 
-    updateStatus(msg("Downloading..."));
+    for(vector<AsyncTransfer *>::iterator i = engine.transfers.begin(); i != engine.transfers.end(); i++)
+    {
+        AsyncTransfer *transfer = *i;
+        NetFile       *file     = transfer->netFile;
 
-    if(!(netFile->size == FILE_SIZE_UNKNOWN))
-        setMarquee(false, false);
+        if(transfer->state == AS_QUEUED)
+            continue;
 
-    processMessages();
+        file->stats.source        = transfer->url.urlString;
+        file->stats.httpStatus    = transfer->httpStatus;
+        file->stats.bytes        += transfer->bytes;
+        file->stats.transferTime += transfer->transferTime;
+        file->bytesDownloaded     = transfer->bytes;
 
-    while(true)
-    {
-        if(downloadCancelled)
+        if(transfer->state == AS_FAILED)
         {
-            file.close();
-            netFile->close();
-            delete[] buffer;
-            return true;
+            file->stats.error = transfer->error;
+            traceEvent(TE_ERROR, file->url.traceId, transfer->httpStatus ? transfer->httpStatus : transfer->error);
+            continue;
         }
 
-        if(!netFile->read(buffer, readBufferSize, &bytesRead))
-        {
-            setMarquee(false, netFile->size == FILE_SIZE_UNKNOWN);
-            updateStatus(msg("Download failed"));
-            storeError();
-            file.close();
-            netFile->close();
-            delete[] buffer;
-            return false;
-        }
+        file->downloaded = true;
 
-        if(bytesRead == 0)
-            break;
+        if(!verifyFile(file->url.urlString, file))
+            continue;
 
-        file.write(buffer, bytesRead);
+        traceEvent(TE_DONE, file->url.traceId, file->bytesDownloaded);
+        downloadedFilesSize += file->bytesDownloaded;
+        done++;
+    }
 
-        if(progressTimer.elapsed())
-            updateProgress(netFile);
+    TRACE(_T("%d of %d files downloaded asynchronously"), done, (int)engine.transfers.size());
+}
 
-        if(speedTimer.elapsed())
-            updateSpeed(netFile, &speedTimer);
+// Saves FTP snapshots, writes performance report & event trace (on error), if they are enabled
+bool Downloader::finishDownload(bool res, bool useComponents)
+{
+    saveFtpSnapshots();
 
-        if(sizeTimeTimer.elapsed())
-            updateSizeTime(netFile, &sizeTimeTimer);
+    TRACE(_T("Peak buffer memory: %I64u bytes (budget %I64u), %u waits, %u shrunk buffers"),
+          bufferPool.peak(), bufferPool.budget, bufferPool.waits(), bufferPool.shrinks());
 
-        processMessages();
-    }
+    if(!perfReportFile.empty())
+    {
+        PerfReport report(defaultTransport()->name(), downloadTimer.totalElapsed());
 
-    updateProgress(netFile);
-    updateSpeed(netFile, &speedTimer);
-    updateSizeTime(netFile, &sizeTimeTimer);
-    updateStatus(msg("Download complete"));
-    processMessages();
+        for(map<tstring, NetFile *>::iterator i = files.begin(); i != files.end(); i++)
+        {
+            NetFile *file = i->second;
 
-    file.close();
-    netFile->close();
+            if(!useComponents || file->selected(components))
+                report.add(i->first, file->name, file->size, file->downloaded, file->stats);
+        }
+
+        TRACE(_T("Writing performance report to %s"), perfReportFile.c_str());
+        report.write(perfReportFile);
+    }
+
+    if(!res)
+        dumpTrace();
+
+    return res;
+}
+
+// Downloads file from its url or mirrors. If all of them failed with transient error, whole
+// cycle is repeated after backoff delay, continuing from last good offset.
+bool Downloader::downloadFileRetrying(tstring url, NetFile *file)
+{
+    if(pieceSidecar && file->pieces.hashes.empty() && !(file->size == FILE_SIZE_UNKNOWN))
+        fetchPieceSidecar(url, file);
+
+    for(int attempt = 1; ; attempt++)
+    {
+        bool res = downloadFileOrMirror(url, file);
+
+        // Cancelled transfer also succeeds: partial data & resume journal are kept for next
+        // download and hash is checked only when file is complete
+        if(res && (downloadCancelled || !file->downloaded))
+            return true;
+
+        if(res && verifyFile(url, file))
+            return true;
+
+        traceEvent(TE_ERROR, file->url.traceId, lastFailure.httpStatus ? lastFailure.httpStatus : lastFailure.code);
+        file->stats.error = lastFailure.code;
+
+        if(downloadCancelled || (attempt >= retryPolicy.attempts) || !retryPolicy.retryable(lastFailure))
+            return false;
+
+        DWORD delay = retryPolicy.delay(attempt - 1, lastFailure);
+
+        if(delay == RETRY_NEVER)
+        {
+            TRACE(_T("Server asks to retry in %u s, giving up"), lastFailure.retryAfter);
+            return false;
+        }
+
+        TRACE(_T("Retrying %s from %I64u in %u ms (attempt %d of %d)"), url.c_str(), file->bytesDownloaded, delay, attempt + 1, retryPolicy.attempts);
+        traceEvent(TE_RETRY, file->url.traceId, delay);
+        file->stats.retries++;
+        updateStatus(msg("Connecting..."));
+
+        if(!waitRetry(delay))
+            return false;
+    }
+}
+
+bool Downloader::downloadFileOrMirror(tstring url, NetFile *file)
+{
+    // If mirror was used in getFileSizes() function, check mirror first:
+    if(file->mirrorUsed.length())
+    {
+        NetFile newFile(file->mirrorUsed, file->name, file->size);
+
+        newFile.bytesDownloaded = file->bytesDownloaded;
+        newFile.url.traceId     = file->url.traceId;
+        newFile.pieces          = file->pieces;
+        newFile.zip             = file->zip;
+        traceEvent(TE_MIRROR, file->url.traceId, 0);
+
+        bool res = downloadFile(&newFile);
+
+        file->stats.add(newFile.stats);
+
+        if(res)
+        {
+            file->downloaded = newFile.downloaded;
+            file->bytesDownloaded = newFile.bytesDownloaded;
+            return true;
+        }
+
+        // Primary url continues from where mirror stopped
+        file->bytesDownloaded = newFile.bytesDownloaded;
+    }
+
+    if(downloadFile(file))
+        return true;
+
+    TRACE(_T("File was not downloaded."));
+    return checkMirrors(url, true);
+}
+
+// Checks hash of downloaded file, if it is known. File with piece hashes is repaired piece by piece,
+// other corrupted file is deleted, so it is downloaded again from beginning on retry.
+bool Downloader::verifyFile(tstring url, NetFile *file)
+{
+    if(file->pieces.covers(file->size))
+    {
+        if(verifyPieces(url, file))
+            return true;
+
+        if(downloadCancelled)
+            return false;
+    }
+    else
+    {
+        if(file->hashAlgorithm == HASH_NONE)
+            return true;
+
+        string hash = Hash::file(file->name, file->hashAlgorithm);
+
+        if(hash.compare(file->hash) == 0)
+            return true;
+
+        TRACE(_T("Hash of %s doesn't match (%s, expected %s)"), file->name.c_str(), fromutf8(hash).c_str(), fromutf8(file->hash).c_str());
+    }
+
+    _tremove(file->name.c_str());
+    ResumeJournal(file->name).remove();
+
+    file->downloaded      = false;
+    file->bytesDownloaded = 0;
+    file->mirrorUsed      = _T("");
+    lastFailure.clear();
+    lastFailure.code      = ERROR_CRC;
+    storeError(formatwinerror(ERROR_CRC), ERROR_CRC);
+    return false;
+}
+
+// Checks pieces, which were not verified during download. Corrupted pieces are downloaded again
+// with range requests: from mirrors first, source of corrupted data is tried last.
+bool Downloader::verifyPieces(tstring url, NetFile *file)
+{
+    ResumeJournal  journal(file->name);
+    size_t         count = file->pieces.hashes.size();
+    vector<size_t> corrupted;
+
+    journal.load(file->size);
+    journal.setPieces(count);
+
+    for(size_t i = 0; i < count; i++)
+    {
+        if(journal.pieceVerified(i))
+            continue;
+
+        if(pieceValid(file, i))
+            journal.setVerified(i);
+        else
+            corrupted.push_back(i);
+    }
+
+    if(!corrupted.empty())
+    {
+        TRACE(_T("%d of %d pieces of %s are corrupted"), (int)corrupted.size(), (int)count, file->name.c_str());
+
+        if(resumeJournal)
+            journal.save();
+
+        pair<multimap<tstring, tstring>::iterator, multimap<tstring, tstring>::iterator> fileMirrors = mirrors.equal_range(url);
+        list<tstring> sources;
+
+        for(multimap<tstring, tstring>::iterator i = fileMirrors.first; i != fileMirrors.second; ++i)
+            sources.push_back(i->second);
+
+        sources.push_back(url);
+
+        if(find(sources.begin(), sources.end(), file->stats.source) != sources.end())
+        {
+            sources.remove(file->stats.source);
+            sources.push_back(file->stats.source);
+        }
+
+        for(vector<size_t>::iterator i = corrupted.begin(); i != corrupted.end(); i++)
+        {
+            bool repaired = false;
+
+            for(list<tstring>::iterator source = sources.begin(); !repaired && (source != sources.end()); ++source)
+            {
+                if(downloadCancelled)
+                    return false;
+
+                repaired = fetchPiece(*source, file, file->pieces.range(*i, file->size)) && pieceValid(file, *i);
+            }
+
+            if(!repaired)
+            {
+                TRACE(_T("Piece %d of %s can't be repaired"), (int)*i, file->name.c_str());
+                return false;
+            }
+
+            journal.setVerified(*i);
+
+            if(resumeJournal)
+                journal.save();
+        }
+    }
+
+    journal.remove();
+    return true;
+}
+
+bool Downloader::pieceValid(NetFile *file, size_t piece)
+{
+    ByteRange range = file->pieces.range(piece, file->size);
+    return Hash::file(file->name, file->pieces.algorithm, range.start, range.end - range.start).compare(file->pieces.hashes[piece]) == 0;
+}
+
+// Downloads range of file from source into same place of local file
+bool Downloader::fetchPiece(tstring source, NetFile *file, ByteRange range)
+{
+    NetFile   piece(source, file->name, file->size);
+    File      out;
+    DWORDLONG remaining = range.end - range.start;
+
+    TRACE(_T("Fetching bytes %I64u-%I64u of %s from %s"), range.start, range.end, file->name.c_str(), source.c_str());
+
+    piece.url.internetOptions = internetOptions;
+    piece.url.traceId         = file->url.traceId;
+    piece.url.rangeEnd        = range.end;
+    piece.bytesDownloaded     = range.start;
+
+    HostSlots slot(piece.url.hostName);
+
+    if(!slot.acquire(&downloadCancelled))
+        return false;
+
+    try
+    {
+        if(!piece.open(internet))
+            return false;
+    }
+    catch(exception &)
+    {
+        piece.updateStats();
+        file->stats.add(piece.stats);
+        return false;
+    }
+
+    // Server, which ignored range, would send whole file
+    if((piece.bytesDownloaded == range.start) && out.openAt(file->name, range.start))
+    {
+        PoolBuffer buffer(readBufferSize, &downloadCancelled);
+        DWORD      bytesRead;
+
+        while(buffer.data && remaining && !downloadCancelled)
+        {
+            if(!piece.read(buffer.data, (DWORD)min((DWORDLONG)buffer.size, remaining), &bytesRead) || !bytesRead)
+                break;
+
+            if(out.write(buffer.data, bytesRead) != bytesRead)
+                break;
+
+            remaining -= bytesRead;
+        }
+
+        out.close();
+    }
+
+    piece.close();
+    piece.updateStats();
+    file->stats.add(piece.stats);
+    return !remaining;
+}
+
+// Reads piece hashes from <url>.pieces, if server has it (PieceSidecar option)
+void Downloader::fetchPieceSidecar(tstring url, NetFile *file)
+{
+    NetFile sidecar(url + PIECES_SIDECAR_EXT, file->name + PIECES_SIDECAR_EXT);
+    string  text;
+
+    sidecar.url.internetOptions = internetOptions;
+
+    try
+    {
+        if(!sidecar.open(internet))
+            return;
+    }
+    catch(exception &)
+    {
+        TRACE(_T("No piece hashes for %s"), url.c_str());
+        return;
+    }
+
+    char  buffer[4096];
+    DWORD bytesRead;
+
+    while(sidecar.read(buffer, sizeof(buffer), &bytesRead) && bytesRead && (text.length() < PIECES_SIDECAR_MAX_SIZE))
+        text.append(buffer, bytesRead);
+
+    sidecar.close();
+
+    PieceHashes pieces;
+
+    if(pieces.parse(text) && pieces.covers(file->size))
+        file->pieces = pieces;
+    else
+        TRACE(_T("Invalid piece hashes for %s"), url.c_str());
+}
+
+// Downloads only selected members of zip archive. Tail of archive & central directory are read
+// with range requests, then local records of selected members, close records with one request.
+// Reduced archive is made of these records and new central directory. If server ignores ranges,
+// whole archive is downloaded next to file and reduced locally (see downloadZipArchive).
+bool Downloader::downloadZipMembers(NetFile *netFile)
+{
+    ZipMembers  *zip     = &netFile->zip;
+    ZipDirectory dir;
+    string       tail;
+    string       central;
+    bool         ignored = false;
+
+    lastFailure.clear();
+    updateFileName(netFile);
+    updateStatus(msg("Connecting..."));
+    netFile->bytesDownloaded = 0;
+
+    // Whole archive is downloaded with its own connection
+    HostSlots slot(netFile->url.hostName);
+
+    if(!slot.acquire(&downloadCancelled))
+        return true;
+
+    if(zip->archiveSize == FILE_SIZE_UNKNOWN)
+    {
+        try
+        {
+            zip->archiveSize = (netFile->size == FILE_SIZE_UNKNOWN) ? netFile->url.getSize(internet) : netFile->size;
+        }
+        catch(exception &)
+        {
+            // Error is reported by download of whole archive
+        }
+    }
+
+    if((zip->archiveSize == FILE_SIZE_UNKNOWN) || !zip->archiveSize)
+    {
+        slot.release();
+        return downloadZipArchive(netFile);
+    }
+
+    ByteRange tailRange = { zip->archiveSize - min(zip->archiveSize, (DWORDLONG)ZIP_TAIL_SIZE), zip->archiveSize };
+
+    if(!fetchRange(netFile, tailRange, &tail, NULL, &ignored))
+    {
+        slot.release();
+        return ignored ? downloadZipArchive(netFile) : false;
+    }
+
+    if(!dir.readEnd(tail, zip->archiveSize))
+        return zipError(netFile, msg("Invalid zip archive"));
+
+    if(dir.centralOffset >= tailRange.start)
+        central = tail.substr((size_t)(dir.centralOffset - tailRange.start), (size_t)dir.centralSize);
+    else
+    {
+        ByteRange centralRange = { dir.centralOffset, dir.centralOffset + dir.centralSize };
+
+        if(!fetchRange(netFile, centralRange, &central, NULL, &ignored))
+            return false;
+    }
+
+    if(!dir.readCentral(central))
+        return zipError(netFile, msg("Invalid zip archive"));
+
+    vector<size_t> selected;
+
+    for(size_t i = 0; i < dir.entries.size(); i++)
+        if(zip->selected(dir.entries[i]))
+            selected.push_back(i);
+
+    vector<ByteRange> ranges  = dir.ranges(selected, ZIP_COALESCE_GAP);
+    DWORDLONG         planned = netFile->bytesDownloaded;
+
+    for(vector<ByteRange>::iterator r = ranges.begin(); r != ranges.end(); r++)
+        planned += r->end - r->start;
+
+    TRACE(_T("Zip: %d of %d members of %s, %d requests, %I64u of %I64u bytes"), (int)selected.size(), (int)dir.entries.size(),
+          netFile->url.urlString.c_str(), (int)ranges.size(), planned, zip->archiveSize);
+
+    // Progress shows bytes, which are really downloaded
+    if(!(filesSize == FILE_SIZE_UNKNOWN) && !(netFile->size == FILE_SIZE_UNKNOWN))
+        filesSize = filesSize - netFile->size + planned;
+
+    netFile->size = planned;
+
+    ZipWriter writer(&dir, selected);
+
+    if(!writer.open(netFile->name))
+        return zipError(netFile, msg("Cannot create file"));
+
+    updateStatus(msg("Downloading..."));
+    setMarquee(false, false);
+
+    for(vector<ByteRange>::iterator r = ranges.begin(); r != ranges.end(); r++)
+        if(!fetchRange(netFile, *r, NULL, &writer, &ignored))
+            return false;
+
+    return finishZip(netFile, &writer);
+}
+
+// Downloads whole archive, then writes selected members from it
+bool Downloader::downloadZipArchive(NetFile *netFile)
+{
+    NetFile archive(netFile->url.urlString, netFile->name + ZIP_ARCHIVE_TEMP_EXT, netFile->zip.archiveSize);
+
+    TRACE(_T("Zip: downloading whole archive %s"), netFile->url.urlString.c_str());
+
+    archive.url.internetOptions = internetOptions;
+    archive.url.traceId         = netFile->url.traceId;
+
+    bool res = downloadFile(&archive);
+
+    netFile->stats.add(archive.stats);
+    netFile->bytesDownloaded = archive.bytesDownloaded;
+
+    if(!res || !archive.downloaded)
+        return false;
+
+    ZipArchive local;
+
+    if(!local.open(archive.name))
+    {
+        local.close();
+        _tremove(archive.name.c_str());
+        return zipError(netFile, msg("Invalid zip archive"));
+    }
+
+    vector<size_t> selected;
+
+    for(size_t i = 0; i < local.dir.entries.size(); i++)
+        if(netFile->zip.selected(local.dir.entries[i]))
+            selected.push_back(i);
+
+    vector<ByteRange> ranges = local.dir.ranges(selected, 0);
+    ZipWriter         writer(&local.dir, selected);
+    PoolBuffer        buffer(readBufferSize, &downloadCancelled);
+    bool              copied = buffer.data && writer.open(netFile->name);
+
+    for(vector<ByteRange>::iterator r = ranges.begin(); copied && (r != ranges.end()); r++)
+    {
+        for(DWORDLONG offset = r->start; copied && (offset < r->end); offset += buffer.size)
+        {
+            DWORD n = (DWORD)min((DWORDLONG)buffer.size, r->end - offset);
+            copied = local.read(offset, buffer.data, n) && writer.write(offset, buffer.data, n);
+        }
+    }
+
+    local.close();
+    _tremove(archive.name.c_str());
+
+    if(!buffer.data)
+        return true;
+
+    if(!copied)
+        return zipError(netFile, msg("Cannot create file"));
+
+    return finishZip(netFile, &writer);
+}
+
+// Writes central directory of reduced archive and extracts it, if needed
+bool Downloader::finishZip(NetFile *netFile, ZipWriter *writer)
+{
+    bool res = writer->finish();
+
+    writer->close();
+
+    if(!res)
+        return zipError(netFile, msg("Cannot create file"));
+
+    updateProgress(netFile);
+
+    if(!netFile->zip.extractDir.empty())
+    {
+        ZipArchive archive;
+
+        updateStatus(msg("Extracting..."));
+        _tmkdir(netFile->zip.extractDir.c_str());
+
+        res = archive.open(netFile->name);
+
+        for(size_t i = 0; res && (i < archive.dir.entries.size()); i++)
+            res = archive.extract(i, netFile->zip.extractDir);
+
+        archive.close();
+
+        if(!res)
+            return zipError(netFile, msg("Cannot extract"));
+
+        _tremove(netFile->name.c_str());
+    }
+
+    updateStatus(msg("Download complete"));
+    netFile->downloaded = true;
+    traceEvent(TE_DONE, netFile->url.traceId, netFile->bytesDownloaded);
+    return true;
+}
+
+// Reads range of file into memory (data) or passes it to writer of reduced zip archive.
+// ignored is set, if server sends whole file instead of range.
+bool Downloader::fetchRange(NetFile *file, ByteRange range, string *data, ZipWriter *writer, bool *ignored)
+{
+    NetFile   part(file->url.urlString, file->name, file->size);
+    DWORDLONG offset = range.start;
+
+    part.url.internetOptions = internetOptions;
+    part.url.traceId         = file->url.traceId;
+    part.url.rangeEnd        = range.end;
+    part.bytesDownloaded     = range.start;
+
+    try
+    {
+        part.open(internet);
+    }
+    catch(exception &e)
+    {
+        HTTPError *httpError = dynamic_cast<HTTPError *>(&e);
+
+        if(httpError)
+        {
+            lastFailure.httpStatus = atoi(e.what());
+            lastFailure.retryAfter = httpError->retryAfter;
+        }
+        else
+            lastFailure.fatal = true;
+
+        updateStatus(msg(e.what()));
+        storeError(msg(e.what()));
+        part.updateStats();
+        file->stats.add(part.stats);
+        return false;
+    }
+
+    if(!part.handle)
+    {
+        updateStatus(msg("Cannot connect"));
+        storeError();
+        lastFailure.code = errorCode;
+        return false;
+    }
+
+    if(part.bytesDownloaded != range.start)
+    {
+        TRACE(_T("Server ignored range of %s"), file->url.urlString.c_str());
+        part.close();
+        *ignored = true;
+        return false;
+    }
+
+    PoolBuffer pool(readBufferSize, &downloadCancelled);
+    BYTE      *buffer = pool.data;
+    DWORD      bytesRead;
+    bool       res    = true;
+    Timer      progressTimer(100);
+
+    while(buffer && (offset < range.end) && !downloadCancelled)
+    {
+        if(!part.read(buffer, (DWORD)min((DWORDLONG)pool.size, range.end - offset), &bytesRead) || !bytesRead)
+        {
+            if(!bytesRead)
+                SetLastError(ERROR_INTERNET_CONNECTION_RESET);
+
+            updateStatus(msg("Download failed"));
+            storeError();
+            lastFailure.code = errorCode;
+            res = false;
+            break;
+        }
+
+        if(data)
+            data->append((const char *)buffer, bytesRead);
+        else if(!writer->write(offset, buffer, bytesRead))
+        {
+            res = zipError(file, msg("Cannot create file"));
+            break;
+        }
+
+        offset                += bytesRead;
+        file->bytesDownloaded += bytesRead;
+
+        if(progressTimer.elapsed())
+            updateProgress(file);
+
+        processMessages();
+    }
+
+    part.close();
+    part.updateStats();
+    file->stats.add(part.stats);
+    return res && (offset == range.end);
+}
+
+bool Downloader::zipError(NetFile *netFile, tstring error)
+{
+    tstring errstr = error + _T(" ") + netFile->name;
+
+    TRACE(_T("Zip: %s"), errstr.c_str());
+    updateStatus(errstr);
+    storeError(errstr, ERROR_BAD_FORMAT);
+    lastFailure.code  = ERROR_BAD_FORMAT;
+    lastFailure.fatal = true;
+    return false;
+}
+
+// Returns false, if download was cancelled while waiting
+bool Downloader::waitRetry(DWORD msec)
+{
+    DWORD startTime = GetTickCount();
+    DWORD elapsed;
+
+    while((elapsed = GetTickCount() - startTime) < msec)
+    {
+        if(downloadCancelled)
+            return false;
+
+        Sleep(min(msec - elapsed, (DWORD)50));
+        processMessages();
+    }
+
+    return !downloadCancelled;
+}
+
+bool Downloader::checkMirrors(tstring url, bool download/* or get size */)
+{
+    TRACE(_T("Checking mirrors for %s (%s)..."), url.c_str(), download ? _T("download") : _T("get size"));
+    pair<multimap<tstring, tstring>::iterator, multimap<tstring, tstring>::iterator> fileMirrors = mirrors.equal_range(url);
+    list<tstring> candidates;
+    list<tstring> stalled;
+
+    // Mirrors are tried in order they were added (Metalink priority), ones on hosts,
+    // which stalled during this session, are tried last
+    for(multimap<tstring, tstring>::iterator i = fileMirrors.first; i != fileMirrors.second; ++i)
+    {
+        if(stalledHosts.count(Url(i->second).hostName))
+            stalled.push_back(i->second);
+        else
+            candidates.push_back(i->second);
+    }
+
+    candidates.splice(candidates.end(), stalled);
+
+    int n = 0;
+
+    for(list<tstring>::iterator i = candidates.begin(); i != candidates.end(); ++i)
+    {
+        tstring mirror = *i;
+        TRACE(_T("Checking mirror %s:"), mirror.c_str());
+        NetFile f(mirror, files[url]->name, files[url]->size);
+
+        // Mirror transfer is traced as part of file transfer
+        f.url.traceId = files[url]->url.traceId;
+        f.pieces      = files[url]->pieces;
+        f.zip         = files[url]->zip;
+
+        if(download)
+        {
+            // Continue partially downloaded file at its current offset
+            f.bytesDownloaded = files[url]->bytesDownloaded;
+            traceEvent(TE_MIRROR, f.url.traceId, ++n);
+
+            bool res = downloadFile(&f);
+
+            files[url]->stats.add(f.stats);
+
+            if(res)
+            {
+                files[url]->downloaded = f.downloaded;
+                files[url]->bytesDownloaded = f.bytesDownloaded;
+                return true;
+            }
+
+            files[url]->bytesDownloaded = f.bytesDownloaded;
+        }
+        else // get size
+        {
+            try
+            {
+                DWORDLONG size = f.url.getSize(internet);
+
+                if(size != FILE_SIZE_UNKNOWN)
+                {
+                    files[url]->size = size;
+                    files[url]->mirrorUsed = mirror;
+                    return true;
+                }
+            }
+            catch(HTTPError &e)
+            {
+                updateStatus(msg(e.what()));
+            }
+        }
+
+        processMessages();
+    }
+
+    return false;
+}
+
+// Flushes file first, so journal never covers data, which is not on disk yet
+static void updateJournal(ResumeJournal *journal, File *file, DWORDLONG bytesDownloaded)
+{
+    if(file->flush())
+    {
+        journal->setCompleted(0, bytesDownloaded);
+        journal->save();
+    }
+}
+
+// Verified pieces are marked in journal, corrupted ones are downloaded again after transfer
+static void takeVerifiedPieces(PieceVerifier *verifier, ResumeJournal *journal)
+{
+    for(vector<size_t>::iterator i = verifier->verified.begin(); i != verifier->verified.end(); i++)
+        journal->setVerified(*i);
+
+    for(vector<size_t>::iterator i = verifier->failed.begin(); i != verifier->failed.end(); i++)
+        TRACE(_T("Piece %d is corrupted"), (int)*i);
+
+    verifier->verified.clear();
+    verifier->failed.clear();
+}
+
+bool Downloader::downloadFile(NetFile *netFile)
+{
+    if(netFile->zip.enabled)
+        return downloadZipMembers(netFile);
+
+    // Waits, while all connections to host, allowed by HostConnections option, are busy
+    HostSlots slot(netFile->url.hostName);
+
+    if(!slot.acquire(&downloadCancelled))
+        return true;
+
+    // ...and while number of streams, allowed by adaptive concurrency controller, is reached
+    StreamSlots stream;
+
+    if(!stream.acquire(&downloadCancelled))
+        return true;
+
+    bool          ftp        = netFile->url.parts.schemeId == URL_SCHEME_FTP;
+    bool          journaling = resumeJournal && !(netFile->size == FILE_SIZE_UNKNOWN);
+    bool          piecewise  = netFile->pieces.covers(netFile->size);
+    ResumeJournal journal(netFile->name);
+
+    lastFailure.clear();
+
+    // Journal, left by killed or cancelled installer, tells which data is already on disk
+    if(journaling)
+        journal.load(netFile->size);
+
+    if(piecewise)
+        journal.setPieces(netFile->pieces.hashes.size());
+
+    if(ftp && (ftpSegments > 1) && (!netFile->bytesDownloaded || !journal.empty()) && !(netFile->size == FILE_SIZE_UNKNOWN) && (netFile->size >= ftpSegmentMinSize))
+        return downloadFileSegmented(netFile, journaling ? &journal : NULL);
+
+    if(!netFile->bytesDownloaded && journal.contiguousBytes())
+    {
+        TRACE(_T("Continuing %s at %I64u from resume journal"), netFile->name.c_str(), journal.contiguousBytes());
+        netFile->bytesDownloaded = journal.contiguousBytes();
+    }
+
+    // Validator of other mirror means nothing to this server
+    netFile->url.ifRange = (journal.url.compare(netFile->url.urlString) == 0) ? journal.validator : _T("");
+
+    // Buffer is shrunk or waited for, while other transfers use whole BufferMemory budget
+    PoolBuffer pool(readBufferSize, &downloadCancelled);
+    BYTE      *buffer = pool.data;
+
+    if(!buffer)
+        return true;
+
+    DWORD     bytesRead;
+    DWORDLONG localSize;
+    DWORDLONG resumeOffset = 0;
+    DWORDLONG startOffset;
+    File      file;
+    PieceVerifier verifier(netFile->pieces, piecewise ? netFile->size : 0);
+
+    // Partially downloaded file can be continued only if it is still on disk
+    if(netFile->bytesDownloaded && !(File::exists(netFile->name, &localSize) && (localSize >= netFile->bytesDownloaded)))
+        netFile->bytesDownloaded = 0;
+
+    updateFileName(netFile);
+    updateStatus(msg("Connecting..."));
+    setMarquee(true, false);
+
+    netFile->url.hedger   = hedging ? &hedger : NULL;
+    netFile->url.hedgeUrl = hedgeMirror(netFile->url.urlString);
+
+    DWORD openStart = GetTickCount();
+
+    try
+    {
+        netFile->open(internet);
+        netFile->updateStats();
+    }
+    catch(exception &e)
+    {
+        HTTPError *httpError = dynamic_cast<HTTPError *>(&e);
+
+        netFile->updateStats();
+
+        if(httpError)
+        {
+            lastFailure.httpStatus = atoi(e.what());
+            lastFailure.retryAfter = httpError->retryAfter;
+
+            if((lastFailure.httpStatus == 429) || (lastFailure.httpStatus == 503))
+                concurrency.addLoss(_T("server busy"));
+        }
+        else
+            lastFailure.fatal = true;
+
+        setMarquee(false, stopOnError ? (netFile->size == FILE_SIZE_UNKNOWN) : false);
+        updateStatus(msg(e.what()));
+        storeError(msg(e.what()));
+        return false;
+    }
+
+    if(!netFile->handle)
+    {
+        concurrency.addLoss(_T("connect failure"));
+        setMarquee(false, stopOnError ? (netFile->size == FILE_SIZE_UNKNOWN) : false);
+        updateStatus(msg("Cannot connect"));
+        storeError();
+        lastFailure.code = errorCode;
+        return false;
+    }
+
+    if(!(netFile->bytesDownloaded ? file.openAt(netFile->name, netFile->bytesDownloaded) : file.open(netFile->name)))
+    {
+        setMarquee(false, stopOnError ? (netFile->size == FILE_SIZE_UNKNOWN) : false);
+        tstring errstr = msg("Cannot create file") + _T(" ") + netFile->name;
+        updateStatus(errstr);
+        storeError(errstr);
+        lastFailure.fatal = true;
+        return false;
+    }
+
+    concurrency.addRtt(GetTickCount() - openStart);
+
+    if(!netFile->bytesDownloaded)
+        journal.reset(netFile->size);
+
+    if(piecewise)
+    {
+        journal.setPieces(netFile->pieces.hashes.size());
+        verifier.start(netFile->name, netFile->bytesDownloaded);
+    }
+
+    journal.url       = netFile->url.urlString;
+    journal.validator = netFile->url.validator;
+
+    Timer progressTimer(100);
+    Timer speedTimer(1000);
+    Timer transferTimer(0);
+    Timer journalTimer(RESUME_JOURNAL_INTERVAL);
+    StallDetector stall(stallTimeout, stallSpeed, stallRatio, StallDetector::median(transferSpeeds));
+
+    startOffset = netFile->bytesDownloaded;
+
+    DWORDLONG counted = startOffset; // Bytes, reported to concurrency controller
+
+    // Blocked read is abandoned after StallTimeout, unless user set ReceiveTimeout (e.g. longer one for slow server)
+    bool stallReads = stallTimeout && (internetOptions.receiveTimeout == TIMEOUT_DEFAULT);
+
+    if(stallReads)
+        netFile->setReadTimeout(stallTimeout);
+
+    updateStatus(msg("Downloading..."));
+
+    if(!(netFile->size == FILE_SIZE_UNKNOWN))
+        setMarquee(false, false);
+
+    processMessages();
+
+    while(true)
+    {
+        if(downloadCancelled)
+        {
+            if(journaling)
+                updateJournal(&journal, &file, netFile->bytesDownloaded);
+
+            file.close();
+            netFile->close();
+            return true;
+        }
+
+        bool res     = netFile->read(buffer, pool.size, &bytesRead);
+        bool stalled = false;
+
+        // Data connection closed before whole file was received
+        if(res && !bytesRead && ftp && !(netFile->size == FILE_SIZE_UNKNOWN) && (netFile->bytesDownloaded < netFile->size))
+            res = false;
+
+        stall.update(netFile->bytesDownloaded);
+
+        if(res && bytesRead)
+        {
+            if(netFile->bytesDownloaded - bytesRead == startOffset)
+                traceEvent(TE_FIRST_BYTE, netFile->url.traceId, startOffset);
+
+            traceEvent(TE_READ, netFile->url.traceId, bytesRead);
+            LONGLONG writeStart = traceTime();
+            DWORD    written    = file.write(buffer, bytesRead);
+            traceEvent(TE_WRITE, netFile->url.traceId, traceNs(traceTime() - writeStart));
+
+            // Journal covers only data, which was written
+            if(written != bytesRead)
+            {
+                netFile->bytesDownloaded -= bytesRead - written;
+                writeError(netFile);
+
+                if(journaling)
+                    updateJournal(&journal, &file, netFile->bytesDownloaded);
+
+                file.close();
+                netFile->close();
+                return false;
+            }
+
+            if(piecewise)
+            {
+                verifier.update(buffer, bytesRead);
+                takeVerifiedPieces(&verifier, &journal);
+            }
+        }
+
+        // Stalled transfer is abandoned, so it can be continued at current offset from other mirror
+        if((res && bytesRead && stall.stalled()) || (!res && stallTimeout && (GetLastError() == ERROR_INTERNET_TIMEOUT)))
+        {
+            TRACE(_T("Transfer of %s stalled at %I64u (less than %u B/s)"), netFile->url.urlString.c_str(), netFile->bytesDownloaded, stall.threshold());
+            traceEvent(TE_STALL, netFile->url.traceId, netFile->bytesDownloaded);
+            stalledHosts.insert(netFile->url.hostName);
+            SetLastError(ERROR_INTERNET_TIMEOUT);
+            stalled = true;
+            res     = false;
+        }
+
+        if(!res && ftp && !(stalled && mirrors.count(netFile->url.urlString)) && (netFile->bytesDownloaded > resumeOffset))
+        {
+            // Reconnect and continue with REST, while transfer makes progress
+            TRACE(_T("Transfer of %s interrupted at %I64u, reconnecting"), netFile->url.urlString.c_str(), netFile->bytesDownloaded);
+            resumeOffset = netFile->bytesDownloaded;
+            netFile->close();
+
+            if(netFile->open(internet) && (netFile->bytesDownloaded == resumeOffset))
+            {
+                stall = StallDetector(stallTimeout, stallSpeed, stallRatio, StallDetector::median(transferSpeeds));
+
+                if(stallReads)
+                    netFile->setReadTimeout(stallTimeout);
+
+                continue;
+            }
+
+            SetLastError(ERROR_INTERNET_CONNECTION_RESET);
+        }
+
+        if(!res)
+        {
+            setMarquee(false, netFile->size == FILE_SIZE_UNKNOWN);
+            updateStatus(msg("Download failed"));
+            storeError();
+            lastFailure.code    = errorCode;
+            lastFailure.stalled = stalled;
+            concurrency.addLoss(stalled ? _T("stall") : (errorCode == ERROR_INTERNET_TIMEOUT) ? _T("timeout") : _T("connection reset"));
+
+            if(journaling)
+                updateJournal(&journal, &file, netFile->bytesDownloaded);
+
+            file.close();
+            netFile->close();
+            return false;
+        }
+
+        if(bytesRead == 0)
+            break;
+
+        if(progressTimer.elapsed())
+        {
+            updateProgress(netFile);
+            concurrency.addBytes(netFile->bytesDownloaded - counted);
+            counted = netFile->bytesDownloaded;
+        }
+
+        if(speedTimer.elapsed())
+            updateSpeed(netFile, &speedTimer);
+
+        if(sizeTimeTimer.elapsed())
+            updateSizeTime(netFile, &sizeTimeTimer);
+
+        if(journaling && journalTimer.elapsed())
+            updateJournal(&journal, &file, netFile->bytesDownloaded);
+
+        processMessages();
+    }
+
+    updateProgress(netFile);
+    updateSpeed(netFile, &speedTimer);
+    updateSizeTime(netFile, &sizeTimeTimer);
+    updateStatus(msg("Download complete"));
+    processMessages();
+
+    // Journal of file with piece hashes is kept, until all pieces are verified (see verifyPieces)
+    if(piecewise && journaling)
+        updateJournal(&journal, &file, netFile->bytesDownloaded);
+
+    // Buffered data is written here, so it can fail too; last saved journal stays valid
+    if(!file.close())
+    {
+        writeError(netFile);
+        netFile->close();
+        return false;
+    }
+
+    if(!(piecewise && journaling))
+        journal.remove();
+
+    netFile->close();
     netFile->downloaded = true;
+    concurrency.addBytes(netFile->bytesDownloaded - counted);
+    traceEvent(TE_DONE, netFile->url.traceId, netFile->bytesDownloaded);
+    addTransferSpeed(netFile->bytesDownloaded - startOffset, transferTimer.totalElapsed());
+
+    return true;
+}
+
+// Disk is full or file is locked: transfer fails and is not retried
+bool Downloader::writeError(NetFile *netFile)
+{
+    DWORD   error  = GetLastError() ? GetLastError() : ERROR_DISK_FULL;
+    tstring errstr = formatwinerror(error) + _T(" ") + netFile->name;
+
+    TRACE(_T("Cannot write %s at %I64u: %s"), netFile->name.c_str(), netFile->bytesDownloaded, formatwinerror(error).c_str());
+    setMarquee(false, netFile->size == FILE_SIZE_UNKNOWN);
+    updateStatus(errstr);
+    storeError(errstr, error);
+    lastFailure.clear();
+    lastFailure.code  = error;
+    lastFailure.fatal = true;
+    return false;
+}
+
+// First mirror of url on host, which did not stall, empty if there is none
+tstring Downloader::hedgeMirror(tstring url)
+{
+    pair<multimap<tstring, tstring>::iterator, multimap<tstring, tstring>::iterator> fileMirrors = mirrors.equal_range(url);
+
+    for(multimap<tstring, tstring>::iterator i = fileMirrors.first; i != fileMirrors.second; ++i)
+        if(!stalledHosts.count(Url(i->second).hostName))
+            return i->second;
+
+    return _T("");
+}
+
+// Small transfers are dominated by connection setup, so they are not used as speed reference
+void Downloader::addTransferSpeed(DWORDLONG bytes, DWORD time)
+{
+    if((bytes >= 65536) && time)
+        transferSpeeds.push_back((DWORD)min(bytes * 1000 / time, (DWORDLONG)0xFFFFFFFF));
+}
+
+// Segment data, flushed from mapped views, is marked after it reached disk
+static void updateJournal(ResumeJournal *journal, MappedFile *file, FtpSegmentedTransfer *transfer)
+{
+    vector<FtpSegment> segments = transfer->state();
+
+    if(file->sync())
+    {
+        for(vector<FtpSegment>::iterator i = segments.begin(); i != segments.end(); i++)
+            journal->setCompleted(i->start, i->flushed);
+
+        journal->save();
+    }
+}
+
+bool Downloader::downloadFileSegmented(NetFile *netFile, ResumeJournal *journal)
+{
+    MappedFile        file;
+    vector<ByteRange> ranges;
+    DWORDLONG         completed = 0;
+
+    if(journal)
+    {
+        ranges = journal->missingRanges();
+
+        for(vector<ByteRange>::iterator i = ranges.begin(); i != ranges.end(); i++)
+            completed += i->end - i->start;
+
+        completed = netFile->size - completed;
+        journal->url = netFile->url.urlString;
+    }
+    else
+    {
+        ByteRange range;
+        range.start = 0;
+        range.end   = netFile->size;
+        ranges.push_back(range);
+    }
+
+    if(completed)
+        TRACE(_T("Continuing %s from resume journal, %I64u bytes left in %d ranges"), netFile->name.c_str(), netFile->size - completed, (int)ranges.size());
+
+    updateFileName(netFile);
+    updateStatus(msg("Connecting..."));
+
+    // Segments write to their parts of preallocated file through memory-mapped views
+    if(!file.open(netFile->name, netFile->size))
+    {
+        tstring errstr = msg("Cannot create file") + _T(" ") + netFile->name;
+        updateStatus(errstr);
+        storeError(errstr);
+        lastFailure.fatal = true;
+        return false;
+    }
+
+    // First connection & stream are held by downloadFile, extra segments get only free connections
+    // and streams, which concurrency controller allows now
+    HostSlots   extra(netFile->url.hostName);
+    StreamSlots streams;
+
+    if(streams.tryAcquire(ftpSegments - 1) < ftpSegments - 1)
+        TRACE(_T("Concurrency controller allows only %d segment(s)"), streams.count + 1);
+
+    if(extra.tryAcquire(streams.count) < streams.count)
+        TRACE(_T("Host %s allows only %d segment(s)"), netFile->url.hostName, extra.count + 1);
+
+    FtpSegmentedTransfer transfer(internet, internetOptions, netFile->url.urlString, &file, ranges,
+                                  extra.count + 1, readBufferSize, &downloadCancelled, netFile->url.traceId);
+
+    if(!ranges.empty() && !transfer.start())
+    {
+        updateStatus(msg("Download failed"));
+        storeError();
+        lastFailure.code = errorCode;
+        return false;
+    }
+
+    Timer progressTimer(100);
+    Timer speedTimer(1000);
+    Timer transferTimer(0);
+    Timer journalTimer(RESUME_JOURNAL_INTERVAL);
+
+    updateStatus(msg("Downloading..."));
+    setMarquee(false, false);
+    processMessages();
+
+    DWORDLONG counted = 0; // Bytes, reported to concurrency controller
+
+    while(!transfer.wait(100))
+    {
+        netFile->bytesDownloaded = completed + transfer.bytesDownloaded();
+        concurrency.addBytes(transfer.bytesDownloaded() - counted);
+        counted = transfer.bytesDownloaded();
+
+        if(journal && journalTimer.elapsed())
+            updateJournal(journal, &file, &transfer);
+
+        if(progressTimer.elapsed())
+            updateProgress(netFile);
+
+        if(speedTimer.elapsed())
+            updateSpeed(netFile, &speedTimer);
+
+        if(sizeTimeTimer.elapsed())
+            updateSizeTime(netFile, &sizeTimeTimer);
+
+        processMessages();
+    }
+
+    netFile->stats.source        = netFile->url.urlString;
+    netFile->stats.transferTime += transferTimer.totalElapsed();
+    netFile->stats.bytes        += transfer.bytesDownloaded();
+
+    concurrency.addBytes(transfer.bytesDownloaded() - counted);
+
+    if(!transfer.completed())
+    {
+        // Only contiguous beginning of file can be continued by single connection, other
+        // completed parts are kept in journal for next segmented transfer
+        if(journal)
+        {
+            updateJournal(journal, &file, &transfer);
+            netFile->bytesDownloaded = journal->contiguousBytes();
+        }
+        else
+            netFile->bytesDownloaded = transfer.contiguousBytes();
+
+        if(downloadCancelled)
+            return true;
+
+        DWORD error = transfer.error();
+        concurrency.addLoss(_T("segment failure"));
+        updateStatus(msg("Download failed"));
+        storeError(formatwinerror(error), error);
+        lastFailure.code = error;
+        return false;
+    }
+
+    netFile->bytesDownloaded = netFile->size;
+
+    updateProgress(netFile);
+    updateSpeed(netFile, &speedTimer);
+    updateSizeTime(netFile, &sizeTimeTimer);
+    updateStatus(msg("Download complete"));
+    processMessages();
 
-    delete[] buffer;
+    // Pieces are verified after segmented transfer, journal is kept until then
+    if(journal && netFile->pieces.covers(netFile->size))
+        updateJournal(journal, &file, &transfer);
+    else if(journal)
+        journal->remove();
+
+    netFile->downloaded = true;
+    traceEvent(TE_DONE, netFile->url.traceId, netFile->bytesDownloaded);
     return true;
 }
 
 void Downloader::updateProgress(NetFile *file)
 {
     if(ui)
+    {
+        traceEvent(TE_UI_UPDATE, file->url.traceId, file->bytesDownloaded);
         ui->setProgressInfo(filesSize, downloadedFilesSize + file->bytesDownloaded, file->size, file->bytesDownloaded);
+    }
 }
 
 void Downloader::updateFileName(NetFile *file)
@@ -702,116 +2141,161 @@ tstring Downloader::getLastErrorStr()
     return errorStr;
 }
 
+// Writes event trace with list of files, so ids of events can be matched with URLs
+bool Downloader::dumpTrace(tstring filename)
+{
+    tstring header;
+
+    if(errorCode || !errorStr.empty())
+    {
+        tstring err = errorStr;
+        err.erase(err.find_last_not_of(_T(" \r\n")) + 1);
+        header = _T("# Error: ") + itotstr(errorCode) + _T(" ") + err + _T("\n");
+    }
+
+    for(map<tstring, NetFile *>::iterator i = files.begin(); i != files.end(); i++)
+    {
+        NetFile *file = i->second;
+        header += _T("# ") + itotstr(file->url.traceId) + _T("\t") + i->first + _T("\t") + file->name + (file->downloaded ? _T("\tdownloaded\n") : _T("\n"));
+    }
+
+    return traceDump(filename, header);
+}
+
+void Downloader::dumpTrace()
+{
+    if(traceFile.empty())
+        return;
+
+    TRACE(_T("Writing event trace to %s"), traceFile.c_str());
+    dumpTrace(traceFile);
+}
+
 void Downloader::addFtpDir(tstring url, tstring mask, tstring destdir, bool recursive, tstring comp)
 {
-    ftpDirs.push_back(new FtpDir(url, mask, destdir, recursive, comp));
+    ftpDirs.push_back(new FtpDir(url, mask, destdir, recursive, componentRegistry.mask(comp, _T(' '))));
 }
 
-bool Downloader::scanFtpDir(FtpDir *ftpDir, tstring destsubdir)
+bool Downloader::scanFtpDir(FtpDir *ftpDir)
 {
-    Url url(ftpDir->url);
-    url.internetOptions = internetOptions;
-    
-    updateFileName(url.components.lpszUrlPath);
-    
-    if(!url.connect(internet))
+    HostSlots slots(Url(ftpDir->url).hostName);
+
+    if(!slots.acquire(&downloadCancelled))
+        return false;
+
+    slots.tryAcquire(ftpScanConnections - 1);
+
+    FtpScanner scanner(internet, internetOptions, ftpDir, slots.count, &downloadCancelled);
+
+    if(!scanner.start())
     {
         storeError();
         return false;
     }
-    
-    if(!FtpSetCurrentDirectory(url.connection, url.components.lpszUrlPath))
+
+    while(!scanner.wait(100))
     {
-        storeError();
-        return false;
+        updateFileName(scanner.currentDir());
+        processMessages();
     }
-    
-    list<tstring> dirs;
-    WIN32_FIND_DATA fd;
 
-    TRACE(_T("Scanning FTP dir %s:"), ftpDir->url.c_str());
-    HINTERNET handle = FtpFindFirstFile(url.connection, ftpDir->mask.c_str(), &fd, NULL, NULL);
+    FtpDirListing *root = scanner.root();
 
-    if(handle)
+    if(!root->listed)
     {
-        TRACE(_T("    (%s) %s"), (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) ? _T("D") : _T("F"), fd.cFileName);
-        updateFileName(tstring(fd.cFileName));
+        storeError(formatwinerror(root->error), root->error);
+        return false;
+    }
 
-        if(fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
-        {
-            tstring dirname(fd.cFileName);
+    if(downloadCancelled)
+        return false;
 
-            if(!(dirname.compare(_T(".")) == 0) && !(dirname.compare(_T("..")) == 0))
-                dirs.push_back(dirname);
-        }
-        else
+    // Files with the same size & modification time as in previous scan, which are already
+    // on disk, are not downloaded again. Snapshot is saved, when download finishes.
+    FtpSnapshot *snapshot = new FtpSnapshot(ftpDir->url, ftpDir->destdir);
+
+    if(ftpSnapshots)
+        snapshot->load();
+
+    // Merge results in breadth-first, name sorted order, so it does not depend on thread timing
+    list<FtpDirListing *> dirs;
+    dirs.push_back(root);
+
+    while(!dirs.empty())
+    {
+        FtpDirListing *dir = dirs.front();
+        dirs.pop_front();
+
+        if(!dir->listed)
         {
-            tstring fileUrl  = addslash(ftpDir->url);
-            tstring fileName = addbackslash(ftpDir->destdir);
-            fileUrl  += tstring(fd.cFileName);
-            fileName += addbackslash(destsubdir);
-            fileName += tstring(fd.cFileName);
-            
-            addFile(fileUrl, fileName, ((DWORDLONG)fd.nFileSizeHigh << 32) | fd.nFileSizeLow, ftpDir->compstr);
+            TRACE(_T("Cannot list FTP dir %s: %s"), dir->url.c_str(), formatwinerror(dir->error).c_str());
+            continue;
         }
 
-        while(InternetFindNextFile(handle, &fd))
+        tstring subdir = preserveFtpDirs ? addbackslash(dir->subdir) : _T("");
+
+        for(vector<FtpDirEntry>::iterator i = dir->entries.begin(); i != dir->entries.end(); i++)
         {
-            TRACE(_T("    (%s) %s"), (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) ? _T("D") : _T("F"), fd.cFileName);
-            updateFileName(tstring(fd.cFileName));
+            if(i->directory)
+                continue;
 
-            if(fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
-            {
-                tstring dirname(fd.cFileName);
+            tstring   fileUrl  = addslash(dir->url) + i->name;
+            tstring   fileName = addbackslash(ftpDir->destdir) + subdir + i->name;
+            DWORDLONG localSize;
 
-                if(!(dirname.compare(_T(".")) == 0) && !(dirname.compare(_T("..")) == 0))
-                    dirs.push_back(dirname);
-            }
-            else
+            addFile(fileUrl, fileName, i->size, ftpDir->components);
+            snapshot->add(fileUrl, i->size, i->modified);
+
+            NetFile *file = files[fileUrl];
+
+            if(!file->downloaded && snapshot->unchanged(fileUrl, i->size, i->modified) && File::exists(fileName, &localSize) && (localSize == i->size))
             {
-                tstring fileUrl  = addslash(ftpDir->url);
-                tstring fileName = addbackslash(ftpDir->destdir);
-                fileUrl  += tstring(fd.cFileName);
-                fileName += addbackslash(destsubdir);
-                fileName += tstring(fd.cFileName);
-                
-                addFile(fileUrl, fileName, ((DWORDLONG)fd.nFileSizeHigh << 32) | fd.nFileSizeLow, ftpDir->compstr);
+                TRACE(_T("File %s not changed since last scan, skipping"), fileUrl.c_str());
+                file->downloaded      = true;
+                file->bytesDownloaded = i->size;
+                downloadedFilesSize  += i->size;
             }
         }
-    }
-
-    url.disconnect();
 
-    if(ftpDir->recursive && !dirs.empty())
-    {
-        for(list<tstring>::iterator i = dirs.begin(); i != dirs.end(); i++)
+        for(vector<FtpDirListing *>::iterator i = dir->subdirs.begin(); i != dir->subdirs.end(); i++)
         {
-            tstring dir = *i;
-
-            tstring urlstr = addslash(ftpDir->url);
-            urlstr += dir;
-            FtpDir fdir(urlstr, ftpDir->mask, ftpDir->destdir, ftpDir->recursive, ftpDir->compstr);
-            
             if(preserveFtpDirs)
             {
-                tstring destdir(addbackslash(ftpDir->destdir));
-                destdir += addbackslash(destsubdir);
-                destdir += dir;
+                tstring destdir = addbackslash(ftpDir->destdir) + (*i)->subdir;
                 TRACE(_T("Creating directory %s"), destdir.c_str());
                 _tmkdir(destdir.c_str());
-
-                tstring subdir = addbackslash(destsubdir);
-                subdir += dir;
-                scanFtpDir(&fdir, subdir);
             }
-            else
-                scanFtpDir(&fdir);
+
+            dirs.push_back(*i);
         }
     }
 
+    if(ftpSnapshots)
+        ftpSnapshotList.push_back(snapshot);
+    else
+        delete snapshot;
+
     return true;
 }
 
+// Files, which were downloaded & verified, are recorded in snapshots of their FTP dirs
+void Downloader::saveFtpSnapshots()
+{
+    for(list<FtpSnapshot *>::iterator i = ftpSnapshotList.begin(); i != ftpSnapshotList.end(); i++)
+    {
+        FtpSnapshot *snapshot = *i;
+
+        for(map<tstring, NetFile *>::iterator j = files.begin(); j != files.end(); j++)
+            if(j->second->downloaded)
+                snapshot->commit(j->first);
+
+        if(!snapshot->save())
+        {
+            TRACE(_T("Cannot save FTP snapshot %s"), snapshot->fileName.c_str());
+        }
+    }
+}
+
 void Downloader::processFtpDirs()
 {
     if(ftpDirsProcessed())
@@ -11,9 +11,27 @@
 #include "ui.h"
 #include "internetoptions.h"
 #include "ftpdir.h"
+#include "ftpscanner.h"
+#include "ftpsnapshot.h"
+#include "ftptransfer.h"
+#include "stalldetector.h"
+#include "hedger.h"
+#include "retrypolicy.h"
+#include "componentmask.h"
+#include "perfreport.h"
+#include "resumejournal.h"
+#include "metalink.h"
+#include "extractor.h"
+#include "hostscheduler.h"
+#include "concurrency.h"
+#include "bufferpool.h"
+#include "asyncengine.h"
 
 #define DOWNLOAD_CANCEL_TIMEOUT 30000
 #define DEFAULT_READ_BUFSIZE    1024
+#define PIECES_SIDECAR_EXT      _T(".pieces")
+#define PIECES_SIDECAR_MAX_SIZE 16777216
+#define ZIP_ARCHIVE_TEMP_EXT    _T(".idparchive") // Whole archive, downloaded if server doesn't support ranges
 
 using namespace std;
 
@@ -28,15 +46,18 @@ public:
     ~Downloader();
 
     void      addFile(tstring url, tstring filename, DWORDLONG size = FILE_SIZE_UNKNOWN, tstring comp = _T(""));
+    void      addFile(tstring url, tstring filename, DWORDLONG size, ComponentMask comp);
     void      addFtpDir(tstring url, tstring mask, tstring destdir, bool recursive, tstring comp = _T(""));
     void      addMirror(tstring url, tstring mirror);
+    bool      addMetalink(tstring source, tstring destdir, tstring comp = _T(""));
+    void      addZipMembers(tstring url, tstring filename, tstring include, tstring exclude, tstring extractDir, tstring comp = _T(""));
     void      setMirrorList(Downloader *d);
     void      clearFiles();
     void      clearMirrors();
     void      clearFtpDirs();
     bool      downloadFiles(bool useComponents = true);
     void      startDownload();
-    void      stopDownload();
+    void      stopDownload(DWORD timeout = DOWNLOAD_CANCEL_TIMEOUT);
     void      pauseDownload();
     void      resumeDownload();
     DWORDLONG getFileSizes(bool useComponents = true);
@@ -48,23 +69,58 @@ public:
     DWORD     getLastError();
     tstring   getLastErrorStr();
     void      setComponents(tstring comp);
+    void      startPrefetch(tstring comp);
+    void      stopPrefetch();
     void      setUi(Ui *newUi);
     void      setInternetOptions(InternetOptions opt);
     void      setOptions(Downloader *d);
     void      setFinishedCallback(FinishedCallback callback);
     void      processMessages();
+    bool      dumpTrace(tstring filename);
 
     bool stopOnError;
     bool ownMsgLoop;
     bool preserveFtpDirs;
+    bool ftpSnapshots;
+    bool resumeJournal;
+    bool pieceSidecar;
     bool downloadCancelled;
     bool downloadPaused;
     int  readBufferSize;
+    int  ftpScanConnections;
+    int  ftpSegments;
+    int  asyncTransfers;          // Plain files are downloaded this many at once by AsyncEngine, 0 - one by one
+    int  asyncThreads;
+    DWORDLONG ftpSegmentMinSize;
+    DWORD     stallTimeout;
+    DWORD     stallSpeed;
+    int       stallRatio;
+    bool      hedging;
+    Hedger    hedger;
+    RetryPolicy retryPolicy;
+    tstring   traceFile;      // Event trace is written here on download error, empty - not written
+    tstring   perfReportFile; // JSON report is written here after download, empty - not written
+    tstring   location;       // ISO 3166-1 country code of user, Metalink mirrors in this country are preferred
+    Extractor *extractor;     // Archives are passed to it as soon as they are downloaded (see idpExtract), NULL - none
 
 protected:
     bool openInternet();
     bool closeInternet();
     bool downloadFile(NetFile *netFile);
+    bool downloadFileSegmented(NetFile *netFile, ResumeJournal *journal);
+    bool downloadFileRetrying(tstring url, NetFile *file);
+    bool downloadFileOrMirror(tstring url, NetFile *file);
+    bool verifyFile(tstring url, NetFile *file);
+    bool verifyPieces(tstring url, NetFile *file);
+    bool pieceValid(NetFile *file, size_t piece);
+    bool fetchPiece(tstring source, NetFile *file, ByteRange range);
+    void fetchPieceSidecar(tstring url, NetFile *file);
+    bool downloadZipMembers(NetFile *netFile);
+    bool downloadZipArchive(NetFile *netFile);
+    bool finishZip(NetFile *netFile, ZipWriter *writer);
+    bool fetchRange(NetFile *file, ByteRange range, string *data, ZipWriter *writer, bool *ignored);
+    bool zipError(NetFile *netFile, tstring error);
+    bool waitRetry(DWORD msec);
     bool checkMirrors(tstring url, bool download/* or get size */);
     void updateProgress(NetFile *file);
     void updateFileName(NetFile *file);
@@ -75,18 +131,34 @@ protected:
     void setMarquee(bool marquee, bool total = true);
     void storeError();
     void storeError(tstring msg, DWORD errcode = 0);
-    bool scanFtpDir(FtpDir *ftpDir, tstring destsubdir = _T(""));
+    bool scanFtpDir(FtpDir *ftpDir);
     void processFtpDirs();
     tstring msg(string key);
+    void    addTransferSpeed(DWORDLONG bytes, DWORD time);
+    tstring hedgeMirror(tstring url);
+    bool    writeError(NetFile *netFile);
+    void    takePrefetched();
+    void    dumpTrace();
+    bool    finishDownload(bool res, bool useComponents);
+    void    saveFtpSnapshots();
+    bool    asyncEligible(NetFile *file);
+    void    getFileSizesAsync(bool useComponents);
+    void    downloadFilesAsync(bool useComponents);
     
     map<tstring, NetFile *>    files;
     multimap<tstring, tstring> mirrors;
-    set<tstring>               components;
+    ComponentRegistry          componentRegistry;
+    ComponentMask              components;
     list<FtpDir *>             ftpDirs;
+    list<FtpSnapshot *>        ftpSnapshotList; // Of scanned FTP dirs, saved when download finishes
+    vector<DWORD>              transferSpeeds; // Of transfers, completed in this session, for stall detection
+    set<tstring>               stalledHosts;
+    TransferError              lastFailure;
     DWORDLONG                  filesSize;
     DWORDLONG                  downloadedFilesSize;
     HINTERNET                  internet;
     Timer                      sizeTimeTimer;
+    Timer                      downloadTimer;
     DWORD                      errorCode;
     tstring                    errorStr;
     Ui                        *ui;
@@ -94,7 +166,8 @@ protected:
     HANDLE                     downloadThread;
     FinishedCallback           finishedCallback;
     MSG                        windowsMsg;
+    Downloader                *prefetcher; // Background download of files, selected before download page
 
-    friend void downloadThreadProc(void *param);
+    friend unsigned __stdcall downloadThreadProc(void *param);
     friend class Ui;
 };
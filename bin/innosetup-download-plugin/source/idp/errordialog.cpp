@@ -36,7 +36,7 @@ void ErrorDialog::setFileList(map<tstring, NetFile *> fileList)
     files = fileList;
 }
 
-void ErrorDialog::setComponents(set<tstring> componentList)
+void ErrorDialog::setComponents(ComponentMask componentList)
 {
     components = componentList;
 }
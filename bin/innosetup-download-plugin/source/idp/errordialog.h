@@ -24,7 +24,7 @@ public:
     void setFont(HFONT newFont);
     void setErrorMsg(tstring msg);
     void setFileList(map<tstring, NetFile *> fileList);
-    void setComponents(set<tstring> componentList);
+    void setComponents(ComponentMask componentList);
     int  exec();
 
 protected:
@@ -33,7 +33,7 @@ protected:
     void fillFileList();
 
     map<tstring, NetFile *> files;
-    set<tstring>            components;
+    ComponentMask           components;
     HWND                    handle;
     HWND                    listBox;
     Ui                     *ui;
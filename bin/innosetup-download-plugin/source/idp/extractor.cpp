@@ -0,0 +1,423 @@
+#include <process.h>
+#include <algorithm>
+#include <direct.h>
+#include "extractor.h"
+#include "file.h"
+#include "trace.h"
+
+ExtractJob::ExtractJob(tstring archiveName, tstring dir)
+{
+    archive   = archiveName;
+    destdir   = dir;
+    started   = false;
+    finished  = false;
+    tasksLeft = 0;
+    size      = 0;
+    done      = 0;
+    error     = 0;
+}
+
+Extractor::Extractor()
+{
+    maxThreads     = DEFAULT_EXTRACT_THREADS;
+    cancelled      = false;
+    runningThreads = 0;
+    doneEvent      = CreateEvent(NULL, FALSE, FALSE, NULL);
+
+    InitializeCriticalSection(&lock);
+}
+
+Extractor::~Extractor()
+{
+    // Worker threads can still run, when setup was cancelled. They can't be waited for
+    // while DLL is unloaded, so they are only cancelled and end together with process.
+    cancel();
+
+    EnterCriticalSection(&lock);
+    bool running = runningThreads > 0;
+    LeaveCriticalSection(&lock);
+
+    if(running)
+        return;
+
+    for(vector<HANDLE>::iterator i = threads.begin(); i != threads.end(); i++)
+        CloseHandle(*i);
+
+    for(vector<ExtractJob *>::iterator i = jobs.begin(); i != jobs.end(); i++)
+        delete *i;
+
+    CloseHandle(doneEvent);
+    DeleteCriticalSection(&lock);
+}
+
+unsigned __stdcall extractThreadProc(void *param)
+{
+    ((Extractor *)param)->worker();
+    return 0;
+}
+
+void Extractor::add(tstring archive, tstring destdir)
+{
+    TRACE(_T("Adding archive %s, destination: %s"), archive.c_str(), destdir.c_str());
+
+    EnterCriticalSection(&lock);
+    jobs.push_back(new ExtractJob(archive, destdir));
+    LeaveCriticalSection(&lock);
+}
+
+void Extractor::clear()
+{
+    wait(INFINITE);
+
+    vector<HANDLE> finished;
+
+    EnterCriticalSection(&lock);
+    finished.swap(threads);
+    LeaveCriticalSection(&lock);
+
+    for(vector<HANDLE>::iterator i = finished.begin(); i != finished.end(); i++)
+    {
+        WaitForSingleObject(*i, INFINITE);
+        CloseHandle(*i);
+    }
+
+    EnterCriticalSection(&lock);
+
+    for(vector<ExtractJob *>::iterator i = jobs.begin(); i != jobs.end(); i++)
+        delete *i;
+
+    jobs.clear();
+    cancelled = false;
+    LeaveCriticalSection(&lock);
+}
+
+void Extractor::fileReady(tstring filename)
+{
+    EnterCriticalSection(&lock);
+
+    for(vector<ExtractJob *>::iterator i = jobs.begin(); i != jobs.end(); i++)
+        if(!(*i)->started && (tstrlower((*i)->archive.c_str()).compare(tstrlower(filename.c_str())) == 0))
+            start(*i);
+
+    LeaveCriticalSection(&lock);
+    spawn();
+}
+
+void Extractor::startAll()
+{
+    EnterCriticalSection(&lock);
+
+    for(vector<ExtractJob *>::iterator i = jobs.begin(); i != jobs.end(); i++)
+        if(!(*i)->started)
+            start(*i);
+
+    LeaveCriticalSection(&lock);
+    spawn();
+}
+
+// Called with lock held
+void Extractor::start(ExtractJob *job)
+{
+    TRACE(_T("Starting extraction of %s"), job->archive.c_str());
+
+    ExtractTask task = { job, EXTRACT_DIRECTORY, EXTRACT_DIRECTORY };
+
+    File::exists(job->archive, &job->size);
+    job->started   = true;
+    job->tasksLeft = 1;
+    queue.push_back(task);
+}
+
+int Extractor::threadLimit()
+{
+    int n = maxThreads;
+
+    if(n <= 0)
+    {
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        n = (int)info.dwNumberOfProcessors;
+    }
+
+    return min(max(n, 1), MAX_EXTRACT_THREADS);
+}
+
+// Starts worker threads, while there are more queued tasks than running threads
+void Extractor::spawn()
+{
+    int limit = threadLimit();
+
+    EnterCriticalSection(&lock);
+
+    while((runningThreads < limit) && (runningThreads < (int)queue.size()))
+    {
+        HANDLE thread = (HANDLE)_beginthreadex(NULL, 0, &extractThreadProc, (void *)this, 0, NULL);
+
+        if(!thread)
+            break;
+
+        threads.push_back(thread);
+        runningThreads++;
+    }
+
+    LeaveCriticalSection(&lock);
+}
+
+bool Extractor::wait(DWORD msec)
+{
+    DWORD start = GetTickCount();
+
+    for(;;)
+    {
+        bool pending = false;
+
+        EnterCriticalSection(&lock);
+
+        for(vector<ExtractJob *>::iterator i = jobs.begin(); i != jobs.end(); i++)
+            if((*i)->started && !(*i)->finished)
+                pending = true;
+
+        LeaveCriticalSection(&lock);
+
+        if(!pending)
+            return true;
+
+        DWORD elapsed = GetTickCount() - start;
+
+        if((msec != INFINITE) && (elapsed >= msec))
+            return false;
+
+        WaitForSingleObject(doneEvent, (msec == INFINITE) ? 100 : min(msec - elapsed, (DWORD)100));
+    }
+}
+
+void Extractor::cancel()
+{
+    cancelled = true;
+}
+
+bool Extractor::succeeded()
+{
+    bool res = true;
+
+    EnterCriticalSection(&lock);
+
+    for(vector<ExtractJob *>::iterator i = jobs.begin(); i != jobs.end(); i++)
+        if(!(*i)->finished || (*i)->error)
+            res = false;
+
+    LeaveCriticalSection(&lock);
+    return res;
+}
+
+void Extractor::progress(DWORDLONG *total, DWORDLONG *done, tstring *currentArchive)
+{
+    *total = 0;
+    *done  = 0;
+
+    EnterCriticalSection(&lock);
+
+    for(vector<ExtractJob *>::iterator i = jobs.begin(); i != jobs.end(); i++)
+    {
+        *total += (*i)->size;
+        *done  += (*i)->done;
+    }
+
+    *currentArchive = current;
+    LeaveCriticalSection(&lock);
+}
+
+DWORD Extractor::getLastError()
+{
+    DWORD res = 0;
+
+    EnterCriticalSection(&lock);
+
+    for(vector<ExtractJob *>::iterator i = jobs.begin(); i != jobs.end() && !res; i++)
+        res = (*i)->error;
+
+    LeaveCriticalSection(&lock);
+    return res;
+}
+
+tstring Extractor::getLastErrorStr()
+{
+    tstring res;
+
+    EnterCriticalSection(&lock);
+
+    for(vector<ExtractJob *>::iterator i = jobs.begin(); i != jobs.end() && res.empty(); i++)
+        if((*i)->error)
+            res = (*i)->errorStr;
+
+    LeaveCriticalSection(&lock);
+    return res;
+}
+
+void Extractor::worker()
+{
+    ZipArchive  archive;
+    tstring     opened;
+    ExtractTask task;
+
+    while(nextTask(&task))
+    {
+        if(task.first == EXTRACT_DIRECTORY)
+        {
+            readDirectory(task.job);
+            continue;
+        }
+
+        if(opened.compare(task.job->archive) != 0)
+        {
+            opened.clear();
+
+            if(!archive.open(task.job->archive, false))
+            {
+                archive.close();
+                taskDone(task.job, 0, ERROR_OPEN_FAILED, _T("Cannot open ") + task.job->archive);
+                continue;
+            }
+
+            opened = task.job->archive;
+        }
+
+        extractMembers(&archive, &task);
+    }
+
+    archive.close();
+}
+
+bool Extractor::nextTask(ExtractTask *task)
+{
+    bool res = false;
+
+    EnterCriticalSection(&lock);
+
+    if(!queue.empty())
+    {
+        *task = queue.front();
+        queue.pop_front();
+        current = task->job->archive;
+        res     = true;
+    }
+    else
+        runningThreads--;
+
+    LeaveCriticalSection(&lock);
+    return res;
+}
+
+// Creates directory with all its parents
+static void createDirs(tstring path)
+{
+    for(size_t i = 1; i <= path.length(); i++)
+        if((i == path.length()) || (path[i] == _T('/')) || (path[i] == _T('\\')))
+            if((i > 2) || (path[1] != _T(':')))
+                _tmkdir(path.substr(0, i).c_str());
+}
+
+// Reads central directory & splits members into batches for worker threads
+void Extractor::readDirectory(ExtractJob *job)
+{
+    ZipArchive archive;
+
+    if(cancelled)
+    {
+        taskDone(job, 0, ERROR_CANCELLED, _T("Extraction cancelled"));
+        return;
+    }
+
+    if(!archive.open(job->archive))
+    {
+        DWORD error = File::exists(job->archive) ? ERROR_BAD_FORMAT : ERROR_FILE_NOT_FOUND;
+        taskDone(job, 0, error, (error == ERROR_BAD_FORMAT ? _T("Invalid zip archive ") : _T("File not found ")) + job->archive);
+        return;
+    }
+
+    archive.close();
+    createDirs(job->destdir);
+
+    vector<ExtractTask> tasks;
+    ExtractTask         task  = { job, 0, 0 };
+    DWORDLONG           batch = 0;
+
+    job->directory = archive.dir;
+
+    for(size_t i = 0; i < job->directory.entries.size(); i++)
+    {
+        batch += job->directory.entries[i].compressedSize;
+        task.last = i + 1;
+
+        if((batch >= EXTRACT_BATCH_SIZE) || (task.last - task.first >= EXTRACT_BATCH_MEMBERS))
+        {
+            tasks.push_back(task);
+            task.first = task.last;
+            batch      = 0;
+        }
+    }
+
+    if(task.last > task.first)
+        tasks.push_back(task);
+
+    TRACE(_T("Extracting %d members of %s in %d batch(es)"), (int)job->directory.entries.size(), job->archive.c_str(), (int)tasks.size());
+
+    EnterCriticalSection(&lock);
+    job->tasksLeft += tasks.size();
+    queue.insert(queue.end(), tasks.begin(), tasks.end());
+    LeaveCriticalSection(&lock);
+
+    spawn();
+    taskDone(job, 0, 0, _T(""));
+}
+
+void Extractor::extractMembers(ZipArchive *archive, ExtractTask *task)
+{
+    ExtractJob *job   = task->job;
+    DWORDLONG   bytes = 0;
+
+    for(size_t i = task->first; i < task->last; i++)
+    {
+        const ZipEntry &e = job->directory.entries[i];
+
+        if(cancelled)
+        {
+            taskDone(job, bytes, ERROR_CANCELLED, _T("Extraction cancelled"));
+            return;
+        }
+
+        if(!archive->extract(e, job->destdir))
+        {
+            taskDone(job, bytes, ERROR_BAD_FORMAT, _T("Cannot extract ") + e.name + _T(" from ") + job->archive);
+            return;
+        }
+
+        bytes += e.compressedSize;
+    }
+
+    taskDone(job, bytes, 0, _T(""));
+}
+
+void Extractor::taskDone(ExtractJob *job, DWORDLONG bytes, DWORD error, tstring errorStr)
+{
+    EnterCriticalSection(&lock);
+
+    job->done += bytes;
+
+    if(error && !job->error)
+    {
+        TRACE(_T("Extraction error: %s"), errorStr.c_str());
+        job->error    = error;
+        job->errorStr = errorStr;
+    }
+
+    if(!--job->tasksLeft)
+    {
+        TRACE(_T("Extraction of %s %s"), job->archive.c_str(), job->error ? _T("failed") : _T("finished"));
+        job->done     = job->size;
+        job->finished = true;
+        SetEvent(doneEvent);
+    }
+
+    LeaveCriticalSection(&lock);
+}
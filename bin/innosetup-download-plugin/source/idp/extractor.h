@@ -0,0 +1,86 @@
+#pragma once
+
+#include <windows.h>
+#include <vector>
+#include <deque>
+#include "tstring.h"
+#include "zip.h"
+
+#define DEFAULT_EXTRACT_THREADS 0       // One thread per processor
+#define MAX_EXTRACT_THREADS     16
+#define EXTRACT_BATCH_SIZE      4194304 // Compressed bytes of members, which one thread takes at once
+#define EXTRACT_BATCH_MEMBERS   256
+
+using namespace std;
+
+// Archive, added with idpExtract
+struct ExtractJob
+{
+    ExtractJob(tstring archiveName, tstring dir);
+
+    tstring      archive;
+    tstring      destdir;
+    ZipDirectory directory;   // Read by first worker, shared by others
+    bool         started;     // Queued for extraction
+    bool         finished;
+    size_t       tasksLeft;   // Batches of members, not extracted yet
+    DWORDLONG    size;        // Of archive file, used for progress
+    DWORDLONG    done;
+    DWORD        error;       // First error, 0 - none
+    tstring      errorStr;
+};
+
+// Part of job, which is done by one worker thread: reading of directory (first == last == EXTRACT_DIRECTORY)
+// or extraction of members [first, last)
+struct ExtractTask
+{
+    ExtractJob *job;
+    size_t      first;
+    size_t      last;
+};
+
+#define EXTRACT_DIRECTORY ((size_t)-1)
+
+// Extracts zip archives on bounded pool of worker threads. Archive is started as soon as it is
+// ready (downloaded, see Downloader::extractor), its members are split into batches, so several
+// threads work on one big archive too. Each worker reads archive through its own file handle.
+class Extractor
+{
+public:
+    Extractor();
+    ~Extractor();
+
+    void    add(tstring archive, tstring destdir);
+    void    clear();         // Waits for started jobs, then removes all
+    void    fileReady(tstring filename); // Starts job of this archive, if there is one
+    void    startAll();
+    bool    wait(DWORD msec); // true, if all started jobs are finished
+    void    cancel();
+    bool    succeeded();
+    void    progress(DWORDLONG *total, DWORDLONG *done, tstring *current);
+    DWORD   getLastError();
+    tstring getLastErrorStr();
+
+    int  maxThreads; // 0 - one per processor
+    bool cancelled;
+
+protected:
+    void start(ExtractJob *job);
+    void spawn();
+    void worker();
+    bool nextTask(ExtractTask *task);
+    void readDirectory(ExtractJob *job);
+    void extractMembers(ZipArchive *archive, ExtractTask *task);
+    void taskDone(ExtractJob *job, DWORDLONG bytes, DWORD error, tstring errorStr);
+    int  threadLimit();
+
+    vector<ExtractJob *> jobs;
+    deque<ExtractTask>   queue;
+    vector<HANDLE>       threads;
+    int                  runningThreads;
+    tstring              current;   // Archive, which was last taken by worker
+    CRITICAL_SECTION     lock;
+    HANDLE               doneEvent; // Set, when job is finished
+
+    friend unsigned __stdcall extractThreadProc(void *param);
+};
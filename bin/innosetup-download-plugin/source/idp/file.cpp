@@ -1,3 +1,5 @@
+#include <sys/stat.h>
+#include <io.h>
 #include "file.h"
 
 File::File()
@@ -16,12 +18,165 @@ bool File::open(tstring filename)
     return (handle = _tfopen(filename.c_str(), _T("wb"))) != NULL;
 }
 
+// Opens existing file for writing, without truncation, and sets position to offset
+bool File::openAt(tstring filename, DWORDLONG offset)
+{
+    if((handle = _tfopen(filename.c_str(), _T("r+b"))) == NULL)
+        return false;
+
+    return _fseeki64(handle, (__int64)offset, SEEK_SET) == 0;
+}
+
 bool File::close()
 {
-    return handle ? (fclose(handle) == 0) : true;
+    if(!handle)
+        return true;
+
+    bool res = fclose(handle) == 0;
+    handle = NULL;
+    return res;
+}
+
+bool File::flush()
+{
+    return (fflush(handle) == 0) && (_commit(_fileno(handle)) == 0);
 }
 
 DWORD File::write(BYTE *buffer, DWORD size)
 {
     return (DWORD)fwrite(buffer, 1, size, handle);
-}
\ No newline at end of file
+}
+
+bool File::exists(tstring filename, DWORDLONG *size)
+{
+    struct _stati64 st;
+
+    if(_tstati64(filename.c_str(), &st) != 0)
+        return false;
+
+    if(size)
+        *size = (DWORDLONG)st.st_size;
+
+    return true;
+}
+
+MappedFile::MappedFile()
+{
+    size    = 0;
+    file    = INVALID_HANDLE_VALUE;
+    mapping = NULL;
+}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+bool MappedFile::open(tstring filename, DWORDLONG filesize)
+{
+    close();
+
+    file = CreateFile(filename.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+
+    if(file == INVALID_HANDLE_VALUE)
+        return false;
+
+    // Allocate whole file at once, so segments don't fragment it and can't run out of disk space
+    LARGE_INTEGER end;
+    end.QuadPart = (LONGLONG)filesize;
+
+    if(!SetFilePointerEx(file, end, NULL, FILE_BEGIN) || !SetEndOfFile(file))
+    {
+        DWORD error = GetLastError();
+        close();
+        SetLastError(error);
+        return false;
+    }
+
+    mapping = CreateFileMapping(file, NULL, PAGE_READWRITE, (DWORD)(filesize >> 32), (DWORD)filesize, NULL);
+
+    if(!mapping)
+    {
+        DWORD error = GetLastError();
+        close();
+        SetLastError(error);
+        return false;
+    }
+
+    size = filesize;
+    return true;
+}
+
+void MappedFile::close()
+{
+    if(mapping)
+        CloseHandle(mapping);
+
+    if(file != INVALID_HANDLE_VALUE)
+        CloseHandle(file);
+
+    mapping = NULL;
+    file    = INVALID_HANDLE_VALUE;
+    size    = 0;
+}
+
+bool MappedFile::sync()
+{
+    return FlushFileBuffers(file) ? true : false;
+}
+
+MappedView::MappedView(MappedFile *mappedFile)
+{
+    file      = mappedFile;
+    view      = NULL;
+    viewStart = 0;
+    viewSize  = 0;
+}
+
+MappedView::~MappedView()
+{
+    unmap();
+}
+
+BYTE *MappedView::map(DWORDLONG offset, DWORD *available)
+{
+    if(offset >= file->size)
+    {
+        SetLastError(ERROR_HANDLE_EOF);
+        return NULL;
+    }
+
+    if(!view || (offset < viewStart) || (offset >= viewStart + viewSize))
+    {
+        unmap();
+
+        viewStart = offset & ~(DWORDLONG)(MAPPED_VIEW_GRANULARITY - 1);
+        DWORDLONG left = file->size - viewStart;
+        viewSize  = (left < MAPPED_VIEW_SIZE) ? (DWORD)left : MAPPED_VIEW_SIZE;
+        view      = (BYTE *)MapViewOfFile(file->mapping, FILE_MAP_WRITE, (DWORD)(viewStart >> 32), (DWORD)viewStart, viewSize);
+
+        if(!view)
+            return NULL;
+    }
+
+    *available = viewSize - (DWORD)(offset - viewStart);
+    return view + (offset - viewStart);
+}
+
+bool MappedView::flush()
+{
+    if(!view)
+        return true;
+
+    return FlushViewOfFile(view, viewSize) ? true : false;
+}
+
+void MappedView::unmap()
+{
+    if(!view)
+        return;
+
+    // Unmapped pages are written by system later, data is safe unless system crashes
+    UnmapViewOfFile(view);
+    view = NULL;
+}
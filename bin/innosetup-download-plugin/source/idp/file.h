@@ -4,6 +4,15 @@
 #include <stdio.h>
 #include "tstring.h"
 
+#define MAPPED_VIEW_SIZE        16777216 // 16 MB
+#define MAPPED_VIEW_GRANULARITY 65536    // View offsets must be multiple of allocation granularity
+
+struct ByteRange
+{
+    DWORDLONG start;
+    DWORDLONG end; // First byte after range
+};
+
 class File
 {
 public:
@@ -11,9 +20,53 @@ public:
     ~File();
 
     bool  open(tstring filename);
+    bool  openAt(tstring filename, DWORDLONG offset);
     bool  close();
+    bool  flush(); // Writes buffered data & waits until it is on disk
     DWORD write(BYTE *buffer, DWORD size);
 
+    static bool exists(tstring filename, DWORDLONG *size = NULL);
+
 protected:
     FILE *handle;
 };
+
+// Destination file, preallocated to its final size, which several writers fill at
+// different offsets through memory-mapped views (see MappedView). Network data is
+// read directly into mapped memory, without intermediate buffer.
+class MappedFile
+{
+public:
+    MappedFile();
+    ~MappedFile();
+
+    bool open(tstring filename, DWORDLONG filesize); // Creates file or opens existing without truncation
+    void close();
+    bool sync(); // Waits until data of flushed views is on disk
+
+    DWORDLONG size;
+
+protected:
+    HANDLE file;
+    HANDLE mapping;
+
+    friend class MappedView;
+};
+
+// Sliding window into MappedFile, used by one writer thread
+class MappedView
+{
+public:
+    MappedView(MappedFile *mappedFile);
+    ~MappedView();
+
+    BYTE *map(DWORDLONG offset, DWORD *available); // Returns memory of file at offset, available - bytes till end of view
+    bool  flush();                                 // Starts writing of modified pages of view to disk
+    void  unmap();
+
+protected:
+    MappedFile *file;
+    BYTE       *view;
+    DWORDLONG   viewStart;
+    DWORD       viewSize;
+};
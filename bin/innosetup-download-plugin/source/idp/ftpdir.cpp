@@ -1,33 +1,16 @@
 #include "ftpdir.h"
 
-FtpDir::FtpDir(tstring u, tstring m, tstring d, bool r, tstring comp)
+FtpDir::FtpDir(tstring u, tstring m, tstring d, bool r, ComponentMask comp)
 {
-    url       = u;
-    mask      = m;
-    destdir   = d;
-    recursive = r;
-    compstr   = comp;
-    processed = false;
-
-    tstringtoset(components, comp, _T(' '));
+    url        = u;
+    mask       = m;
+    destdir    = d;
+    recursive  = r;
+    components = comp;
+    processed  = false;
 }
 
-bool FtpDir::selected(set<tstring> comp)
+bool FtpDir::selected(const ComponentMask &comp)
 {
-    if(components.empty())
-        return true;
-
-    for(set<tstring>::iterator i = components.begin(); i != components.end(); i++)
-    {
-        tstring comp1 = *i;
-        for(set<tstring>::iterator j = comp.begin(); j != comp.end(); j++)
-        {
-            tstring comp2 = *j;
-
-            if(comp1 == comp2)
-                return true;
-        }
-    }
-
-    return false;
+    return components.empty() || components.intersects(comp);
 }
@@ -1,18 +1,18 @@
 #pragma once
 #include <set>
 #include "tstring.h"
+#include "componentmask.h"
 
 class FtpDir
 {
 public:
-    FtpDir(tstring u, tstring m, tstring d, bool r, tstring comp = _T(""));
-    bool selected(set<tstring> comp);
+    FtpDir(tstring u, tstring m, tstring d, bool r, ComponentMask comp = ComponentMask());
+    bool selected(const ComponentMask &comp);
 
-    tstring      url;
-    tstring      mask;
-    tstring      destdir;
-    bool         recursive;
-    set<tstring> components;
-    tstring      compstr;
-    bool         processed;
+    tstring       url;
+    tstring       mask;
+    tstring       destdir;
+    bool          recursive;
+    ComponentMask components;
+    bool          processed;
 };
\ No newline at end of file
@@ -0,0 +1,208 @@
+#include <process.h>
+#include <algorithm>
+#include "ftpscanner.h"
+#include "url.h"
+#include "trace.h"
+
+FtpDirListing::FtpDirListing(tstring dirUrl, tstring dirPath, tstring localSubdir)
+{
+    url    = dirUrl;
+    path   = dirPath;
+    subdir = localSubdir;
+    listed = false;
+    error  = 0;
+}
+
+FtpDirListing::~FtpDirListing()
+{
+    for(vector<FtpDirListing *>::iterator i = subdirs.begin(); i != subdirs.end(); i++)
+        delete *i;
+}
+
+static bool subdirLess(const FtpDirListing *a, const FtpDirListing *b)
+{
+    return a->url < b->url;
+}
+
+FtpScanner::FtpScanner(HINTERNET inet, InternetOptions opt, FtpDir *dir, int connections, bool *cancelled)
+{
+    internet        = inet;
+    internetOptions = opt;
+    ftpDir          = dir;
+    maxThreads      = (connections > 0) ? connections : 1;
+    busyThreads     = 0;
+    useMlsd         = true;
+    stop            = cancelled;
+    queueEvent      = CreateEvent(NULL, FALSE, FALSE, NULL);
+
+    Url url(ftpDir->url);
+    rootDir = new FtpDirListing(ftpDir->url, url.urlPath, _T(""));
+    queue.push_back(rootDir);
+
+    InitializeCriticalSection(&lock);
+}
+
+FtpScanner::~FtpScanner()
+{
+    wait(INFINITE);
+
+    for(vector<HANDLE>::iterator i = threads.begin(); i != threads.end(); i++)
+        CloseHandle(*i);
+
+    CloseHandle(queueEvent);
+    DeleteCriticalSection(&lock);
+    delete rootDir;
+}
+
+unsigned __stdcall ftpScanThreadProc(void *param)
+{
+    ((FtpScanner *)param)->worker();
+    return 0;
+}
+
+bool FtpScanner::start()
+{
+    TRACE(_T("Scanning FTP dir %s with %d connection(s)"), ftpDir->url.c_str(), ftpDir->recursive ? maxThreads : 1);
+
+    for(int i = 0; i < (ftpDir->recursive ? maxThreads : 1); i++)
+    {
+        HANDLE thread = (HANDLE)_beginthreadex(NULL, 0, &ftpScanThreadProc, (void *)this, 0, NULL);
+
+        if(thread)
+            threads.push_back(thread);
+    }
+
+    return !threads.empty();
+}
+
+bool FtpScanner::wait(DWORD msec)
+{
+    if(threads.empty())
+        return true;
+
+    return WaitForMultipleObjects((DWORD)threads.size(), &threads[0], TRUE, msec) != WAIT_TIMEOUT;
+}
+
+tstring FtpScanner::currentDir()
+{
+    EnterCriticalSection(&lock);
+    tstring res = lastDir;
+    LeaveCriticalSection(&lock);
+    return res;
+}
+
+FtpDirListing *FtpScanner::root()
+{
+    return rootDir;
+}
+
+void FtpScanner::worker()
+{
+    Url url(ftpDir->url);
+    url.internetOptions = internetOptions;
+
+    FtpDirListing *dir;
+
+    while((dir = nextDir()) != NULL)
+    {
+        if(!url.connection)
+            url.connect(internet);
+
+        bool res = url.connection && listDir(&url, dir);
+
+        if(!res && url.connection && !*stop)
+        {
+            // Control connection may be closed by server between directories
+            TRACE(_T("Listing %s failed, reconnecting"), dir->path.c_str());
+            url.disconnect();
+
+            if(url.connect(internet))
+                res = listDir(&url, dir);
+        }
+
+        if(!res)
+            dir->error = GetLastError();
+
+        dir->listed = res;
+        dirDone(dir);
+    }
+
+    url.disconnect();
+}
+
+FtpDirListing *FtpScanner::nextDir()
+{
+    EnterCriticalSection(&lock);
+
+    while(queue.empty() && busyThreads && !*stop)
+    {
+        LeaveCriticalSection(&lock);
+        WaitForSingleObject(queueEvent, 100);
+        EnterCriticalSection(&lock);
+    }
+
+    FtpDirListing *dir = NULL;
+
+    if(!queue.empty() && !*stop)
+    {
+        dir = queue.front();
+        queue.pop_front();
+        busyThreads++;
+        lastDir = dir->path;
+    }
+
+    LeaveCriticalSection(&lock);
+
+    if(!dir)
+        SetEvent(queueEvent); // Wake up other waiting threads, so they can exit too
+
+    return dir;
+}
+
+void FtpScanner::dirDone(FtpDirListing *dir)
+{
+    if(dir->listed && ftpDir->recursive)
+    {
+        for(vector<FtpDirEntry>::iterator i = dir->entries.begin(); i != dir->entries.end(); i++)
+        {
+            if(!i->directory)
+                continue;
+
+            FtpDirListing *sub = new FtpDirListing(addslash(dir->url) + i->name, addslash(dir->path) + i->name, addbackslash(dir->subdir) + i->name);
+            dir->subdirs.push_back(sub);
+        }
+
+        sort(dir->subdirs.begin(), dir->subdirs.end(), subdirLess);
+    }
+
+    EnterCriticalSection(&lock);
+
+    for(vector<FtpDirListing *>::iterator i = dir->subdirs.begin(); i != dir->subdirs.end(); i++)
+        queue.push_back(*i);
+
+    busyThreads--;
+    LeaveCriticalSection(&lock);
+
+    SetEvent(queueEvent);
+}
+
+bool FtpScanner::listDir(Url *url, FtpDirListing *dir)
+{
+    TRACE(_T("Listing %s"), dir->path.c_str());
+
+    // Transport clears flag, when server doesn't support MLSD; it's shared by workers, so copy is used
+    EnterCriticalSection(&lock);
+    bool mlsd = useMlsd;
+    LeaveCriticalSection(&lock);
+
+    bool res = url->transport->listDir(url, dir->path, ftpDir->mask, dir->entries, &mlsd);
+
+    if(!mlsd)
+    {
+        EnterCriticalSection(&lock);
+        useMlsd = false;
+        LeaveCriticalSection(&lock);
+    }
+
+    return res;
+}
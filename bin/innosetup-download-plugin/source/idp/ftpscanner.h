@@ -0,0 +1,68 @@
+#pragma once
+
+#include <windows.h>
+#include <wininet.h>
+#include <vector>
+#include <deque>
+#include "tstring.h"
+#include "internetoptions.h"
+#include "ftpdir.h"
+#include "transport.h"
+
+#define DEFAULT_FTP_SCAN_CONNECTIONS 4
+
+using namespace std;
+
+// Listing of one directory on FTP server
+class FtpDirListing
+{
+public:
+    FtpDirListing(tstring dirUrl, tstring dirPath, tstring localSubdir);
+    ~FtpDirListing();
+
+    tstring                 url;     // Directory URL
+    tstring                 path;    // Directory path on server
+    tstring                 subdir;  // Local subdirectory, relative to FtpDir::destdir
+    vector<FtpDirEntry>     entries;
+    vector<FtpDirListing *> subdirs; // Sorted by name
+    bool                    listed;
+    DWORD                   error;
+};
+
+// Breadth-first scanner of FTP directory tree. Directories are listed concurrently
+// by a bounded number of worker threads, each one using its own control connection.
+// MLSD is used to get exact sizes and modification times, if server supports it,
+// otherwise transport falls back to LIST parsing.
+class FtpScanner
+{
+public:
+    FtpScanner(HINTERNET inet, InternetOptions opt, FtpDir *dir, int connections, bool *cancelled);
+    ~FtpScanner();
+
+    bool           start();
+    bool           wait(DWORD msec);
+    tstring        currentDir();
+    FtpDirListing *root();
+
+protected:
+    void           worker();
+    FtpDirListing *nextDir();
+    void           dirDone(FtpDirListing *dir);
+    bool           listDir(Url *url, FtpDirListing *dir);
+
+    HINTERNET               internet;
+    InternetOptions         internetOptions;
+    FtpDir                 *ftpDir;
+    FtpDirListing          *rootDir;
+    deque<FtpDirListing *>  queue;
+    vector<HANDLE>          threads;
+    int                     maxThreads;
+    int                     busyThreads;
+    bool                    useMlsd;
+    bool                   *stop;
+    tstring                 lastDir;
+    CRITICAL_SECTION        lock;
+    HANDLE                  queueEvent;
+
+    friend unsigned __stdcall ftpScanThreadProc(void *param);
+};
@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "ftpsnapshot.h"
+#include "trace.h"
+
+#define SNAPSHOT_SIGNATURE "IDPFTPSNAPSHOT 1"
+
+FtpSnapshot::FtpSnapshot(tstring rootUrl, tstring dir)
+{
+    root = rootUrl;
+
+    // FNV-1a hash of URL makes file name unique for each scanned tree
+    unsigned long hash = 2166136261UL;
+
+    for(size_t i = 0; i < root.length(); i++)
+        hash = ((hash ^ (unsigned long)root[i]) * 16777619UL) & 0xffffffffUL;
+
+    fileName = addbackslash(dir) + tstrprintf(_T(".idpftp-%08lx.snapshot"), hash);
+}
+
+bool FtpSnapshot::load()
+{
+    FILE *f = _tfopen(fileName.c_str(), _T("rb"));
+
+    if(!f)
+        return false;
+
+    char line[4096];
+    bool res = false;
+
+    // Line format: size <tab> modified <tab> url (UTF-8)
+    if(fgets(line, sizeof(line), f) && (strncmp(line, SNAPSHOT_SIGNATURE, strlen(SNAPSHOT_SIGNATURE)) == 0) &&
+       fgets(line, sizeof(line), f) && (fromutf8(string(line, strcspn(line, "\r\n"))).compare(root) == 0))
+    {
+        while(fgets(line, sizeof(line), f))
+        {
+            char *p;
+            FtpSnapshotEntry entry;
+
+            entry.size = _strtoui64(line, &p, 10);
+
+            if(*p++ != '\t')
+                continue;
+
+            entry.modified = _strtoui64(p, &p, 10);
+
+            if(*p++ != '\t')
+                continue;
+
+            oldEntries[fromutf8(string(p, strcspn(p, "\r\n")))] = entry;
+        }
+
+        res = true;
+    }
+
+    fclose(f);
+    TRACE(_T("FTP snapshot %s: %d files"), fileName.c_str(), (int)oldEntries.size());
+    return res;
+}
+
+bool FtpSnapshot::save()
+{
+    FILE *f = _tfopen(fileName.c_str(), _T("wb"));
+
+    if(!f)
+        return false;
+
+    fprintf(f, "%s\n%s\n", SNAPSHOT_SIGNATURE, toutf8(root).c_str());
+
+    for(map<tstring, FtpSnapshotEntry>::iterator i = newEntries.begin(); i != newEntries.end(); i++)
+        fprintf(f, "%s\t%s\t%s\n", u64tostr(i->second.size).c_str(), u64tostr(i->second.modified).c_str(), toutf8(i->first).c_str());
+
+    return fclose(f) == 0;
+}
+
+bool FtpSnapshot::unchanged(tstring url, unsigned long long size, unsigned long long modified)
+{
+    if(!modified)
+        return false; // No exact modification time (LIST fallback)
+
+    map<tstring, FtpSnapshotEntry>::iterator i = oldEntries.find(url);
+
+    if(i == oldEntries.end())
+        return false;
+
+    return (i->second.size == size) && (i->second.modified == modified);
+}
+
+void FtpSnapshot::add(tstring url, unsigned long long size, unsigned long long modified)
+{
+    map<tstring, FtpSnapshotEntry>::iterator i = oldEntries.find(url);
+
+    // Files, deleted from server, are dropped from snapshot
+    if(i != oldEntries.end())
+        newEntries[url] = i->second;
+
+    if(!modified)
+        return;
+
+    FtpSnapshotEntry entry;
+    entry.size     = size;
+    entry.modified = modified;
+    scannedEntries[url] = entry;
+}
+
+void FtpSnapshot::commit(tstring url)
+{
+    map<tstring, FtpSnapshotEntry>::iterator i = scannedEntries.find(url);
+
+    if(i != scannedEntries.end())
+        newEntries[url] = i->second;
+    else
+        newEntries.erase(url); // Downloaded version is unknown
+}
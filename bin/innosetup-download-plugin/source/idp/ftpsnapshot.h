@@ -0,0 +1,35 @@
+#pragma once
+
+#include <map>
+#include "tstring.h"
+
+using namespace std;
+
+struct FtpSnapshotEntry
+{
+    unsigned long long size;
+    unsigned long long modified; // YYYYMMDDHHMMSS, as reported by MLSD
+};
+
+// On-disk record of files of FTP directory tree, which were downloaded, keyed by URL.
+// Size & modification time, found during scan, are recorded only after file is downloaded
+// and verified; until then file keeps its previous entry, so changed file is never skipped.
+class FtpSnapshot
+{
+public:
+    FtpSnapshot(tstring rootUrl, tstring dir);
+
+    bool load();
+    bool save();
+    bool unchanged(tstring url, unsigned long long size, unsigned long long modified);
+    void add(tstring url, unsigned long long size, unsigned long long modified); // File found during scan
+    void commit(tstring url); // File was downloaded
+
+    tstring fileName;
+
+protected:
+    tstring                          root;
+    map<tstring, FtpSnapshotEntry>   oldEntries;
+    map<tstring, FtpSnapshotEntry>   newEntries;
+    map<tstring, FtpSnapshotEntry>   scannedEntries;
+};
@@ -0,0 +1,320 @@
+#include <process.h>
+#include "ftptransfer.h"
+#include "url.h"
+#include "trace.h"
+
+FtpSegmentedTransfer::FtpSegmentedTransfer(HINTERNET inet, InternetOptions opt, tstring url, MappedFile *mappedFile, const vector<ByteRange> &ranges,
+                                           int segmentsCount, int bufsize, bool *cancelled, DWORD traceid)
+{
+    internet        = inet;
+    internetOptions = opt;
+    urlString       = url;
+    file            = mappedFile;
+    bufferSize      = bufsize;
+    activeThreads   = 0;
+    stop            = cancelled;
+    traceId         = traceid;
+
+    if(segmentsCount < 1)
+        segmentsCount = 1;
+
+    threadsCount = segmentsCount;
+
+    DWORDLONG total = 0;
+
+    for(vector<ByteRange>::const_iterator r = ranges.begin(); r != ranges.end(); r++)
+        total += r->end - r->start;
+
+    // Each range gets share of segments, proportional to its size
+    DWORDLONG segmentSize = total / segmentsCount + 1;
+
+    for(vector<ByteRange>::const_iterator r = ranges.begin(); r != ranges.end(); r++)
+    {
+        DWORDLONG length = r->end - r->start;
+        DWORDLONG count  = (length + segmentSize / 2) / segmentSize;
+
+        if(!count)
+            count = 1;
+
+        for(DWORDLONG i = 0; i < count; i++)
+        {
+            FtpSegment seg;
+            seg.start    = r->start + length / count * i;
+            seg.end      = (i == count - 1) ? r->end : seg.start + length / count;
+            seg.position = seg.start;
+            seg.flushed  = seg.start;
+            seg.error    = 0;
+            seg.attempts = 0;
+            segments.push_back(seg);
+        }
+    }
+
+    for(vector<FtpSegment>::iterator i = segments.begin(); i != segments.end(); i++)
+        queue.push_back(&(*i));
+
+    InitializeCriticalSection(&lock);
+}
+
+FtpSegmentedTransfer::~FtpSegmentedTransfer()
+{
+    wait(INFINITE);
+
+    for(vector<HANDLE>::iterator i = threads.begin(); i != threads.end(); i++)
+        CloseHandle(*i);
+
+    DeleteCriticalSection(&lock);
+}
+
+unsigned __stdcall ftpSegmentThreadProc(void *param)
+{
+    ((FtpSegmentedTransfer *)param)->worker();
+    return 0;
+}
+
+bool FtpSegmentedTransfer::start()
+{
+    TRACE(_T("Downloading %s in %d segments"), urlString.c_str(), (int)segments.size());
+
+    for(size_t i = 0; (i < segments.size()) && (i < (size_t)threadsCount); i++)
+    {
+        EnterCriticalSection(&lock);
+        activeThreads++;
+        LeaveCriticalSection(&lock);
+
+        HANDLE thread = (HANDLE)_beginthreadex(NULL, 0, &ftpSegmentThreadProc, (void *)this, 0, NULL);
+
+        if(thread)
+            threads.push_back(thread);
+        else
+        {
+            EnterCriticalSection(&lock);
+            activeThreads--;
+            LeaveCriticalSection(&lock);
+        }
+    }
+
+    return !threads.empty();
+}
+
+bool FtpSegmentedTransfer::wait(DWORD msec)
+{
+    if(threads.empty())
+        return true;
+
+    return WaitForMultipleObjects((DWORD)threads.size(), &threads[0], TRUE, msec) != WAIT_TIMEOUT;
+}
+
+bool FtpSegmentedTransfer::completed()
+{
+    for(vector<FtpSegment>::iterator i = segments.begin(); i != segments.end(); i++)
+        if(i->position != i->end)
+            return false;
+
+    return true;
+}
+
+DWORD FtpSegmentedTransfer::error()
+{
+    for(vector<FtpSegment>::iterator i = segments.begin(); i != segments.end(); i++)
+        if(i->error)
+            return i->error;
+
+    return 0;
+}
+
+DWORDLONG FtpSegmentedTransfer::bytesDownloaded()
+{
+    DWORDLONG res = 0;
+
+    EnterCriticalSection(&lock);
+
+    for(vector<FtpSegment>::iterator i = segments.begin(); i != segments.end(); i++)
+        res += i->position - i->start;
+
+    LeaveCriticalSection(&lock);
+    return res;
+}
+
+DWORDLONG FtpSegmentedTransfer::contiguousBytes()
+{
+    DWORDLONG res = 0;
+
+    EnterCriticalSection(&lock);
+
+    for(vector<FtpSegment>::iterator i = segments.begin(); i != segments.end(); i++)
+    {
+        res = i->position;
+
+        if(i->position != i->end)
+            break;
+    }
+
+    LeaveCriticalSection(&lock);
+    return res;
+}
+
+vector<FtpSegment> FtpSegmentedTransfer::state()
+{
+    EnterCriticalSection(&lock);
+    vector<FtpSegment> res = segments;
+    LeaveCriticalSection(&lock);
+    return res;
+}
+
+void FtpSegmentedTransfer::worker()
+{
+    MappedView  view(file);
+    FtpSegment *seg;
+
+    while((seg = nextSegment()) != NULL)
+    {
+        bool      res;
+        DWORDLONG pos;
+
+        // Dropped connection is restarted from current position, while segment makes progress
+        do
+        {
+            pos = seg->position;
+            res = fetch(seg, &view);
+        }
+        while(!res && (seg->position > pos) && !*stop);
+
+        if(res || *stop)
+            continue;
+
+        seg->error = GetLastError();
+
+        if(segmentFailed(seg))
+            break;
+    }
+}
+
+FtpSegment *FtpSegmentedTransfer::nextSegment()
+{
+    FtpSegment *seg = NULL;
+
+    EnterCriticalSection(&lock);
+
+    if(!queue.empty() && !*stop)
+    {
+        seg = queue.front();
+        queue.pop_front();
+    }
+    else
+        activeThreads--;
+
+    LeaveCriticalSection(&lock);
+    return seg;
+}
+
+// Returns true, if calling thread should exit
+bool FtpSegmentedTransfer::segmentFailed(FtpSegment *seg)
+{
+    bool res = false;
+
+    EnterCriticalSection(&lock);
+
+    if(activeThreads > 1)
+    {
+        // Probably server limits number of connections: leave segment to other threads
+        TRACE(_T("Segment at %I64u failed, %d thread(s) left"), seg->start, activeThreads - 1);
+        queue.push_back(seg);
+        activeThreads--;
+        res = true;
+    }
+    else if(++seg->attempts < FTP_SEGMENT_ATTEMPTS)
+    {
+        queue.push_back(seg);
+    }
+
+    LeaveCriticalSection(&lock);
+    return res;
+}
+
+bool FtpSegmentedTransfer::fetch(FtpSegment *seg, MappedView *view)
+{
+    Url url(urlString);
+    url.internetOptions = internetOptions;
+    url.traceId         = traceId;
+
+    if(!url.open(internet, NULL, seg->position))
+    {
+        DWORD error = GetLastError();
+        url.close();
+        SetLastError(error);
+        return false;
+    }
+
+    bool  res = true;
+    DWORD bytesRead;
+    DWORD available;
+
+    while(seg->position < seg->end)
+    {
+        if(*stop)
+        {
+            res = false;
+            break;
+        }
+
+        BYTE *dest = view->map(seg->position, &available);
+
+        if(!dest)
+        {
+            res = false;
+            break;
+        }
+
+        DWORDLONG left   = seg->end - seg->position;
+        DWORD     toRead = (left < (DWORDLONG)bufferSize) ? (DWORD)left : (DWORD)bufferSize;
+
+        if(toRead > available)
+            toRead = available;
+
+        if(!url.transport->read(url.filehandle, dest, toRead, &bytesRead) || !bytesRead)
+        {
+            res = false;
+            break;
+        }
+
+        traceEvent(TE_READ, traceId, bytesRead);
+
+        EnterCriticalSection(&lock);
+        seg->position += bytesRead;
+        LeaveCriticalSection(&lock);
+
+        // Flush point: view is full or segment is complete, next data goes to another view
+        if((bytesRead == available) || (seg->position == seg->end))
+        {
+            LONGLONG flushStart = traceTime();
+
+            if(!view->flush())
+            {
+                res = false;
+                break;
+            }
+
+            traceEvent(TE_WRITE, traceId, traceNs(traceTime() - flushStart));
+
+            EnterCriticalSection(&lock);
+            seg->flushed = seg->position;
+            LeaveCriticalSection(&lock);
+        }
+    }
+
+    DWORD error = GetLastError();
+
+    // Received data of interrupted segment is kept, so journal can cover it
+    if(!res && view->flush())
+    {
+        EnterCriticalSection(&lock);
+        seg->flushed = seg->position;
+        LeaveCriticalSection(&lock);
+    }
+
+    // Closing data connection before end of file aborts transfer of the rest of file
+    url.close();
+
+    SetLastError(error);
+    return res;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <windows.h>
+#include <wininet.h>
+#include <vector>
+#include <deque>
+#include "tstring.h"
+#include "internetoptions.h"
+#include "file.h"
+
+#define DEFAULT_FTP_SEGMENTS         4
+#define DEFAULT_FTP_SEGMENT_MIN_SIZE 8388608 // 8 MB
+#define FTP_SEGMENT_ATTEMPTS         2       // Attempts without progress by last running thread
+
+using namespace std;
+
+struct FtpSegment
+{
+    DWORDLONG start;
+    DWORDLONG end;      // First byte after segment
+    DWORDLONG position; // Next byte to receive
+    DWORDLONG flushed;  // Data before this offset was handed over to system for writing to disk
+    DWORD     error;
+    int       attempts;
+};
+
+// Downloads one file over several FTP data connections simultaneously. Each segment
+// is requested with REST <start>, and its connection is closed as soon as segment end
+// is reached. If server refuses extra connections, failed segments are taken over by
+// remaining threads, when they finish their own segments.
+// Data is received directly into memory-mapped views of preallocated destination file.
+// Only given ranges of file are downloaded, so interrupted transfer can be continued.
+class FtpSegmentedTransfer
+{
+public:
+    FtpSegmentedTransfer(HINTERNET inet, InternetOptions opt, tstring url, MappedFile *mappedFile, const vector<ByteRange> &ranges,
+                         int segmentsCount, int bufsize, bool *cancelled, DWORD traceid = 0);
+    ~FtpSegmentedTransfer();
+
+    bool      start();
+    bool      wait(DWORD msec);
+    bool      completed();
+    DWORD     error();
+    DWORDLONG bytesDownloaded();
+    DWORDLONG contiguousBytes(); // Size of completely downloaded beginning of file (data outside of ranges counts as downloaded)
+    vector<FtpSegment> state();
+
+protected:
+    void        worker();
+    FtpSegment *nextSegment();
+    bool        segmentFailed(FtpSegment *seg);
+    bool        fetch(FtpSegment *seg, MappedView *view);
+
+    HINTERNET           internet;
+    InternetOptions     internetOptions;
+    tstring             urlString;
+    MappedFile         *file;
+    vector<FtpSegment>  segments;
+    deque<FtpSegment *> queue;
+    vector<HANDLE>      threads;
+    int                 activeThreads;
+    int                 threadsCount;
+    int                 bufferSize;
+    DWORD               traceId; // Segment connections are traced as part of file transfer
+    bool               *stop;
+    CRITICAL_SECTION    lock;
+
+    friend unsigned __stdcall ftpSegmentThreadProc(void *param);
+};
@@ -0,0 +1,357 @@
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include "hash.h"
+
+#define HASH_FILE_BUFSIZE 1048576
+
+#define ROL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+#define ROR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static const DWORD sha256K[64] =
+{
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+Hash::Hash(int alg)
+{
+    algorithmId = alg;
+    used        = 0;
+    total       = 0;
+
+    if(alg == HASH_SHA1)
+    {
+        state[0] = 0x67452301; state[1] = 0xefcdab89; state[2] = 0x98badcfe; state[3] = 0x10325476;
+        state[4] = 0xc3d2e1f0;
+    }
+    else
+    {
+        state[0] = 0x6a09e667; state[1] = 0xbb67ae85; state[2] = 0x3c6ef372; state[3] = 0xa54ff53a;
+        state[4] = 0x510e527f; state[5] = 0x9b05688c; state[6] = 0x1f83d9ab; state[7] = 0x5be0cd19;
+    }
+}
+
+void Hash::block(const BYTE *p)
+{
+    DWORD w[80];
+
+    for(int i = 0; i < 16; i++)
+        w[i] = ((DWORD)p[i * 4] << 24) | ((DWORD)p[i * 4 + 1] << 16) | ((DWORD)p[i * 4 + 2] << 8) | p[i * 4 + 3];
+
+    if(algorithmId == HASH_SHA1)
+    {
+        for(int i = 16; i < 80; i++)
+            w[i] = ROL(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+        DWORD a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+
+        for(int i = 0; i < 80; i++)
+        {
+            DWORD f, k;
+
+            if(i < 20)      { f = (b & c) | (~b & d);           k = 0x5a827999; }
+            else if(i < 40) { f = b ^ c ^ d;                    k = 0x6ed9eba1; }
+            else if(i < 60) { f = (b & c) | (b & d) | (c & d);  k = 0x8f1bbcdc; }
+            else            { f = b ^ c ^ d;                    k = 0xca62c1d6; }
+
+            DWORD t = ROL(a, 5) + f + e + k + w[i];
+            e = d; d = c; c = ROL(b, 30); b = a; a = t;
+        }
+
+        state[0] += a; state[1] += b; state[2] += c; state[3] += d; state[4] += e;
+        return;
+    }
+
+    for(int i = 16; i < 64; i++)
+    {
+        DWORD s0 = ROR(w[i - 15], 7) ^ ROR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        DWORD s1 = ROR(w[i - 2], 17) ^ ROR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    DWORD a = state[0], b = state[1], c = state[2], d = state[3];
+    DWORD e = state[4], f = state[5], g = state[6], h = state[7];
+
+    for(int i = 0; i < 64; i++)
+    {
+        DWORD t1 = h + (ROR(e, 6) ^ ROR(e, 11) ^ ROR(e, 25)) + ((e & f) ^ (~e & g)) + sha256K[i] + w[i];
+        DWORD t2 = (ROR(a, 2) ^ ROR(a, 13) ^ ROR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g; g = f; f = e; e = d + t1; d = c; c = b; b = a; a = t1 + t2;
+    }
+
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+void Hash::update(const void *data, size_t size)
+{
+    const BYTE *p = (const BYTE *)data;
+    total += size;
+
+    if(used)
+    {
+        size_t n = min(size, sizeof(buffer) - used);
+        memcpy(buffer + used, p, n);
+        used += n;
+        p    += n;
+        size -= n;
+
+        if(used < sizeof(buffer))
+            return;
+
+        block(buffer);
+        used = 0;
+    }
+
+    for(; size >= sizeof(buffer); p += sizeof(buffer), size -= sizeof(buffer))
+        block(p);
+
+    memcpy(buffer, p, size);
+    used = size;
+}
+
+string Hash::hex()
+{
+    DWORDLONG bits = total * 8;
+    BYTE      pad[72];
+    size_t    padSize = ((used < 56) ? 56 : 120) - used;
+
+    memset(pad, 0, sizeof(pad));
+    pad[0] = 0x80;
+
+    for(int i = 0; i < 8; i++)
+        pad[padSize + i] = (BYTE)(bits >> (56 - i * 8));
+
+    update(pad, padSize + 8);
+
+    string res;
+    char   digit[3];
+    int    words = (algorithmId == HASH_SHA1) ? 5 : 8;
+
+    for(int i = 0; i < words * 4; i++)
+    {
+        sprintf(digit, "%02x", (unsigned)(BYTE)(state[i / 4] >> (24 - (i % 4) * 8)));
+        res += digit;
+    }
+
+    return res;
+}
+
+int Hash::algorithm(string name)
+{
+    for(size_t i = 0; i < name.length(); i++)
+        name[i] = (char)tolower(name[i]);
+
+    if((name.compare("sha-1") == 0) || (name.compare("sha1") == 0))
+        return HASH_SHA1;
+
+    if((name.compare("sha-256") == 0) || (name.compare("sha256") == 0))
+        return HASH_SHA256;
+
+    return HASH_NONE;
+}
+
+bool Hash::updateFile(tstring filename, DWORDLONG offset, DWORDLONG length)
+{
+    FILE *f = _tfopen(filename.c_str(), _T("rb"));
+
+    if(!f)
+        return false;
+
+    if(_fseeki64(f, (__int64)offset, SEEK_SET) != 0)
+    {
+        fclose(f);
+        return false;
+    }
+
+    BYTE *buf = new BYTE[HASH_FILE_BUFSIZE];
+    bool  res = true;
+
+    while(length)
+    {
+        size_t toRead = (length < HASH_FILE_BUFSIZE) ? (size_t)length : HASH_FILE_BUFSIZE;
+        size_t n      = fread(buf, 1, toRead, f);
+
+        update(buf, n);
+
+        if(length != (DWORDLONG)-1)
+            length -= n;
+
+        // Whole file is read until its end, range must be read completely
+        if(n < toRead)
+        {
+            res = (length == (DWORDLONG)-1) && !ferror(f);
+            break;
+        }
+    }
+
+    delete[] buf;
+    fclose(f);
+    return res;
+}
+
+string Hash::file(tstring filename, int alg, DWORDLONG offset, DWORDLONG length)
+{
+    Hash hash(alg);
+    return hash.updateFile(filename, offset, length) ? hash.hex() : "";
+}
+
+bool PieceHashes::load(tstring filename)
+{
+    FILE *f = _tfopen(filename.c_str(), _T("rb"));
+
+    if(!f)
+        return false;
+
+    string text;
+    char   buffer[4096];
+    size_t n;
+
+    while((n = fread(buffer, 1, sizeof(buffer), f)) > 0)
+        text.append(buffer, n);
+
+    fclose(f);
+    return parse(text);
+}
+
+bool PieceHashes::parse(const string &text)
+{
+    char name[32];
+    int  consumed = 0;
+    unsigned long long pieceLength = 0;
+
+    if((sscanf(text.c_str(), "%31s %llu%n", name, &pieceLength, &consumed) < 2) || !pieceLength)
+        return false;
+
+    int            alg = Hash::algorithm(name);
+    vector<string> list;
+    size_t         pos = (size_t)consumed;
+
+    if(alg == HASH_NONE)
+        return false;
+
+    while((pos = text.find_first_not_of(" \t\r\n", pos)) != string::npos)
+    {
+        size_t end  = text.find_first_of(" \t\r\n", pos);
+        string item = text.substr(pos, end - pos);
+
+        for(size_t i = 0; i < item.length(); i++)
+            item[i] = (char)tolower(item[i]);
+
+        list.push_back(item);
+        pos = end;
+    }
+
+    if(list.empty())
+        return false;
+
+    algorithm = alg;
+    length    = pieceLength;
+    hashes    = list;
+    return true;
+}
+
+bool PieceHashes::covers(DWORDLONG filesize)
+{
+    return length && !(filesize == (DWORDLONG)-1) && (hashes.size() == (filesize + length - 1) / length);
+}
+
+ByteRange PieceHashes::range(size_t piece, DWORDLONG filesize)
+{
+    ByteRange r;
+
+    r.start = (DWORDLONG)piece * length;
+    r.end   = min(r.start + length, filesize);
+    return r;
+}
+
+PieceVerifier::PieceVerifier(const PieceHashes &expected, DWORDLONG filesize): pieces(expected), hash(expected.algorithm)
+{
+    size    = filesize;
+    offset  = 0;
+    hashing = true;
+}
+
+void PieceVerifier::start(tstring filename, DWORDLONG startOffset)
+{
+    if(pieces.hashes.empty())
+        return;
+
+    DWORDLONG pieceStart = startOffset - startOffset % pieces.length;
+
+    offset  = startOffset;
+    hash    = Hash(pieces.algorithm);
+    hashing = (startOffset == pieceStart) || hash.updateFile(filename, pieceStart, startOffset - pieceStart);
+}
+
+void PieceVerifier::update(const void *data, size_t dataSize)
+{
+    const BYTE *p = (const BYTE *)data;
+
+    while(dataSize && (offset < size) && !pieces.hashes.empty())
+    {
+        size_t    piece = (size_t)(offset / pieces.length);
+        DWORDLONG end   = pieces.range(piece, size).end;
+        size_t    n     = (size_t)min((DWORDLONG)dataSize, end - offset);
+
+        if(hashing)
+            hash.update(p, n);
+
+        p        += n;
+        dataSize -= n;
+        offset   += n;
+
+        if(offset < end)
+            break;
+
+        if(hashing && (piece < pieces.hashes.size()))
+        {
+            if(hash.hex().compare(pieces.hashes[piece]) == 0)
+                verified.push_back(piece);
+            else
+                failed.push_back(piece);
+        }
+
+        hash    = Hash(pieces.algorithm);
+        hashing = true;
+    }
+}
+
+static DWORD crc32Table[256];
+
+static bool crc32MakeTable()
+{
+    for(DWORD i = 0; i < 256; i++)
+    {
+        DWORD c = i;
+
+        for(int k = 0; k < 8; k++)
+            c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+
+        crc32Table[i] = c;
+    }
+
+    return true;
+}
+
+static bool crc32TableReady = crc32MakeTable();
+
+DWORD crc32(DWORD crc, const void *data, size_t size)
+{
+    const BYTE *p = (const BYTE *)data;
+
+    crc = ~crc;
+
+    while(size--)
+        crc = crc32Table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+
+    return ~crc;
+}
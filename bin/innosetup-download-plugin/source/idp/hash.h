@@ -0,0 +1,77 @@
+#pragma once
+
+#include <windows.h>
+#include <string>
+#include <vector>
+#include "tstring.h"
+#include "file.h"
+
+#define HASH_NONE   0
+#define HASH_SHA1   1
+#define HASH_SHA256 2
+
+using namespace std;
+
+// SHA-1 & SHA-256, used to verify files and pieces, listed in Metalink.
+// Own implementation: same code on all systems, no CryptoAPI provider dependencies.
+class Hash
+{
+public:
+    Hash(int alg);
+
+    void   update(const void *data, size_t size);
+    string hex(); // Finishes hash, returns lowercase hex digest
+
+    bool   updateFile(tstring filename, DWORDLONG offset = 0, DWORDLONG length = (DWORDLONG)-1); // false if file or range can't be read
+
+    static int    algorithm(string name); // Metalink name ("sha-256", "sha1"), HASH_NONE if not supported
+    static string file(tstring filename, int alg, DWORDLONG offset = 0, DWORDLONG length = (DWORDLONG)-1); // Empty if file can't be read
+
+    int algorithmId;
+
+protected:
+    void block(const BYTE *p);
+
+    DWORD     state[8];
+    BYTE      buffer[64];
+    size_t    used;
+    DWORDLONG total;
+};
+
+// CRC-32 (ISO 3309), as used by zip archives. Start with crc = 0
+DWORD crc32(DWORD crc, const void *data, size_t size);
+
+// Expected hashes of equal-sized pieces of file (last piece may be shorter)
+struct PieceHashes
+{
+    PieceHashes(): algorithm(HASH_NONE), length(0) {}
+
+    bool      load(tstring filename); // Sidecar file: "<algorithm> <piece length>" line, then hash of each piece per line
+    bool      parse(const string &text);
+    bool      covers(DWORDLONG filesize); // There is hash for each piece of file of this size
+    ByteRange range(size_t piece, DWORDLONG filesize);
+
+    int            algorithm;
+    DWORDLONG      length;
+    vector<string> hashes; // Lowercase hex
+};
+
+// Hashes sequentially written file data and checks each piece, when it is complete
+class PieceVerifier
+{
+public:
+    PieceVerifier(const PieceHashes &expected, DWORDLONG filesize);
+
+    void start(tstring filename, DWORDLONG offset); // Hashes beginning of current piece, which is already on disk
+    void update(const void *data, size_t size);
+
+    vector<size_t> verified; // Pieces, which matched their hash, caller takes them
+    vector<size_t> failed;
+
+protected:
+    PieceHashes pieces;
+    DWORDLONG   size;
+    DWORDLONG   offset;  // Of next byte
+    Hash        hash;    // Of current piece
+    bool        hashing; // false - beginning of current piece couldn't be read
+};
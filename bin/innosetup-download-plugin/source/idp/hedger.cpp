@@ -0,0 +1,354 @@
+#include <process.h>
+#include <algorithm>
+#include "hedger.h"
+#include "url.h"
+#include "trace.h"
+#include "hostscheduler.h"
+
+enum { HEDGE_OK, HEDGE_HTTP_ERROR, HEDGE_FATAL_ERROR };
+
+// One of concurrent requests. Runs in its own thread on its own Url, so winner's
+// handles can be moved to caller's Url, while loser is finished independently.
+struct HedgeAttempt
+{
+    Hedger    *hedger;
+    Url       *url;
+    HINTERNET  internet;
+    tstring    httpVerb;  // Empty - default (GET)
+    DWORDLONG  offset;
+    HINTERNET  result;
+    DWORD      error;
+    int        exception;
+    string     what;
+    DWORD      retryAfter;
+    DWORD      startTime;
+    DWORD      ttfb;
+    HANDLE     event;
+    HANDLE     thread;
+    bool       done;
+    bool       cancelled;
+};
+
+Hedger::Hedger()
+{
+    fixedDelay = 0;
+    budget     = DEFAULT_HEDGE_BUDGET;
+    wasted     = 0;
+    hedges     = 0;
+    wins       = 0;
+
+    InitializeCriticalSection(&lock);
+}
+
+Hedger::~Hedger()
+{
+    wait();
+    DeleteCriticalSection(&lock);
+}
+
+void Hedger::addSample(DWORD ttfb)
+{
+    samples.push_back(ttfb);
+
+    if(samples.size() > HEDGE_MAX_SAMPLES)
+        samples.pop_front();
+}
+
+DWORD Hedger::delay()
+{
+    if(fixedDelay)
+        return max(fixedDelay, (DWORD)HEDGE_MIN_DELAY);
+
+    if(samples.size() < HEDGE_MIN_SAMPLES)
+        return INFINITE;
+
+    vector<DWORD> s(samples.begin(), samples.end());
+    size_t        p90 = s.size() * 9 / 10;
+
+    nth_element(s.begin(), s.begin() + p90, s.end());
+    return max(s[p90], (DWORD)HEDGE_MIN_DELAY);
+}
+
+void Hedger::wait()
+{
+    wait(INFINITE);
+}
+
+void Hedger::wait(DWORD msec)
+{
+    vector<HANDLE> running;
+
+    for(vector<HANDLE>::iterator i = detached.begin(); i != detached.end(); i++)
+    {
+        if(WaitForSingleObject(*i, msec) == WAIT_TIMEOUT)
+            running.push_back(*i);
+        else
+            CloseHandle(*i);
+    }
+
+    detached = running;
+}
+
+unsigned __stdcall hedgeThreadProc(void *param)
+{
+    HedgeAttempt *a = (HedgeAttempt *)param;
+
+    try
+    {
+        a->result = a->url->open(a->internet, a->httpVerb.empty() ? NULL : a->httpVerb.c_str(), a->offset);
+        a->error  = a->result ? 0 : GetLastError();
+    }
+    catch(HTTPError &e)
+    {
+        a->exception  = HEDGE_HTTP_ERROR;
+        a->what       = e.what();
+        a->retryAfter = e.retryAfter;
+    }
+    catch(FatalNetworkError &e)
+    {
+        a->exception = HEDGE_FATAL_ERROR;
+        a->what      = e.what();
+    }
+
+    a->ttfb = GetTickCount() - a->startTime;
+    a->hedger->finished(a);
+    return 0;
+}
+
+HedgeAttempt *Hedger::start(tstring address, Url *url, HINTERNET internet, const _TCHAR *httpVerb, DWORDLONG offset, HANDLE event)
+{
+    HedgeAttempt *a = new HedgeAttempt;
+
+    a->hedger     = this;
+    a->url        = new Url(address);
+    a->internet   = internet;
+    a->httpVerb   = httpVerb ? httpVerb : _T("");
+    a->offset     = offset;
+    a->result     = NULL;
+    a->error      = 0;
+    a->exception  = HEDGE_OK;
+    a->retryAfter = 0;
+    a->startTime  = GetTickCount();
+    a->ttfb       = 0;
+    a->event      = event;
+    a->done       = false;
+    a->cancelled  = false;
+
+    a->url->internetOptions = url->internetOptions;
+    a->url->transport       = url->transport;
+    a->url->traceId         = url->traceId;
+    a->url->rangeEnd        = url->rangeEnd;
+
+    // Validator of other server means nothing to mirror
+    if(address.compare(url->urlString) == 0)
+        a->url->ifRange = url->ifRange;
+
+    a->thread = (HANDLE)_beginthreadex(NULL, 0, &hedgeThreadProc, (void *)a, 0, NULL);
+
+    if(!a->thread)
+    {
+        delete a->url;
+        delete a;
+        return NULL;
+    }
+
+    return a;
+}
+
+// Request for file body, which was not used
+static bool wastes(HedgeAttempt *a)
+{
+    return a->result && (a->httpVerb.compare(_T("HEAD")) != 0);
+}
+
+// Called by request thread. Cancelled request cleans up after itself.
+void Hedger::finished(HedgeAttempt *a)
+{
+    EnterCriticalSection(&lock);
+    bool cancelled = a->cancelled;
+    a->done = true;
+
+    if(cancelled && wastes(a))
+        wasted += HEDGE_WASTE_ESTIMATE;
+
+    if(!cancelled)
+        SetEvent(a->event);
+
+    LeaveCriticalSection(&lock);
+
+    if(cancelled)
+    {
+        TRACE(_T("Cancelled request to %s finished"), a->url->urlString.c_str());
+        delete a->url;
+        delete a;
+    }
+}
+
+// Called by opening thread for finished requests
+void Hedger::release(HedgeAttempt *a, bool winner)
+{
+    WaitForSingleObject(a->thread, INFINITE);
+    CloseHandle(a->thread);
+
+    if(!winner && wastes(a))
+    {
+        EnterCriticalSection(&lock);
+        wasted += HEDGE_WASTE_ESTIMATE;
+        LeaveCriticalSection(&lock);
+    }
+
+    delete a->url;
+    delete a;
+}
+
+HINTERNET Hedger::open(Url *url, HINTERNET internet, const _TCHAR *httpVerb, DWORDLONG offset)
+{
+    DWORD hedgeDelay = delay();
+
+    wait(0);
+
+    EnterCriticalSection(&lock);
+    bool budgetLeft = wasted + HEDGE_WASTE_ESTIMATE <= budget;
+    LeaveCriticalSection(&lock);
+
+    if((hedgeDelay == INFINITE) || !budgetLeft)
+    {
+        DWORD     startTime = GetTickCount();
+        HINTERNET file      = url->openSingle(internet, httpVerb, offset);
+
+        if(file)
+            addSample(GetTickCount() - startTime);
+
+        return file;
+    }
+
+    HANDLE        event      = CreateEvent(NULL, FALSE, FALSE, NULL);
+    HedgeAttempt *attempts[] = { start(url->urlString, url, internet, httpVerb, offset, event), NULL };
+    HedgeAttempt *winner     = NULL;
+    int           exception  = HEDGE_OK;
+    string        what;
+    DWORD         error      = 0;
+    DWORD         retryAfter = 0;
+
+    if(!attempts[0])
+    {
+        CloseHandle(event);
+        return url->openSingle(internet, httpVerb, offset);
+    }
+
+    HostSlots hedgeSlot(_T(""));
+
+    if(WaitForSingleObject(event, hedgeDelay) == WAIT_TIMEOUT)
+    {
+        tstring address = url->hedgeUrl.empty() ? url->urlString : url->hedgeUrl;
+
+        // Hedge never waits for connection: host, which is at its limit, is not asked twice
+        hedgeSlot.hostName = Url(address).hostName;
+
+        if(!hedgeSlot.tryAcquire(1))
+            TRACE(_T("No response from %s in %u ms, no free connection to %s for hedged request"), url->urlString.c_str(), hedgeDelay, address.c_str());
+        else
+        {
+            TRACE(_T("No response from %s in %u ms, sending hedged request to %s"), url->urlString.c_str(), hedgeDelay, address.c_str());
+
+            if((attempts[1] = start(address, url, internet, httpVerb, offset, event)) != NULL)
+                hedges++;
+        }
+    }
+    else
+        SetEvent(event); // Wait below checks state of requests
+
+    while(true)
+    {
+        bool pending = false;
+
+        WaitForSingleObject(event, INFINITE);
+        EnterCriticalSection(&lock);
+
+        for(int i = 0; i < 2; i++)
+        {
+            if(!attempts[i])
+                continue;
+
+            if(attempts[i]->done && attempts[i]->result && !winner)
+                winner = attempts[i];
+            else if(!attempts[i]->done)
+                pending = true;
+        }
+
+        if(winner || !pending)
+        {
+            // Cancelled request may be deleted by its thread as soon as lock is released
+            for(int i = 0; i < 2; i++)
+            {
+                if(attempts[i] && !attempts[i]->done)
+                {
+                    attempts[i]->cancelled = true;
+                    attempts[i]->url->cancelled = true;
+                    detached.push_back(attempts[i]->thread);
+                    attempts[i] = NULL;
+                }
+            }
+        }
+
+        LeaveCriticalSection(&lock);
+
+        if(winner || !pending)
+            break;
+    }
+
+    CloseHandle(event);
+
+    if(!winner)
+    {
+        exception       = attempts[0]->exception;
+        what            = attempts[0]->what;
+        error           = attempts[0]->error;
+        retryAfter      = attempts[0]->retryAfter;
+        url->httpStatus = attempts[0]->url->httpStatus;
+    }
+
+    for(int i = 0; i < 2; i++)
+    {
+        HedgeAttempt *a = attempts[i];
+
+        if(!a)
+            continue;
+
+        if(a == winner)
+        {
+            addSample(a->ttfb);
+
+            if(i)
+            {
+                wins++;
+                TRACE(_T("Hedged request to %s responded first"), a->url->urlString.c_str());
+            }
+
+            // Winner's connection & request become handles of caller's Url
+            url->close();
+            url->connection     = a->url->connection;
+            url->filehandle     = a->url->filehandle;
+            url->startOffset    = a->url->startOffset;
+            url->timings        = a->url->timings;
+            url->httpStatus     = a->url->httpStatus;
+            url->validator      = a->url->validator;
+            a->url->connection  = NULL;
+            a->url->filehandle  = NULL;
+        }
+
+        release(a, a == winner);
+    }
+
+    if(winner)
+        return url->filehandle;
+
+    // Both requests failed, error of primary one is reported
+    if(exception == HEDGE_HTTP_ERROR)
+        throw HTTPError(what, retryAfter);
+    else if(exception == HEDGE_FATAL_ERROR)
+        throw FatalNetworkError(what);
+
+    SetLastError(error);
+    return NULL;
+}
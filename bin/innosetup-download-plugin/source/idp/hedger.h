@@ -0,0 +1,53 @@
+#pragma once
+
+#include <windows.h>
+#include <wininet.h>
+#include <deque>
+#include <vector>
+#include "tstring.h"
+
+#define DEFAULT_HEDGE_BUDGET 1048576 // bytes
+#define HEDGE_WASTE_ESTIMATE 65536   // bytes, charged for each cancelled request, which got response
+#define HEDGE_MIN_DELAY      50      // ms, hedge is never sent earlier
+#define HEDGE_MIN_SAMPLES    5
+#define HEDGE_MAX_SAMPLES    64
+
+using namespace std;
+
+class Url;
+struct HedgeAttempt;
+
+// Hedged requests. If response to request is not received within 90th percentile of
+// time to first byte, measured in this session (or within fixed delay), same request
+// is sent to Url::hedgeUrl (mirror) or over second connection to same server. First
+// successful response is used, other request is cancelled. Responses of cancelled
+// requests are charged against wasted bytes budget, hedging stops when it is spent.
+class Hedger
+{
+public:
+    Hedger();
+    ~Hedger();
+
+    HINTERNET open(Url *url, HINTERNET internet, const _TCHAR *httpVerb, DWORDLONG offset);
+    DWORD     delay(); // INFINITE, if not enough samples
+    void      wait();  // Waits for cancelled requests, must be called before session is closed
+    void      wait(DWORD msec);
+
+    DWORD     fixedDelay; // ms, 0 - use measured time to first byte
+    DWORDLONG budget;
+    DWORDLONG wasted;
+    int       hedges;     // Hedged requests sent
+    int       wins;       // ...which responded first
+
+protected:
+    HedgeAttempt *start(tstring address, Url *url, HINTERNET internet, const _TCHAR *httpVerb, DWORDLONG offset, HANDLE event);
+    void          finished(HedgeAttempt *attempt);
+    void          release(HedgeAttempt *attempt, bool winner);
+    void          addSample(DWORD ttfb);
+
+    deque<DWORD>     samples;
+    vector<HANDLE>   detached; // Threads of cancelled requests
+    CRITICAL_SECTION lock;
+
+    friend unsigned __stdcall hedgeThreadProc(void *param);
+};
@@ -0,0 +1,215 @@
+#include "hostscheduler.h"
+#include "trace.h"
+
+HostScheduler hostScheduler;
+
+HostScheduler::HostScheduler()
+{
+    defaultLimit = DEFAULT_HOST_CONNECTIONS;
+    turn         = 0;
+    released     = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+    InitializeCriticalSection(&lock);
+}
+
+HostScheduler::~HostScheduler()
+{
+    CloseHandle(released);
+    DeleteCriticalSection(&lock);
+}
+
+bool HostScheduler::setLimits(tstring spec)
+{
+    bool    res = true;
+    tstring item;
+
+    EnterCriticalSection(&lock);
+
+    for(size_t i = 0; i <= spec.length(); i++)
+    {
+        if((i < spec.length()) && (spec[i] != _T(';')) && (spec[i] != _T(',')) && (spec[i] != _T(' ')))
+        {
+            item += spec[i];
+            continue;
+        }
+
+        if(item.empty())
+            continue;
+
+        size_t  eq    = item.find(_T('='));
+        tstring value = tstrlower(item.substr((eq == tstring::npos) ? 0 : eq + 1).c_str());
+        int     n     = _ttoi(value.c_str());
+
+        if((value.compare(_T("default")) == 0) || (value.compare(_T("auto")) == 0))
+            n = DEFAULT_HOST_CONNECTIONS;
+        else if(value.empty() || (value.find_first_not_of(_T("0123456789")) != tstring::npos))
+            n = -1;
+
+        if(n < 0)
+            res = false;
+        else if(eq == tstring::npos)
+            defaultLimit = n;
+        else if(eq)
+            limits[tstrlower(item.substr(0, eq).c_str())] = n;
+        else
+            res = false;
+
+        item.clear();
+    }
+
+    LeaveCriticalSection(&lock);
+    return res;
+}
+
+// Called with lock held
+int HostScheduler::limit(tstring host)
+{
+    map<tstring, int>::iterator i = limits.find(host);
+    return (i == limits.end()) ? defaultLimit : i->second;
+}
+
+int HostScheduler::active(tstring host)
+{
+    EnterCriticalSection(&lock);
+    int res = connections.count(host) ? connections[host] : 0;
+    LeaveCriticalSection(&lock);
+    return res;
+}
+
+// Called with lock held
+bool HostScheduler::hasFree(tstring host)
+{
+    int n = limit(host);
+    return !n || !connections.count(host) || (connections[host] < n);
+}
+
+bool HostScheduler::acquire(tstring host, bool *cancelled)
+{
+    bool waited = false;
+
+    for(;;)
+    {
+        EnterCriticalSection(&lock);
+
+        if(hasFree(host))
+        {
+            connections[host]++;
+            LeaveCriticalSection(&lock);
+
+            if(waited)
+            {
+                TRACE(_T("Got connection to %s"), host.c_str());
+            }
+
+            return true;
+        }
+
+        if(!waited)
+        {
+            TRACE(_T("All %d connections to %s are busy, waiting"), limit(host), host.c_str());
+        }
+
+        ResetEvent(released);
+        LeaveCriticalSection(&lock);
+
+        if(cancelled && *cancelled)
+            return false;
+
+        waited = true;
+        WaitForSingleObject(released, HOST_WAIT_INTERVAL);
+    }
+}
+
+int HostScheduler::tryAcquire(tstring host, int count)
+{
+    int n = 0;
+
+    EnterCriticalSection(&lock);
+
+    while((n < count) && hasFree(host))
+    {
+        connections[host]++;
+        n++;
+    }
+
+    LeaveCriticalSection(&lock);
+    return n;
+}
+
+void HostScheduler::release(tstring host, int count)
+{
+    if(!count)
+        return;
+
+    EnterCriticalSection(&lock);
+
+    if((connections[host] -= count) <= 0)
+        connections.erase(host);
+
+    SetEvent(released);
+    LeaveCriticalSection(&lock);
+}
+
+// Round robin across hosts: of hosts with free connections, one which was picked longest ago
+// is taken, its first queued item goes next. If all hosts are busy, same order is used anyway.
+size_t HostScheduler::pick(const vector<tstring> &hosts)
+{
+    size_t best     = hosts.size();
+    bool   bestFree = false;
+    DWORD  bestTurn = 0;
+
+    EnterCriticalSection(&lock);
+
+    for(size_t i = 0; i < hosts.size(); i++)
+    {
+        bool  isFree   = hasFree(hosts[i]);
+        DWORD lastTurn = served.count(hosts[i]) ? served[hosts[i]] : 0;
+
+        if((best == hosts.size()) || (isFree && !bestFree) || ((isFree == bestFree) && (lastTurn < bestTurn)))
+        {
+            best     = i;
+            bestFree = isFree;
+            bestTurn = lastTurn;
+        }
+    }
+
+    if(best < hosts.size())
+        served[hosts[best]] = ++turn;
+
+    LeaveCriticalSection(&lock);
+    return best;
+}
+
+HostSlots::HostSlots(tstring host)
+{
+    hostName = host;
+    count    = 0;
+}
+
+HostSlots::~HostSlots()
+{
+    release();
+}
+
+bool HostSlots::acquire(bool *cancelled)
+{
+    if(!hostScheduler.acquire(hostName, cancelled))
+        return false;
+
+    count++;
+    return true;
+}
+
+int HostSlots::tryAcquire(int n)
+{
+    int got = (n > 0) ? hostScheduler.tryAcquire(hostName, n) : 0;
+
+    count += got;
+    return got;
+}
+
+void HostSlots::release()
+{
+    hostScheduler.release(hostName, count);
+    count = 0;
+}
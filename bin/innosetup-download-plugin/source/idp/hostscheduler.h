@@ -0,0 +1,60 @@
+#pragma once
+
+#include <windows.h>
+#include <map>
+#include <vector>
+#include "tstring.h"
+
+#define DEFAULT_HOST_CONNECTIONS 4
+#define HOST_WAIT_INTERVAL       100 // ms, waiting threads check for cancel this often
+
+using namespace std;
+
+// Limits number of connections to each host. Connections of all downloaders in process
+// (prefetch, idpget jobs, FTP segments & scanners, hedged requests) are counted together.
+// File transfer waits for free connection, extra connections (segments, hedges) are only
+// opened, if host has free connections. Queued files are taken in round-robin order of
+// hosts, so one host with many files doesn't keep others idle (see pick).
+class HostScheduler
+{
+public:
+    HostScheduler();
+    ~HostScheduler();
+
+    bool   setLimits(tstring spec); // "4", "github.com=2", "4; github.com=2; ftp.example.org=1"
+    bool   acquire(tstring host, bool *cancelled); // false, if cancelled while waiting
+    int    tryAcquire(tstring host, int count);    // Acquires free connections (up to count), returns their number
+    void   release(tstring host, int count);
+    size_t pick(const vector<tstring> &hosts);     // Index of queued item to start next, hosts - of queued items
+    int    active(tstring host);
+
+    int defaultLimit; // 0 - unlimited
+
+protected:
+    int  limit(tstring host);
+    bool hasFree(tstring host);
+
+    map<tstring, int>   limits;
+    map<tstring, int>   connections;
+    map<tstring, DWORD> served;   // Host, last picked at this turn
+    DWORD               turn;
+    CRITICAL_SECTION    lock;
+    HANDLE              released;
+};
+
+// Connections, acquired from hostScheduler, released at end of scope
+class HostSlots
+{
+public:
+    HostSlots(tstring host);
+    ~HostSlots();
+
+    bool acquire(bool *cancelled);
+    int  tryAcquire(int n);
+    void release();
+
+    tstring hostName;
+    int     count;
+};
+
+extern HostScheduler hostScheduler;
@@ -4,8 +4,10 @@
 HINSTANCE idpDllHandle = NULL;
 
 Downloader      downloader;
+Extractor       extractor;
 Ui              ui;
 InternetOptions internetOptions;
+tstring         location = _T("auto");
 
 void idpAddFile(_TCHAR *url, _TCHAR *filename)
 {
@@ -42,8 +44,75 @@ void idpAddFtpDirComp(_TCHAR *url, _TCHAR *mask, _TCHAR *destdir, bool recursive
     downloader.addFtpDir(STR(url), STR(mask), STR(destdir), recursive, components);
 }
 
+bool idpAddMetalink(_TCHAR *source, _TCHAR *destdir)
+{
+    return idpAddMetalinkComp(source, destdir, NULL);
+}
+
+bool idpAddMetalinkComp(_TCHAR *source, _TCHAR *destdir, _TCHAR *components)
+{
+    downloader.location = locationVal(location);
+    downloader.setInternetOptions(internetOptions);
+    return downloader.addMetalink(STR(source), STR(destdir), STR(components));
+}
+
+void idpAddZipMembers(_TCHAR *url, _TCHAR *filename, _TCHAR *include, _TCHAR *exclude, _TCHAR *extractdir)
+{
+    downloader.addZipMembers(STR(url), STR(filename), STR(include), STR(exclude), STR(extractdir));
+}
+
+void idpAddZipMembersComp(_TCHAR *url, _TCHAR *filename, _TCHAR *include, _TCHAR *exclude, _TCHAR *extractdir, _TCHAR *components)
+{
+    downloader.addZipMembers(STR(url), STR(filename), STR(include), STR(exclude), STR(extractdir), STR(components));
+}
+
+void idpExtract(_TCHAR *archive, _TCHAR *destdir)
+{
+    downloader.extractor = &extractor;
+    extractor.add(STR(archive), STR(destdir));
+}
+
+bool idpExtractAll()
+{
+    DWORDLONG total, done;
+    tstring   current, shown;
+    MSG       msg;
+
+    extractor.startAll();
+    ui.setStatus(ui.msg("Extracting..."));
+    ui.setMarquee(false);
+
+    while(!extractor.wait(100))
+    {
+        extractor.progress(&total, &done, &current);
+
+        if(current.compare(shown) != 0)
+        {
+            ui.setFileName(current);
+            shown = current;
+        }
+
+        ui.setProgressInfo(total, done, total, done);
+
+        while(PeekMessage(&msg, 0, 0, 0, PM_REMOVE))
+        {
+            TranslateMessage(&msg);
+            DispatchMessage(&msg);
+        }
+    }
+
+    bool res = extractor.succeeded();
+
+    extractor.progress(&total, &done, &current);
+    ui.setProgressInfo(total, done, total, done);
+    ui.setStatus(res ? ui.msg("Extraction complete") : ui.msg("Extraction failed") + _T(": ") + extractor.getLastErrorStr());
+    extractor.clear();
+    return res;
+}
+
 void idpClearFiles()
 {
+    downloader.stopPrefetch();
     downloader.clearFiles();
 }
 
@@ -174,6 +243,12 @@ void idpSetComponents(_TCHAR *components)
     downloader.setComponents(STR(components));
 }
 
+void idpPrefetch(_TCHAR *components)
+{
+    downloader.setInternetOptions(internetOptions);
+    downloader.startPrefetch(STR(components));
+}
+
 void idpStartDownload()
 {
     ui.lockButtons();
@@ -326,6 +401,60 @@ int bufSizeVal(_TCHAR *value)
     return bufSize ? bufSize : DEFAULT_READ_BUFSIZE;
 }
 
+int connectionsVal(_TCHAR *value, int defaultVal)
+{
+    string val = toansi(tstrlower(STR(value)));
+
+    if(val.compare("default") == 0) return defaultVal;
+    if(val.compare("auto")    == 0) return defaultVal;
+
+    int connections = _ttoi(value);
+    return (connections > 0) ? connections : defaultVal;
+}
+
+DWORDLONG sizeVal(_TCHAR *value, DWORDLONG defaultVal)
+{
+    string val = toansi(tstrlower(STR(value)));
+
+    if(val.compare("default") == 0) return defaultVal;
+    if(val.compare("auto")    == 0) return defaultVal;
+
+    __int64 size = _ttoi64(STR(value));
+    return (size > 0) ? (DWORDLONG)size : defaultVal;
+}
+
+// 0 or "infinite" turns stall detection off
+DWORD stallTimeoutVal(_TCHAR *value)
+{
+    string val = toansi(tstrlower(STR(value)));
+
+    if(val.compare("default") == 0) return DEFAULT_STALL_TIMEOUT;
+
+    DWORD timeout = timeoutVal(value);
+    return (timeout == TIMEOUT_INFINITE) ? 0 : timeout;
+}
+
+// "auto" - country, set in Windows regional settings, "none" - location is not used
+tstring locationVal(tstring value)
+{
+    tstring val = tstrlower(value.c_str());
+
+    if(val.compare(_T("none")) == 0)
+        return _T("");
+
+    if((val.compare(_T("auto")) == 0) || (val.compare(_T("default")) == 0))
+    {
+        _TCHAR iso2[8];
+
+        if(GetGeoInfo(GetUserGeoID(GEOCLASS_NATION), GEO_ISO2, iso2, sizeof(iso2) / sizeof(_TCHAR), 0))
+            return tstrlower(iso2);
+
+        return _T("");
+    }
+
+    return val;
+}
+
 void idpSetInternalOption(_TCHAR *name, _TCHAR *value)
 {
     if(!name)
@@ -342,7 +471,32 @@ void idpSetInternalOption(_TCHAR *name, _TCHAR *value)
     }
     else if(key.compare("stoponerror")      == 0) downloader.stopOnError         = boolVal(value);
     else if(key.compare("preserveftpdirs")  == 0) downloader.preserveFtpDirs     = boolVal(value);
+    else if(key.compare("ftpsnapshot")      == 0) downloader.ftpSnapshots        = boolVal(value);
+    else if(key.compare("resumejournal")    == 0) downloader.resumeJournal       = boolVal(value);
+    else if(key.compare("piecesidecar")     == 0) downloader.pieceSidecar        = boolVal(value);
     else if(key.compare("readbuffersize")   == 0) downloader.readBufferSize      = bufSizeVal(value);
+    else if(key.compare("buffermemory")     == 0) bufferPool.budget              = (_tcscmp(STR(value), _T("0")) == 0) ? 0 : sizeVal(value, DEFAULT_BUFFER_BUDGET);
+    else if(key.compare("ftpscanconnections") == 0) downloader.ftpScanConnections = connectionsVal(value, DEFAULT_FTP_SCAN_CONNECTIONS);
+    else if(key.compare("extractthreads")   == 0) extractor.maxThreads           = connectionsVal(value, DEFAULT_EXTRACT_THREADS);
+    else if(key.compare("hostconnections")  == 0) hostScheduler.setLimits(STR(value));
+    else if(key.compare("adaptiveconcurrency") == 0) concurrency.enabled         = boolVal(value);
+    else if(key.compare("maxstreams")       == 0) concurrency.maxStreams         = connectionsVal(value, DEFAULT_MAX_STREAMS);
+    else if(key.compare("ftpsegments")      == 0) downloader.ftpSegments         = connectionsVal(value, DEFAULT_FTP_SEGMENTS);
+    else if(key.compare("asynctransfers")   == 0) downloader.asyncTransfers      = connectionsVal(value, 0);
+    else if(key.compare("asyncthreads")     == 0) downloader.asyncThreads        = connectionsVal(value, DEFAULT_ASYNC_THREADS);
+    else if(key.compare("ftpsegmentminsize") == 0) downloader.ftpSegmentMinSize  = sizeVal(value, DEFAULT_FTP_SEGMENT_MIN_SIZE);
+    else if(key.compare("stalltimeout")     == 0) downloader.stallTimeout        = stallTimeoutVal(value);
+    else if(key.compare("stallspeed")       == 0) downloader.stallSpeed          = (DWORD)sizeVal(value, DEFAULT_STALL_SPEED);
+    else if(key.compare("stallratio")       == 0) downloader.stallRatio          = _ttoi(value);
+    else if(key.compare("hedge")            == 0) downloader.hedging             = boolVal(value);
+    else if(key.compare("hedgedelay")       == 0) downloader.hedger.fixedDelay   = timeoutVal(value);
+    else if(key.compare("hedgebudget")      == 0) downloader.hedger.budget       = sizeVal(value, DEFAULT_HEDGE_BUDGET);
+    else if(key.compare("retryattempts")    == 0) downloader.retryPolicy.attempts  = connectionsVal(value, DEFAULT_RETRY_ATTEMPTS);
+    else if(key.compare("retrydelay")       == 0) downloader.retryPolicy.baseDelay = timeoutVal(value);
+    else if(key.compare("retrymaxdelay")    == 0) downloader.retryPolicy.maxDelay  = timeoutVal(value);
+    else if(key.compare("tracefile")        == 0) downloader.traceFile           = STR(value);
+    else if(key.compare("perfreport")       == 0) downloader.perfReportFile      = STR(value);
+    else if(key.compare("location")         == 0) location                       = STR(value);
     else if(key.compare("retrybutton")      == 0) ui.hasRetryButton              = boolVal(value);
     else if(key.compare("redrawbackground") == 0) ui.redrawBackground            = boolVal(value);
     else if(key.compare("errordialog")      == 0) ui.errorDlgMode                = dlgVal(value);
@@ -366,6 +520,13 @@ void idpSetInternalOption(_TCHAR *name, _TCHAR *value)
         if(!internetOptions.proxyName.empty())
             internetOptions.accessType = INTERNET_OPEN_TYPE_PROXY;
     }
+    else if(key.compare("transport")        == 0)
+    {
+        Transport *transport = findTransport(STR(value));
+
+        if(transport)
+            setDefaultTransport(transport);
+    }
 }
 
 void idpSetProxyMode(_TCHAR *mode)
@@ -406,6 +567,11 @@ void idpTrace(_TCHAR *text)
     TRACE(_T("%s"), text);
 }
 
+bool idpDumpTrace(_TCHAR *filename)
+{
+    return downloader.dumpTrace(STR(filename));
+}
+
 BOOL WINAPI DllMain(HINSTANCE hinstDLL, DWORD dwReason, LPVOID lpvReserved)
 {
     if(dwReason == DLL_PROCESS_ATTACH)
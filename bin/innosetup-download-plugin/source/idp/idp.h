@@ -15,6 +15,12 @@ void idpAddFileSizeComp32(_TCHAR *url, _TCHAR *filename, DWORD size, _TCHAR *com
 void idpAddMirror(_TCHAR *url, _TCHAR *mirror);
 void idpAddFtpDir(_TCHAR *url, _TCHAR *mask, _TCHAR *destdir, bool recursive);
 void idpAddFtpDirComp(_TCHAR *url, _TCHAR *mask, _TCHAR *destdir, bool recursive, _TCHAR *components);
+bool idpAddMetalink(_TCHAR *source, _TCHAR *destdir);
+bool idpAddMetalinkComp(_TCHAR *source, _TCHAR *destdir, _TCHAR *components);
+void idpAddZipMembers(_TCHAR *url, _TCHAR *filename, _TCHAR *include, _TCHAR *exclude, _TCHAR *extractdir);
+void idpAddZipMembersComp(_TCHAR *url, _TCHAR *filename, _TCHAR *include, _TCHAR *exclude, _TCHAR *extractdir, _TCHAR *components);
+void idpExtract(_TCHAR *archive, _TCHAR *destdir);
+bool idpExtractAll();
 void idpClearFiles();
 int  idpFilesCount();
 int  idpFtpDirsCount();
@@ -37,13 +43,16 @@ void idpConnectControl(_TCHAR *name, HWND handle);
 void idpAddMessage(_TCHAR *name, _TCHAR *message);
 void idpSetInternalOption(_TCHAR *name, _TCHAR *value);
 void idpSetComponents(_TCHAR *components);
+void idpPrefetch(_TCHAR *components);
 void idpSetDetailedMode(bool mode);
 void idpStartDownload();
 void idpStopDownload();
 void idpReportError();
 void idpTrace(_TCHAR *text);
+bool idpDumpTrace(_TCHAR *filename);
 
 BOOL WINAPI DllMain(HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpvReserved);
 }
 
-void downloadFinished(Downloader *d, bool res);
+void    downloadFinished(Downloader *d, bool res);
+tstring locationVal(tstring value);
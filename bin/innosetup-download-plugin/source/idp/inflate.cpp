@@ -0,0 +1,383 @@
+#include <string.h>
+#include "inflate.h"
+#include "hash.h"
+
+#define INFLATE_MAX_BITS 15
+#define INFLATE_WINDOW_MASK (INFLATE_WINDOW_SIZE - 1)
+
+static const short lengthBase[29]  = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const short lengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const short distBase[30]    = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const short distExtra[30]   = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+Inflater::Inflater(FILE *input, DWORDLONG inputSize, FILE *output)
+{
+    in         = input;
+    out        = output;
+    inLeft     = inputSize;
+    inPos      = 0;
+    inLen      = 0;
+    bitBuf     = 0;
+    bitCount   = 0;
+    error      = false;
+    windowPos  = 0;
+    flushed    = 0;
+    crc        = 0;
+    outputSize = 0;
+}
+
+bool Inflater::run()
+{
+    int last;
+
+    do
+    {
+        last = bits(1);
+
+        switch(bits(2))
+        {
+        case 0 : error = error || !stored(); break;
+        case 1 : error = error || !fixed();  break;
+        case 2 : error = error || !dynamic(); break;
+        default: error = true;
+        }
+    }
+    while(!last && !error);
+
+    return flush() && !error;
+}
+
+// Reads next block of compressed data, false if there is no more
+bool Inflater::fill()
+{
+    if(!inLeft)
+        return false;
+
+    size_t n = (size_t)((inLeft < INFLATE_BUFSIZE) ? inLeft : INFLATE_BUFSIZE);
+
+    inLen   = fread(inBuf, 1, n, in);
+    inPos   = 0;
+    inLeft -= inLen;
+
+    if(inLen != n)
+        inLeft = 0;
+
+    return inLen > 0;
+}
+
+int Inflater::bits(int need)
+{
+    while(bitCount < need)
+    {
+        if((inPos == inLen) && !fill())
+        {
+            error = true;
+            return 0;
+        }
+
+        bitBuf   |= (DWORD)inBuf[inPos++] << bitCount;
+        bitCount += 8;
+    }
+
+    int val = (int)(bitBuf & ((1UL << need) - 1));
+
+    bitBuf  >>= need;
+    bitCount -= need;
+    return val;
+}
+
+int Inflater::decode(const Huffman *h)
+{
+    while((bitCount < INFLATE_FAST_BITS) && ((inPos < inLen) || fill()))
+    {
+        bitBuf   |= (DWORD)inBuf[inPos++] << bitCount;
+        bitCount += 8;
+    }
+
+    if(bitCount >= INFLATE_FAST_BITS)
+    {
+        int entry = h->fast[bitBuf & ((1 << INFLATE_FAST_BITS) - 1)];
+
+        if(entry)
+        {
+            bitBuf  >>= entry >> 9;
+            bitCount -= entry >> 9;
+            return entry & 511;
+        }
+    }
+
+    // Long code or end of input: bit by bit (codes are stored with most significant bit first)
+    int code  = 0;
+    int first = 0;
+    int index = 0;
+
+    for(int len = 1; len <= INFLATE_MAX_BITS; len++)
+    {
+        code |= bits(1);
+
+        if(error)
+            return -1;
+
+        int count = h->count[len];
+
+        if(code - count < first)
+            return h->symbol[index + (code - first)];
+
+        index += count;
+        first += count;
+        first <<= 1;
+        code  <<= 1;
+    }
+
+    return -1;
+}
+
+// Builds canonical Huffman code from code lengths. Returns false, if lengths are over-subscribed,
+// or incomplete, except single code (allowed by RFC 1951 for distance codes).
+bool Inflater::build(Huffman *h, const short *length, int n)
+{
+    short offset[INFLATE_MAX_BITS + 2];
+
+    memset(h->count, 0, sizeof(h->count));
+    memset(h->fast, 0, sizeof(h->fast));
+
+    for(int s = 0; s < n; s++)
+        h->count[length[s]]++;
+
+    if(h->count[0] == n)
+        return true; // No codes: only valid, if they are not used
+
+    int left = 1;
+
+    for(int len = 1; len <= INFLATE_MAX_BITS; len++)
+    {
+        left <<= 1;
+        left  -= h->count[len];
+
+        if(left < 0)
+            return false;
+    }
+
+    offset[1] = 0;
+
+    for(int len = 1; len <= INFLATE_MAX_BITS; len++)
+        offset[len + 1] = offset[len] + h->count[len];
+
+    for(int s = 0; s < n; s++)
+        if(length[s])
+            h->symbol[offset[length[s]]++] = (short)s;
+
+    // Table of short codes, indexed by next input bits (which hold code reversed)
+    int code  = 0;
+    int index = 0;
+
+    for(int len = 1; len <= INFLATE_FAST_BITS; len++)
+    {
+        for(int k = 0; k < h->count[len]; k++, code++)
+        {
+            int reversed = 0;
+
+            for(int b = 0; b < len; b++)
+                reversed |= ((code >> b) & 1) << (len - 1 - b);
+
+            for(int i = reversed; i < (1 << INFLATE_FAST_BITS); i += 1 << len)
+                h->fast[i] = (short)((len << 9) | h->symbol[index + k]);
+        }
+
+        index += h->count[len];
+        code <<= 1;
+    }
+
+    return (left == 0) || ((left > 0) && (n - h->count[0] == 1));
+}
+
+bool Inflater::stored()
+{
+    // Block starts at byte boundary, whole bytes, which are already in bit buffer, come first
+    bitBuf  >>= bitCount & 7;
+    bitCount -= bitCount & 7;
+
+    int len  = bits(16);
+    int nlen = bits(16);
+
+    if(error || (len != (~nlen & 0xffff)))
+        return false;
+
+    while(len && bitCount)
+    {
+        put((BYTE)bits(8));
+        len--;
+    }
+
+    while(len)
+    {
+        if((inPos == inLen) && !fill())
+            return false;
+
+        put(inBuf[inPos++]);
+        len--;
+    }
+
+    return true;
+}
+
+bool Inflater::fixed()
+{
+    Huffman lencode, distcode;
+    short   length[288];
+    int     s;
+
+    for(s = 0;   s < 144; s++) length[s] = 8;
+    for(;        s < 256; s++) length[s] = 9;
+    for(;        s < 280; s++) length[s] = 7;
+    for(;        s < 288; s++) length[s] = 8;
+
+    build(&lencode, length, 288);
+
+    for(s = 0; s < 30; s++)
+        length[s] = 5;
+
+    build(&distcode, length, 30);
+    return codes(&lencode, &distcode);
+}
+
+bool Inflater::dynamic()
+{
+    static const short order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+    Huffman lencode, distcode;
+    short   length[286 + 30];
+    int     nlen  = bits(5) + 257;
+    int     ndist = bits(5) + 1;
+    int     ncode = bits(4) + 4;
+
+    if(error || (nlen > 286) || (ndist > 30))
+        return false;
+
+    int index;
+
+    for(index = 0; index < ncode; index++)
+        length[order[index]] = (short)bits(3);
+
+    for(; index < 19; index++)
+        length[order[index]] = 0;
+
+    if(error || !build(&lencode, length, 19) || (lencode.count[0] + 1 == 19))
+        return false;
+
+    for(index = 0; index < nlen + ndist; )
+    {
+        int symbol = decode(&lencode);
+
+        if(symbol < 0)
+            return false;
+
+        if(symbol < 16)
+        {
+            length[index++] = (short)symbol;
+            continue;
+        }
+
+        short len = 0;
+        int   repeat;
+
+        if(symbol == 16)
+        {
+            if(!index)
+                return false;
+
+            len    = length[index - 1];
+            repeat = 3 + bits(2);
+        }
+        else if(symbol == 17)
+            repeat = 3 + bits(3);
+        else
+            repeat = 11 + bits(7);
+
+        if(error || (index + repeat > nlen + ndist))
+            return false;
+
+        while(repeat--)
+            length[index++] = len;
+    }
+
+    // End of block code is required
+    if(!length[256])
+        return false;
+
+    if(!build(&lencode, length, nlen) || !build(&distcode, length + nlen, ndist))
+        return false;
+
+    return codes(&lencode, &distcode);
+}
+
+bool Inflater::codes(const Huffman *lencode, const Huffman *distcode)
+{
+    for(;;)
+    {
+        int symbol = decode(lencode);
+
+        if(symbol < 0)
+            return false;
+
+        if(symbol < 256)
+        {
+            put((BYTE)symbol);
+            continue;
+        }
+
+        if(symbol == 256)
+            return !error;
+
+        symbol -= 257;
+
+        if(symbol >= 29)
+            return false;
+
+        int len = lengthBase[symbol] + bits(lengthExtra[symbol]);
+
+        symbol = decode(distcode);
+
+        if((symbol < 0) || (symbol >= 30))
+            return false;
+
+        DWORD dist = distBase[symbol] + bits(distExtra[symbol]);
+
+        if(error || (dist > outputSize))
+            return false;
+
+        while(len--)
+            put(window[(windowPos - dist) & INFLATE_WINDOW_MASK]);
+    }
+}
+
+void Inflater::put(BYTE b)
+{
+    window[windowPos++] = b;
+    outputSize++;
+
+    if(windowPos == INFLATE_WINDOW_SIZE)
+    {
+        if(!flush())
+            error = true;
+
+        windowPos = 0;
+        flushed   = 0;
+    }
+}
+
+// Writes output, accumulated in window
+bool Inflater::flush()
+{
+    size_t size = windowPos - flushed;
+
+    if(!size)
+        return true;
+
+    crc = crc32(crc, window + flushed, size);
+
+    bool res = fwrite(window + flushed, 1, size, out) == size;
+
+    flushed = windowPos;
+    return res;
+}
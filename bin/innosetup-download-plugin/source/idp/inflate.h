@@ -0,0 +1,54 @@
+#pragma once
+
+#include <windows.h>
+#include <stdio.h>
+
+#define INFLATE_WINDOW_SIZE 32768
+#define INFLATE_BUFSIZE     65536
+#define INFLATE_FAST_BITS   9     // Codes up to this length are decoded with one table lookup
+
+// Raw DEFLATE (RFC 1951) decoder, used to extract zip archive members.
+// Reads compressed data from current position of input file, writes decompressed
+// data to output file and computes its CRC-32. Own implementation: DLL has no zlib dependency.
+class Inflater
+{
+public:
+    Inflater(FILE *input, DWORDLONG inputSize, FILE *output);
+
+    bool run(); // false on corrupted data, read or write error
+
+    DWORD     crc;
+    DWORDLONG outputSize;
+
+protected:
+    struct Huffman
+    {
+        short count[16];  // Number of codes of each length
+        short symbol[288]; // Symbols, ordered by code
+        short fast[1 << INFLATE_FAST_BITS]; // (length << 9) | symbol by next bits, 0 - longer code
+    };
+
+    bool fill();
+    int  bits(int need);
+    int  decode(const Huffman *h);
+    bool build(Huffman *h, const short *length, int n);
+    bool stored();
+    bool fixed();
+    bool dynamic();
+    bool codes(const Huffman *lencode, const Huffman *distcode);
+    void put(BYTE b);
+    bool flush();
+
+    FILE     *in;
+    FILE     *out;
+    DWORDLONG inLeft;   // Compressed bytes, not read from file yet
+    BYTE      inBuf[INFLATE_BUFSIZE];
+    size_t    inPos;
+    size_t    inLen;
+    DWORD     bitBuf;
+    int       bitCount;
+    bool      error;
+    BYTE      window[INFLATE_WINDOW_SIZE]; // Last output bytes for back references, also output buffer
+    size_t    windowPos;
+    size_t    flushed;  // Position in window, up to which output is written
+};
@@ -0,0 +1,451 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <map>
+#include "metalink.h"
+#include "url.h"
+#include "trace.h"
+
+#define METALINK_MAX_SIZE 16777216
+
+struct XmlNode
+{
+    string          name; // Without namespace prefix
+    vector<string>  attrNames;
+    vector<string>  attrValues;
+    string          text;
+    vector<XmlNode> children;
+
+    string attr(const char *attrName)
+    {
+        for(size_t i = 0; i < attrNames.size(); i++)
+            if(attrNames[i].compare(attrName) == 0)
+                return attrValues[i];
+
+        return "";
+    }
+};
+
+static string stripPrefix(string name)
+{
+    size_t colon = name.find(':');
+    return (colon == string::npos) ? name : name.substr(colon + 1);
+}
+
+static void appendUtf8(string &s, unsigned long c)
+{
+    if(c < 0x80)
+        s += (char)c;
+    else if(c < 0x800)
+    {
+        s += (char)(0xc0 | (c >> 6));
+        s += (char)(0x80 | (c & 0x3f));
+    }
+    else if(c < 0x10000)
+    {
+        s += (char)(0xe0 | (c >> 12));
+        s += (char)(0x80 | ((c >> 6) & 0x3f));
+        s += (char)(0x80 | (c & 0x3f));
+    }
+    else
+    {
+        s += (char)(0xf0 | (c >> 18));
+        s += (char)(0x80 | ((c >> 12) & 0x3f));
+        s += (char)(0x80 | ((c >> 6) & 0x3f));
+        s += (char)(0x80 | (c & 0x3f));
+    }
+}
+
+static string decodeEntities(const string &s)
+{
+    string r;
+
+    for(size_t i = 0; i < s.length(); i++)
+    {
+        size_t semicolon;
+
+        if((s[i] != '&') || ((semicolon = s.find(';', i)) == string::npos))
+        {
+            r += s[i];
+            continue;
+        }
+
+        string entity = s.substr(i + 1, semicolon - i - 1);
+
+        if(entity.compare("lt") == 0)        r += '<';
+        else if(entity.compare("gt") == 0)   r += '>';
+        else if(entity.compare("amp") == 0)  r += '&';
+        else if(entity.compare("quot") == 0) r += '"';
+        else if(entity.compare("apos") == 0) r += '\'';
+        else if(!entity.empty() && (entity[0] == '#'))
+            appendUtf8(r, (entity.length() > 1 && (entity[1] == 'x' || entity[1] == 'X')) ? strtoul(entity.c_str() + 2, NULL, 16) : strtoul(entity.c_str() + 1, NULL, 10));
+        else
+        {
+            r += s[i];
+            continue;
+        }
+
+        i = semicolon;
+    }
+
+    return r;
+}
+
+static string trim(const string &s)
+{
+    size_t first = s.find_first_not_of(" \t\r\n");
+
+    if(first == string::npos)
+        return "";
+
+    return s.substr(first, s.find_last_not_of(" \t\r\n") - first + 1);
+}
+
+// Minimal non-validating XML parser: elements, attributes, text, CDATA & character entities.
+// Declarations, comments, processing instructions & DTD are skipped.
+class XmlParser
+{
+public:
+    XmlParser(const string &text): xml(text), pos(0) {}
+
+    bool parse(XmlNode *root)
+    {
+        if(!skipMisc() || (pos >= xml.length()))
+            return false;
+
+        return element(root, 0);
+    }
+
+protected:
+    // Skips whitespace, <?...?>, <!--...-->, <!DOCTYPE...>, returns false on unterminated construct
+    bool skipMisc()
+    {
+        for(;;)
+        {
+            while((pos < xml.length()) && isspace((unsigned char)xml[pos]))
+                pos++;
+
+            if(xml.compare(pos, 2, "<?") == 0)
+                pos = xml.find("?>", pos);
+            else if(xml.compare(pos, 4, "<!--") == 0)
+                pos = xml.find("-->", pos);
+            else if(xml.compare(pos, 2, "<!") == 0)
+                pos = xml.find(">", pos);
+            else
+                return true;
+
+            if(pos == string::npos)
+                return false;
+
+            pos = xml.find('>', pos) + 1;
+        }
+    }
+
+    bool element(XmlNode *node, int depth)
+    {
+        if((depth > 32) || (xml[pos] != '<'))
+            return false;
+
+        size_t nameEnd = xml.find_first_of(" \t\r\n/>", ++pos);
+
+        if(nameEnd == string::npos)
+            return false;
+
+        string qname = xml.substr(pos, nameEnd - pos);
+        node->name   = stripPrefix(qname);
+        pos          = nameEnd;
+
+        // Attributes
+        for(;;)
+        {
+            while((pos < xml.length()) && isspace((unsigned char)xml[pos]))
+                pos++;
+
+            if(pos >= xml.length())
+                return false;
+
+            if(xml.compare(pos, 2, "/>") == 0)
+            {
+                pos += 2;
+                return true;
+            }
+
+            if(xml[pos] == '>')
+            {
+                pos++;
+                break;
+            }
+
+            size_t eq = xml.find('=', pos);
+
+            if((eq == string::npos) || (eq + 1 >= xml.length()))
+                return false;
+
+            size_t valueStart = xml.find_first_not_of(" \t\r\n", eq + 1);
+
+            if((valueStart == string::npos) || ((xml[valueStart] != '"') && (xml[valueStart] != '\'')))
+                return false;
+
+            size_t valueEnd = xml.find(xml[valueStart], valueStart + 1);
+
+            if(valueEnd == string::npos)
+                return false;
+
+            node->attrNames.push_back(stripPrefix(trim(xml.substr(pos, eq - pos))));
+            node->attrValues.push_back(decodeEntities(xml.substr(valueStart + 1, valueEnd - valueStart - 1)));
+            pos = valueEnd + 1;
+        }
+
+        // Content
+        for(;;)
+        {
+            size_t tag = xml.find('<', pos);
+
+            if(tag == string::npos)
+                return false;
+
+            node->text += decodeEntities(xml.substr(pos, tag - pos));
+            pos = tag;
+
+            if(xml.compare(pos, 2, "</") == 0)
+            {
+                size_t end = xml.find('>', pos);
+
+                if((end == string::npos) || (trim(xml.substr(pos + 2, end - pos - 2)).compare(qname) != 0))
+                    return false;
+
+                pos        = end + 1;
+                node->text = trim(node->text);
+                return true;
+            }
+            else if(xml.compare(pos, 9, "<![CDATA[") == 0)
+            {
+                size_t end = xml.find("]]>", pos);
+
+                if(end == string::npos)
+                    return false;
+
+                node->text += xml.substr(pos + 9, end - pos - 9);
+                pos = end + 3;
+            }
+            else if((xml.compare(pos, 4, "<!--") == 0) || (xml.compare(pos, 2, "<?") == 0))
+            {
+                if(!skipMisc())
+                    return false;
+            }
+            else
+            {
+                node->children.push_back(XmlNode());
+
+                if(!element(&node->children.back(), depth + 1))
+                    return false;
+            }
+        }
+    }
+
+    const string &xml;
+    size_t        pos;
+};
+
+bool Metalink::load(tstring filename)
+{
+    FILE *f = _tfopen(filename.c_str(), _T("rb"));
+
+    if(!f)
+        return false;
+
+    string xml;
+    char   buffer[65536];
+    size_t n;
+
+    while(((n = fread(buffer, 1, sizeof(buffer), f)) > 0) && (xml.length() < METALINK_MAX_SIZE))
+        xml.append(buffer, n);
+
+    fclose(f);
+    return parse(xml);
+}
+
+bool Metalink::parse(const string &xml)
+{
+    XmlNode   root;
+    XmlParser parser(xml);
+
+    files.clear();
+
+    if(!parser.parse(&root) || (root.name.compare("metalink") != 0))
+    {
+        TRACE(_T("Not a Metalink document"));
+        return false;
+    }
+
+    // Metalink 4: metalink/file, Metalink 3: metalink/files/file
+    for(vector<XmlNode>::iterator i = root.children.begin(); i != root.children.end(); i++)
+    {
+        if(i->name.compare("file") == 0)
+            readFile(&*i);
+        else if(i->name.compare("files") == 0)
+            for(vector<XmlNode>::iterator j = i->children.begin(); j != i->children.end(); j++)
+                if(j->name.compare("file") == 0)
+                    readFile(&*j);
+    }
+
+    TRACE(_T("Metalink: %d files"), (int)files.size());
+    return true;
+}
+
+// Name must stay inside destination directory (RFC 5854, section 4.1.2.1)
+static bool safeName(const string &name)
+{
+    if(name.empty() || (name[0] == '/') || (name.find_first_of("\\:") != string::npos))
+        return false;
+
+    string part;
+
+    for(size_t i = 0; i <= name.length(); i++)
+    {
+        if((i == name.length()) || (name[i] == '/'))
+        {
+            if(part.empty() || (part.compare("..") == 0) || (part.compare(".") == 0))
+                return false;
+
+            part.clear();
+        }
+        else
+            part += name[i];
+    }
+
+    return true;
+}
+
+void Metalink::readFile(XmlNode *node)
+{
+    string name = node->attr("name");
+
+    if(!safeName(name))
+    {
+        TRACE(_T("Metalink: skipping file with unsafe name %s"), fromutf8(name).c_str());
+        return;
+    }
+
+    MetalinkFile file;
+
+    file.name          = fromutf8(name);
+    file.size          = FILE_SIZE_UNKNOWN;
+    file.hashAlgorithm = HASH_NONE;
+
+    for(vector<XmlNode>::iterator i = node->children.begin(); i != node->children.end(); i++)
+    {
+        if((i->name.compare("size") == 0) && !i->text.empty())
+            file.size = _strtoui64(i->text.c_str(), NULL, 10);
+        else if(i->name.compare("verification") == 0) // Metalink 3
+            readHashes(&*i, &file);
+        else if(i->name.compare("resources") == 0) // Metalink 3
+            readUrls(&*i, &file);
+    }
+
+    readHashes(node, &file);
+    readUrls(node, &file);
+
+    if(file.urls.empty())
+    {
+        TRACE(_T("Metalink: no usable URLs for %s"), file.name.c_str());
+        return;
+    }
+
+    files.push_back(file);
+}
+
+void Metalink::readHashes(XmlNode *node, MetalinkFile *file)
+{
+    for(vector<XmlNode>::iterator i = node->children.begin(); i != node->children.end(); i++)
+    {
+        int alg = Hash::algorithm(i->attr("type"));
+
+        if(alg == HASH_NONE)
+            continue;
+
+        if((i->name.compare("hash") == 0) && (alg > file->hashAlgorithm))
+        {
+            file->hashAlgorithm = alg;
+            file->hash          = toutf8(tstrlower(fromutf8(i->text).c_str()));
+        }
+        else if((i->name.compare("pieces") == 0) && (alg > file->pieces.algorithm))
+        {
+            PieceHashes       pieces;
+            map<long, string> numbered;
+            bool              valid = true;
+
+            pieces.algorithm = alg;
+            pieces.length    = _strtoui64(i->attr("length").c_str(), NULL, 10);
+
+            // Metalink 4 lists piece hashes in order, Metalink 3 numbers them with "piece" attribute
+            for(vector<XmlNode>::iterator j = i->children.begin(); j != i->children.end(); j++)
+            {
+                if(j->name.compare("hash") != 0)
+                    continue;
+
+                string piece = j->attr("piece");
+                char  *end   = NULL;
+                long   index = piece.empty() ? (numbered.empty() ? 0 : numbered.rbegin()->first + 1) : strtol(piece.c_str(), &end, 10);
+
+                if((end && *end) || (index < 0) || numbered.count(index))
+                    valid = false;
+
+                numbered[index] = toutf8(tstrlower(fromutf8(j->text).c_str()));
+            }
+
+            // Pieces must be numbered 0..n-1, and there can't be more of them, than file has
+            if(!numbered.empty() && (numbered.rbegin()->first != (long)numbered.size() - 1))
+                valid = false;
+
+            if(pieces.length && !(file->size == FILE_SIZE_UNKNOWN) && (numbered.size() > (file->size + pieces.length - 1) / pieces.length))
+                valid = false;
+
+            if(!valid)
+            {
+                TRACE(_T("Metalink: ignoring invalid piece hashes of %s"), file->name.c_str());
+                continue;
+            }
+
+            for(map<long, string>::iterator j = numbered.begin(); j != numbered.end(); j++)
+                pieces.hashes.push_back(j->second);
+
+            if(pieces.length && !pieces.hashes.empty())
+                file->pieces = pieces;
+        }
+    }
+}
+
+void Metalink::readUrls(XmlNode *node, MetalinkFile *file)
+{
+    for(vector<XmlNode>::iterator i = node->children.begin(); i != node->children.end(); i++)
+    {
+        if((i->name.compare("url") != 0) || i->text.empty())
+            continue;
+
+        MetalinkUrl url;
+        string      priority   = i->attr("priority");
+        string      preference = i->attr("preference");
+        string      type       = i->attr("type");
+
+        url.url      = fromutf8(i->text);
+        url.location = tstrlower(fromutf8(i->attr("location")).c_str());
+
+        // Metalink 4: priority 1..999999, lower is better; Metalink 3: preference 0..100, higher is better
+        if(!priority.empty())
+            url.priority = atoi(priority.c_str());
+        else if(!preference.empty())
+            url.priority = 101 - atoi(preference.c_str());
+        else
+            url.priority = METALINK_PRIORITY_NONE;
+
+        // Other resource types (BitTorrent, ed2k, ...) of Metalink 3 can't be downloaded
+        tstring scheme = type.empty() ? tstrlower(url.url.substr(0, url.url.find(':')).c_str()) : fromutf8(type);
+
+        if((scheme.compare(_T("http")) != 0) && (scheme.compare(_T("https")) != 0) && (scheme.compare(_T("ftp")) != 0))
+            continue;
+
+        file->urls.push_back(url);
+    }
+}
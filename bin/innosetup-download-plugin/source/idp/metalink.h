@@ -0,0 +1,47 @@
+#pragma once
+
+#include <windows.h>
+#include <string>
+#include <vector>
+#include "tstring.h"
+#include "hash.h"
+
+#define METALINK_PRIORITY_NONE 999999 // Lowest Metalink 4 priority, used for URLs without one
+
+using namespace std;
+
+struct MetalinkUrl
+{
+    tstring url;
+    int     priority; // 1 - most preferred. Metalink 3 preference (100 - most preferred) is converted
+    tstring location; // ISO 3166-1 alpha-2 country code, lowercase, empty if not given
+};
+
+struct MetalinkFile
+{
+    tstring             name;          // Relative path, '/' separated
+    DWORDLONG           size;          // FILE_SIZE_UNKNOWN, if not given
+    int                 hashAlgorithm; // Strongest supported hash of whole file, HASH_NONE if none
+    string              hash;          // Lowercase hex
+    PieceHashes         pieces;
+    vector<MetalinkUrl> urls;          // HTTP & FTP only, in document order
+};
+
+struct XmlNode;
+
+// Metalink 4 (RFC 5854, .meta4) & Metalink 3 (.metalink) reader.
+// Only what is needed to download files is read: names, sizes, hashes & URLs.
+// Uses small own XML parser: DLL has no XML library dependencies.
+class Metalink
+{
+public:
+    bool load(tstring filename);
+    bool parse(const string &xml);
+
+    vector<MetalinkFile> files;
+
+protected:
+    void readFile(XmlNode *node);
+    void readHashes(XmlNode *node, MetalinkFile *file);
+    void readUrls(XmlNode *node, MetalinkFile *file);
+};
@@ -1,7 +1,7 @@
 #include "netfile.h"
 #include "trace.h"
 
-NetFile::NetFile(tstring fileurl, tstring filename, DWORDLONG filesize, tstring comp): url(fileurl)
+NetFile::NetFile(tstring fileurl, tstring filename, DWORDLONG filesize, ComponentMask comp): url(fileurl)
 {
     name            = filename;
     size            = filesize;
@@ -9,30 +9,85 @@ NetFile::NetFile(tstring fileurl, tstring filename, DWORDLONG filesize, tstring
     downloaded      = false;
     handle          = NULL;
     mirrorUsed      = _T("");
-
-    tstringtoset(components, comp, _T(' '));
+    components      = comp;
+    transferring    = false;
+    hashAlgorithm   = HASH_NONE;
 }
 
 NetFile::~NetFile()
 {
 }
 
+// Continues from bytesDownloaded, if possible (FTP REST or HTTP Range), otherwise starts from beginning.
+// bytesDownloaded is left unchanged, if file cannot be opened, so partial file can be continued from other mirror.
 bool NetFile::open(HINTERNET internet)
 {
-    bytesDownloaded = 0; //NOTE: remove, if download resume will be implemented
-    return (handle = url.open(internet)) != NULL;
+    if(bytesDownloaded)
+    {
+        if((handle = url.open(internet, NULL, bytesDownloaded)) != NULL)
+        {
+            // Server, which doesn't support If-Range, sends rest of changed file
+            if(url.startOffset && !url.ifRange.empty() && !url.validator.empty() && url.validator.compare(url.ifRange))
+            {
+                TRACE(_T("%s changed since partial download (%s, was %s), starting from beginning"), url.urlString.c_str(), url.validator.c_str(), url.ifRange.c_str());
+                url.close();
+            }
+            else
+            {
+                if(!url.startOffset)
+                    TRACE(_T("Server ignored range of %s, starting from beginning"), url.urlString.c_str());
+
+                bytesDownloaded = url.startOffset;
+                transferTimer.start(0);
+                transferring    = true;
+                return true;
+            }
+        }
+        else
+        {
+            TRACE(_T("Cannot continue %s, starting from beginning"), url.urlString.c_str());
+            url.close();
+        }
+    }
+
+    if((handle = url.open(internet)) == NULL)
+        return false;
+
+    bytesDownloaded = 0;
+    transferTimer.start(0);
+    transferring    = true;
+    return true;
 }
 
 void NetFile::close()
 {
     url.close();
+
+    if(transferring)
+        stats.transferTime += transferTimer.totalElapsed();
+
+    transferring = false;
 }
 
 bool NetFile::read(void *buffer, DWORD size, DWORD *bytesRead)
 {
-    BOOL res = InternetReadFile(handle, buffer, size, bytesRead);
+    bool res = url.transport->read(handle, buffer, size, bytesRead);
     bytesDownloaded += *bytesRead;
-    return res != FALSE;
+    stats.bytes     += *bytesRead;
+    return res;
+}
+
+// Takes timings & status of last request (successful or not) into stats
+void NetFile::updateStats()
+{
+    stats.timings    = url.timings;
+    stats.httpStatus = url.httpStatus;
+    stats.source     = url.urlString;
+}
+
+void NetFile::setReadTimeout(DWORD timeout)
+{
+    url.transport->setReadTimeout(handle, timeout);
 }
 
 tstring NetFile::getShortName()
@@ -48,24 +103,7 @@ tstring NetFile::getShortName()
     return name.substr(off, len);
 }
 
-bool NetFile::selected(set<tstring> comp)
+bool NetFile::selected(const ComponentMask &comp)
 {
-    if(components.empty())
-        return true;
-
-    TRACE(_T("NetFile::selected for %s"), getShortName().c_str());
-
-    for(set<tstring>::iterator i = components.begin(); i != components.end(); i++)
-    {
-        tstring comp1 = *i;
-        for(set<tstring>::iterator j = comp.begin(); j != comp.end(); j++)
-        {
-            tstring comp2 = *j;
-            TRACE(_T("1=%s 2=%s"), comp1.c_str(), comp2.c_str());
-            if(comp1 == comp2)
-                return true;
-        }
-    }
-
-    return false;
+    return components.empty() || components.intersects(comp);
 }
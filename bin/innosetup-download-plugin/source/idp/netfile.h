@@ -2,27 +2,43 @@
 
 #include "tstring.h"
 #include "url.h"
+#include "componentmask.h"
+#include "perfreport.h"
+#include "timer.h"
+#include "hash.h"
+#include "zip.h"
 
 using namespace std;
 
 class NetFile
 {
 public:
-    NetFile(tstring url, tstring filename, DWORDLONG filesize = FILE_SIZE_UNKNOWN, tstring comp = _T(""));
+    NetFile(tstring url, tstring filename, DWORDLONG filesize = FILE_SIZE_UNKNOWN, ComponentMask comp = ComponentMask());
     ~NetFile();
 
     bool    open(HINTERNET internet);
     void    close();
     bool    read(void *buffer, DWORD size, DWORD *bytesRead);
+    void    setReadTimeout(DWORD timeout);
+    void    updateStats();
     tstring getShortName();
-    bool    selected(set<tstring> comp);
+    bool    selected(const ComponentMask &comp);
 
-    Url          url;
-    tstring      name;
-    set<tstring> components;
-    DWORDLONG    size;
-    DWORDLONG    bytesDownloaded;
-    bool         downloaded;
-    HINTERNET    handle;
-    tstring      mirrorUsed;
+    Url           url;
+    tstring       name;
+    ComponentMask components;
+    DWORDLONG     size;
+    DWORDLONG     bytesDownloaded;
+    bool          downloaded;
+    HINTERNET     handle;
+    tstring       mirrorUsed;
+    TransferStats stats;
+    int           hashAlgorithm; // Expected hash of downloaded file (from Metalink), HASH_NONE - not checked
+    string        hash;
+    PieceHashes   pieces;
+    ZipMembers    zip;           // Only these members of zip archive are downloaded, if enabled
+
+protected:
+    Timer         transferTimer;
+    bool          transferring;
 };
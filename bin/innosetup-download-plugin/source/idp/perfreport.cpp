@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include "perfreport.h"
+#include "url.h"
+#include "bufferpool.h"
+
+RequestTimings::RequestTimings()
+{
+    clear();
+}
+
+void RequestTimings::clear()
+{
+    dns         = TIMING_UNKNOWN;
+    connect     = TIMING_UNKNOWN;
+    tls         = TIMING_UNKNOWN;
+    requestSent = TIMING_UNKNOWN;
+    firstByte   = TIMING_UNKNOWN;
+}
+
+TransferStats::TransferStats()
+{
+    transferTime = 0;
+    bytes        = 0;
+    retries      = 0;
+    httpStatus   = 0;
+    error        = 0;
+}
+
+// Merges stats of transfer from mirror (temporary NetFile) into stats of file
+void TransferStats::add(const TransferStats &s)
+{
+    transferTime += s.transferTime;
+    bytes        += s.bytes;
+    retries      += s.retries;
+
+    if(s.source.empty())
+        return;
+
+    timings    = s.timings;
+    source     = s.source;
+    httpStatus = s.httpStatus;
+    error      = s.error;
+}
+
+PerfReport::PerfReport(tstring transportName, DWORD totalTime)
+{
+    transport = transportName;
+    time      = totalTime;
+}
+
+void PerfReport::add(tstring url, tstring filename, DWORDLONG size, bool downloaded, const TransferStats &stats)
+{
+    Entry e;
+    e.url        = url;
+    e.filename   = filename;
+    e.size       = size;
+    e.downloaded = downloaded;
+    e.stats      = stats;
+    entries.push_back(e);
+}
+
+static string jsonString(tstring s)
+{
+    string u = toutf8(s);
+    string res = "\"";
+
+    for(size_t i = 0; i < u.length(); i++)
+    {
+        unsigned char c = (unsigned char)u[i];
+
+        if((c == '"') || (c == '\\'))
+        {
+            res += '\\';
+            res += (char)c;
+        }
+        else if(c < 0x20)
+        {
+            char buf[8];
+            sprintf(buf, "\\u%04x", c);
+            res += buf;
+        }
+        else
+            res += (char)c;
+    }
+
+    return res + "\"";
+}
+
+static string jsonMs(DWORD usec)
+{
+    if(usec == TIMING_UNKNOWN)
+        return "null";
+
+    char buf[32];
+    sprintf(buf, "%.3f", usec / 1000.0);
+    return buf;
+}
+
+bool PerfReport::write(tstring filename)
+{
+    FILE *f = _tfopen(filename.c_str(), _T("wb"));
+
+    if(!f)
+        return false;
+
+    fprintf(f, "{\n\"transport\":%s,\"seconds\":%.3f,\"buffer_peak_bytes\":%s,\"buffer_waits\":%u,\"files\":[\n",
+            jsonString(transport).c_str(), time / 1000.0, u64tostr(bufferPool.peak()).c_str(), bufferPool.waits());
+
+    for(size_t i = 0; i < entries.size(); i++)
+    {
+        Entry         &e = entries[i];
+        TransferStats &s = e.stats;
+        tstring source   = s.source.empty() ? e.url : s.source;
+        char    speed[32] = "null";
+
+        if(s.transferTime)
+            sprintf(speed, "%.2f", s.bytes / 1048576.0 / (s.transferTime / 1000.0));
+
+        fprintf(f, "{\"url\":%s,\"source\":%s,\"host\":%s,\"file\":%s,\"size\":%s,\"bytes\":%s,\"downloaded\":%s,"
+                   "\"http_status\":%d,\"error\":%u,\"retries\":%d,\"dns_ms\":%s,\"connect_ms\":%s,\"tls_ms\":%s,"
+                   "\"request_sent_ms\":%s,\"first_byte_ms\":%s,\"transfer_ms\":%u,\"mb_per_s\":%s}%s\n",
+                jsonString(e.url).c_str(), jsonString(source).c_str(), jsonString(Url(source).hostName).c_str(), jsonString(e.filename).c_str(),
+                (e.size == FILE_SIZE_UNKNOWN) ? "null" : u64tostr(e.size).c_str(), u64tostr(s.bytes).c_str(), e.downloaded ? "true" : "false",
+                s.httpStatus, s.error, s.retries, jsonMs(s.timings.dns).c_str(), jsonMs(s.timings.connect).c_str(), jsonMs(s.timings.tls).c_str(),
+                jsonMs(s.timings.requestSent).c_str(), jsonMs(s.timings.firstByte).c_str(), s.transferTime, speed,
+                (i + 1 < entries.size()) ? "," : "");
+    }
+
+    fprintf(f, "]}\n");
+    fclose(f);
+    return true;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <windows.h>
+#include <vector>
+#include "tstring.h"
+
+#define TIMING_UNKNOWN 0xffffffff
+
+using namespace std;
+
+// Phases of one request, in microseconds from start of Url::open. TIMING_UNKNOWN, if
+// backend can't measure phase (TLS in WinINet), or phase was skipped (reused connection).
+struct RequestTimings
+{
+    RequestTimings();
+    void clear();
+
+    DWORD dns;         // Host name resolved
+    DWORD connect;     // TCP connection established
+    DWORD tls;         // TLS handshake completed
+    DWORD requestSent;
+    DWORD firstByte;   // Response received
+};
+
+// Statistics of one file, collected over all attempts & mirrors
+struct TransferStats
+{
+    TransferStats();
+    void add(const TransferStats &s);
+
+    RequestTimings timings;      // Of last request
+    DWORD          transferTime; // ms, from response to end of transfer
+    DWORDLONG      bytes;        // Received in this session
+    int            retries;
+    tstring        source;       // URL of last request (primary or mirror)
+    int            httpStatus;   // Of last response, 0 - FTP or no response
+    DWORD          error;        // Of last failed attempt, 0 - none
+};
+
+// Machine-readable report of download session (PerfReport option), written as JSON,
+// so reports of many installations can be aggregated to find slow mirrors & hosts.
+class PerfReport
+{
+public:
+    PerfReport(tstring transportName, DWORD totalTime);
+
+    void add(tstring url, tstring filename, DWORDLONG size, bool downloaded, const TransferStats &stats);
+    bool write(tstring filename);
+
+protected:
+    struct Entry
+    {
+        tstring       url;
+        tstring       filename;
+        DWORDLONG     size;
+        bool          downloaded;
+        TransferStats stats;
+    };
+
+    tstring       transport;
+    DWORD         time;
+    vector<Entry> entries;
+};
@@ -0,0 +1,748 @@
+#include <windows.h>
+#include <wininet.h>
+#include <process.h>
+#include <errno.h>
+#include <ctype.h>
+#include <time.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <string>
+#include <map>
+
+using namespace std;
+
+// Kernel objects
+
+#define HANDLE_EVENT  1
+#define HANDLE_THREAD 2
+#define HANDLE_FILE   3 // File & file mapping own descriptor
+
+struct CompatHandle
+{
+    int             type;
+    int             refs;
+    bool            signaled;
+    bool            manualReset;
+    pthread_t       thread;
+    int             fd;
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+};
+
+// All waits use one condition, so WaitForMultipleObjects can wait for any of handles.
+static pthread_mutex_t waitMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  waitCond  = PTHREAD_COND_INITIALIZER;
+
+static CompatHandle *newHandle(int type)
+{
+    CompatHandle *h = new CompatHandle;
+    h->type        = type;
+    h->refs        = 1;
+    h->signaled    = false;
+    h->manualReset = true;
+    return h;
+}
+
+static void releaseHandle(CompatHandle *h)
+{
+    pthread_mutex_lock(&waitMutex);
+    bool last = --h->refs == 0;
+    pthread_mutex_unlock(&waitMutex);
+
+    if(last)
+    {
+        if(h->type == HANDLE_THREAD)
+            pthread_detach(h->thread);
+        else if(h->type == HANDLE_FILE)
+            close(h->fd);
+
+        delete h;
+    }
+}
+
+static void signalHandle(CompatHandle *h)
+{
+    pthread_mutex_lock(&waitMutex);
+    h->signaled = true;
+    pthread_cond_broadcast(&waitCond);
+    pthread_mutex_unlock(&waitMutex);
+}
+
+static void deadline(DWORD milliseconds, struct timespec *ts)
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+
+    unsigned long long ns = (unsigned long long)now.tv_usec * 1000 + (unsigned long long)milliseconds * 1000000;
+    ts->tv_sec  = now.tv_sec + (time_t)(ns / 1000000000);
+    ts->tv_nsec = (long)(ns % 1000000000);
+}
+
+void InitializeCriticalSection(CRITICAL_SECTION *cs)
+{
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(cs, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+void DeleteCriticalSection(CRITICAL_SECTION *cs)
+{
+    pthread_mutex_destroy(cs);
+}
+
+void EnterCriticalSection(CRITICAL_SECTION *cs)
+{
+    pthread_mutex_lock(cs);
+}
+
+void LeaveCriticalSection(CRITICAL_SECTION *cs)
+{
+    pthread_mutex_unlock(cs);
+}
+
+HANDLE CreateEvent(void *security, BOOL manualReset, BOOL initialState, LPCTSTR name)
+{
+    CompatHandle *h = newHandle(HANDLE_EVENT);
+    h->manualReset = manualReset ? true : false;
+    h->signaled    = initialState ? true : false;
+    return h;
+}
+
+BOOL SetEvent(HANDLE event)
+{
+    if(!event)
+        return FALSE;
+
+    signalHandle((CompatHandle *)event);
+    return TRUE;
+}
+
+BOOL ResetEvent(HANDLE event)
+{
+    if(!event)
+        return FALSE;
+
+    pthread_mutex_lock(&waitMutex);
+    ((CompatHandle *)event)->signaled = false;
+    pthread_mutex_unlock(&waitMutex);
+    return TRUE;
+}
+
+DWORD WaitForSingleObject(HANDLE handle, DWORD milliseconds)
+{
+    return WaitForMultipleObjects(1, &handle, TRUE, milliseconds);
+}
+
+DWORD WaitForMultipleObjects(DWORD count, const HANDLE *handles, BOOL waitAll, DWORD milliseconds)
+{
+    struct timespec ts;
+    DWORD result = WAIT_TIMEOUT;
+
+    if(milliseconds != INFINITE)
+        deadline(milliseconds, &ts);
+
+    pthread_mutex_lock(&waitMutex);
+
+    for(;;)
+    {
+        DWORD signaled = 0;
+        DWORD first    = count;
+
+        for(DWORD i = 0; i < count; i++)
+        {
+            if(((CompatHandle *)handles[i])->signaled)
+            {
+                signaled++;
+
+                if(first == count)
+                    first = i;
+            }
+        }
+
+        if(waitAll ? (signaled == count) : (signaled > 0))
+        {
+            for(DWORD i = 0; i < count; i++)
+            {
+                CompatHandle *h = (CompatHandle *)handles[i];
+
+                if((waitAll || (i == first)) && (h->type == HANDLE_EVENT) && !h->manualReset)
+                    h->signaled = false;
+            }
+
+            result = WAIT_OBJECT_0 + (waitAll ? 0 : first);
+            break;
+        }
+
+        if(milliseconds == INFINITE)
+            pthread_cond_wait(&waitCond, &waitMutex);
+        else if(pthread_cond_timedwait(&waitCond, &waitMutex, &ts) == ETIMEDOUT)
+            break;
+    }
+
+    pthread_mutex_unlock(&waitMutex);
+    return result;
+}
+
+BOOL CloseHandle(HANDLE handle)
+{
+    if(!handle)
+        return FALSE;
+
+    releaseHandle((CompatHandle *)handle);
+    return TRUE;
+}
+
+// Files & mappings
+
+static void setErrnoError()
+{
+    switch(errno)
+    {
+    case ENOENT: SetLastError(ERROR_FILE_NOT_FOUND);    break;
+    case EACCES:
+    case EPERM:  SetLastError(ERROR_ACCESS_DENIED);     break;
+    case ENOSPC: SetLastError(ERROR_DISK_FULL);         break;
+    case ENOMEM: SetLastError(ERROR_NOT_ENOUGH_MEMORY); break;
+    default:     SetLastError(ERROR_INVALID_HANDLE);    break;
+    }
+}
+
+// Views don't know their size on POSIX, munmap & msync need it
+static map<const void *, size_t> viewSizes;
+static pthread_mutex_t           viewMutex = PTHREAD_MUTEX_INITIALIZER;
+
+HANDLE CreateFile(LPCTSTR name, DWORD access, DWORD shareMode, void *security, DWORD disposition, DWORD flags, HANDLE templateFile)
+{
+    int mode = ((access & GENERIC_READ) && (access & GENERIC_WRITE)) ? O_RDWR : ((access & GENERIC_WRITE) ? O_WRONLY : O_RDONLY);
+
+    if(disposition == OPEN_ALWAYS)
+        mode |= O_CREAT;
+
+    int fd = open(name, mode, 0644);
+
+    if(fd < 0)
+    {
+        setErrnoError();
+        return INVALID_HANDLE_VALUE;
+    }
+
+    CompatHandle *h = newHandle(HANDLE_FILE);
+    h->fd = fd;
+    return h;
+}
+
+BOOL SetFilePointerEx(HANDLE file, LARGE_INTEGER distance, LARGE_INTEGER *newPosition, DWORD moveMethod)
+{
+    off_t pos = lseek(((CompatHandle *)file)->fd, (off_t)distance.QuadPart, (moveMethod == FILE_BEGIN) ? SEEK_SET : SEEK_CUR);
+
+    if(pos < 0)
+    {
+        setErrnoError();
+        return FALSE;
+    }
+
+    if(newPosition)
+        newPosition->QuadPart = (LONGLONG)pos;
+
+    return TRUE;
+}
+
+BOOL SetEndOfFile(HANDLE file)
+{
+    int   fd  = ((CompatHandle *)file)->fd;
+    off_t pos = lseek(fd, 0, SEEK_CUR);
+
+    if((pos < 0) || (ftruncate(fd, pos) != 0))
+    {
+        setErrnoError();
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+BOOL FlushFileBuffers(HANDLE file)
+{
+    if(fsync(((CompatHandle *)file)->fd) != 0)
+    {
+        setErrnoError();
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+// rename() replaces existing file atomically, which is what MOVEFILE_REPLACE_EXISTING is used for
+BOOL MoveFileEx(LPCTSTR existingName, LPCTSTR newName, DWORD flags)
+{
+    if(rename(existingName, newName) != 0)
+    {
+        setErrnoError();
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+HANDLE CreateFileMapping(HANDLE file, void *security, DWORD protect, DWORD sizeHigh, DWORD sizeLow, LPCTSTR name)
+{
+    int fd = dup(((CompatHandle *)file)->fd);
+
+    if(fd < 0)
+    {
+        setErrnoError();
+        return NULL;
+    }
+
+    CompatHandle *h = newHandle(HANDLE_FILE);
+    h->fd = fd;
+    return h;
+}
+
+void *MapViewOfFile(HANDLE mapping, DWORD access, DWORD offsetHigh, DWORD offsetLow, size_t size)
+{
+    off_t offset = (off_t)(((DWORDLONG)offsetHigh << 32) | offsetLow);
+    int   prot   = (access & FILE_MAP_WRITE) ? (PROT_READ | PROT_WRITE) : PROT_READ;
+    void *view   = mmap(NULL, size, prot, MAP_SHARED, ((CompatHandle *)mapping)->fd, offset);
+
+    if(view == MAP_FAILED)
+    {
+        setErrnoError();
+        return NULL;
+    }
+
+    pthread_mutex_lock(&viewMutex);
+    viewSizes[view] = size;
+    pthread_mutex_unlock(&viewMutex);
+    return view;
+}
+
+BOOL UnmapViewOfFile(const void *address)
+{
+    pthread_mutex_lock(&viewMutex);
+    map<const void *, size_t>::iterator i = viewSizes.find(address);
+    size_t size = 0;
+
+    if(i != viewSizes.end())
+    {
+        size = i->second;
+        viewSizes.erase(i);
+    }
+
+    pthread_mutex_unlock(&viewMutex);
+
+    if(!size || (munmap((void *)address, size) != 0))
+    {
+        SetLastError(ERROR_INVALID_HANDLE);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+BOOL FlushViewOfFile(const void *address, size_t size)
+{
+    // Views always start at page boundary
+    if(msync((void *)address, size, MS_ASYNC) != 0)
+    {
+        setErrnoError();
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+// Threads
+
+struct ThreadStart
+{
+    CompatHandle *handle;
+    unsigned (__stdcall *proc)(void *);
+    void (*simpleProc)(void *);
+    void *arg;
+};
+
+static void *threadStart(void *param)
+{
+    ThreadStart  *start = (ThreadStart *)param;
+    CompatHandle *h     = start->handle;
+
+    if(start->proc)
+        start->proc(start->arg);
+    else
+        start->simpleProc(start->arg);
+
+    delete start;
+    signalHandle(h);
+    releaseHandle(h);
+    return NULL;
+}
+
+static uintptr_t startThread(ThreadStart *start)
+{
+    CompatHandle *h = newHandle(HANDLE_THREAD);
+    h->refs  = 2; // caller & thread itself
+    start->handle = h;
+
+    if(pthread_create(&h->thread, NULL, threadStart, start) != 0)
+    {
+        delete start;
+        delete h;
+        return 0;
+    }
+
+    return (uintptr_t)h;
+}
+
+uintptr_t _beginthreadex(void *security, unsigned stackSize, unsigned (__stdcall *startAddress)(void *), void *arg, unsigned initFlag, unsigned *threadId)
+{
+    ThreadStart *start = new ThreadStart;
+    start->proc       = startAddress;
+    start->simpleProc = NULL;
+    start->arg        = arg;
+
+    uintptr_t h = startThread(start);
+
+    if(threadId)
+        *threadId = 0;
+
+    return h;
+}
+
+uintptr_t _beginthread(void (*startAddress)(void *), unsigned stackSize, void *arg)
+{
+    ThreadStart *start = new ThreadStart;
+    start->proc       = NULL;
+    start->simpleProc = startAddress;
+    start->arg        = arg;
+
+    uintptr_t h = startThread(start);
+
+    // _beginthread handle is closed automatically when thread exits
+    if(h)
+        releaseHandle((CompatHandle *)h);
+
+    return h ? h : (uintptr_t)-1;
+}
+
+// Miscellaneous
+
+DWORD GetTickCount()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (DWORD)((unsigned long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+BOOL QueryPerformanceCounter(LARGE_INTEGER *count)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    count->QuadPart = (LONGLONG)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    return TRUE;
+}
+
+BOOL QueryPerformanceFrequency(LARGE_INTEGER *frequency)
+{
+    frequency->QuadPart = 1000000000;
+    return TRUE;
+}
+
+LONG InterlockedIncrement(volatile LONG *value)
+{
+    return __sync_add_and_fetch(value, 1);
+}
+
+// Thread id is cached, as it is called on each traced event
+DWORD GetCurrentThreadId()
+{
+    static __thread DWORD tid = 0;
+
+    if(!tid)
+        tid = (DWORD)syscall(SYS_gettid);
+
+    return tid;
+}
+
+void GetSystemInfo(SYSTEM_INFO *info)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    info->dwNumberOfProcessors = (n > 0) ? (DWORD)n : 1;
+}
+
+void Sleep(DWORD milliseconds)
+{
+    usleep((useconds_t)milliseconds * 1000);
+}
+
+static __thread DWORD lastError = 0;
+
+DWORD GetLastError()
+{
+    return lastError;
+}
+
+void SetLastError(DWORD error)
+{
+    lastError = error;
+}
+
+void OutputDebugString(LPCTSTR str)
+{
+    fputs(str, stderr);
+}
+
+static const struct { DWORD code; const char *message; } inetMessages[] =
+{
+    { ERROR_INTERNET_OUT_OF_HANDLES,       "No more handles could be generated at this time" },
+    { ERROR_INTERNET_TIMEOUT,              "The operation timed out" },
+    { ERROR_INTERNET_EXTENDED_ERROR,       "An extended error was returned from the server" },
+    { ERROR_INTERNET_INTERNAL_ERROR,       "An internal error has occurred" },
+    { ERROR_INTERNET_INVALID_URL,          "The URL is invalid" },
+    { ERROR_INTERNET_UNRECOGNIZED_SCHEME,  "The URL scheme could not be recognized or is not supported" },
+    { ERROR_INTERNET_NAME_NOT_RESOLVED,    "The server name could not be resolved" },
+    { ERROR_INTERNET_PROTOCOL_NOT_FOUND,   "The requested protocol could not be located" },
+    { ERROR_INTERNET_INCORRECT_USER_NAME,  "The request to connect and log on to an FTP server could not be completed because the supplied user name is incorrect" },
+    { ERROR_INTERNET_INCORRECT_PASSWORD,   "The request to connect and log on to an FTP server could not be completed because the supplied password is incorrect" },
+    { ERROR_INTERNET_LOGIN_FAILURE,        "The request to connect to and log on to an FTP server failed" },
+    { ERROR_INTERNET_OPERATION_CANCELLED,  "The operation was canceled" },
+    { ERROR_INTERNET_CANNOT_CONNECT,       "The attempt to connect to the server failed" },
+    { ERROR_INTERNET_CONNECTION_ABORTED,   "The connection with the server has been terminated" },
+    { ERROR_INTERNET_CONNECTION_RESET,     "The connection with the server has been reset" },
+    { ERROR_INTERNET_FORCE_RETRY,          "The request must be resent" },
+    { ERROR_INTERNET_SEC_CERT_DATE_INVALID,"The SSL certificate date is invalid" },
+    { ERROR_INTERNET_SEC_CERT_CN_INVALID,  "The SSL certificate common name does not match the host name" },
+    { ERROR_INTERNET_INVALID_CA,           "The certificate authority is invalid or incorrect" },
+    { ERROR_FTP_DROPPED,                   "The FTP operation was not completed because the session was aborted" },
+    { ERROR_HTTP_INVALID_SERVER_RESPONSE,  "The server response could not be parsed" },
+    { ERROR_FILE_NOT_FOUND,                "The system cannot find the file specified" },
+    { ERROR_ACCESS_DENIED,                 "Access is denied" },
+    { ERROR_DISK_FULL,                     "There is not enough space on the disk" },
+    { ERROR_CRC,                           "Data error (cyclic redundancy check)" },
+    { 0, NULL }
+};
+
+DWORD FormatMessage(DWORD flags, const void *source, DWORD messageId, DWORD languageId, LPTSTR buffer, DWORD size, void *args)
+{
+    string msg;
+
+    for(int i = 0; inetMessages[i].message; i++)
+    {
+        if(inetMessages[i].code == messageId)
+        {
+            msg = inetMessages[i].message;
+            break;
+        }
+    }
+
+    if(msg.empty())
+    {
+        if(messageId == ERROR_CANCELLED)
+            msg = "The operation was canceled by the user";
+        else if(messageId == ERROR_SUCCESS)
+            msg = "The operation completed successfully";
+        else
+            return 0;
+    }
+
+    msg += ".\r\n";
+
+    if(!size)
+        return 0;
+
+    _tcsncpy(buffer, msg.c_str(), size - 1);
+    buffer[size - 1] = 0;
+    return (DWORD)_tcslen(buffer);
+}
+
+HMODULE GetModuleHandle(LPCTSTR moduleName)
+{
+    return NULL;
+}
+
+// Code pages: CP_ACP is UTF-8 on POSIX systems, wchar_t holds UTF-32 code points
+
+int MultiByteToWideChar(UINT codePage, DWORD flags, LPCSTR str, int len, wchar_t *wstr, int wlen)
+{
+    const unsigned char *s   = (const unsigned char *)str;
+    const unsigned char *end = s + ((len < 0) ? strlen(str) + 1 : (size_t)len);
+    int n = 0;
+
+    while(s < end)
+    {
+        unsigned long c = *s++;
+        int extra = 0;
+
+        if(c >= 0xF0)      { c &= 0x07; extra = 3; }
+        else if(c >= 0xE0) { c &= 0x0F; extra = 2; }
+        else if(c >= 0xC0) { c &= 0x1F; extra = 1; }
+        else if(c >= 0x80) { c = 0xFFFD; }
+
+        while(extra-- && (s < end) && ((*s & 0xC0) == 0x80))
+            c = (c << 6) | (*s++ & 0x3F);
+
+        if(wlen)
+        {
+            if(n >= wlen)
+                return 0;
+
+            wstr[n] = (wchar_t)c;
+        }
+
+        n++;
+    }
+
+    return n;
+}
+
+int WideCharToMultiByte(UINT codePage, DWORD flags, LPCWSTR wstr, int wlen, char *str, int len, LPCSTR defaultChar, BOOL *usedDefaultChar)
+{
+    LPCWSTR end = wstr + ((wlen < 0) ? wcslen(wstr) + 1 : (size_t)wlen);
+    int n = 0;
+
+    for(; wstr < end; wstr++)
+    {
+        unsigned long c = (unsigned long)*wstr;
+        unsigned char buf[4];
+        int count;
+
+        if(c < 0x80)         { buf[0] = (unsigned char)c; count = 1; }
+        else if(c < 0x800)   { buf[0] = (unsigned char)(0xC0 | (c >> 6));  buf[1] = (unsigned char)(0x80 | (c & 0x3F)); count = 2; }
+        else if(c < 0x10000) { buf[0] = (unsigned char)(0xE0 | (c >> 12)); buf[1] = (unsigned char)(0x80 | ((c >> 6) & 0x3F)); buf[2] = (unsigned char)(0x80 | (c & 0x3F)); count = 3; }
+        else                 { buf[0] = (unsigned char)(0xF0 | (c >> 18)); buf[1] = (unsigned char)(0x80 | ((c >> 12) & 0x3F)); buf[2] = (unsigned char)(0x80 | ((c >> 6) & 0x3F)); buf[3] = (unsigned char)(0x80 | (c & 0x3F)); count = 4; }
+
+        if(len)
+        {
+            if(n + count > len)
+                return 0;
+
+            memcpy(str + n, buf, count);
+        }
+
+        n += count;
+    }
+
+    return n;
+}
+
+BOOL PeekMessage(MSG *msg, HWND wnd, UINT filterMin, UINT filterMax, UINT removeMsg)
+{
+    return FALSE;
+}
+
+BOOL TranslateMessage(const MSG *msg)
+{
+    return FALSE;
+}
+
+LRESULT DispatchMessage(const MSG *msg)
+{
+    return 0;
+}
+
+// C runtime
+
+char *_strlwr(char *s)
+{
+    for(char *p = s; *p; p++)
+        *p = (char)tolower((unsigned char)*p);
+
+    return s;
+}
+
+static char *u64toa(unsigned long long value, char *buf, int radix, bool negative)
+{
+    char tmp[66];
+    int  n = 0;
+
+    do
+    {
+        int d = (int)(value % radix);
+        tmp[n++] = (char)((d < 10) ? ('0' + d) : ('a' + d - 10));
+        value /= radix;
+    }
+    while(value);
+
+    char *p = buf;
+
+    if(negative)
+        *p++ = '-';
+
+    while(n)
+        *p++ = tmp[--n];
+
+    *p = 0;
+    return buf;
+}
+
+char *_itoa(int value, char *buf, int radix)
+{
+    if((radix == 10) && (value < 0))
+        return u64toa((unsigned long long)(-(long long)value), buf, radix, true);
+
+    return u64toa((unsigned int)value, buf, radix, false);
+}
+
+char *_ultoa(unsigned long value, char *buf, int radix)
+{
+    return u64toa(value, buf, radix, false);
+}
+
+char *_ui64toa(unsigned long long value, char *buf, int radix)
+{
+    return u64toa(value, buf, radix, false);
+}
+
+// Replaces Microsoft "I64" size prefix with "ll"
+static string convertFormat(const char *format)
+{
+    string res;
+
+    for(const char *p = format; *p; p++)
+    {
+        if((p[0] == 'I') && (p[1] == '6') && (p[2] == '4'))
+        {
+            res += "ll";
+            p += 2;
+        }
+        else
+        {
+            res += *p;
+        }
+    }
+
+    return res;
+}
+
+int _vsnprintf_compat(char *buf, size_t size, const char *format, va_list args)
+{
+    return vsnprintf(buf, size, convertFormat(format).c_str(), args);
+}
+
+int _vsprintf_compat(char *buf, const char *format, va_list args)
+{
+    return vsprintf(buf, convertFormat(format).c_str(), args);
+}
+
+int _sprintf_compat(char *buf, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int res = _vsprintf_compat(buf, format, args);
+    va_end(args);
+    return res;
+}
+
+int _snprintf_compat(char *buf, size_t size, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int res = _vsnprintf_compat(buf, size, format, args);
+    va_end(args);
+    return res;
+}
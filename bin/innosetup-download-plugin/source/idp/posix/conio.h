@@ -0,0 +1,6 @@
+#pragma once
+
+#include <stdio.h>
+
+#define _getch   getchar
+#define _gettch  getchar
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#define _tmkdir(dir) mkdir(dir, 0777)
+#define _mkdir(dir)  mkdir(dir, 0777)
+#define _trmdir      rmdir
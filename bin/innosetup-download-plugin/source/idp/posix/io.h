@@ -0,0 +1,7 @@
+#pragma once
+
+#include <stdio.h>
+#include <unistd.h>
+
+#define _fileno fileno
+#define _commit fsync
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <windows.h>
+#include <stdint.h>
+
+uintptr_t _beginthreadex(void *security, unsigned stackSize, unsigned (__stdcall *startAddress)(void *), void *arg, unsigned initFlag, unsigned *threadId);
+uintptr_t _beginthread(void (*startAddress)(void *), unsigned stackSize, void *arg);
@@ -0,0 +1,62 @@
+#pragma once
+
+// Generic-text mappings for POSIX systems. Only ANSI (UTF-8) build is supported.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdarg.h>
+#include <locale.h>
+#include <math.h>
+#include <sys/stat.h>
+
+typedef char _TCHAR;
+typedef char TCHAR;
+
+#define _T(x)       x
+#define _TEXT(x)    x
+#define _tmain      main
+
+#define _tcslen     strlen
+#define _tcscpy     strcpy
+#define _tcsncpy    strncpy
+#define _tcscat     strcat
+#define _tcscmp     strcmp
+#define _tcsncmp    strncmp
+#define _tcsicmp    strcasecmp
+#define _tcschr     strchr
+#define _tcsrchr    strrchr
+#define _tcsstr     strstr
+#define _tcslwr     _strlwr
+#define _tcstoul    strtoul
+#define _tcstoui64  strtoull
+#define _strtoui64  strtoull
+#define _ttoi       atoi
+#define _ttoi64     atoll
+#define _itot       _itoa
+#define _tfopen     fopen
+#define _tremove    remove
+#define _fgetts     fgets
+#define _tprintf    printf
+#define _ftprintf   fprintf
+#define _stprintf   _sprintf_compat
+#define _sntprintf  _snprintf_compat
+#define _vstprintf  _vsprintf_compat
+#define _vsntprintf _vsnprintf_compat
+#define _tsetlocale setlocale
+#define _tstati64   stat
+#define _stati64    stat
+#define _fseeki64   fseeko
+#define _isnan      isnan
+
+char *_strlwr(char *s);
+char *_itoa(int value, char *buf, int radix);
+char *_ultoa(unsigned long value, char *buf, int radix);
+char *_ui64toa(unsigned long long value, char *buf, int radix);
+
+// printf family with support of Microsoft "I64" size prefix
+int _sprintf_compat(char *buf, const char *format, ...);
+int _snprintf_compat(char *buf, size_t size, const char *format, ...);
+int _vsprintf_compat(char *buf, const char *format, va_list args);
+int _vsnprintf_compat(char *buf, size_t size, const char *format, va_list args);
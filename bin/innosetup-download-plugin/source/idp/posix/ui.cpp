@@ -0,0 +1,126 @@
+#include "../ui.h"
+#include "../trace.h"
+
+// Headless Ui for systems without Win32 GUI. Keeps messages for Ui::msg,
+// all visual feedback is dropped, dialogs are answered with "Cancel".
+
+HWND uiMainWindow()
+{
+    return NULL;
+}
+
+Ui::Ui()
+{
+    allowContinue    = false;
+    hasRetryButton   = true;
+    detailedMode     = false;
+    redrawBackground = false;
+    errorDlgMode     = DLG_SIMPLE;
+    dllHandle        = NULL;
+
+    _tsetlocale(LC_ALL, _T(""));
+}
+
+Ui::~Ui()
+{
+}
+
+void Ui::connectControl(tstring name, HWND handle)
+{
+    controls[toansi(name)] = handle;
+}
+
+void Ui::addMessage(tstring name, tstring message)
+{
+    messages[toansi(name)] = message;
+}
+
+tstring Ui::msg(string key)
+{
+    if(messages.count(key))
+        return messages[key].empty() ? tocurenc(key) : messages[key];
+    else
+        return tocurenc(key);
+}
+
+void Ui::setFileName(tstring filename)
+{
+}
+
+void Ui::setProgressInfo(DWORDLONG totalSize, DWORDLONG totalDownloaded, DWORDLONG fileSize, DWORDLONG fileDownloaded)
+{
+}
+
+void Ui::setSpeedInfo(DWORD speed, DWORD remainingTime)
+{
+}
+
+void Ui::setSpeedInfo(DWORD speed)
+{
+}
+
+void Ui::setSizeTimeInfo(DWORDLONG totalSize, DWORDLONG totalDownloaded, DWORDLONG fileSize, DWORDLONG fileDownloaded, DWORD elapsedTime)
+{
+}
+
+void Ui::setStatus(tstring status)
+{
+    statusStr = status;
+}
+
+void Ui::setMarquee(bool marquee, bool total)
+{
+}
+
+void Ui::setDetailedMode(bool mode)
+{
+    detailedMode = mode;
+}
+
+void Ui::setLabelText(HWND l, tstring text)
+{
+}
+
+void Ui::clearLabel(HWND l)
+{
+}
+
+void Ui::setProgressBarPos(HWND pb, int pos)
+{
+}
+
+void Ui::setProgressBarMarquee(HWND pb, bool marquee)
+{
+}
+
+void Ui::rightAlignLabel(HWND label, tstring text)
+{
+}
+
+int Ui::messageBox(tstring text, tstring caption, DWORD type)
+{
+    TRACE(_T("%s: %s"), caption.c_str(), text.c_str());
+    return IDCANCEL;
+}
+
+int Ui::errorDialog(Downloader *d)
+{
+    return IDCANCEL;
+}
+
+void Ui::clickNextButton()
+{
+}
+
+void Ui::lockButtons()
+{
+}
+
+void Ui::unlockButtons()
+{
+}
+
+void Ui::reportError()
+{
+    idpReportError();
+}
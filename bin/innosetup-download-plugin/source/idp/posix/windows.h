@@ -0,0 +1,143 @@
+#pragma once
+
+// Minimal subset of Win32 API for POSIX systems. Provides only what the portable
+// part of the plugin (downloader, transports, FTP scanner) and the tests use.
+// Handles are reference-counted objects, implemented in compat.cpp.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <tchar.h>
+
+typedef uint32_t           DWORD;
+typedef uint64_t           DWORDLONG;
+typedef int64_t            __int64;
+typedef uint8_t            BYTE;
+typedef uint16_t           WORD;
+typedef int                BOOL;
+typedef int32_t            LONG;
+typedef unsigned int       UINT;
+typedef long long          LONGLONG;
+typedef unsigned long long ULONGLONG;
+typedef uintptr_t          WPARAM;
+typedef intptr_t           LPARAM;
+typedef intptr_t           LRESULT;
+typedef DWORD             *LPDWORD;
+typedef void              *LPVOID;
+typedef void              *HANDLE;
+typedef void              *HWND;
+typedef void              *HINSTANCE;
+typedef void              *HMODULE;
+typedef void              *HFONT;
+typedef const _TCHAR      *LPCTSTR;
+typedef _TCHAR            *LPTSTR;
+typedef const char        *LPCSTR;
+typedef const wchar_t     *LPCWSTR;
+
+#define TRUE     1
+#define FALSE    0
+#define WINAPI
+#define CALLBACK
+#define __stdcall
+#define MAX_PATH 260
+
+#define INFINITE               0xFFFFFFFF
+#define WAIT_OBJECT_0          0
+#define WAIT_TIMEOUT           258
+#define WAIT_FAILED            0xFFFFFFFF
+
+#define ERROR_SUCCESS          0
+#define ERROR_FILE_NOT_FOUND   2
+#define ERROR_ACCESS_DENIED    5
+#define ERROR_INVALID_HANDLE   6
+#define ERROR_NOT_ENOUGH_MEMORY 8
+#define ERROR_BAD_FORMAT       11
+#define ERROR_NO_MORE_FILES    18
+#define ERROR_CRC              23
+#define ERROR_HANDLE_EOF       38
+#define ERROR_OPEN_FAILED      110
+#define ERROR_DISK_FULL        112
+#define ERROR_CANCELLED        1223
+
+#define IDOK                   1
+#define IDCANCEL               2
+#define IDABORT                3
+#define IDRETRY                4
+#define IDIGNORE               5
+#define MB_OK                  0x00
+#define MB_RETRYCANCEL         0x05
+#define MB_ICONWARNING         0x30
+
+#define PM_REMOVE              1
+
+#define LANG_NEUTRAL           0
+#define SUBLANG_DEFAULT        1
+#define MAKELANGID(p, s)       ((((WORD)(s)) << 10) | (WORD)(p))
+
+#define FORMAT_MESSAGE_IGNORE_INSERTS 0x00000200
+#define FORMAT_MESSAGE_FROM_HMODULE   0x00000800
+#define FORMAT_MESSAGE_FROM_SYSTEM    0x00001000
+
+#define INVALID_HANDLE_VALUE   ((HANDLE)(intptr_t)-1)
+#define GENERIC_READ           0x80000000
+#define GENERIC_WRITE          0x40000000
+#define FILE_SHARE_READ        0x00000001
+#define OPEN_ALWAYS            4
+#define FILE_ATTRIBUTE_NORMAL  0x00000080
+#define FILE_BEGIN             0
+#define PAGE_READWRITE         0x04
+#define FILE_MAP_WRITE         0x0002
+#define MOVEFILE_REPLACE_EXISTING 0x00000001
+#define MOVEFILE_WRITE_THROUGH 0x00000008
+
+#define CP_ACP                 0
+#define CP_UTF8                65001
+
+typedef struct { LONG x, y; } POINT;
+typedef struct { DWORD dwNumberOfProcessors; } SYSTEM_INFO;
+typedef union { struct { DWORD LowPart; LONG HighPart; } u; LONGLONG QuadPart; } LARGE_INTEGER;
+typedef struct { HWND hwnd; UINT message; WPARAM wParam; LPARAM lParam; DWORD time; POINT pt; } MSG;
+
+typedef pthread_mutex_t CRITICAL_SECTION;
+
+void  InitializeCriticalSection(CRITICAL_SECTION *cs);
+void  DeleteCriticalSection(CRITICAL_SECTION *cs);
+void  EnterCriticalSection(CRITICAL_SECTION *cs);
+void  LeaveCriticalSection(CRITICAL_SECTION *cs);
+
+HANDLE CreateFile(LPCTSTR name, DWORD access, DWORD shareMode, void *security, DWORD disposition, DWORD flags, HANDLE templateFile);
+BOOL   SetFilePointerEx(HANDLE file, LARGE_INTEGER distance, LARGE_INTEGER *newPosition, DWORD moveMethod);
+BOOL   SetEndOfFile(HANDLE file);
+BOOL   FlushFileBuffers(HANDLE file);
+BOOL   MoveFileEx(LPCTSTR existingName, LPCTSTR newName, DWORD flags);
+HANDLE CreateFileMapping(HANDLE file, void *security, DWORD protect, DWORD sizeHigh, DWORD sizeLow, LPCTSTR name);
+void  *MapViewOfFile(HANDLE mapping, DWORD access, DWORD offsetHigh, DWORD offsetLow, size_t size);
+BOOL   UnmapViewOfFile(const void *address);
+BOOL   FlushViewOfFile(const void *address, size_t size);
+
+HANDLE CreateEvent(void *security, BOOL manualReset, BOOL initialState, LPCTSTR name);
+BOOL   SetEvent(HANDLE event);
+BOOL   ResetEvent(HANDLE event);
+DWORD  WaitForSingleObject(HANDLE handle, DWORD milliseconds);
+DWORD  WaitForMultipleObjects(DWORD count, const HANDLE *handles, BOOL waitAll, DWORD milliseconds);
+BOOL   CloseHandle(HANDLE handle);
+
+DWORD  GetTickCount();
+BOOL   QueryPerformanceCounter(LARGE_INTEGER *count);
+BOOL   QueryPerformanceFrequency(LARGE_INTEGER *frequency);
+LONG   InterlockedIncrement(volatile LONG *value);
+DWORD  GetCurrentThreadId();
+void   GetSystemInfo(SYSTEM_INFO *info);
+void   Sleep(DWORD milliseconds);
+DWORD  GetLastError();
+void   SetLastError(DWORD error);
+void   OutputDebugString(LPCTSTR str);
+DWORD  FormatMessage(DWORD flags, const void *source, DWORD messageId, DWORD languageId, LPTSTR buffer, DWORD size, void *args);
+HMODULE GetModuleHandle(LPCTSTR moduleName);
+
+int    MultiByteToWideChar(UINT codePage, DWORD flags, LPCSTR str, int len, wchar_t *wstr, int wlen);
+int    WideCharToMultiByte(UINT codePage, DWORD flags, LPCWSTR wstr, int wlen, char *str, int len, LPCSTR defaultChar, BOOL *usedDefaultChar);
+
+BOOL    PeekMessage(MSG *msg, HWND wnd, UINT filterMin, UINT filterMax, UINT removeMsg);
+BOOL    TranslateMessage(const MSG *msg);
+LRESULT DispatchMessage(const MSG *msg);
@@ -0,0 +1,47 @@
+#pragma once
+
+// WinINet types & constants, used by portable part of the plugin. No WinINet
+// functions here: on POSIX systems all network operations go through CurlTransport.
+
+#include <windows.h>
+
+typedef void          *HINTERNET;
+typedef unsigned short INTERNET_PORT;
+
+#define INTERNET_SERVICE_FTP                           1
+#define INTERNET_SERVICE_HTTP                          3
+
+#define INTERNET_OPEN_TYPE_PRECONFIG                   0
+#define INTERNET_OPEN_TYPE_DIRECT                      1
+#define INTERNET_OPEN_TYPE_PROXY                       3
+#define INTERNET_OPEN_TYPE_PRECONFIG_WITH_NO_AUTOPROXY 4
+
+#define HTTP_STATUS_OK                                 200
+#define HTTP_STATUS_CREATED                            201
+#define HTTP_STATUS_PARTIAL_CONTENT                    206
+#define HTTP_STATUS_NOT_FOUND                          404
+#define HTTP_STATUS_PROXY_AUTH_REQ                     407
+#define HTTP_STATUS_SERVICE_UNAVAIL                    503
+
+#define INTERNET_ERROR_BASE                            12000
+#define ERROR_INTERNET_OUT_OF_HANDLES                  12001
+#define ERROR_INTERNET_TIMEOUT                         12002
+#define ERROR_INTERNET_EXTENDED_ERROR                  12003
+#define ERROR_INTERNET_INTERNAL_ERROR                  12004
+#define ERROR_INTERNET_INVALID_URL                     12005
+#define ERROR_INTERNET_UNRECOGNIZED_SCHEME             12006
+#define ERROR_INTERNET_NAME_NOT_RESOLVED               12007
+#define ERROR_INTERNET_PROTOCOL_NOT_FOUND              12008
+#define ERROR_INTERNET_INCORRECT_USER_NAME             12013
+#define ERROR_INTERNET_INCORRECT_PASSWORD              12014
+#define ERROR_INTERNET_LOGIN_FAILURE                   12015
+#define ERROR_INTERNET_OPERATION_CANCELLED             12017
+#define ERROR_INTERNET_CANNOT_CONNECT                  12029
+#define ERROR_INTERNET_CONNECTION_ABORTED              12030
+#define ERROR_INTERNET_CONNECTION_RESET                12031
+#define ERROR_INTERNET_FORCE_RETRY                     12032
+#define ERROR_INTERNET_SEC_CERT_DATE_INVALID           12037
+#define ERROR_INTERNET_SEC_CERT_CN_INVALID             12038
+#define ERROR_INTERNET_INVALID_CA                      12045
+#define ERROR_FTP_DROPPED                              12111
+#define ERROR_HTTP_INVALID_SERVER_RESPONSE             12152
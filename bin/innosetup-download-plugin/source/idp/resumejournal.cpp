@@ -0,0 +1,263 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <io.h>
+#include "resumejournal.h"
+#include "trace.h"
+
+#define JOURNAL_SIGNATURE "IDPRESUME 1"
+
+ResumeJournal::ResumeJournal(tstring filename)
+{
+    fileName    = filename;
+    journalName = filename + RESUME_JOURNAL_EXT;
+    stored      = false;
+    reset(0);
+}
+
+void ResumeJournal::reset(DWORDLONG filesize)
+{
+    size      = filesize;
+    chunks    = (size_t)((filesize + RESUME_JOURNAL_CHUNK_SIZE - 1) / RESUME_JOURNAL_CHUNK_SIZE);
+    url       = _T("");
+    validator = _T("");
+    bitmap.assign((chunks + 7) / 8, 0);
+    pieces    = 0;
+    verified.clear();
+}
+
+static bool parseBitmap(const string &hex, vector<BYTE> *bitmap)
+{
+    if(hex.length() != bitmap->size() * 2)
+        return false;
+
+    for(size_t i = 0; i < bitmap->size(); i++)
+        (*bitmap)[i] = (BYTE)strtoul(hex.substr(i * 2, 2).c_str(), NULL, 16);
+
+    return true;
+}
+
+// Reads line of any length: bitmap of big file & URL can be longer than buffer
+static bool readLine(FILE *f, string *line)
+{
+    char buf[4096];
+    bool read = false;
+
+    line->clear();
+
+    while(fgets(buf, sizeof(buf), f))
+    {
+        size_t n = strcspn(buf, "\n");
+
+        line->append(buf, n);
+        read = true;
+
+        if(buf[n])
+            break;
+    }
+
+    if(!read)
+        return false;
+
+    if(!line->empty() && ((*line)[line->length() - 1] == '\r'))
+        line->erase(line->length() - 1);
+
+    return true;
+}
+
+bool ResumeJournal::load(DWORDLONG filesize)
+{
+    reset(filesize);
+
+    FILE *f = _tfopen(journalName.c_str(), _T("rb"));
+
+    if(!f)
+        return false;
+
+    stored = true;
+
+    // Lines: signature, url & validator (UTF-8), size <tab> chunk size, bitmap in hex,
+    // optional piece count <tab> verified pieces bitmap in hex
+    string signature, fileUrl, fileValidator, sizes, hex, pieceLine;
+    bool   res = false;
+
+    if(readLine(f, &signature) && (signature.compare(JOURNAL_SIGNATURE) == 0) &&
+       readLine(f, &fileUrl) && readLine(f, &fileValidator) && readLine(f, &sizes) && readLine(f, &hex))
+    {
+        char     *p;
+        DWORDLONG journalSize = _strtoui64(sizes.c_str(), &p, 10);
+        DWORDLONG chunkSize   = (*p == '\t') ? _strtoui64(p + 1, NULL, 10) : 0;
+
+        if((journalSize == filesize) && (chunkSize == RESUME_JOURNAL_CHUNK_SIZE) && parseBitmap(hex, &bitmap))
+        {
+            url       = fromutf8(fileUrl);
+            validator = fromutf8(fileValidator);
+            res       = true;
+
+            if(readLine(f, &pieceLine))
+            {
+                pieces = (size_t)strtoul(pieceLine.c_str(), &p, 10);
+                verified.assign((pieces + 7) / 8, 0);
+
+                if((*p != '\t') || !parseBitmap(p + 1, &verified))
+                {
+                    pieces = 0;
+                    verified.clear();
+                }
+            }
+        }
+    }
+
+    fclose(f);
+
+    // Journal is useless, if destination was deleted or truncated after it was written
+    DWORDLONG localSize;
+
+    if(res && !(File::exists(fileName, &localSize) && (localSize >= contiguousBytes())))
+        res = false;
+
+    if(!res)
+        reset(filesize);
+
+    TRACE(_T("Resume journal %s %s"), journalName.c_str(), res ? _T("loaded") : _T("ignored"));
+    return res;
+}
+
+bool ResumeJournal::save()
+{
+    tstring tempName = journalName + _T(".tmp");
+    FILE   *f        = _tfopen(tempName.c_str(), _T("wb"));
+
+    if(!f)
+        return false;
+
+    fprintf(f, "%s\n%s\n%s\n%s\t%d\n", JOURNAL_SIGNATURE, toutf8(url).c_str(), toutf8(validator).c_str(),
+            u64tostr(size).c_str(), RESUME_JOURNAL_CHUNK_SIZE);
+
+    for(size_t i = 0; i < bitmap.size(); i++)
+        fprintf(f, "%02x", bitmap[i]);
+
+    fprintf(f, "\n");
+
+    if(pieces)
+    {
+        fprintf(f, "%u\t", (unsigned)pieces);
+
+        for(size_t i = 0; i < verified.size(); i++)
+            fprintf(f, "%02x", verified[i]);
+
+        fprintf(f, "\n");
+    }
+
+    // New journal must be on disk before it replaces old one, so crash leaves one of them intact
+    bool res = (fflush(f) == 0) && (_commit(_fileno(f)) == 0);
+
+    if((fclose(f) != 0) || !res)
+    {
+        ::_tremove(tempName.c_str());
+        return false;
+    }
+
+    if(!MoveFileEx(tempName.c_str(), journalName.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+    {
+        ::_tremove(tempName.c_str());
+        return false;
+    }
+
+    stored = true;
+    return true;
+}
+
+void ResumeJournal::remove()
+{
+    if(stored)
+        ::_tremove(journalName.c_str());
+
+    stored = false;
+}
+
+void ResumeJournal::setCompleted(DWORDLONG start, DWORDLONG end)
+{
+    if(end > size)
+        end = size;
+
+    // Partially covered chunks at range edges are not marked
+    DWORDLONG first = (start + RESUME_JOURNAL_CHUNK_SIZE - 1) / RESUME_JOURNAL_CHUNK_SIZE;
+    DWORDLONG last  = (end == size) ? chunks : end / RESUME_JOURNAL_CHUNK_SIZE; // Last chunk of file may be short
+
+    for(DWORDLONG i = first; i < last; i++)
+        bitmap[(size_t)(i / 8)] |= (BYTE)(1 << (i % 8));
+}
+
+bool ResumeJournal::chunkCompleted(size_t chunk)
+{
+    return (bitmap[chunk / 8] & (1 << (chunk % 8))) != 0;
+}
+
+void ResumeJournal::setPieces(size_t count)
+{
+    if(count == pieces)
+        return;
+
+    pieces = count;
+    verified.assign((count + 7) / 8, 0);
+}
+
+void ResumeJournal::setVerified(size_t piece)
+{
+    if(piece < pieces)
+        verified[piece / 8] |= (BYTE)(1 << (piece % 8));
+}
+
+bool ResumeJournal::pieceVerified(size_t piece)
+{
+    return (piece < pieces) && ((verified[piece / 8] & (1 << (piece % 8))) != 0);
+}
+
+bool ResumeJournal::empty()
+{
+    for(size_t i = 0; i < bitmap.size(); i++)
+        if(bitmap[i])
+            return false;
+
+    return true;
+}
+
+DWORDLONG ResumeJournal::contiguousBytes()
+{
+    size_t i = 0;
+
+    while((i < chunks) && chunkCompleted(i))
+        i++;
+
+    DWORDLONG res = (DWORDLONG)i * RESUME_JOURNAL_CHUNK_SIZE;
+    return (res > size) ? size : res;
+}
+
+vector<ByteRange> ResumeJournal::missingRanges()
+{
+    vector<ByteRange> ranges;
+
+    for(size_t i = 0; i < chunks; i++)
+    {
+        if(chunkCompleted(i))
+            continue;
+
+        DWORDLONG start = (DWORDLONG)i * RESUME_JOURNAL_CHUNK_SIZE;
+        DWORDLONG end   = start + RESUME_JOURNAL_CHUNK_SIZE;
+
+        if(end > size)
+            end = size;
+
+        if(!ranges.empty() && (ranges.back().end == start))
+            ranges.back().end = end;
+        else
+        {
+            ByteRange range;
+            range.start = start;
+            range.end   = end;
+            ranges.push_back(range);
+        }
+    }
+
+    return ranges;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <windows.h>
+#include <vector>
+#include "tstring.h"
+#include "file.h"
+
+#define RESUME_JOURNAL_CHUNK_SIZE 1048576 // 1 MB
+#define RESUME_JOURNAL_INTERVAL   2000    // ms between journal updates during download
+#define RESUME_JOURNAL_EXT        _T(".idpjournal")
+
+using namespace std;
+
+// Crash-safe record of partially downloaded file, kept next to it as <file>.idpjournal.
+// Holds source URL, validator (ETag or Last-Modified), file size and bitmap of completed
+// chunks. Caller flushes file data to disk before chunks are marked and journal is saved,
+// so after installer was killed, download continues exactly where durable data ends.
+// Files with piece hashes also keep bitmap of verified pieces, so they are not hashed again.
+class ResumeJournal
+{
+public:
+    ResumeJournal(tstring filename);
+
+    bool load(DWORDLONG filesize); // false, if there is no journal for file of this size
+    bool save();                   // Atomically replaces journal on disk
+    void remove();
+    void reset(DWORDLONG filesize);
+    void setCompleted(DWORDLONG start, DWORDLONG end); // Marks chunks, which are entirely inside range
+    bool empty();
+    void setPieces(size_t count); // Clears verified pieces, if count differs from loaded one
+    void setVerified(size_t piece);
+    bool pieceVerified(size_t piece);
+
+    DWORDLONG         contiguousBytes(); // Size of completed beginning of file
+    vector<ByteRange> missingRanges();
+
+    tstring   url;
+    tstring   validator;
+    DWORDLONG size;
+
+protected:
+    bool chunkCompleted(size_t chunk);
+
+    tstring      fileName;
+    tstring      journalName;
+    vector<BYTE> bitmap;
+    size_t       chunks;
+    vector<BYTE> verified;
+    size_t       pieces;
+    bool         stored; // Journal file exists on disk
+};
@@ -0,0 +1,87 @@
+#include <windows.h>
+#include <wininet.h>
+#include "retrypolicy.h"
+
+TransferError::TransferError()
+{
+    clear();
+}
+
+void TransferError::clear()
+{
+    code       = 0;
+    httpStatus = 0;
+    retryAfter = 0;
+    stalled    = false;
+    fatal      = false;
+}
+
+RetryPolicy::RetryPolicy()
+{
+    attempts  = DEFAULT_RETRY_ATTEMPTS;
+    baseDelay = DEFAULT_RETRY_DELAY;
+    maxDelay  = DEFAULT_RETRY_MAX_DELAY;
+    seed      = GetTickCount() | 1;
+}
+
+bool RetryPolicy::retryable(const TransferError &error)
+{
+    if(error.fatal)
+        return false;
+
+    if(error.stalled)
+        return true;
+
+    if(error.httpStatus)
+    {
+        int s = error.httpStatus;
+        return (s == 408) || (s == 429) || ((s >= 500) && (s != 501) && (s != 505));
+    }
+
+    switch(error.code)
+    {
+    case ERROR_INTERNET_TIMEOUT            :
+    case ERROR_INTERNET_NAME_NOT_RESOLVED  :
+    case ERROR_INTERNET_CANNOT_CONNECT     :
+    case ERROR_INTERNET_CONNECTION_ABORTED :
+    case ERROR_INTERNET_CONNECTION_RESET   :
+    case ERROR_HTTP_INVALID_SERVER_RESPONSE:
+    case ERROR_CRC                         : return true; // Downloaded file doesn't match its hash
+    default                                : return false;
+    }
+}
+
+// Exponential backoff with "equal jitter": half of delay is fixed, other half is random,
+// so clients, which failed at same time, do not retry at same time
+DWORD RetryPolicy::delay(int retry, const TransferError &error)
+{
+    DWORD backoff = baseDelay;
+
+    for(int i = 0; (i < retry) && (backoff < maxDelay); i++)
+        backoff *= 2;
+
+    if(backoff > maxDelay)
+        backoff = maxDelay;
+
+    backoff = backoff / 2 + random() % (backoff / 2 + 1);
+
+    if(error.retryAfter)
+    {
+        if(error.retryAfter > maxDelay / 1000)
+            return RETRY_NEVER;
+
+        if(error.retryAfter * 1000 > backoff)
+            backoff = error.retryAfter * 1000;
+    }
+
+    return backoff;
+}
+
+// xorshift32, rand() state is shared with installer script
+DWORD RetryPolicy::random()
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
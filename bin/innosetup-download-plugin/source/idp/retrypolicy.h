@@ -0,0 +1,42 @@
+#pragma once
+
+#include <windows.h>
+
+#define DEFAULT_RETRY_ATTEMPTS  3
+#define DEFAULT_RETRY_DELAY     500   // ms, delay before first retry
+#define DEFAULT_RETRY_MAX_DELAY 30000 // ms
+#define RETRY_NEVER             INFINITE
+
+// Why last download attempt failed
+struct TransferError
+{
+    TransferError();
+    void clear();
+
+    DWORD code;       // WinINet error code, 0 - not a network error
+    int   httpStatus; // 0 - no HTTP error
+    DWORD retryAfter; // seconds from Retry-After header, 0 - none
+    bool  stalled;
+    bool  fatal;      // Download must not be repeated (cancelled, proxy authentication failed, local file error)
+};
+
+// Automatic retries of failed downloads. Transient errors (timeouts, resets,
+// 408, 429 & 5xx responses) are retried with exponential backoff & jitter,
+// Retry-After header of server is respected.
+class RetryPolicy
+{
+public:
+    RetryPolicy();
+
+    bool  retryable(const TransferError &error);
+    DWORD delay(int retry, const TransferError &error); // RETRY_NEVER, if server asks to wait longer than maxDelay
+
+    int   attempts;  // Including first one, 1 - no retries
+    DWORD baseDelay;
+    DWORD maxDelay;
+
+protected:
+    DWORD random();
+
+    DWORD seed;
+};
@@ -0,0 +1,54 @@
+#include <algorithm>
+#include "stalldetector.h"
+
+StallDetector::StallDetector(DWORD stallTimeout, DWORD stallSpeed, int ratio, DWORD medianSpeed)
+{
+    timeout   = stallTimeout;
+    minSpeed  = max(stallSpeed, (DWORD)((DWORDLONG)medianSpeed * ratio / 100));
+    startTime = GetTickCount();
+}
+
+// Called after each read, bytesDownloaded is total byte count of transfer
+void StallDetector::update(DWORDLONG bytesDownloaded)
+{
+    DWORD  now = GetTickCount();
+    Sample s   = { now, bytesDownloaded };
+
+    if(samples.empty() || (now - samples.back().time >= STALL_SAMPLE_INTERVAL))
+        samples.push_back(s);
+    else
+        samples.back().bytes = bytesDownloaded;
+
+    // First sample is the newest one, which is at least timeout ms old
+    while((samples.size() > 2) && (now - samples[1].time >= timeout))
+        samples.pop_front();
+}
+
+bool StallDetector::stalled()
+{
+    if(!timeout || samples.empty())
+        return false;
+
+    DWORD now     = GetTickCount();
+    DWORD elapsed = now - samples.front().time;
+
+    if((now - startTime < timeout) || (elapsed < timeout))
+        return false;
+
+    DWORDLONG bytes = samples.back().bytes - samples.front().bytes;
+    return bytes * 1000 / elapsed < minSpeed;
+}
+
+DWORD StallDetector::threshold()
+{
+    return minSpeed;
+}
+
+DWORD StallDetector::median(vector<DWORD> speeds)
+{
+    if(speeds.empty())
+        return 0;
+
+    nth_element(speeds.begin(), speeds.begin() + speeds.size() / 2, speeds.end());
+    return speeds[speeds.size() / 2];
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <windows.h>
+#include <deque>
+#include <vector>
+
+#define DEFAULT_STALL_TIMEOUT 15000 // ms
+#define DEFAULT_STALL_SPEED   512   // bytes per second
+#define DEFAULT_STALL_RATIO   10    // percent of session median speed
+#define STALL_SAMPLE_INTERVAL 100   // ms
+
+using namespace std;
+
+// Detects stalled transfer: throughput over last timeout ms is below minimal speed,
+// or below given percent of median speed of transfers, completed in this session.
+class StallDetector
+{
+public:
+    StallDetector(DWORD timeout, DWORD minSpeed, int ratio, DWORD medianSpeed);
+
+    void  update(DWORDLONG bytesDownloaded);
+    bool  stalled();
+    DWORD threshold();
+
+    static DWORD median(vector<DWORD> speeds);
+
+protected:
+    struct Sample
+    {
+        DWORD     time;
+        DWORDLONG bytes;
+    };
+
+    DWORD         timeout;
+    DWORD         minSpeed;
+    DWORD         startTime;
+    deque<Sample> samples;
+};
@@ -2,8 +2,15 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <vector>
+#include <algorithm>
 #include <windows.h>
 #include "tstring.h"
+#include "trace.h"
+
+static TraceEvent    traceRing[TRACE_RING_SIZE];
+static volatile LONG traceNext = 0;
+static volatile LONG traceIds  = 0;
 
 void debugprintf(const _TCHAR *format, ...)
 {
@@ -34,4 +41,113 @@ tstring formatwinerror(DWORD error)
     tstring res = buf;
     return res;
 
+}
+
+DWORD traceNewId()
+{
+    return (DWORD)InterlockedIncrement(&traceIds);
+}
+
+LONGLONG traceTime()
+{
+    LARGE_INTEGER t;
+    QueryPerformanceCounter(&t);
+    return t.QuadPart;
+}
+
+static LONGLONG traceQueryFrequency()
+{
+    LARGE_INTEGER f;
+    QueryPerformanceFrequency(&f);
+    return f.QuadPart;
+}
+
+static LONGLONG traceFrequency = traceQueryFrequency();
+
+DWORDLONG traceNs(LONGLONG duration)
+{
+    return (DWORDLONG)((double)duration * 1000000000.0 / (double)traceFrequency);
+}
+
+void traceEvent(WORD type, DWORD id, DWORDLONG value)
+{
+    LONGLONG time = traceTime();
+    DWORD    seq  = (DWORD)InterlockedIncrement(&traceNext);
+
+    // Stores through volatile pointer are not reordered, so seq is written last
+    volatile TraceEvent *e = &traceRing[(seq - 1) & (TRACE_RING_SIZE - 1)];
+
+    e->seq    = 0;
+    e->time   = time;
+    e->value  = value;
+    e->thread = GetCurrentThreadId();
+    e->id     = id;
+    e->type   = type;
+    e->seq    = seq;
+}
+
+static const _TCHAR *traceEventNames[] =
+{
+    _T("?"), _T("connect"), _T("connected"), _T("request"), _T("response"), _T("tls"), _T("first_byte"),
+    _T("read"), _T("write"), _T("ui_update"), _T("mirror"), _T("stall"), _T("retry"), _T("error"), _T("done"),
+    _T("concurrency")
+};
+
+static bool earlier(const TraceEvent &a, const TraceEvent &b)
+{
+    return a.time < b.time;
+}
+
+// Writes events as tab separated text, time is in ns from first written event.
+// header is written before events, each line should start with '#'.
+bool traceDump(tstring filename, tstring header)
+{
+    DWORD last  = (DWORD)traceNext;
+    DWORD first = (last > TRACE_RING_SIZE) ? last - TRACE_RING_SIZE + 1 : 1;
+
+    FILE *f = _tfopen(filename.c_str(), _T("w"));
+
+    if(!f)
+        return false;
+
+    vector<TraceEvent> events;
+    events.reserve(last - first + 1);
+
+    for(DWORD seq = first; (seq <= last) && last; seq++)
+    {
+        // Loads through volatile pointer are not reordered either. Slot, whose seq changed while
+        // it was copied, was overwritten by newer event or is being written now.
+        volatile TraceEvent *slot = &traceRing[(seq - 1) & (TRACE_RING_SIZE - 1)];
+        TraceEvent           e;
+
+        if(slot->seq != seq)
+            continue;
+
+        e.time     = slot->time;
+        e.value    = slot->value;
+        e.thread   = slot->thread;
+        e.id       = slot->id;
+        e.type     = slot->type;
+        e.reserved = 0;
+        e.seq      = slot->seq;
+
+        if(e.seq == seq)
+            events.push_back(e);
+    }
+
+    // Time is taken before sequence number, so preempted writer can get later number with earlier time
+    stable_sort(events.begin(), events.end(), earlier);
+
+    _ftprintf(f, _T("# IDP event trace, %u events\n%s# time_ns\tthread\tid\tevent\tvalue\n"), (DWORD)events.size(), header.c_str());
+
+    for(size_t i = 0; i < events.size(); i++)
+    {
+        TraceEvent *e = &events[i];
+        const _TCHAR *name = (e->type < sizeof(traceEventNames) / sizeof(traceEventNames[0])) ? traceEventNames[e->type] : traceEventNames[0];
+
+        _ftprintf(f, _T("%s\t%u\t%u\t%s\t%s\n"), tocurenc(u64tostr(traceNs(e->time - events[0].time))).c_str(), e->thread, e->id, name, tocurenc(u64tostr(e->value)).c_str());
+    }
+
+    fclose(f);
+    return true;
 }
\ No newline at end of file
@@ -12,3 +12,46 @@ void debugprintf(const _TCHAR *format, ...);
 #endif
 
 tstring formatwinerror(DWORD error);
+
+// Event trace of download hot path. Unlike TRACE, it is always on: events are stored
+// in fixed-size ring buffer without locks or formatting, so tracing costs only timer
+// read & one interlocked increment. Last TRACE_RING_SIZE events are written to text
+// file by traceDump() on download error (TraceFile option) or on request (idpDumpTrace).
+
+#define TRACE_RING_SIZE 16384 // Events, must be power of 2
+
+enum TraceEventType
+{
+    TE_CONNECT = 1, // Url::connect started
+    TE_CONNECTED,   // value: 1 - connection handle created, 0 - failed
+    TE_REQUEST,     // File requested, value: offset
+    TE_RESPONSE,    // value: 1 - response received, 0 - failed
+    TE_TLS,         // value: TLS handshake time, ns (libcurl backend only)
+    TE_FIRST_BYTE,  // value: offset
+    TE_READ,        // value: bytes
+    TE_WRITE,       // value: write time, ns
+    TE_UI_UPDATE,   // value: bytes downloaded
+    TE_MIRROR,      // Download switched to mirror, value: mirror number, 0 - mirror found by size query
+    TE_STALL,       // value: offset
+    TE_RETRY,       // value: delay, ms
+    TE_ERROR,       // value: HTTP status or error code
+    TE_DONE,        // File downloaded, value: bytes
+    TE_CONCURRENCY  // Adaptive concurrency window changed, value: streams
+};
+
+struct TraceEvent
+{
+    LONGLONG  time;   // Performance counter
+    DWORDLONG value;
+    DWORD     seq;    // Number of event, written last, so dump can skip slot being overwritten
+    DWORD     thread;
+    DWORD     id;     // Url::traceId
+    WORD      type;
+    WORD      reserved;
+};
+
+DWORD     traceNewId();
+LONGLONG  traceTime();
+DWORDLONG traceNs(LONGLONG duration);
+void      traceEvent(WORD type, DWORD id, DWORDLONG value = 0);
+bool      traceDump(tstring filename, tstring header);
@@ -0,0 +1,143 @@
+#include <stdlib.h>
+#include "transport.h"
+#include "trace.h"
+
+#ifdef _WIN32
+#include "wininettransport.h"
+static WinInetTransport winInetTransport;
+#endif
+
+#ifdef IDP_CURL
+#include "curltransport.h"
+static CurlTransport curlTransport;
+#endif
+
+static Transport *currentTransport = NULL;
+
+Transport *findTransport(tstring name)
+{
+    tstring n = tstrlower(name.c_str());
+
+#ifdef _WIN32
+    if(n.compare(_T("wininet")) == 0)
+        return &winInetTransport;
+#endif
+
+#ifdef IDP_CURL
+    if((n.compare(_T("curl")) == 0) || (n.compare(_T("libcurl")) == 0))
+        return &curlTransport;
+#endif
+
+    return NULL;
+}
+
+Transport *defaultTransport()
+{
+    if(!currentTransport)
+    {
+#ifdef _WIN32
+        currentTransport = &winInetTransport;
+#elif defined(IDP_CURL)
+        currentTransport = &curlTransport;
+#endif
+    }
+
+    return currentTransport;
+}
+
+void setDefaultTransport(Transport *transport)
+{
+    currentTransport = transport;
+}
+
+static string asciilower(string s)
+{
+    for(size_t i = 0; i < s.length(); i++)
+        if((s[i] >= 'A') && (s[i] <= 'Z'))
+            s[i] = s[i] - 'A' + 'a';
+
+    return s;
+}
+
+// Parses MLSD line: "type=file;size=1024;modify=20140101120000; name"
+bool Transport::parseMlsdLine(string line, FtpDirEntry *entry)
+{
+    size_t sep = line.find(' ');
+
+    if(sep == string::npos)
+        return false;
+
+    string facts = line.substr(0, sep);
+    string type;
+
+    entry->name      = fromutf8(line.substr(sep + 1));
+    entry->directory = false;
+    entry->size      = 0;
+    entry->modified  = 0;
+
+    size_t pos = 0;
+
+    while(pos < facts.length())
+    {
+        size_t end = facts.find(';', pos);
+
+        if(end == string::npos)
+            end = facts.length();
+
+        string fact  = facts.substr(pos, end - pos);
+        size_t eq    = fact.find('=');
+        pos = end + 1;
+
+        if(eq == string::npos)
+            continue;
+
+        string name  = asciilower(fact.substr(0, eq));
+        string value = fact.substr(eq + 1);
+
+        if(name.compare("type") == 0)
+            type = asciilower(value);
+        else if(name.compare("size") == 0)
+            entry->size = _strtoui64(value.c_str(), NULL, 10);
+        else if(name.compare("modify") == 0)
+            entry->modified = _strtoui64(value.substr(0, 14).c_str(), NULL, 10);
+    }
+
+    if(type.compare("dir") == 0)
+        entry->directory = true;
+    else if(type.compare("file") != 0)
+        return false; // cdir, pdir, links & other special entries
+
+    return !entry->name.empty();
+}
+
+bool Transport::parseMlsd(const string &listing, tstring mask, vector<FtpDirEntry> &entries)
+{
+    size_t pos = 0;
+
+    while(pos < listing.length())
+    {
+        size_t end = listing.find('\n', pos);
+
+        if(end == string::npos)
+            end = listing.length();
+
+        string line = listing.substr(pos, end - pos);
+        pos = end + 1;
+
+        if(!line.empty() && (line[line.length()-1] == '\r'))
+            line.erase(line.length()-1);
+
+        FtpDirEntry entry;
+
+        if(!parseMlsdLine(line, &entry))
+            continue;
+
+        if(!mask.empty() && !wildcardmatch(mask.c_str(), entry.name.c_str()))
+            continue;
+
+        TRACE(_T("    (%s) %s %I64u %I64u"), entry.directory ? _T("D") : _T("F"), entry.name.c_str(), entry.size, entry.modified);
+        entries.push_back(entry);
+    }
+
+    return true;
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <windows.h>
+#include <wininet.h>
+#include <vector>
+#include "tstring.h"
+#include "internetoptions.h"
+
+using namespace std;
+
+class Url;
+class AsyncTransfer;
+
+struct FtpDirEntry
+{
+    tstring   name;
+    bool      directory;
+    DWORDLONG size;
+    DWORDLONG modified; // YYYYMMDDHHMMSS from MLSD, 0 if unknown
+};
+
+// Drives many transfers from one thread without blocking calls (see AsyncEngine). Each engine
+// thread owns one driver; driver & transfers, started by it, are used only by that thread.
+class AsyncDriver
+{
+public:
+    virtual ~AsyncDriver() {};
+
+    // false, if transfers of url can't be done by driver
+    virtual bool supports(Url * /*url*/) { return true; }
+
+    // Starts request of transfer->url. false, if it can't be started (error in transfer->error)
+    virtual bool start(AsyncTransfer *transfer) = 0;
+
+    // Waits for network events up to wait ms and processes them: calls response(), received()
+    // & finished() of transfers
+    virtual void poll(DWORD wait) = 0;
+
+    // Frees request of finished transfer, aborts it, if it is still running
+    virtual void remove(AsyncTransfer *transfer) = 0;
+};
+
+// Network backend. Url, NetFile, FtpScanner & FtpSegmentedTransfer do all network
+// operations through this interface. Returned handles are opaque, each backend
+// uses its own objects (WinINet handles, libcurl easy & multi handles).
+class Transport
+{
+public:
+    virtual ~Transport() {};
+
+    virtual const _TCHAR *name() = 0;
+
+    // Session (InternetOpen), shared by all connections of one Downloader
+    virtual HINTERNET openSession(InternetOptions &opt) = 0;
+
+    // Connection to url's server. Returns NULL on error, GetLastError() returns error code.
+    virtual HINTERNET connect(HINTERNET session, Url *url, const _TCHAR *user, const _TCHAR *pass) = 0;
+
+    // Opens url->urlPath using url->connection. Transfer is started from offset (FTP REST or
+    // HTTP Range), url->startOffset is set to offset, if server accepted it, left 0 otherwise.
+    // Throws HTTPError for unexpected HTTP status, FatalNetworkError, if download must be stopped.
+    virtual HINTERNET openFile(Url *url, const _TCHAR *httpVerb, DWORDLONG offset) = 0;
+
+    virtual bool      read(HINTERNET file, void *buffer, DWORD size, DWORD *bytesRead) = 0;
+
+    // read() fails with ERROR_INTERNET_TIMEOUT, if no data received during timeout ms
+    virtual void      setReadTimeout(HINTERNET file, DWORD timeout) = 0;
+    virtual DWORDLONG fileSize(Url *url) = 0; // Size of url->filehandle, FILE_SIZE_UNKNOWN if not known
+
+    // Lists FTP directory path using url->connection. If *useMlsd is true, MLSD is tried first,
+    // and set to false if server does not support it. mask is applied to file & directory names.
+    virtual bool listDir(Url *url, tstring path, tstring mask, vector<FtpDirEntry> &entries, bool *useMlsd) = 0;
+
+    virtual void closeHandle(HINTERNET handle) = 0;
+
+    // Driver of asynchronous transfers, using connections of session. NULL, if backend has none
+    virtual AsyncDriver *createAsyncDriver(HINTERNET /*session*/) { return NULL; }
+
+protected:
+    static bool parseMlsdLine(string line, FtpDirEntry *entry);
+    static bool parseMlsd(const string &listing, tstring mask, vector<FtpDirEntry> &entries);
+};
+
+Transport *defaultTransport();
+Transport *findTransport(tstring name); // NULL, if backend is not compiled in
+void       setDefaultTransport(Transport *transport);
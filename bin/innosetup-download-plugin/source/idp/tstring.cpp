@@ -1,9 +1,9 @@
 #include <windows.h>
-#include <wininet.h>
 #include <stdio.h>
 #include <stdarg.h>
 #include "tstring.h"
 #include "trace.h"
+#include "urlparser.h"
 
 string toansi(tstring s)
 {
@@ -56,6 +56,13 @@ string dwtostr(unsigned long d)
     return buf;
 }
 
+string u64tostr(unsigned long long d)
+{
+    char buf[66];
+    _ui64toa(d, buf, 10);
+    return buf;
+}
+
 tstring tstrprintf(tstring format, ...)
 {
     _TCHAR str[256];
@@ -135,14 +142,106 @@ tstring addbackslash(tstring s)
 
 tstring encodeurl(tstring url)
 {
-    DWORD buflen = (DWORD)url.length() * 3 + 2;
-    _TCHAR *buf = new _TCHAR[buflen];
+    UrlParts      parts;
+    const _TCHAR *s   = url.c_str();
+    size_t        len = url.length();
 
-    if(InternetCanonicalizeUrl(url.c_str(), buf, &buflen, 0))
-        return tstring(buf);
-    else
+    if(!urlparse(s, len, &parts))
     {
-        TRACE(_T("Error canonicalizing URL: %s"), url.c_str());
+        TRACE(_T("Error canonicalizing URL: %s"), s);
         return url;
     }
+
+    size_t headLen = parts.path.offset;
+    size_t pathLen = (parts.hasFragment ? parts.fragment.offset - 1 : len) - headLen;
+    size_t n       = urlnormalize(s + headLen, pathLen, (_TCHAR *)NULL, URLN_ENCODE);
+    size_t fragLen = parts.hasFragment ? urlnormalize(s + parts.fragment.offset, parts.fragment.length, (_TCHAR *)NULL, URLN_ENCODE) + 1 : 0;
+
+    tstring res(headLen + n + fragLen, _T(' '));
+    res.replace(0, headLen, s, headLen);
+    urlnormalize(s + headLen, pathLen, &res[headLen], URLN_ENCODE);
+
+    if(parts.hasFragment)
+    {
+        res[headLen + n] = _T('#');
+        urlnormalize(s + parts.fragment.offset, parts.fragment.length, &res[headLen + n + 1], URLN_ENCODE);
+    }
+
+    return res;
+}
+
+string toutf8(tstring s)
+{
+#ifdef UNICODE
+    wstring w = s;
+#else
+    int wlen = MultiByteToWideChar(CP_ACP, 0, s.c_str(), (int)s.length(), NULL, 0);
+    wstring w(wlen, L' ');
+
+    if(wlen)
+        MultiByteToWideChar(CP_ACP, 0, s.c_str(), (int)s.length(), &w[0], wlen);
+#endif
+    int len = WideCharToMultiByte(CP_UTF8, 0, w.c_str(), (int)w.length(), NULL, 0, NULL, NULL);
+    string res(len, ' ');
+
+    if(len)
+        WideCharToMultiByte(CP_UTF8, 0, w.c_str(), (int)w.length(), &res[0], len, NULL, NULL);
+
+    return res;
+}
+
+tstring fromutf8(string s)
+{
+    int wlen = MultiByteToWideChar(CP_UTF8, 0, s.c_str(), (int)s.length(), NULL, 0);
+    wstring w(wlen, L' ');
+
+    if(wlen)
+        MultiByteToWideChar(CP_UTF8, 0, s.c_str(), (int)s.length(), &w[0], wlen);
+#ifdef UNICODE
+    return w;
+#else
+    int len = WideCharToMultiByte(CP_ACP, 0, w.c_str(), (int)w.length(), NULL, 0, NULL, NULL);
+    string res(len, ' ');
+
+    if(len)
+        WideCharToMultiByte(CP_ACP, 0, w.c_str(), (int)w.length(), &res[0], len, NULL, NULL);
+
+    return res;
+#endif
+}
+
+// Matches name against mask with '*' and '?' wildcards, case-insensitive (for ASCII letters)
+bool wildcardmatch(const _TCHAR *mask, const _TCHAR *name)
+{
+    const _TCHAR *star     = NULL;
+    const _TCHAR *starName = NULL;
+
+    while(*name)
+    {
+        _TCHAR m = (*mask >= _T('A') && *mask <= _T('Z')) ? *mask + (_T('a') - _T('A')) : *mask;
+        _TCHAR n = (*name >= _T('A') && *name <= _T('Z')) ? *name + (_T('a') - _T('A')) : *name;
+
+        if(m == _T('*'))
+        {
+            star     = ++mask;
+            starName = name;
+        }
+        else if((m == _T('?')) || (m && (m == n)))
+        {
+            mask++;
+            name++;
+        }
+        else if(star)
+        {
+            mask = star;
+            name = ++starName;
+        }
+        else
+            return false;
+    }
+
+    while(*mask == _T('*'))
+        mask++;
+
+    return *mask == 0;
 }
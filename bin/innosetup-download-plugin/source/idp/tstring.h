@@ -16,6 +16,7 @@ tstring tstrlower(const _TCHAR *s);
 tstring tstrprintf(tstring format, ...);
 tstring itotstr(int d);
 string  dwtostr(unsigned long d);
+string  u64tostr(unsigned long long d);
 tstring formatsize(unsigned long long size, tstring kb, tstring mb, tstring gb);
 tstring formatsize(tstring ofmsg, unsigned long long size1, unsigned long long size2, tstring kb, tstring mb, tstring gb);
 tstring formatspeed(unsigned long speed, tstring kbs, tstring mbs);
@@ -23,5 +24,8 @@ void    tstringtoset(set<tstring> &stringset, tstring str, _TCHAR sep);
 tstring addslash(tstring s);
 tstring addbackslash(tstring s);
 tstring encodeurl(tstring url);
+string  toutf8(tstring s);
+tstring fromutf8(string s);
+bool    wildcardmatch(const _TCHAR *mask, const _TCHAR *name);
 
 #define STR(x) x ? x : const_cast<_TCHAR *>(_T(""))
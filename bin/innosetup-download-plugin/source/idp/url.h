@@ -5,10 +5,17 @@
 #include <tchar.h>
 #include "tstring.h"
 #include "internetoptions.h"
+#include "urlparser.h"
+#include "transport.h"
+#include "hedger.h"
+#include "perfreport.h"
 
 #define FILE_SIZE_UNKNOWN 0xffffffffffffffffULL
 #define OPERATION_STOPPED 0xfffffffffffffffeULL
 
+// URL components of most URLs fit into this buffer, so no heap allocation needed
+#define URL_INLINE_BUFSIZE 256
+
 class FatalNetworkError: public exception
 {
 private:
@@ -26,9 +33,11 @@ private:
     string msg;
 
 public:
-    HTTPError(const string &message): msg(message) {};
+    HTTPError(const string &message, DWORD retryAfterSec = 0): msg(message), retryAfter(retryAfterSec) {};
     virtual ~HTTPError() throw() {};
     virtual const char *what() const throw() { return msg.c_str(); };
+
+    DWORD retryAfter; // Seconds from Retry-After header, 0 - none
 };
 
 class Url
@@ -38,23 +47,45 @@ public:
     ~Url();
 
     HINTERNET connect(HINTERNET internet);
-    HINTERNET open(HINTERNET internet, const _TCHAR *httpVerb = NULL);
+    HINTERNET open(HINTERNET internet, const _TCHAR *httpVerb = NULL, DWORDLONG offset = 0);
+    HINTERNET openSingle(HINTERNET internet, const _TCHAR *httpVerb = NULL, DWORDLONG offset = 0);
     void      disconnect();
     void      close();
     DWORDLONG getSize(HINTERNET internet);
+    DWORD     elapsed(); // Microseconds from start of last openSingle()
 
     tstring         urlString;
     InternetOptions internetOptions;
-    URL_COMPONENTS  components;
-    HINTERNET      connection;
-    HINTERNET      filehandle;
+    UrlParts        parts;
+    HINTERNET       connection;
+    HINTERNET       filehandle;
+    DWORDLONG       startOffset; // Offset of first byte of filehandle, 0 if server ignored requested offset
+    Transport      *transport;
+    Hedger         *hedger;    // NULL - requests are not hedged
+    tstring         hedgeUrl;  // Mirror for hedged requests, empty - same URL over second connection
+    volatile bool   cancelled; // Set by other thread to abort open() (checked by libcurl backend)
+    DWORD           traceId;   // Id of transfer in event trace (see traceEvent)
+    RequestTimings  timings;   // Of last request, set by openSingle() & transport
+    int             httpStatus; // Of last response, 0 - none or FTP
+    tstring         validator; // ETag or Last-Modified of last HTTP response, empty if none
+    tstring         ifRange;   // Sent as If-Range with range requests, so changed file is sent from beginning
+    DWORDLONG       rangeEnd;  // First byte after requested HTTP range, 0 - till end of file
+    _TCHAR         *urlPath;   // Path with query string (and fragment for FTP)
+    _TCHAR         *scheme;
+    _TCHAR         *hostName;
+    _TCHAR         *userName;
+    _TCHAR         *password;
+    DWORD           service;
 
 protected:
-    _TCHAR        *scheme;
-    _TCHAR        *hostName;
-    _TCHAR        *userName;
-    _TCHAR        *password;
-    _TCHAR        *urlPath;
-    _TCHAR        *extraInfo;
-    DWORD          service;
+    LONGLONG       openTime;
+    _TCHAR        *buffer;
+    _TCHAR         inlineBuffer[URL_INLINE_BUFSIZE];
+
+    _TCHAR *copyPart(_TCHAR *dst, size_t offset, size_t length, int flags);
+
+private:
+    // Parts point into own buffer, so copy would use buffer of original: not implemented
+    Url(const Url &);
+    Url &operator=(const Url &);
 };
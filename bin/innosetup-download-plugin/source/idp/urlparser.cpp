@@ -0,0 +1,345 @@
+#include "urlparser.h"
+
+static const char urlhexdigits[] = "0123456789ABCDEF";
+
+static inline UrlRange urlrange(size_t offset, size_t length)
+{
+    UrlRange r;
+    r.offset = offset;
+    r.length = length;
+    return r;
+}
+
+static inline bool urlalpha(unsigned long c)
+{
+    return ((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z'));
+}
+
+static inline bool urldigit(unsigned long c)
+{
+    return (c >= '0') && (c <= '9');
+}
+
+static inline int urlhexval(unsigned long c)
+{
+    if((c >= '0') && (c <= '9')) return (int)(c - '0');
+    if((c >= 'a') && (c <= 'f')) return (int)(c - 'a' + 10);
+    if((c >= 'A') && (c <= 'F')) return (int)(c - 'A' + 10);
+
+    return -1;
+}
+
+static inline bool urlunreserved(unsigned long c)
+{
+    return urlalpha(c) || urldigit(c) || (c == '-') || (c == '.') || (c == '_') || (c == '~');
+}
+
+// Characters, allowed in path and query without encoding (RFC 3986, section 3.3 and 3.4)
+static inline bool urlallowed(unsigned long c)
+{
+    if(urlunreserved(c))
+        return true;
+
+    switch(c)
+    {
+    case '!': case '$': case '&': case '\'': case '(': case ')':
+    case '*': case '+': case ',': case ';' : case '=': case ':':
+    case '@': case '/': case '?':
+        return true;
+    }
+
+    return false;
+}
+
+static inline unsigned long urllower(unsigned long c)
+{
+    return ((c >= 'A') && (c <= 'Z')) ? c + ('a' - 'A') : c;
+}
+
+template<class C> static inline bool urlequal(const C *s, size_t len, const char *ascii)
+{
+    size_t i;
+
+    for(i = 0; i < len; i++)
+        if(!ascii[i] || (urllower((unsigned long)s[i]) != (unsigned long)ascii[i]))
+            return false;
+
+    return ascii[i] == 0;
+}
+
+template<class C> static inline size_t urlput(C *dst, size_t n, unsigned long c)
+{
+    if(dst)
+        dst[n] = (C)c;
+
+    return n + 1;
+}
+
+template<class C> static inline size_t urlputescaped(C *dst, size_t n, unsigned long b)
+{
+    n = urlput(dst, n, '%');
+    n = urlput(dst, n, urlhexdigits[(b >> 4) & 0x0f]);
+    return urlput(dst, n, urlhexdigits[b & 0x0f]);
+}
+
+// Encodes code point as UTF-8 percent escapes
+template<class C> static inline size_t urlpututf8(C *dst, size_t n, unsigned long cp)
+{
+    if(cp < 0x800)
+    {
+        n = urlputescaped(dst, n, 0xc0 | (cp >> 6));
+    }
+    else if(cp < 0x10000)
+    {
+        n = urlputescaped(dst, n, 0xe0 | (cp >> 12));
+        n = urlputescaped(dst, n, 0x80 | ((cp >> 6) & 0x3f));
+    }
+    else
+    {
+        n = urlputescaped(dst, n, 0xf0 | (cp >> 18));
+        n = urlputescaped(dst, n, 0x80 | ((cp >> 12) & 0x3f));
+        n = urlputescaped(dst, n, 0x80 | ((cp >> 6) & 0x3f));
+    }
+
+    return urlputescaped(dst, n, 0x80 | (cp & 0x3f));
+}
+
+template<class C> bool urlparse(const C *url, size_t len, UrlParts *parts)
+{
+    *parts = UrlParts();
+
+    if(!len || !urlalpha((unsigned long)url[0]))
+        return false;
+
+    // scheme "://"
+    size_t i = 1;
+
+    while((i < len) && (urlalpha((unsigned long)url[i]) || urldigit((unsigned long)url[i]) ||
+                        (url[i] == '+') || (url[i] == '-') || (url[i] == '.')))
+        i++;
+
+    if((i + 3 > len) || (url[i] != ':') || (url[i+1] != '/') || (url[i+2] != '/'))
+        return false;
+
+    parts->scheme = urlrange(0, i);
+
+    if     (urlequal(url, i, "ftp"))   parts->schemeId = URL_SCHEME_FTP;
+    else if(urlequal(url, i, "http"))  parts->schemeId = URL_SCHEME_HTTP;
+    else if(urlequal(url, i, "https")) parts->schemeId = URL_SCHEME_HTTPS;
+    else                               parts->schemeId = URL_SCHEME_UNKNOWN;
+
+    // authority
+    size_t authStart = i + 3;
+    size_t authEnd   = authStart;
+
+    while((authEnd < len) && (url[authEnd] != '/') && (url[authEnd] != '?') && (url[authEnd] != '#'))
+        authEnd++;
+
+    size_t hostStart = authStart;
+
+    for(size_t j = authEnd; j > authStart; j--)
+    {
+        if(url[j-1] == '@')
+        {
+            parts->userinfo = urlrange(authStart, j - 1 - authStart);
+            hostStart = j;
+            break;
+        }
+    }
+
+    if(hostStart != authStart)
+    {
+        size_t sep = authStart;
+        size_t end = hostStart - 1;
+
+        while((sep < end) && (url[sep] != ':'))
+            sep++;
+
+        parts->user = urlrange(authStart, sep - authStart);
+
+        if(sep < end)
+            parts->password = urlrange(sep + 1, end - sep - 1);
+        else
+            parts->password = urlrange(end, 0);
+    }
+
+    size_t portStart = authEnd;
+    bool   hasPort   = false;
+
+    if((hostStart < authEnd) && (url[hostStart] == '['))
+    {
+        size_t close = hostStart + 1;
+
+        while((close < authEnd) && (url[close] != ']'))
+            close++;
+
+        if(close == authEnd)
+            return false;
+
+        parts->host = urlrange(hostStart + 1, close - hostStart - 1);
+
+        if(close + 1 < authEnd)
+        {
+            if(url[close+1] != ':')
+                return false;
+
+            portStart = close + 2;
+            hasPort   = true;
+        }
+    }
+    else
+    {
+        size_t hostEnd = authEnd;
+
+        for(size_t j = authEnd; j > hostStart; j--)
+        {
+            if(url[j-1] == ':')
+            {
+                hostEnd   = j - 1;
+                portStart = j;
+                hasPort   = true;
+                break;
+            }
+        }
+
+        parts->host = urlrange(hostStart, hostEnd - hostStart);
+    }
+
+    if(!parts->host.length)
+        return false;
+
+    if(hasPort)
+    {
+        unsigned long port = 0;
+
+        parts->port = urlrange(portStart, authEnd - portStart);
+
+        for(size_t j = portStart; j < authEnd; j++)
+        {
+            if(!urldigit((unsigned long)url[j]))
+                return false;
+
+            port = port * 10 + (unsigned long)(url[j] - '0');
+
+            if(port > 65535)
+                return false;
+        }
+
+        parts->portNumber = (unsigned)port;
+    }
+    else
+        parts->port = urlrange(authEnd, 0);
+
+    if(!parts->port.length)
+    {
+        switch(parts->schemeId)
+        {
+        case URL_SCHEME_FTP  : parts->portNumber = URL_PORT_FTP;   break;
+        case URL_SCHEME_HTTP : parts->portNumber = URL_PORT_HTTP;  break;
+        case URL_SCHEME_HTTPS: parts->portNumber = URL_PORT_HTTPS; break;
+        }
+    }
+
+    // path, query & fragment
+    size_t pathEnd = authEnd;
+
+    while((pathEnd < len) && (url[pathEnd] != '?') && (url[pathEnd] != '#'))
+        pathEnd++;
+
+    parts->path = urlrange(authEnd, pathEnd - authEnd);
+
+    size_t queryEnd = pathEnd;
+
+    if((pathEnd < len) && (url[pathEnd] == '?'))
+    {
+        queryEnd = pathEnd + 1;
+
+        while((queryEnd < len) && (url[queryEnd] != '#'))
+            queryEnd++;
+
+        parts->query    = urlrange(pathEnd + 1, queryEnd - pathEnd - 1);
+        parts->hasQuery = true;
+    }
+    else
+        parts->query = urlrange(pathEnd, 0);
+
+    if(queryEnd < len)
+    {
+        parts->fragment    = urlrange(queryEnd + 1, len - queryEnd - 1);
+        parts->hasFragment = true;
+    }
+    else
+        parts->fragment = urlrange(len, 0);
+
+    return true;
+}
+
+template<class C> size_t urlnormalize(const C *src, size_t len, C *dst, int flags)
+{
+    size_t n = 0;
+
+    for(size_t i = 0; i < len; i++)
+    {
+        unsigned long c = (sizeof(C) == 1) ? (unsigned char)src[i] : (unsigned long)src[i];
+
+        if(!(flags & URLN_ENCODE))
+        {
+            n = urlput(dst, n, (flags & URLN_LOWERCASE) ? urllower(c) : c);
+            continue;
+        }
+
+        if(c == '%')
+        {
+            int hi = (i + 2 < len) ? urlhexval((unsigned long)src[i+1]) : -1;
+            int lo = (i + 2 < len) ? urlhexval((unsigned long)src[i+2]) : -1;
+
+            if((hi < 0) || (lo < 0))
+            {
+                n = urlputescaped(dst, n, '%'); // Stray '%' character
+                continue;
+            }
+
+            unsigned long b = (unsigned long)(hi << 4 | lo);
+
+            if(urlunreserved(b))
+                n = urlput(dst, n, b);
+            else
+                n = urlputescaped(dst, n, b);
+
+            i += 2;
+        }
+        else if(c < 0x80)
+        {
+            if(urlallowed(c))
+                n = urlput(dst, n, (flags & URLN_LOWERCASE) ? urllower(c) : c);
+            else
+                n = urlputescaped(dst, n, c);
+        }
+        else if(sizeof(C) == 1)
+        {
+            n = urlputescaped(dst, n, c); // ANSI: encode bytes as is
+        }
+        else
+        {
+            if((c >= 0xd800) && (c <= 0xdbff) && (i + 1 < len))
+            {
+                unsigned long c2 = (unsigned long)src[i+1];
+
+                if((c2 >= 0xdc00) && (c2 <= 0xdfff))
+                {
+                    c = 0x10000 + ((c - 0xd800) << 10) + (c2 - 0xdc00);
+                    i++;
+                }
+            }
+
+            n = urlpututf8(dst, n, c);
+        }
+    }
+
+    return n;
+}
+
+template bool   urlparse<char>        (const char    *url, size_t len, UrlParts *parts);
+template bool   urlparse<wchar_t>     (const wchar_t *url, size_t len, UrlParts *parts);
+template size_t urlnormalize<char>    (const char    *src, size_t len, char    *dst, int flags);
+template size_t urlnormalize<wchar_t> (const wchar_t *src, size_t len, wchar_t *dst, int flags);
@@ -0,0 +1,53 @@
+#pragma once
+
+// Platform independent URL parser. Does not allocate memory and does not depend
+// on windows.h, so it can be built and benchmarked on any system.
+
+#include <stddef.h>
+
+#define URL_SCHEME_UNKNOWN 0
+#define URL_SCHEME_FTP     1
+#define URL_SCHEME_HTTP    2
+#define URL_SCHEME_HTTPS   3
+
+#define URL_PORT_FTP       21
+#define URL_PORT_HTTP      80
+#define URL_PORT_HTTPS     443
+
+// urlnormalize() flags
+#define URLN_LOWERCASE     0x01 // Convert ASCII letters to lower case (scheme, host name)
+#define URLN_ENCODE        0x02 // Percent-encoding normalization (path, query, fragment)
+
+// Part of parsed URL string: offset of first character and number of characters.
+struct UrlRange
+{
+    size_t offset;
+    size_t length;
+};
+
+struct UrlParts
+{
+    UrlRange scheme;
+    UrlRange userinfo;
+    UrlRange user;
+    UrlRange password;
+    UrlRange host;     // Without square brackets for IPv6 literals
+    UrlRange port;
+    UrlRange path;     // Starts with '/', if not empty
+    UrlRange query;    // Without leading '?'
+    UrlRange fragment; // Without leading '#'
+
+    int      schemeId;   // URL_SCHEME_* constant
+    unsigned portNumber; // Explicit port, or default port for scheme
+    bool     hasQuery;
+    bool     hasFragment;
+};
+
+// Splits absolute URL into components. Returns false, if url is not in
+// scheme://[user[:password]@]host[:port][/path][?query][#fragment] form.
+template<class C> bool urlparse(const C *url, size_t len, UrlParts *parts);
+
+// Copies len characters from src to dst, applying normalization specified by flags.
+// Result is not null-terminated. If dst is NULL, only calculates length of result.
+// Returns number of characters written (or to be written) to dst.
+template<class C> size_t urlnormalize(const C *src, size_t len, C *dst, int flags);
@@ -0,0 +1,841 @@
+#include "wininettransport.h"
+#include "url.h"
+#include "ui.h"
+#include "asyncengine.h"
+#include "trace.h"
+
+// Status callback is called only for handles with non-zero context
+#define STATUS_CONTEXT 1
+
+#define ASYNC_READ_SIZE  16384
+#define ASYNC_READ_BURST 16 // Reads, done at once by one transfer, before other transfers of driver get their turn
+
+// Url, whose connection or request is being opened by current thread. WinINet calls
+// status callback on thread of blocking call, so phases of request are timed there.
+static DWORD timingSlot = TlsAlloc();
+
+struct TimedRequest
+{
+    TimedRequest(Url *url) { TlsSetValue(timingSlot, url);  }
+    ~TimedRequest()        { TlsSetValue(timingSlot, NULL); }
+};
+
+static void CALLBACK statusCallback(HINTERNET handle, DWORD_PTR context, DWORD status, LPVOID info, DWORD infoLength)
+{
+    Url *url = (Url *)TlsGetValue(timingSlot);
+
+    if(!url)
+        return;
+
+    switch(status)
+    {
+    case INTERNET_STATUS_NAME_RESOLVED      : url->timings.dns         = url->elapsed(); break;
+    case INTERNET_STATUS_CONNECTED_TO_SERVER: url->timings.connect     = url->elapsed(); break;
+    case INTERNET_STATUS_REQUEST_SENT       : url->timings.requestSent = url->elapsed(); break;
+    case INTERNET_STATUS_RESPONSE_RECEIVED  :
+        if(url->timings.firstByte == TIMING_UNKNOWN)
+            url->timings.firstByte = url->elapsed();
+        break;
+    }
+}
+
+static void setTimeouts(HINTERNET internet, InternetOptions &opt)
+{
+    if(opt.connectTimeout != TIMEOUT_DEFAULT)
+        InternetSetOption(internet, INTERNET_OPTION_CONNECT_TIMEOUT, &opt.connectTimeout, sizeof(DWORD));
+
+    if(opt.sendTimeout    != TIMEOUT_DEFAULT)
+        InternetSetOption(internet, INTERNET_OPTION_SEND_TIMEOUT,    &opt.sendTimeout,    sizeof(DWORD));
+
+    if(opt.receiveTimeout != TIMEOUT_DEFAULT)
+        InternetSetOption(internet, INTERNET_OPTION_RECEIVE_TIMEOUT, &opt.receiveTimeout, sizeof(DWORD));
+}
+
+const _TCHAR *WinInetTransport::name()
+{
+    return _T("wininet");
+}
+
+HINTERNET WinInetTransport::openSession(InternetOptions &opt)
+{
+    HINTERNET internet = InternetOpen(opt.userAgent.c_str(), opt.accessType, opt.proxyName.empty() ? NULL : opt.proxyName.c_str(), NULL, 0);
+
+    if(!internet)
+        return NULL;
+
+    InternetSetStatusCallback(internet, &statusCallback);
+
+    TRACE(_T("Setting timeouts..."));
+    setTimeouts(internet, opt);
+
+#ifdef _DEBUG
+    DWORD connectTimeout, sendTimeout, receiveTimeout, bufSize = sizeof(DWORD);
+
+    InternetQueryOption(internet, INTERNET_OPTION_CONNECT_TIMEOUT, &connectTimeout, &bufSize);
+    InternetQueryOption(internet, INTERNET_OPTION_SEND_TIMEOUT,    &sendTimeout,    &bufSize);
+    InternetQueryOption(internet, INTERNET_OPTION_RECEIVE_TIMEOUT, &receiveTimeout, &bufSize);
+
+    TRACE(_T("Internet options:"));
+    TRACE(_T("    Connect timeout: %d"), connectTimeout);
+    TRACE(_T("    Send timeout   : %d"), sendTimeout);
+    TRACE(_T("    Receive timeout: %d"), receiveTimeout);
+#endif
+
+    return internet;
+}
+
+HINTERNET WinInetTransport::connect(HINTERNET session, Url *url, const _TCHAR *user, const _TCHAR *pass)
+{
+    DWORD        flags = (url->service == INTERNET_SERVICE_FTP) ? INTERNET_FLAG_PASSIVE : 0;
+    TimedRequest timed(url);
+
+    return InternetConnect(session, url->hostName, (INTERNET_PORT)url->parts.portNumber, user, pass, url->service, flags, STATUS_CONTEXT);
+}
+
+HINTERNET WinInetTransport::openFile(Url *url, const _TCHAR *httpVerb, DWORDLONG offset)
+{
+    TimedRequest timed(url);
+
+    if(url->service == INTERNET_SERVICE_FTP)
+        return openFtpFile(url, offset);
+    else
+        return openHttpFile(url, httpVerb, offset);
+}
+
+HINTERNET WinInetTransport::openFtpFile(Url *url, DWORDLONG offset)
+{
+    if(!offset)
+        return FtpOpenFile(url->connection, url->urlPath, GENERIC_READ, FTP_TRANSFER_TYPE_BINARY | INTERNET_FLAG_RELOAD, STATUS_CONTEXT);
+
+    // FtpOpenFile has no restart offset, so transfer is started with raw commands
+    HINTERNET data = NULL;
+    tstring   rest = tstrprintf(_T("REST %I64u"), offset);
+    tstring   retr = tstring(_T("RETR ")) + url->urlPath;
+
+    TRACE(_T("Restarting transfer of %s at %I64u"), url->urlPath, offset);
+
+    if(!FtpCommand(url->connection, FALSE, FTP_TRANSFER_TYPE_BINARY, _T("TYPE I"),   STATUS_CONTEXT, NULL) ||
+       !FtpCommand(url->connection, FALSE, FTP_TRANSFER_TYPE_BINARY, rest.c_str(),  STATUS_CONTEXT, NULL) ||
+       !FtpCommand(url->connection, TRUE,  FTP_TRANSFER_TYPE_BINARY, retr.c_str(),  STATUS_CONTEXT, &data))
+    {
+        TRACE(_T("Restart FAILED: %s"), formatwinerror(GetLastError()).c_str());
+        return NULL;
+    }
+
+    url->startOffset = offset;
+    return data;
+}
+
+HINTERNET WinInetTransport::openHttpFile(Url *url, const _TCHAR *httpVerb, DWORDLONG offset)
+{
+    LPCTSTR acceptTypes[] = { _T("*/*"), NULL };
+    bool proxyAuthSet = false;
+    tstring range;
+    bool    ranged = offset || url->rangeEnd;
+
+    if(url->rangeEnd)
+        range = tstrprintf(_T("Range: bytes=%I64u-%I64u\r\n"), offset, url->rangeEnd - 1);
+    else if(offset)
+        range = tstrprintf(_T("Range: bytes=%I64u-\r\n"), offset);
+
+    if(ranged && !url->ifRange.empty())
+        range += _T("If-Range: ") + url->ifRange + _T("\r\n");
+
+    InternetOptions &internetOptions = url->internetOptions;
+    HINTERNET        connection      = url->connection;
+    HINTERNET        filehandle;
+
+    DWORD flags = INTERNET_FLAG_NO_CACHE_WRITE | INTERNET_FLAG_RELOAD | INTERNET_FLAG_KEEP_CONNECTION;
+
+    if(url->parts.schemeId == URL_SCHEME_HTTPS)
+    {
+        flags |= INTERNET_FLAG_SECURE;
+
+        if(internetOptions.invalidCert == INVC_IGNORE)
+            flags |= INTERNET_FLAG_IGNORE_CERT_CN_INVALID | INTERNET_FLAG_IGNORE_CERT_DATE_INVALID;
+    }
+
+    TRACE(_T("Opening %s..."), url->urlPath);
+    filehandle = url->filehandle = HttpOpenRequest(connection, httpVerb, url->urlPath, NULL, internetOptions.hasReferer() ? internetOptions.referer.c_str() : NULL, acceptTypes, flags, STATUS_CONTEXT);
+
+retry:
+    TRACE(_T("Sending request..."));
+    if(!HttpSendRequest(filehandle, ranged ? range.c_str() : NULL, ranged ? (DWORD)-1L : 0, NULL, 0))
+    {
+        DWORD error = GetLastError();
+
+        if((error == ERROR_INTERNET_INVALID_CA           ) ||
+           (error == ERROR_INTERNET_SEC_CERT_CN_INVALID  ) ||
+           (error == ERROR_INTERNET_SEC_CERT_DATE_INVALID))
+        {
+            TRACE(_T("Invalid certificate (0x%08x: %s)"), error, formatwinerror(error).c_str());
+
+            if(internetOptions.invalidCert == INVC_SHOWDLG)
+            {
+                TRACE(_T("Showing InternetErrorDlg"));
+
+                DWORD r = InternetErrorDlg(uiMainWindow(), filehandle, error,
+                                           FLAGS_ERROR_UI_FILTER_FOR_ERRORS | FLAGS_ERROR_UI_FLAGS_GENERATE_DATA | FLAGS_ERROR_UI_FLAGS_CHANGE_OPTIONS,
+                                           NULL);
+
+#ifdef _DEBUG
+                _TCHAR *rstr;
+                switch(r)
+                {
+                case ERROR_SUCCESS             : rstr = _T("ERROR_SUCCESS");              break;
+                case ERROR_INTERNET_FORCE_RETRY: rstr = _T("ERROR_INTERNET_FORCE_RETRY"); break;
+                case ERROR_CANCELLED           : rstr = _T("ERROR_CANCELLED");            break;
+                case ERROR_INVALID_HANDLE      : rstr = _T("ERROR_INVALID_HANDLE");       break;
+                default                        : rstr = _T("Unknown error code");         break;
+                }
+                TRACE(_T("InternetErrorDlg returned 0x%08x: %s"), r, rstr);
+#endif
+
+                if((r == ERROR_SUCCESS) || (r == ERROR_INTERNET_FORCE_RETRY))
+                    goto retry;
+                else if(r == ERROR_CANCELLED)
+                {
+                    url->close();
+                    throw FatalNetworkError("Download cancelled");
+                }
+            }
+            else if(internetOptions.invalidCert == INVC_IGNORE)
+            {
+                TRACE(_T("Ignoring invalid certificate"));
+
+                DWORD flags;
+                DWORD flagsSize = sizeof(flags);
+
+                InternetQueryOption(filehandle, INTERNET_OPTION_SECURITY_FLAGS, (LPVOID)&flags, &flagsSize);
+                flags |= SECURITY_FLAG_IGNORE_UNKNOWN_CA;
+                InternetSetOption(filehandle, INTERNET_OPTION_SECURITY_FLAGS, &flags, sizeof(flags));
+
+                goto retry;
+            }
+        }
+
+        TRACE(_T("HttpSendRequest FAILED: 0x%08x - %s"), error, formatwinerror(error).c_str());
+        return NULL;
+    }
+
+    DWORD dwStatusCode = 0, dwIndex = 0, dwBufSize;
+    dwBufSize = sizeof(DWORD);
+
+    if(!HttpQueryInfo(filehandle, HTTP_QUERY_STATUS_CODE | HTTP_QUERY_FLAG_NUMBER, &dwStatusCode, &dwBufSize, &dwIndex))
+    {
+        TRACE(_T("HttpQueryInfo FAILED"));
+        return NULL;
+    }
+
+    TRACE(_T("HTTP Status code: %d"), dwStatusCode);
+    url->httpStatus = dwStatusCode;
+
+    if(dwStatusCode == HTTP_STATUS_PROXY_AUTH_REQ)
+    {
+        TRACE(_T("Proxy authentification requested"));
+
+        if(internetOptions.hasProxyLoginInfo())
+        {
+            if(!proxyAuthSet)
+            {
+                TRACE(_T("Setting proxy username & password: %s, %s"), internetOptions.proxyLogin.c_str(), internetOptions.proxyPassword.c_str());
+
+                InternetSetOption(connection, INTERNET_OPTION_PROXY_USERNAME, (LPVOID)internetOptions.proxyLogin.c_str(),    (DWORD)internetOptions.proxyLogin.length());
+                InternetSetOption(connection, INTERNET_OPTION_PROXY_PASSWORD, (LPVOID)internetOptions.proxyPassword.c_str(), (DWORD)internetOptions.proxyPassword.length());
+
+                proxyAuthSet = true;
+                goto retry;
+            }
+            else
+            {
+                TRACE(_T("Proxy username & password not accepted"));
+                url->close();
+                throw FatalNetworkError("407");
+            }
+        }
+        else
+        {
+            TRACE(_T("Proxy auth: Showing InternetErrorDlg"));
+
+            DWORD r = InternetErrorDlg(uiMainWindow(), filehandle, ERROR_INTERNET_INCORRECT_PASSWORD,
+                                       FLAGS_ERROR_UI_FILTER_FOR_ERRORS | FLAGS_ERROR_UI_FLAGS_GENERATE_DATA | FLAGS_ERROR_UI_FLAGS_CHANGE_OPTIONS,
+                                       NULL);
+
+#ifdef _DEBUG
+            _TCHAR *rstr;
+            switch(r)
+            {
+            case ERROR_SUCCESS             : rstr = _T("ERROR_SUCCESS");              break;
+            case ERROR_INTERNET_FORCE_RETRY: rstr = _T("ERROR_INTERNET_FORCE_RETRY"); break;
+            case ERROR_CANCELLED           : rstr = _T("ERROR_CANCELLED");            break;
+            case ERROR_INVALID_HANDLE      : rstr = _T("ERROR_INVALID_HANDLE");       break;
+            default                        : rstr = _T("Unknown error code");         break;
+            }
+            TRACE(_T("InternetErrorDlg returned 0x%08x: %s"), r, rstr);
+#endif
+
+            if(r == ERROR_INTERNET_FORCE_RETRY)
+                goto retry;
+            else
+            {
+                url->close();
+                throw FatalNetworkError("407");
+            }
+        }
+    }
+
+    if((offset || url->rangeEnd) && (dwStatusCode == HTTP_STATUS_PARTIAL_CONTENT))
+        url->startOffset = offset;
+    else if((dwStatusCode != HTTP_STATUS_OK) && (dwStatusCode != HTTP_STATUS_CREATED/*Not sure, if this code can be returned*/))
+    {
+        // Only delay-seconds form of Retry-After is used, HTTP-date fails to convert to number
+        DWORD retryAfter = 0;
+        dwBufSize = sizeof(DWORD);
+        dwIndex   = 0;
+
+        if(!HttpQueryInfo(filehandle, HTTP_QUERY_RETRY_AFTER | HTTP_QUERY_FLAG_NUMBER, &retryAfter, &dwBufSize, &dwIndex))
+            retryAfter = 0;
+
+        url->close();
+        throw HTTPError(dwtostr(dwStatusCode), retryAfter);
+    }
+
+    TRACE(_T("Request opened OK"));
+
+    // Validator is used for If-Range, when interrupted download is continued (see ResumeJournal)
+    _TCHAR validator[256];
+    dwBufSize = sizeof(validator);
+    dwIndex   = 0;
+
+    if(HttpQueryInfo(filehandle, HTTP_QUERY_ETAG, validator, &dwBufSize, &dwIndex))
+        url->validator = validator;
+    else
+    {
+        dwBufSize = sizeof(validator);
+        dwIndex   = 0;
+
+        if(HttpQueryInfo(filehandle, HTTP_QUERY_LAST_MODIFIED, validator, &dwBufSize, &dwIndex))
+            url->validator = validator;
+    }
+
+#ifdef _DEBUG
+    _TCHAR buf[10000];
+    dwBufSize = sizeof(buf);
+    if(HttpQueryInfo(filehandle, HTTP_QUERY_RAW_HEADERS_CRLF, &buf, &dwBufSize, &dwIndex))
+        TRACE(_T("HTTP_QUERY_RAW_HEADERS_CRLF: %s"), buf);
+    else
+        TRACE(_T("HTTP_QUERY_RAW_HEADERS_CRLF failed: %s"), formatwinerror(GetLastError()).c_str());
+#endif
+
+    return filehandle;
+}
+
+bool WinInetTransport::read(HINTERNET file, void *buffer, DWORD size, DWORD *bytesRead)
+{
+    return InternetReadFile(file, buffer, size, bytesRead) != FALSE;
+}
+
+void WinInetTransport::setReadTimeout(HINTERNET file, DWORD timeout)
+{
+    InternetSetOption(file, INTERNET_OPTION_RECEIVE_TIMEOUT, &timeout, sizeof(timeout));
+}
+
+DWORDLONG WinInetTransport::fileSize(Url *url)
+{
+    if(url->service == INTERNET_SERVICE_FTP)
+    {
+        DWORD loword, hiword;
+        loword = FtpGetFileSize(url->filehandle, &hiword);
+        return ((DWORDLONG)hiword << 32) | loword;
+    }
+    else
+    {
+        DWORD dwFileSize = 0, dwIndex = 0, dwBufSize;
+        dwBufSize = sizeof(DWORD);
+
+        if(!HttpQueryInfo(url->filehandle, HTTP_QUERY_CONTENT_LENGTH | HTTP_QUERY_FLAG_NUMBER, &dwFileSize, &dwBufSize, &dwIndex))
+            return FILE_SIZE_UNKNOWN;
+
+        return dwFileSize;
+    }
+}
+
+void WinInetTransport::closeHandle(HINTERNET handle)
+{
+    InternetCloseHandle(handle);
+}
+
+bool WinInetTransport::listDir(Url *url, tstring path, tstring mask, vector<FtpDirEntry> &entries, bool *useMlsd)
+{
+    entries.clear();
+
+    if(!FtpSetCurrentDirectory(url->connection, path.c_str()))
+        return false;
+
+    if(*useMlsd)
+    {
+        bool unsupported = false;
+
+        if(listDirMlsd(url->connection, mask, entries, &unsupported))
+            return true;
+
+        if(!unsupported)
+            return false;
+
+        TRACE(_T("MLSD not supported, using LIST"));
+        *useMlsd = false;
+    }
+
+    return listDirList(url->connection, mask, entries);
+}
+
+static int lastResponseCode()
+{
+    DWORD  error;
+    DWORD  len = 0;
+
+    InternetGetLastResponseInfo(&error, NULL, &len);
+
+    if(!len)
+        return 0;
+
+    _TCHAR *buf = new _TCHAR[len + 1];
+    len++;
+
+    int code = InternetGetLastResponseInfo(&error, buf, &len) ? _ttoi(buf) : 0;
+
+    delete[] buf;
+    return code;
+}
+
+bool WinInetTransport::listDirMlsd(HINTERNET connection, tstring mask, vector<FtpDirEntry> &entries, bool *unsupported)
+{
+    HINTERNET data = NULL;
+
+    if(!FtpCommand(connection, TRUE, FTP_TRANSFER_TYPE_BINARY, _T("MLSD"), 0, &data))
+    {
+        DWORD error = GetLastError();
+        int   code  = lastResponseCode();
+
+        TRACE(_T("MLSD failed: %d (error %u)"), code, error);
+        *unsupported = (code >= 500) || (error == ERROR_INTERNET_EXTENDED_ERROR && !code);
+        return false;
+    }
+
+    string listing;
+    char   buf[4096];
+    DWORD  bytesRead;
+    BOOL   res;
+
+    while((res = InternetReadFile(data, buf, sizeof(buf), &bytesRead)) && bytesRead)
+        listing.append(buf, bytesRead);
+
+    InternetCloseHandle(data);
+
+    if(!res)
+        return false;
+
+    return parseMlsd(listing, mask, entries);
+}
+
+bool WinInetTransport::listDirList(HINTERNET connection, tstring mask, vector<FtpDirEntry> &entries)
+{
+    WIN32_FIND_DATA fd;
+    HINTERNET handle = FtpFindFirstFile(connection, mask.c_str(), &fd, NULL, NULL);
+
+    if(!handle)
+        return GetLastError() == ERROR_NO_MORE_FILES; // Empty directory
+
+    do
+    {
+        TRACE(_T("    (%s) %s"), (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) ? _T("D") : _T("F"), fd.cFileName);
+
+        FtpDirEntry entry;
+        entry.name      = fd.cFileName;
+        entry.directory = (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+        entry.size      = ((DWORDLONG)fd.nFileSizeHigh << 32) | fd.nFileSizeLow;
+        entry.modified  = 0; // LIST times are not precise enough
+
+        if(entry.directory && ((entry.name.compare(_T(".")) == 0) || (entry.name.compare(_T("..")) == 0)))
+            continue;
+
+        entries.push_back(entry);
+    }
+    while(InternetFindNextFile(handle, &fd));
+
+    InternetCloseHandle(handle);
+    return true;
+}
+
+// Events of asynchronous requests, queued for poll() of driver
+#define AE_COMPLETE 0 // Pending operation completed (error is 0 on success)
+#define AE_CONTINUE 1 // Transfer yielded after burst of reads, reading continues
+#define AE_CLOSED   2 // Request handle is closed, no more callbacks come for it
+
+class WinInetAsyncDriver;
+
+// Request of asynchronous transfer. It lives until WinINet reports, that its handle is closed,
+// because pending read writes to buffer & bytesRead even after remove().
+struct WinInetAsyncRequest
+{
+    WinInetAsyncDriver *driver;
+    AsyncTransfer      *transfer;   // NULL after remove()
+    HINTERNET           connection;
+    HINTERNET           handle;
+    bool                responded;  // Response headers are received, body is read
+    DWORD               bytesRead;
+    BYTE                buffer[ASYNC_READ_SIZE];
+};
+
+struct WinInetAsyncEvent
+{
+    WinInetAsyncRequest *request;
+    int                  type;
+    DWORD                error;
+};
+
+// All transfers of one AsyncEngine thread in one WinINet session, opened with INTERNET_FLAG_ASYNC.
+// WinINet completes their requests & reads on its own threads, status callback only queues
+// completions, so transfers are called back from poll() on thread of engine, as with other drivers.
+// Only HTTP(S) is done asynchronously, FTP files are left to usual download.
+class WinInetAsyncDriver: public AsyncDriver
+{
+public:
+    WinInetAsyncDriver();
+    ~WinInetAsyncDriver();
+
+    bool supports(Url *url);
+    bool start(AsyncTransfer *transfer);
+    void poll(DWORD wait);
+    void remove(AsyncTransfer *transfer);
+
+    void post(WinInetAsyncRequest *request, int type, DWORD error);
+
+protected:
+    bool openSession(InternetOptions &opt);
+    void take(vector<WinInetAsyncEvent> &ready, DWORD wait);
+    void process(WinInetAsyncEvent &event);
+    bool response(WinInetAsyncRequest *request);
+    bool deliver(WinInetAsyncRequest *request);
+    void read(WinInetAsyncRequest *request);
+
+    HINTERNET                 session;
+    int                       open;   // Requests, whose handles are not reported closed yet
+    vector<WinInetAsyncEvent> events;
+    HANDLE                    signal; // Set, when events are queued
+    CRITICAL_SECTION          lock;
+};
+
+static void CALLBACK asyncStatusCallback(HINTERNET handle, DWORD_PTR context, DWORD status, LPVOID info, DWORD infoLength)
+{
+    WinInetAsyncRequest *request = (WinInetAsyncRequest *)context;
+
+    if(!request)
+        return;
+
+    if(status == INTERNET_STATUS_REQUEST_COMPLETE)
+    {
+        INTERNET_ASYNC_RESULT *result = (INTERNET_ASYNC_RESULT *)info;
+
+        request->driver->post(request, AE_COMPLETE, result->dwResult ? 0 : (result->dwError ? result->dwError : ERROR_INTERNET_INTERNAL_ERROR));
+    }
+    else if(status == INTERNET_STATUS_HANDLE_CLOSING)
+        request->driver->post(request, AE_CLOSED, 0);
+}
+
+WinInetAsyncDriver::WinInetAsyncDriver()
+{
+    session = NULL;
+    open    = 0;
+    signal  = CreateEvent(NULL, FALSE, FALSE, NULL);
+
+    InitializeCriticalSection(&lock);
+}
+
+// Callbacks refer to driver, so it waits, until handles of all removed requests are closed
+WinInetAsyncDriver::~WinInetAsyncDriver()
+{
+    while(open > 0)
+    {
+        vector<WinInetAsyncEvent> ready;
+
+        take(ready, INFINITE);
+
+        for(vector<WinInetAsyncEvent>::iterator i = ready.begin(); i != ready.end(); i++)
+            if(i->type == AE_CLOSED)
+                process(*i);
+    }
+
+    if(session)
+        InternetCloseHandle(session);
+
+    CloseHandle(signal);
+    DeleteCriticalSection(&lock);
+}
+
+// Session is opened with options of first transfer, as Downloader does with its own options
+bool WinInetAsyncDriver::openSession(InternetOptions &opt)
+{
+    session = InternetOpen(opt.userAgent.c_str(), opt.accessType, opt.proxyName.empty() ? NULL : opt.proxyName.c_str(), NULL, INTERNET_FLAG_ASYNC);
+
+    if(!session)
+        return false;
+
+    InternetSetStatusCallback(session, &asyncStatusCallback);
+    setTimeouts(session, opt);
+    return true;
+}
+
+bool WinInetAsyncDriver::supports(Url *url)
+{
+    return url->service == INTERNET_SERVICE_HTTP;
+}
+
+// Certificate & proxy authentication dialogs can't be shown from engine thread: such transfers
+// fail here and get them in usual download.
+bool WinInetAsyncDriver::start(AsyncTransfer *transfer)
+{
+    Url             *url             = &transfer->url;
+    InternetOptions &internetOptions = url->internetOptions;
+    LPCTSTR          acceptTypes[]   = { _T("*/*"), NULL };
+    bool             own             = (_tcslen(url->userName) > 0) || (_tcslen(url->password) > 0);
+
+    if(!session && !openSession(internetOptions))
+    {
+        transfer->error = GetLastError();
+        return false;
+    }
+
+    DWORD flags = INTERNET_FLAG_NO_CACHE_WRITE | INTERNET_FLAG_RELOAD | INTERNET_FLAG_KEEP_CONNECTION;
+
+    if(url->parts.schemeId == URL_SCHEME_HTTPS)
+    {
+        flags |= INTERNET_FLAG_SECURE;
+
+        if(internetOptions.invalidCert == INVC_IGNORE)
+            flags |= INTERNET_FLAG_IGNORE_CERT_CN_INVALID | INTERNET_FLAG_IGNORE_CERT_DATE_INVALID;
+    }
+
+    WinInetAsyncRequest *request = new WinInetAsyncRequest;
+
+    request->driver     = this;
+    request->transfer   = transfer;
+    request->handle     = NULL;
+    request->responded  = false;
+    request->bytesRead  = 0;
+    request->connection = InternetConnect(session, url->hostName, (INTERNET_PORT)url->parts.portNumber,
+                                          own ? url->userName : internetOptions.login.c_str(),
+                                          own ? url->password : internetOptions.password.c_str(),
+                                          INTERNET_SERVICE_HTTP, 0, 0);
+
+    if(request->connection)
+        request->handle = HttpOpenRequest(request->connection, transfer->sizeOnly ? _T("HEAD") : _T("GET"), url->urlPath, NULL,
+                                          internetOptions.hasReferer() ? internetOptions.referer.c_str() : NULL, acceptTypes, flags, (DWORD_PTR)request);
+
+    if(!request->handle)
+    {
+        transfer->error = GetLastError();
+
+        if(request->connection)
+            InternetCloseHandle(request->connection);
+
+        delete request;
+        return false;
+    }
+
+    if(internetOptions.hasProxyLoginInfo())
+    {
+        InternetSetOption(request->connection, INTERNET_OPTION_PROXY_USERNAME, (LPVOID)internetOptions.proxyLogin.c_str(),    (DWORD)internetOptions.proxyLogin.length());
+        InternetSetOption(request->connection, INTERNET_OPTION_PROXY_PASSWORD, (LPVOID)internetOptions.proxyPassword.c_str(), (DWORD)internetOptions.proxyPassword.length());
+    }
+
+    if((url->parts.schemeId == URL_SCHEME_HTTPS) && (internetOptions.invalidCert == INVC_IGNORE))
+    {
+        DWORD securityFlags;
+        DWORD flagsSize = sizeof(securityFlags);
+
+        InternetQueryOption(request->handle, INTERNET_OPTION_SECURITY_FLAGS, (LPVOID)&securityFlags, &flagsSize);
+        securityFlags |= SECURITY_FLAG_IGNORE_UNKNOWN_CA;
+        InternetSetOption(request->handle, INTERNET_OPTION_SECURITY_FLAGS, &securityFlags, sizeof(securityFlags));
+    }
+
+    transfer->request = request;
+    open++;
+
+    // Request, completed at once, is handled in poll() too
+    if(HttpSendRequest(request->handle, NULL, 0, NULL, 0))
+        post(request, AE_COMPLETE, 0);
+    else
+    {
+        DWORD error = GetLastError();
+
+        if(error != ERROR_IO_PENDING)
+            post(request, AE_COMPLETE, error);
+    }
+
+    return true;
+}
+
+void WinInetAsyncDriver::post(WinInetAsyncRequest *request, int type, DWORD error)
+{
+    WinInetAsyncEvent event = { request, type, error };
+
+    EnterCriticalSection(&lock);
+    events.push_back(event);
+    LeaveCriticalSection(&lock);
+
+    SetEvent(signal);
+}
+
+void WinInetAsyncDriver::take(vector<WinInetAsyncEvent> &ready, DWORD wait)
+{
+    WaitForSingleObject(signal, wait);
+
+    EnterCriticalSection(&lock);
+    ready.swap(events);
+    LeaveCriticalSection(&lock);
+}
+
+void WinInetAsyncDriver::poll(DWORD wait)
+{
+    vector<WinInetAsyncEvent> ready;
+
+    take(ready, wait);
+
+    for(vector<WinInetAsyncEvent>::iterator i = ready.begin(); i != ready.end(); i++)
+        process(*i);
+}
+
+void WinInetAsyncDriver::process(WinInetAsyncEvent &event)
+{
+    WinInetAsyncRequest *request  = event.request;
+    AsyncTransfer       *transfer = request->transfer;
+
+    if(event.type == AE_CLOSED)
+    {
+        delete request;
+        open--;
+        return;
+    }
+
+    // Removed, or finished by engine (cancelled)
+    if(!transfer || (transfer->state != AS_RUNNING))
+        return;
+
+    if(event.error)
+    {
+        TRACE(_T("WinINet error %u: %s (%s)"), event.error, formatwinerror(event.error).c_str(), transfer->url.urlString.c_str());
+        transfer->finished(event.error);
+        return;
+    }
+
+    if(event.type == AE_COMPLETE)
+    {
+        if(!request->responded)
+        {
+            request->responded = true;
+
+            if(!response(request))
+                return;
+        }
+        else if(!deliver(request)) // Pending read completed
+            return;
+    }
+
+    read(request);
+}
+
+// Status & size are passed to transfer, when response headers are received. Size query ends here.
+bool WinInetAsyncDriver::response(WinInetAsyncRequest *request)
+{
+    AsyncTransfer *transfer   = request->transfer;
+    DWORD          status     = 0;
+    DWORD          retryAfter = 0;
+    DWORDLONG      length     = FILE_SIZE_UNKNOWN;
+    DWORD          bufSize    = sizeof(DWORD);
+    DWORD          index      = 0;
+    _TCHAR         lengthStr[32];
+
+    if(!HttpQueryInfo(request->handle, HTTP_QUERY_STATUS_CODE | HTTP_QUERY_FLAG_NUMBER, &status, &bufSize, &index))
+    {
+        transfer->finished(GetLastError());
+        return false;
+    }
+
+    bufSize = sizeof(DWORD);
+    index   = 0;
+
+    if(!HttpQueryInfo(request->handle, HTTP_QUERY_RETRY_AFTER | HTTP_QUERY_FLAG_NUMBER, &retryAfter, &bufSize, &index))
+        retryAfter = 0;
+
+    // Queried as text, number form has only 32 bits
+    bufSize = sizeof(lengthStr);
+    index   = 0;
+
+    if(HttpQueryInfo(request->handle, HTTP_QUERY_CONTENT_LENGTH, lengthStr, &bufSize, &index))
+        length = _tcstoui64(lengthStr, NULL, 10);
+
+    if(!transfer->response((int)status, length, retryAfter) || transfer->sizeOnly)
+    {
+        transfer->finished(0);
+        return false;
+    }
+
+    return true;
+}
+
+// Passes data of completed read to transfer. false - transfer is finished (end of data or aborted)
+bool WinInetAsyncDriver::deliver(WinInetAsyncRequest *request)
+{
+    AsyncTransfer *transfer = request->transfer;
+
+    if(!request->bytesRead || !transfer->received(request->buffer, request->bytesRead))
+    {
+        transfer->finished(0);
+        return false;
+    }
+
+    return true;
+}
+
+// Reads data, which WinINet has at hand, until read is pending. Its completion comes to callback.
+void WinInetAsyncDriver::read(WinInetAsyncRequest *request)
+{
+    for(int i = 0; i < ASYNC_READ_BURST; i++)
+    {
+        if(!InternetReadFile(request->handle, request->buffer, sizeof(request->buffer), &request->bytesRead))
+        {
+            DWORD error = GetLastError();
+
+            if(error != ERROR_IO_PENDING)
+                request->transfer->finished(error);
+
+            return;
+        }
+
+        if(!deliver(request))
+            return;
+    }
+
+    post(request, AE_CONTINUE, 0);
+}
+
+// Pending operation is cancelled by closing of handle, request is freed, when closing is reported
+void WinInetAsyncDriver::remove(AsyncTransfer *transfer)
+{
+    WinInetAsyncRequest *request = (WinInetAsyncRequest *)transfer->request;
+
+    if(!request)
+        return;
+
+    request->transfer = NULL;
+    transfer->request = NULL;
+
+    InternetCloseHandle(request->handle);
+    InternetCloseHandle(request->connection);
+}
+
+AsyncDriver *WinInetTransport::createAsyncDriver(HINTERNET /*session*/)
+{
+    return new WinInetAsyncDriver();
+}
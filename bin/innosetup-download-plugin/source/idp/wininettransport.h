@@ -0,0 +1,27 @@
+#pragma once
+
+#include "transport.h"
+
+// Transport, based on WinINet. Default backend on Windows.
+class WinInetTransport: public Transport
+{
+public:
+    const _TCHAR *name();
+
+    HINTERNET openSession(InternetOptions &opt);
+    HINTERNET connect(HINTERNET session, Url *url, const _TCHAR *user, const _TCHAR *pass);
+    HINTERNET openFile(Url *url, const _TCHAR *httpVerb, DWORDLONG offset);
+    bool      read(HINTERNET file, void *buffer, DWORD size, DWORD *bytesRead);
+    void      setReadTimeout(HINTERNET file, DWORD timeout);
+    DWORDLONG fileSize(Url *url);
+    bool      listDir(Url *url, tstring path, tstring mask, vector<FtpDirEntry> &entries, bool *useMlsd);
+    void      closeHandle(HINTERNET handle);
+
+    AsyncDriver *createAsyncDriver(HINTERNET session);
+
+protected:
+    HINTERNET openFtpFile(Url *url, DWORDLONG offset);
+    HINTERNET openHttpFile(Url *url, const _TCHAR *httpVerb, DWORDLONG offset);
+    bool      listDirMlsd(HINTERNET connection, tstring mask, vector<FtpDirEntry> &entries, bool *unsupported);
+    bool      listDirList(HINTERNET connection, tstring mask, vector<FtpDirEntry> &entries);
+};
@@ -0,0 +1,592 @@
+#include <algorithm>
+#include <string.h>
+#include <direct.h>
+#include "zip.h"
+#include "url.h"
+#include "hash.h"
+#include "inflate.h"
+#include "trace.h"
+
+#ifdef _WIN32
+#define PATH_SEPARATOR _T('\\')
+#else
+#define PATH_SEPARATOR _T('/')
+#endif
+
+#define ZIP_LOCAL_SIG    "PK\3\4"
+#define ZIP_CENTRAL_SIG  "PK\1\2"
+#define ZIP_END_SIG      "PK\5\6"
+#define ZIP64_END_SIG    "PK\6\6"
+#define ZIP64_LOCATOR_SIG "PK\6\7"
+#define ZIP_EXTRACT_BUFSIZE 65536
+
+static WORD get16(const string &s, size_t pos)
+{
+    return (WORD)((BYTE)s[pos] | ((BYTE)s[pos + 1] << 8));
+}
+
+static DWORD get32(const string &s, size_t pos)
+{
+    return get16(s, pos) | ((DWORD)get16(s, pos + 2) << 16);
+}
+
+static DWORDLONG get64(const string &s, size_t pos)
+{
+    return get32(s, pos) | ((DWORDLONG)get32(s, pos + 4) << 32);
+}
+
+static void put16(string &s, WORD value)
+{
+    s += (char)(value & 0xff);
+    s += (char)(value >> 8);
+}
+
+static void put32(string &s, DWORD value)
+{
+    put16(s, (WORD)(value & 0xffff));
+    put16(s, (WORD)(value >> 16));
+}
+
+static void put64(string &s, DWORDLONG value)
+{
+    put32(s, (DWORD)(value & 0xffffffff));
+    put32(s, (DWORD)(value >> 32));
+}
+
+static void set32(string &s, size_t pos, DWORD value)
+{
+    string v;
+    put32(v, value);
+    s.replace(pos, 4, v);
+}
+
+static void set64(string &s, size_t pos, DWORDLONG value)
+{
+    string v;
+    put64(v, value);
+    s.replace(pos, 8, v);
+}
+
+ZipDirectory::ZipDirectory()
+{
+    centralOffset = 0;
+    centralSize   = 0;
+    count         = 0;
+}
+
+// Finds end of central directory record (and Zip64 one, if archive has it)
+bool ZipDirectory::readEnd(const string &tail, DWORDLONG archiveSize)
+{
+    if((tail.length() < 22) || (tail.length() > archiveSize))
+        return false;
+
+    DWORDLONG tailOffset = archiveSize - tail.length();
+    size_t    pos        = tail.length() - 22;
+
+    for(;; pos--)
+    {
+        if((tail.compare(pos, 4, ZIP_END_SIG) == 0) && (pos + 22 + get16(tail, pos + 20) <= tail.length()))
+            break;
+
+        if(!pos || (tail.length() - pos > 22 + 65535))
+        {
+            TRACE(_T("Zip: end of central directory not found"));
+            return false;
+        }
+    }
+
+    DWORDLONG endOffset = tailOffset + pos;
+
+    count         = get16(tail, pos + 10);
+    centralSize   = get32(tail, pos + 12);
+    centralOffset = get32(tail, pos + 16);
+
+    if((pos >= 20) && (tail.compare(pos - 20, 4, ZIP64_LOCATOR_SIG) == 0))
+    {
+        DWORDLONG zip64Offset = get64(tail, pos - 20 + 8);
+
+        if((zip64Offset < tailOffset) || (zip64Offset - tailOffset + 56 > pos - 20))
+        {
+            TRACE(_T("Zip: Zip64 end of central directory is out of tail"));
+            return false;
+        }
+
+        size_t rec = (size_t)(zip64Offset - tailOffset);
+
+        if(tail.compare(rec, 4, ZIP64_END_SIG) != 0)
+            return false;
+
+        count         = get64(tail, rec + 32);
+        centralSize   = get64(tail, rec + 40);
+        centralOffset = get64(tail, rec + 48);
+        endOffset     = zip64Offset;
+    }
+
+    // Self-extracting archives (data before first record) are not supported
+    if((centralOffset + centralSize != endOffset) || (centralSize > ZIP_MAX_CENTRAL_SIZE))
+    {
+        TRACE(_T("Zip: unsupported central directory at %I64u, %I64u bytes"), centralOffset, centralSize);
+        return false;
+    }
+
+    return true;
+}
+
+struct ZipOffsetLess
+{
+    ZipOffsetLess(const vector<ZipEntry> &e): entries(e) {}
+    bool operator()(size_t a, size_t b) const { return entries[a].offset < entries[b].offset; }
+    const vector<ZipEntry> &entries;
+};
+
+bool ZipDirectory::readCentral(const string &central)
+{
+    size_t pos = 0;
+
+    entries.clear();
+
+    while((pos + 46 <= central.length()) && (central.compare(pos, 4, ZIP_CENTRAL_SIG) == 0))
+    {
+        ZipEntry e;
+        size_t   nameLen    = get16(central, pos + 28);
+        size_t   extraLen   = get16(central, pos + 30);
+        size_t   commentLen = get16(central, pos + 32);
+        size_t   recordLen  = 46 + nameLen + extraLen + commentLen;
+
+        if(pos + recordLen > central.length())
+            return false;
+
+        string name = central.substr(pos + 46, nameLen);
+
+        e.record         = central.substr(pos, recordLen);
+        e.name           = (get16(central, pos + 8) & 0x800) ? fromutf8(name) : tocurenc(name);
+        e.flags          = get16(central, pos + 8);
+        e.method         = get16(central, pos + 10);
+        e.crc            = get32(central, pos + 16);
+        e.compressedSize = get32(central, pos + 20);
+        e.size           = get32(central, pos + 24);
+        e.offset         = get32(central, pos + 42);
+        e.offsetField    = 42;
+        e.offset64       = false;
+
+        // Zip64 extended information: 64-bit values of fields, set to 0xffffffff, in fixed order
+        for(size_t x = 46 + nameLen; x + 4 <= 46 + nameLen + extraLen; )
+        {
+            WORD   id   = get16(e.record, x);
+            size_t len  = get16(e.record, x + 2);
+            size_t f    = x + 4;
+            size_t fend = min(f + len, 46 + nameLen + extraLen);
+
+            if(id == 0x0001)
+            {
+                if((e.size == 0xffffffff) && (f + 8 <= fend))           { e.size = get64(e.record, f); f += 8; }
+                if((e.compressedSize == 0xffffffff) && (f + 8 <= fend)) { e.compressedSize = get64(e.record, f); f += 8; }
+
+                if((e.offset == 0xffffffff) && (f + 8 <= fend))
+                {
+                    e.offset      = get64(e.record, f);
+                    e.offsetField = f;
+                    e.offset64    = true;
+                }
+            }
+
+            x += 4 + len;
+        }
+
+        if(e.offset >= centralOffset)
+            return false;
+
+        entries.push_back(e);
+        pos += recordLen;
+    }
+
+    // Local record ends, where next one (in file order) starts
+    vector<size_t> order;
+
+    for(size_t i = 0; i < entries.size(); i++)
+        order.push_back(i);
+
+    sort(order.begin(), order.end(), ZipOffsetLess(entries));
+
+    for(size_t i = 0; i < order.size(); i++)
+        entries[order[i]].end = (i + 1 < order.size()) ? entries[order[i + 1]].offset : centralOffset;
+
+    TRACE(_T("Zip: %d entries in central directory"), (int)entries.size());
+    return true;
+}
+
+vector<ByteRange> ZipDirectory::ranges(const vector<size_t> &selected, DWORDLONG gap)
+{
+    vector<size_t> order = selected;
+    vector<ByteRange> res;
+
+    sort(order.begin(), order.end(), ZipOffsetLess(entries));
+
+    for(vector<size_t>::iterator i = order.begin(); i != order.end(); i++)
+    {
+        ByteRange r = { entries[*i].offset, entries[*i].end };
+
+        if(!res.empty() && (r.start <= res.back().end + gap))
+            res.back().end = max(res.back().end, r.end);
+        else
+            res.push_back(r);
+    }
+
+    return res;
+}
+
+ZipMembers::ZipMembers()
+{
+    enabled     = false;
+    archiveSize = FILE_SIZE_UNKNOWN;
+}
+
+static bool matchesAny(tstring masks, tstring name)
+{
+    size_t start = 0;
+
+    while(start <= masks.length())
+    {
+        size_t  end  = masks.find(_T(';'), start);
+        tstring mask = masks.substr(start, (end == tstring::npos) ? tstring::npos : end - start);
+        size_t  first = mask.find_first_not_of(_T(' '));
+
+        if(first != tstring::npos)
+        {
+            mask = mask.substr(first, mask.find_last_not_of(_T(' ')) - first + 1);
+
+            if(wildcardmatch(mask.c_str(), name.c_str()))
+                return true;
+        }
+
+        if(end == tstring::npos)
+            break;
+
+        start = end + 1;
+    }
+
+    return false;
+}
+
+bool ZipMembers::selected(const ZipEntry &entry) const
+{
+    if(!include.empty() && !matchesAny(include, entry.name))
+        return false;
+
+    return exclude.empty() || !matchesAny(exclude, entry.name);
+}
+
+ZipWriter::ZipWriter(ZipDirectory *directory, const vector<size_t> &selected)
+{
+    dir      = directory;
+    entries  = selected;
+    current  = 0;
+    done     = 0;
+    position = 0;
+    handle   = NULL;
+
+    sort(entries.begin(), entries.end(), ZipOffsetLess(dir->entries));
+    newOffsets.resize(entries.size());
+}
+
+ZipWriter::~ZipWriter()
+{
+    close();
+}
+
+bool ZipWriter::open(tstring filename)
+{
+    close();
+    handle = _tfopen(filename.c_str(), _T("wb"));
+    return handle != NULL;
+}
+
+void ZipWriter::close()
+{
+    if(handle)
+    {
+        fclose(handle);
+        handle = NULL;
+    }
+}
+
+bool ZipWriter::write(DWORDLONG offset, const BYTE *data, DWORD size)
+{
+    while(size && (current < entries.size()))
+    {
+        const ZipEntry &e        = dir->entries[entries[current]];
+        DWORDLONG       expected = e.offset + done;
+
+        if(offset + size <= expected)
+            return true;
+
+        if(offset < expected)
+        {
+            DWORD skip = (DWORD)(expected - offset);
+
+            data   += skip;
+            size   -= skip;
+            offset  = expected;
+        }
+
+        if(offset > expected)
+            return false; // Beginning of record is missing
+
+        if(!done)
+            newOffsets[current] = position;
+
+        DWORD n = (DWORD)min((DWORDLONG)size, e.end - offset);
+
+        if(fwrite(data, 1, n, handle) != n)
+            return false;
+
+        position += n;
+        done     += n;
+        offset   += n;
+        data     += n;
+        size     -= n;
+
+        if(e.offset + done == e.end)
+        {
+            current++;
+            done = 0;
+        }
+    }
+
+    return true;
+}
+
+bool ZipWriter::finish()
+{
+    if(current != entries.size())
+        return false;
+
+    DWORDLONG centralOffset = position;
+    DWORDLONG centralSize   = 0;
+    DWORDLONG count         = entries.size();
+
+    for(size_t i = 0; i < entries.size(); i++)
+    {
+        const ZipEntry &e      = dir->entries[entries[i]];
+        string          record = e.record;
+
+        // Reduced archive is smaller, so offset fits in same field
+        if(e.offset64)
+            set64(record, e.offsetField, newOffsets[i]);
+        else
+            set32(record, e.offsetField, (DWORD)newOffsets[i]);
+
+        if(fwrite(record.data(), 1, record.length(), handle) != record.length())
+            return false;
+
+        centralSize += record.length();
+    }
+
+    string end;
+    bool   zip64 = (count >= 0xffff) || (centralOffset >= 0xffffffff) || (centralSize >= 0xffffffff);
+
+    if(zip64)
+    {
+        DWORDLONG zip64Offset = centralOffset + centralSize;
+
+        end += ZIP64_END_SIG;
+        put64(end, 44);
+        put16(end, 45);
+        put16(end, 45);
+        put32(end, 0);
+        put32(end, 0);
+        put64(end, count);
+        put64(end, count);
+        put64(end, centralSize);
+        put64(end, centralOffset);
+
+        end += ZIP64_LOCATOR_SIG;
+        put32(end, 0);
+        put64(end, zip64Offset);
+        put32(end, 1);
+    }
+
+    end += ZIP_END_SIG;
+    put16(end, 0);
+    put16(end, 0);
+    put16(end, zip64 ? 0xffff : (WORD)count);
+    put16(end, zip64 ? 0xffff : (WORD)count);
+    put32(end, zip64 ? 0xffffffff : (DWORD)centralSize);
+    put32(end, zip64 ? 0xffffffff : (DWORD)centralOffset);
+    put16(end, 0);
+
+    return (fwrite(end.data(), 1, end.length(), handle) == end.length()) && (fflush(handle) == 0);
+}
+
+ZipArchive::ZipArchive()
+{
+    handle = NULL;
+}
+
+ZipArchive::~ZipArchive()
+{
+    close();
+}
+
+bool ZipArchive::open(tstring filename, bool readDirectory)
+{
+    DWORDLONG size;
+
+    close();
+
+    if(!File::exists(filename, &size) || !(handle = _tfopen(filename.c_str(), _T("rb"))))
+        return false;
+
+    if(!readDirectory)
+        return true;
+
+    string tail((size_t)min(size, (DWORDLONG)ZIP_TAIL_SIZE), '\0');
+
+    if(!read(size - tail.length(), &tail[0], (DWORD)tail.length()) || !dir.readEnd(tail, size))
+        return false;
+
+    string central((size_t)dir.centralSize, '\0');
+
+    return (central.empty() || read(dir.centralOffset, &central[0], (DWORD)central.length())) && dir.readCentral(central);
+}
+
+void ZipArchive::close()
+{
+    if(handle)
+    {
+        fclose(handle);
+        handle = NULL;
+    }
+}
+
+bool ZipArchive::read(DWORDLONG offset, void *buffer, DWORD size)
+{
+    return !_fseeki64(handle, offset, SEEK_SET) && (fread(buffer, 1, size, handle) == size);
+}
+
+bool ZipArchive::safeName(tstring name)
+{
+    if(name.empty() || (name[0] == _T('/')) || (name[0] == _T('\\')) || (name.find(_T(':')) != tstring::npos))
+        return false;
+
+    tstring part;
+
+    for(size_t i = 0; i <= name.length(); i++)
+    {
+        if((i == name.length()) || (name[i] == _T('/')) || (name[i] == _T('\\')))
+        {
+            if((part.compare(_T("..")) == 0) || (part.compare(_T(".")) == 0))
+                return false;
+
+            part.clear();
+        }
+        else
+            part += name[i];
+    }
+
+    return true;
+}
+
+// Creates destdir subdirectories of '/' separated name, returns full path
+static tstring extractPath(tstring destdir, tstring name)
+{
+    tstring path = destdir;
+
+    if(!path.empty() && (path[path.length() - 1] != _T('/')) && (path[path.length() - 1] != _T('\\')))
+        path += PATH_SEPARATOR;
+
+    for(size_t i = 0; i < name.length(); i++)
+    {
+        if((name[i] == _T('/')) || (name[i] == _T('\\')))
+        {
+            _tmkdir(path.c_str());
+            path += PATH_SEPARATOR;
+        }
+        else
+            path += name[i];
+    }
+
+    return path;
+}
+
+bool ZipArchive::extract(size_t index, tstring destdir)
+{
+    return extract(dir.entries[index], destdir);
+}
+
+bool ZipArchive::extract(const ZipEntry &e, tstring destdir)
+{
+    if(!safeName(e.name))
+    {
+        TRACE(_T("Zip: skipping unsafe name %s"), e.name.c_str());
+        return false;
+    }
+
+    tstring path = extractPath(destdir, e.name);
+
+    // Directory entry
+    if((e.name[e.name.length() - 1] == _T('/')) || (e.name[e.name.length() - 1] == _T('\\')))
+        return true;
+
+    string header(30, '\0');
+
+    if((e.flags & 1) || !read(e.offset, &header[0], 30) || (header.compare(0, 4, ZIP_LOCAL_SIG) != 0))
+        return false;
+
+    DWORDLONG dataOffset = e.offset + 30 + get16(header, 26) + get16(header, 28);
+
+    if((dataOffset + e.compressedSize > e.end) || _fseeki64(handle, dataOffset, SEEK_SET))
+        return false;
+
+    FILE *out = _tfopen(path.c_str(), _T("wb"));
+
+    if(!out)
+        return false;
+
+    DWORD     crc  = 0;
+    DWORDLONG size = 0;
+    bool      res  = true;
+
+    if(e.method == ZIP_STORED)
+    {
+        BYTE     *buffer = new BYTE[ZIP_EXTRACT_BUFSIZE];
+        DWORDLONG left   = e.compressedSize;
+
+        while(left && res)
+        {
+            size_t n = (size_t)min(left, (DWORDLONG)ZIP_EXTRACT_BUFSIZE);
+
+            res   = (fread(buffer, 1, n, handle) == n) && (fwrite(buffer, 1, n, out) == n);
+            crc   = crc32(crc, buffer, n);
+            size += n;
+            left -= n;
+        }
+
+        delete[] buffer;
+    }
+    else if(e.method == ZIP_DEFLATED)
+    {
+        Inflater *inflater = new Inflater(handle, e.compressedSize, out);
+
+        res  = inflater->run();
+        crc  = inflater->crc;
+        size = inflater->outputSize;
+        delete inflater;
+    }
+    else
+    {
+        TRACE(_T("Zip: unsupported compression method %d of %s"), (int)e.method, e.name.c_str());
+        res = false;
+    }
+
+    res = (fclose(out) == 0) && res;
+
+    if(!res || (size != e.size) || (crc != e.crc))
+    {
+        TRACE(_T("Zip: %s is corrupted"), e.name.c_str());
+        _tremove(path.c_str());
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <windows.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "tstring.h"
+#include "file.h"
+
+#define ZIP_TAIL_SIZE        (65535 + 22 + 20 + 56) // Longest comment, end of central directory, Zip64 locator & end record
+#define ZIP_COALESCE_GAP     65536     // Selected members, closer than this, are fetched with one range request
+#define ZIP_MAX_CENTRAL_SIZE 268435456 // Central directory is read into memory
+#define ZIP_STORED           0
+#define ZIP_DEFLATED         8
+
+using namespace std;
+
+struct ZipEntry
+{
+    tstring   name;           // '/' separated
+    WORD      flags;
+    WORD      method;
+    DWORD     crc;
+    DWORDLONG compressedSize;
+    DWORDLONG size;
+    DWORDLONG offset;         // Of local header
+    DWORDLONG end;            // First byte after local record: next local header or central directory
+    string    record;         // Central directory record, as is
+    size_t    offsetField;    // Position of local header offset in record
+    bool      offset64;       // Offset is stored in Zip64 extra field
+};
+
+// Central directory of zip archive (Zip64 included). Parsed from memory, so same code serves remote
+// archive, whose tail & directory are fetched with range requests, and local file.
+class ZipDirectory
+{
+public:
+    ZipDirectory();
+
+    bool readEnd(const string &tail, DWORDLONG archiveSize); // tail - last bytes of archive
+    bool readCentral(const string &central);                 // centralSize bytes at centralOffset
+    vector<ByteRange> ranges(const vector<size_t> &selected, DWORDLONG gap); // Sorted, coalesced local records
+
+    vector<ZipEntry> entries;
+    DWORDLONG        centralOffset;
+    DWORDLONG        centralSize;
+    DWORDLONG        count;
+};
+
+// Members of zip archive, which are downloaded (see Downloader::addZipMembers)
+struct ZipMembers
+{
+    ZipMembers();
+
+    bool selected(const ZipEntry &entry) const;
+
+    bool      enabled;
+    tstring   include;     // ';' separated masks of member names, empty - all members
+    tstring   exclude;
+    tstring   extractDir;  // Members are extracted here and reduced archive is deleted, empty - archive is kept
+    DWORDLONG archiveSize; // Of whole remote archive, FILE_SIZE_UNKNOWN until known
+};
+
+// Writes reduced archive: local records of selected entries as is, then new central directory.
+// Data of source archive is passed in increasing offset order, bytes between records are skipped.
+class ZipWriter
+{
+public:
+    ZipWriter(ZipDirectory *directory, const vector<size_t> &selected);
+    ~ZipWriter();
+
+    bool open(tstring filename);
+    bool write(DWORDLONG offset, const BYTE *data, DWORD size); // Bytes of source archive at offset
+    bool finish();                                              // false, if some record is incomplete
+    void close();
+
+protected:
+    ZipDirectory     *dir;
+    vector<size_t>    entries;    // Selected, sorted by offset
+    vector<DWORDLONG> newOffsets;
+    size_t            current;    // Entry, which is written now
+    DWORDLONG         done;       // Bytes of current entry, which are written
+    DWORDLONG         position;   // In reduced archive
+    FILE             *handle;
+};
+
+// Reads & extracts local zip archive. Stored & deflated members are supported.
+class ZipArchive
+{
+public:
+    ZipArchive();
+    ~ZipArchive();
+
+    bool open(tstring filename, bool readDirectory = true); // Directory may be read once & shared (see Extractor)
+    void close();
+    bool extract(size_t index, tstring destdir); // Checks CRC-32 of extracted data
+    bool extract(const ZipEntry &entry, tstring destdir);
+    bool read(DWORDLONG offset, void *buffer, DWORD size);
+
+    static bool safeName(tstring name); // Name, which stays inside destination directory
+
+    ZipDirectory dir;
+
+protected:
+    FILE *handle;
+};
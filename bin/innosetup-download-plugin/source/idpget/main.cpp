@@ -0,0 +1,617 @@
+// Command-line bulk downloader, built on Downloader core. Used by build scripts to fetch
+// components of installers with same transfer engine, which installers use.
+//
+//   idpget [options] [-i list] [list | metalink]...
+//
+// Download lists use aria2c input file format, so lists generated by build scripts are read
+// as is: URL line (mirrors of same file are separated by tabs), followed by indented
+// "key=value" lines. Keys out (file name), dir (directory) and checksum ("sha-256=hex",
+// "sha-1=hex") are used, other keys, empty lines & lines starting with '#' are ignored.
+// Arguments ending with .meta4 or .metalink are added with Downloader::addMetalink.
+//
+// Files are taken from one queue by --jobs threads, each with its own Downloader, so
+// mirrors, FTP segments, retries, resume journals & hash checks work as in installer.
+// Queue is served in round-robin order of hosts and connections to each host are limited
+// (--host-connections, see HostScheduler), so many files from one host don't hold all jobs.
+// Read buffers of all jobs share --buffer-memory budget (see BufferPool), its peak use is
+// printed with summary.
+// With --async n, files of lists are downloaded by one downloader, n at once on few threads
+// (AsyncTransfers option, see AsyncEngine), instead of --jobs threads.
+// With --adaptive, number of running transfers & segments (up to --jobs * --split) follows
+// measured goodput (see ConcurrencyController).
+// Existing file is skipped (unless --overwrite), if it has no resume journal, has expected
+// hash and is not smaller than --min-size. Downloaded files are checked against their size
+// on server and --min-size (error pages, saved instead of archives).
+// One line is printed per file. Exit code: 0 - all files are valid, 1 - some failed,
+// 2 - invalid arguments or download list.
+
+#include "../idp/downloader.h"
+#include "../idp/file.h"
+#include "../idp/hash.h"
+#include "../idp/trace.h"
+#include <stdio.h>
+#include <direct.h>
+#include <process.h>
+#include <algorithm>
+
+#define DEFAULT_JOBS 4
+#define MAX_JOBS     64
+
+void idpReportError() {} // stub to aviod compile error
+
+struct Entry
+{
+    vector<tstring> urls;          // Primary URL, then mirrors
+    tstring         filename;
+    tstring         metalink;      // Metalink document, its files are downloaded to --dir
+    tstring         host;          // Of primary URL
+    int             hashAlgorithm;
+    string          hash;
+};
+
+struct Result
+{
+    tstring       url;
+    tstring       filename;
+    DWORDLONG     size;
+    bool          ok;
+    bool          skipped;
+    tstring       error;
+    TransferStats stats;
+};
+
+struct Job
+{
+    vector<Entry>   entries;
+    vector<size_t>  pending; // Entries, not taken by worker yet, in list order
+    vector<Result>  results;
+    Downloader      options;
+    InternetOptions internetOptions;
+    tstring         dir;
+    DWORDLONG       minSize;
+    bool            overwrite;
+    CRITICAL_SECTION lock;
+};
+
+class BulkDownloader: public Downloader
+{
+public:
+    // Hash is checked after download, mismatch is retried like transfer error (see verifyFile)
+    void setHash(tstring url, int algorithm, string hash)
+    {
+        files[url]->hashAlgorithm = algorithm;
+        files[url]->hash          = hash;
+    }
+
+    void takeResults(vector<Result> *results, DWORDLONG minSize)
+    {
+        for(map<tstring, NetFile *>::iterator i = files.begin(); i != files.end(); i++)
+        {
+            NetFile  *file = i->second;
+            Result    r;
+            DWORDLONG size = 0;
+
+            r.url      = i->first;
+            r.filename = file->name;
+            r.size     = file->size;
+            r.ok       = file->downloaded;
+            r.skipped  = false;
+            r.stats    = file->stats;
+
+            if(!r.ok && file->stats.httpStatus >= 400)
+                r.error = tstrprintf(_T("HTTP error %d"), file->stats.httpStatus);
+            else if(!r.ok)
+                r.error = file->stats.error ? formatwinerror(file->stats.error) : getLastErrorStr();
+            else if(!File::exists(file->name, &size))
+                r.error = _T("File not found after download");
+            else if(!(file->size == FILE_SIZE_UNKNOWN) && (size != file->size))
+                r.error = tstrprintf(_T("Size is %I64u bytes, server reported %I64u"), size, file->size);
+            else if(size < minSize)
+                r.error = tstrprintf(_T("Size is %I64u bytes, less than %I64u"), size, minSize);
+
+            if(!r.error.empty())
+                r.ok = false;
+
+            if(r.ok)
+                r.size = size;
+            else if(r.error.empty())
+                r.error = _T("Not downloaded");
+
+            results->push_back(r);
+        }
+    }
+};
+
+static tstring trim(tstring s)
+{
+    size_t first = s.find_first_not_of(_T(" \t\r\n"));
+
+    if(first == tstring::npos)
+        return _T("");
+
+    return s.substr(first, s.find_last_not_of(_T(" \t\r\n")) - first + 1);
+}
+
+static bool endsWith(tstring s, tstring suffix)
+{
+    return (s.length() >= suffix.length()) && !_tcsicmp(s.c_str() + s.length() - suffix.length(), suffix.c_str());
+}
+
+static tstring joinPath(tstring dir, tstring name)
+{
+    if(dir.empty() || (name.length() && ((name[0] == _T('/')) || (name[0] == _T('\\')))) || (name.find(_T(':')) != tstring::npos))
+        return name;
+
+    _TCHAR last = dir[dir.length() - 1];
+    return ((last == _T('/')) || (last == _T('\\'))) ? dir + name : dir + _T("/") + name;
+}
+
+// Creates all missing directories of file path
+static void makeDirs(tstring filename)
+{
+    for(size_t i = 1; i < filename.length(); i++)
+        if(((filename[i] == _T('/')) || (filename[i] == _T('\\'))) && (filename[i - 1] != _T(':')))
+            _tmkdir(filename.substr(0, i).c_str());
+}
+
+// Last path segment of URL, without query
+static tstring urlFileName(tstring url)
+{
+    tstring path = url.substr(0, url.find_first_of(_T("?#")));
+    return path.substr(path.find_last_of(_T('/')) + 1);
+}
+
+// Reads download list in aria2c input file format, false on syntax error
+static bool readList(tstring listname, tstring dir, vector<Entry> *entries)
+{
+    FILE *f = _tfopen(listname.c_str(), _T("rb"));
+
+    if(!f)
+    {
+        fprintf(stderr, "Cannot open %s\n", toansi(listname).c_str());
+        return false;
+    }
+
+    char    buffer[8192];
+    int     lineNo = 0;
+    bool    res    = true;
+    tstring entryDir;
+    tstring out;
+
+    while(fgets(buffer, sizeof(buffer), f))
+    {
+        tstring line = fromutf8(buffer);
+        tstring text = trim(line);
+
+        lineNo++;
+
+        if(text.empty() || (text[0] == _T('#')))
+            continue;
+
+        if((line[0] != _T(' ')) && (line[0] != _T('\t')))
+        {
+            Entry e;
+            size_t start = 0;
+
+            while(start < text.length())
+            {
+                size_t  tab = text.find(_T('\t'), start);
+                tstring url = trim(text.substr(start, (tab == tstring::npos) ? tstring::npos : tab - start));
+
+                if(!url.empty())
+                    e.urls.push_back(url);
+
+                start = (tab == tstring::npos) ? text.length() : tab + 1;
+            }
+
+            e.hashAlgorithm = HASH_NONE;
+            e.host          = Url(e.urls[0]).hostName;
+            e.filename      = joinPath(dir, urlFileName(e.urls[0]));
+            entryDir        = dir;
+            out             = urlFileName(e.urls[0]);
+            entries->push_back(e);
+            continue;
+        }
+
+        size_t eq = text.find(_T('='));
+
+        if(entries->empty() || (eq == tstring::npos))
+        {
+            fprintf(stderr, "%s(%d): expected key=value line of URL\n", toansi(listname).c_str(), lineNo);
+            res = false;
+            continue;
+        }
+
+        Entry  *e     = &entries->back();
+        tstring key   = tstrlower(trim(text.substr(0, eq)).c_str());
+        tstring value = trim(text.substr(eq + 1));
+
+        if(key.compare(_T("out")) == 0)
+            out = value;
+        else if(key.compare(_T("dir")) == 0)
+            entryDir = joinPath(dir, value);
+        else if(key.compare(_T("checksum")) == 0)
+        {
+            size_t sep = value.find(_T('='));
+            int    alg = (sep == tstring::npos) ? HASH_NONE : Hash::algorithm(toutf8(value.substr(0, sep)));
+
+            if(alg == HASH_NONE)
+            {
+                fprintf(stderr, "%s(%d): unsupported checksum %s\n", toansi(listname).c_str(), lineNo, toansi(value).c_str());
+                res = false;
+                continue;
+            }
+
+            e->hashAlgorithm = alg;
+            e->hash          = toutf8(tstrlower(value.substr(sep + 1).c_str()));
+        }
+
+        e->filename = joinPath(entryDir, out);
+    }
+
+    fclose(f);
+    return res;
+}
+
+static void addResults(Job *job, vector<Result> &results)
+{
+    EnterCriticalSection(&job->lock);
+
+    for(vector<Result>::iterator r = results.begin(); r != results.end(); r++)
+    {
+        if(r->skipped)
+            printf("skip  %12s  %s\n", u64tostr(r->size).c_str(), toansi(r->filename).c_str());
+        else if(r->ok)
+            printf("ok    %12s  %s\n", u64tostr(r->size).c_str(), toansi(r->filename).c_str());
+        else
+            printf("FAIL  %12s  %s: %s (%s)\n", "", toansi(r->filename).c_str(), toansi(trim(r->error)).c_str(), toansi(r->url).c_str());
+
+        job->results.push_back(*r);
+    }
+
+    fflush(stdout);
+    LeaveCriticalSection(&job->lock);
+}
+
+// Existing file can be kept, if its download was finished and it has expected hash
+static bool fileValid(Entry *e, DWORDLONG minSize, DWORDLONG *size)
+{
+    if(!File::exists(e->filename, size) || File::exists(e->filename + RESUME_JOURNAL_EXT) || (*size < minSize))
+        return false;
+
+    return (e->hashAlgorithm == HASH_NONE) || (Hash::file(e->filename, e->hashAlgorithm).compare(e->hash) == 0);
+}
+
+// Adds entry to downloader, or to results, if it is metalink which can't be read, or file which is skipped
+static void addEntry(BulkDownloader *d, Job *job, Entry *e, vector<Result> *results)
+{
+    DWORDLONG size;
+
+    if(!e->metalink.empty())
+    {
+        if(!d->addMetalink(e->metalink, job->dir))
+        {
+            Result r;
+            r.url      = e->metalink;
+            r.filename = e->metalink;
+            r.size     = FILE_SIZE_UNKNOWN;
+            r.ok       = false;
+            r.skipped  = false;
+            r.error    = _T("Invalid Metalink document");
+            results->push_back(r);
+        }
+    }
+    else if(!job->overwrite && fileValid(e, job->minSize, &size))
+    {
+        Result r;
+        r.url      = e->urls[0];
+        r.filename = e->filename;
+        r.size     = size;
+        r.ok       = true;
+        r.skipped  = true;
+        results->push_back(r);
+    }
+    else
+    {
+        makeDirs(e->filename);
+        d->addFile(e->urls[0], e->filename);
+
+        for(size_t i = 1; i < e->urls.size(); i++)
+            d->addMirror(e->urls[0], e->urls[i]);
+
+        if(e->hashAlgorithm != HASH_NONE)
+            d->setHash(e->urls[0], e->hashAlgorithm, e->hash);
+    }
+}
+
+// With --async, all files of lists are given to one downloader, which runs them on AsyncEngine.
+// Metalinks are left in queue for workers.
+static void downloadAsync(Job *job)
+{
+    BulkDownloader d;
+    vector<Result> results;
+    vector<size_t> metalinks;
+
+    d.setOptions(&job->options);
+    d.setInternetOptions(job->internetOptions);
+
+    for(vector<size_t>::iterator i = job->pending.begin(); i != job->pending.end(); i++)
+    {
+        if(job->entries[*i].metalink.empty())
+            addEntry(&d, job, &job->entries[*i], &results);
+        else
+            metalinks.push_back(*i);
+    }
+
+    if(d.filesCount())
+    {
+        d.downloadFiles(false);
+        d.takeResults(&results, job->minSize);
+    }
+
+    addResults(job, results);
+    job->pending.swap(metalinks);
+}
+
+static unsigned __stdcall workerProc(void *param)
+{
+    Job           *job = (Job *)param;
+    BulkDownloader d;
+
+    d.setOptions(&job->options);
+    d.setInternetOptions(job->internetOptions);
+
+    for(;;)
+    {
+        vector<tstring> hosts;
+        size_t          index = job->entries.size();
+
+        EnterCriticalSection(&job->lock);
+
+        for(vector<size_t>::iterator i = job->pending.begin(); i != job->pending.end(); i++)
+            hosts.push_back(job->entries[*i].host);
+
+        size_t picked = hostScheduler.pick(hosts);
+
+        if(picked < job->pending.size())
+        {
+            index = job->pending[picked];
+            job->pending.erase(job->pending.begin() + picked);
+        }
+
+        LeaveCriticalSection(&job->lock);
+
+        if(index >= job->entries.size())
+            break;
+
+        vector<Result> results;
+
+        addEntry(&d, job, &job->entries[index], &results);
+
+        if(d.filesCount())
+        {
+            d.downloadFiles(false);
+            d.takeResults(&results, job->minSize);
+            d.clearFiles();
+            d.clearMirrors();
+        }
+
+        addResults(job, results);
+    }
+
+    return 0;
+}
+
+static DWORDLONG sizeArg(tstring s)
+{
+    DWORDLONG size = _tcstoui64(s.c_str(), NULL, 10);
+
+    switch(s.empty() ? 0 : s[s.length() - 1])
+    {
+    case _T('g'): case _T('G'): size *= 1024; // fall through
+    case _T('m'): case _T('M'): size *= 1024; // fall through
+    case _T('k'): case _T('K'): size *= 1024;
+    }
+
+    return size;
+}
+
+static int usage()
+{
+    fprintf(stderr,
+        "Usage: idpget [options] [-i list] [list | metalink]...\n"
+        "  -i, --input file         download list in aria2c input file format\n"
+        "  -d, --dir path           directory for relative file names (default: current)\n"
+        "  -j, --jobs n             files downloaded at same time (default: %d)\n"
+        "  -s, --split n            connections per FTP file (FtpSegments option)\n"
+        "  --host-connections spec  connections per host, like 4 or \"4;github.com=2\" (HostConnections option)\n"
+        "  --buffer-memory size     budget of all read buffers, 0 - unlimited (BufferMemory option)\n"
+        "  --async n                download n files at once on asynchronous engine (AsyncTransfers option)\n"
+        "  --adaptive               tune number of transfers to measured throughput (AdaptiveConcurrency option)\n"
+        "  --retries n              attempts per file (RetryAttempts option)\n"
+        "  --timeout ms             connect & receive timeout\n"
+        "  --min-size size          smaller files are failed (k, m, g suffixes)\n"
+        "  --overwrite              download existing files again\n"
+        "  --no-check-certificate   accept invalid HTTPS certificates\n"
+        "  --user-agent text\n"
+        "  --transport name         wininet or curl\n"
+        "  --report file            write JSON performance report (PerfReport option)\n",
+        DEFAULT_JOBS);
+
+    return 2;
+}
+
+int _tmain(int argc, _TCHAR *argv[])
+{
+    Job             job;
+    vector<tstring> lists;
+    vector<tstring> metalinks;
+    tstring         reportFile;
+    int             jobs = DEFAULT_JOBS;
+
+    job.minSize                     = 0;
+    job.overwrite                   = false;
+    job.options.stopOnError         = false;
+    job.internetOptions.invalidCert = INVC_STOP;
+
+    for(int i = 1; i < argc; i++)
+    {
+        tstring arg   = argv[i];
+        bool    value = i + 1 < argc;
+
+        if(((arg.compare(_T("-i")) == 0) || (arg.compare(_T("--input")) == 0)) && value)
+            lists.push_back(argv[++i]);
+        else if(((arg.compare(_T("-d")) == 0) || (arg.compare(_T("--dir")) == 0)) && value)
+            job.dir = argv[++i];
+        else if(((arg.compare(_T("-j")) == 0) || (arg.compare(_T("--jobs")) == 0)) && value)
+            jobs = max(1, min(MAX_JOBS, _ttoi(argv[++i])));
+        else if(((arg.compare(_T("-s")) == 0) || (arg.compare(_T("--split")) == 0)) && value)
+            job.options.ftpSegments = max(1, _ttoi(argv[++i]));
+        else if((arg.compare(_T("--host-connections")) == 0) && value)
+        {
+            if(!hostScheduler.setLimits(argv[++i]))
+                return usage();
+        }
+        else if((arg.compare(_T("--buffer-memory")) == 0) && value)
+            bufferPool.budget = sizeArg(argv[++i]);
+        else if((arg.compare(_T("--async")) == 0) && value)
+            job.options.asyncTransfers = max(0, _ttoi(argv[++i]));
+        else if(arg.compare(_T("--adaptive")) == 0)
+            concurrency.enabled = true;
+        else if((arg.compare(_T("--retries")) == 0) && value)
+            job.options.retryPolicy.attempts = max(1, _ttoi(argv[++i]));
+        else if((arg.compare(_T("--timeout")) == 0) && value)
+            job.internetOptions.connectTimeout = job.internetOptions.receiveTimeout = _ttoi(argv[++i]);
+        else if((arg.compare(_T("--min-size")) == 0) && value)
+            job.minSize = sizeArg(argv[++i]);
+        else if(arg.compare(_T("--overwrite")) == 0)
+            job.overwrite = true;
+        else if(arg.compare(_T("--no-check-certificate")) == 0)
+            job.internetOptions.invalidCert = INVC_IGNORE;
+        else if((arg.compare(_T("--user-agent")) == 0) && value)
+            job.internetOptions.userAgent = argv[++i];
+        else if((arg.compare(_T("--report")) == 0) && value)
+            reportFile = argv[++i];
+        else if((arg.compare(_T("--transport")) == 0) && value)
+        {
+            Transport *transport = findTransport(argv[++i]);
+
+            if(!transport)
+            {
+                fprintf(stderr, "Unknown transport: %s\n", toansi(argv[i]).c_str());
+                return 2;
+            }
+
+            setDefaultTransport(transport);
+        }
+        else if(!arg.empty() && (arg[0] != _T('-')))
+        {
+            if(endsWith(arg, _T(".meta4")) || endsWith(arg, _T(".metalink")))
+                metalinks.push_back(arg);
+            else
+                lists.push_back(arg);
+        }
+        else
+            return usage();
+    }
+
+    if(lists.empty() && metalinks.empty())
+        return usage();
+
+    concurrency.maxStreams = jobs * max(1, job.options.ftpSegments);
+
+    for(vector<tstring>::iterator i = lists.begin(); i != lists.end(); i++)
+        if(!readList(*i, job.dir, &job.entries))
+            return 2;
+
+    for(vector<tstring>::iterator i = metalinks.begin(); i != metalinks.end(); i++)
+    {
+        Entry e;
+        e.metalink      = *i;
+        e.hashAlgorithm = HASH_NONE;
+        job.entries.push_back(e);
+    }
+
+    // Lists of several installers share files: each one is downloaded once
+    set<tstring>  names;
+    vector<Entry> unique;
+
+    for(vector<Entry>::iterator i = job.entries.begin(); i != job.entries.end(); i++)
+        if(!i->metalink.empty() || names.insert(i->filename).second)
+            unique.push_back(*i);
+
+    job.entries.swap(unique);
+
+    for(size_t i = 0; i < job.entries.size(); i++)
+        job.pending.push_back(i);
+
+    // Transport is initialized once, before it is used by several threads
+    HINTERNET session = defaultTransport()->openSession(job.internetOptions);
+
+    if(session)
+        defaultTransport()->closeHandle(session);
+
+    InitializeCriticalSection(&job.lock);
+
+    Timer          timer;
+    vector<HANDLE> threads;
+
+    timer.start(0);
+
+    if(job.options.asyncTransfers)
+        downloadAsync(&job);
+
+    for(int i = 0; i < min(jobs, (int)job.pending.size()); i++)
+    {
+        HANDLE thread = (HANDLE)_beginthreadex(NULL, 0, &workerProc, (void *)&job, 0, NULL);
+
+        if(thread)
+            threads.push_back(thread);
+    }
+
+    if(threads.empty() && !job.pending.empty())
+        workerProc(&job);
+
+    for(vector<HANDLE>::iterator i = threads.begin(); i != threads.end(); i++)
+    {
+        WaitForSingleObject(*i, INFINITE);
+        CloseHandle(*i);
+    }
+
+    DeleteCriticalSection(&job.lock);
+
+    int       ok = 0, skipped = 0, failed = 0;
+    DWORDLONG bytes = 0;
+
+    for(vector<Result>::iterator r = job.results.begin(); r != job.results.end(); r++)
+    {
+        if(r->skipped)
+            skipped++;
+        else if(r->ok)
+        {
+            ok++;
+            bytes += r->stats.bytes;
+        }
+        else
+            failed++;
+    }
+
+    DWORD elapsed = timer.totalElapsed();
+
+    printf("%d files: %d downloaded (%s bytes in %.1f s), %d skipped, %d failed, peak buffer memory %s bytes\n",
+           (int)job.results.size(), ok, u64tostr(bytes).c_str(), elapsed / 1000.0, skipped, failed, u64tostr(bufferPool.peak()).c_str());
+
+    if(!reportFile.empty())
+    {
+        PerfReport report(defaultTransport()->name(), elapsed);
+
+        for(vector<Result>::iterator r = job.results.begin(); r != job.results.end(); r++)
+            if(!r->skipped)
+                report.add(r->url, r->filename, r->size, r->ok, r->stats);
+
+        if(!report.write(reportFile))
+            fprintf(stderr, "Cannot write %s\n", toansi(reportFile).c_str());
+    }
+
+    return failed ? 1 : 0;
+}
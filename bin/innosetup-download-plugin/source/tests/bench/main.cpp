@@ -0,0 +1,507 @@
+// End-to-end download benchmark. Starts loopback HTTP & FTP test server, downloads
+// synthetic files with Downloader and prints one JSON object per scenario (JSON Lines),
+// so results can be collected and compared between builds.
+//
+//   idpbench [--quick] [--scenario name] [--transport name] [--dir path] [--list]
+//            [--fault "/prefix key=value ..."] [--trace dir] [--report dir]
+//
+// Full run needs about 2.5 GB of free disk space. --quick divides file sizes by 128
+// and large file counts by 40 (used by ctest). Peak RSS is peak of whole process
+// up to end of scenario; run single scenario with --scenario to get isolated value.
+// Fault scenarios inject failures into primary URLs (see TestFault) and report
+// wasted bytes (file bytes sent by server, but not needed) and average time from
+// faulted request to next clean one (recover_ms). Stall scenarios use short StallTimeout,
+// so stalled transfer is continued from mirror at current offset. Hedge scenarios send
+// hedged requests to mirrors, server_requests shows how many were sent. Prefetch scenarios
+// start background prefetch and wait before download (user on earlier wizard pages);
+// seconds is time of download only, wasted_bytes includes prefetch. --trace writes event
+// trace of each scenario to <dir>/<scenario>.trace, --report writes performance report
+// (PerfReport option) to <dir>/<scenario>.json. Interrupted scenarios stop first download
+// midway (installer killed or cancelled), then new Downloader continues from resume journals;
+// wasted_bytes shows how much was downloaded again. Metalink scenarios add files from generated
+// Metalink document, which lists mirror before faulted primary URL, but with lower priority;
+// files are checked with SHA-256 hashes from document. Corrupt scenarios flip one byte
+// of primary file: wasted_bytes shows whole file downloaded again without piece hashes and
+// one piece with them. In full run scenario fails, if wasted_bytes exceed its limit (percent
+// of bytes); --quick files are not much bigger than one chunk of bandwidth cap, so it's not checked.
+
+#include "../server/testserver.h"
+#include "../../idp/downloader.h"
+#include <stdio.h>
+#include <direct.h>
+#ifdef _WIN32
+#include <psapi.h>
+#else
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <time.h>
+#endif
+
+#define MB (1024ULL * 1024ULL)
+#define GB (1024ULL * MB)
+
+#define QUICK_SIZE_DIVIDER  128
+#define QUICK_COUNT_DIVIDER 40
+
+void idpReportError() {} // stub to aviod compile error
+
+struct Scenario
+{
+    const char        *name;
+    const char        *protocol;
+    int                count;
+    unsigned long long size;
+    int                readBufferSize;
+    int                ftpSegments;
+    bool               mirror;         // Add mirror for each file
+    const char        *fault;          // Fault for primary URLs, NULL - none. "/file key=value ..." - for one file
+    DWORD              receiveTimeout; // ms, 0 - default
+    DWORD              stallTimeout;   // ms, 0 - default
+    bool               expectFail;
+    bool               hedge;
+    DWORD              prefetch;       // ms of background prefetch before download, 0 - none
+    DWORD              interrupt;      // ms after which first download is stopped, 0 - not interrupted
+    bool               metalink;       // Add files with idpAddMetalink instead of idpAddFile
+    unsigned long long pieceSize;      // Metalink lists SHA-256 of pieces of this size, 0 - of whole file only
+    int                maxWasted;      // Percent of bytes, 0 - not checked
+};
+
+static Scenario scenarios[] =
+{
+    { "http-1x2g",              "http", 1,     2 * GB,  DEFAULT_READ_BUFSIZE, 1, false, NULL },
+    { "ftp-1x2g",               "ftp",  1,     2 * GB,  DEFAULT_READ_BUFSIZE, 1, false, NULL },
+    { "ftp-1x2g-seg4",          "ftp",  1,     2 * GB,  DEFAULT_READ_BUFSIZE, 4, false, NULL },
+    { "ftp-1x2g-seg8",          "ftp",  1,     2 * GB,  DEFAULT_READ_BUFSIZE, 8, false, NULL },
+    { "http-50x20m",            "http", 50,    20 * MB, DEFAULT_READ_BUFSIZE, 1, false, NULL },
+    { "ftp-50x20m",             "ftp",  50,    20 * MB, DEFAULT_READ_BUFSIZE, 1, false, NULL },
+    { "http-50x20m-buf16k",     "http", 50,    20 * MB, 16384,                1, false, NULL },
+    { "http-50x20m-buf64k",     "http", 50,    20 * MB, 65536,                1, false, NULL },
+    { "http-50x20m-buf256k",    "http", 50,    20 * MB, 262144,               1, false, NULL },
+    { "http-50x20m-mirror",     "http", 50,    20 * MB, DEFAULT_READ_BUFSIZE, 1, true,  "status=404" },
+    { "http-20000x4k",          "http", 20000, 4096,    DEFAULT_READ_BUFSIZE, 1, false, NULL },
+    { "ftp-20000x4k",           "ftp",  20000, 4096,    DEFAULT_READ_BUFSIZE, 1, false, NULL },
+    // Network conditions & failures
+    { "http-10x4m-shaped",      "http", 10,    4 * MB,  DEFAULT_READ_BUFSIZE, 1, false, "latency=50 bandwidth=32m" },
+    { "http-10x4m-handshake",   "http", 10,    4 * MB,  DEFAULT_READ_BUFSIZE, 1, false, "handshake=300" },
+    { "http-1x64m-503-mirror",  "http", 1,     64 * MB, DEFAULT_READ_BUFSIZE, 1, true,  "status=503 retryafter=1" },
+    { "http-1x64m-reset-mirror","http", 1,     64 * MB, DEFAULT_READ_BUFSIZE, 1, true,  "reset=25%" },
+    { "http-1x64m-reset-retry", "http", 1,     64 * MB, DEFAULT_READ_BUFSIZE, 1, false, "reset=25% times=1" },
+    { "http-1x64m-503-retry",   "http", 1,     64 * MB, DEFAULT_READ_BUFSIZE, 1, false, "status=503 times=2" },
+    { "http-1x64m-429-retry",   "http", 1,     64 * MB, DEFAULT_READ_BUFSIZE, 1, false, "status=429 retryafter=1 times=1" },
+    { "http-1x64m-stall-mirror","http", 1,     64 * MB, DEFAULT_READ_BUFSIZE, 1, true,  "stall=25%", 0, 2000 },
+    { "http-8x16m-trickle-mirror","http", 8,   16 * MB, DEFAULT_READ_BUFSIZE, 1, true,  "/f00007.bin bandwidth=16k", 0, 2000 },
+    { "ftp-1x64m-reset",        "ftp",  1,     64 * MB, DEFAULT_READ_BUFSIZE, 1, false, "reset=50% times=1" },
+    { "ftp-1x64m-stall",        "ftp",  1,     64 * MB, DEFAULT_READ_BUFSIZE, 1, false, "stall=50% times=1", 0, 2000 },
+    { "http-1x4m-407",          "http", 1,     4 * MB,  DEFAULT_READ_BUFSIZE, 1, false, "status=407", 0, 0, true },
+    { "http-20x1m-slow",        "http", 20,    1 * MB,  DEFAULT_READ_BUFSIZE, 1, true,  "/f00010.bin latency=1000" },
+    { "http-20x1m-slow-hedge",  "http", 20,    1 * MB,  DEFAULT_READ_BUFSIZE, 1, true,  "/f00010.bin latency=1000", 0, 0, false, true },
+    { "http-10x4m-shaped-prefetch","http", 10, 4 * MB,  DEFAULT_READ_BUFSIZE, 1, false, "latency=50 bandwidth=32m", 0, 0, false, false, 1000 },
+    { "http-1x64m-interrupted", "http", 1,     64 * MB, DEFAULT_READ_BUFSIZE, 1, false, "bandwidth=16m", 0, 0, false, false, 0, 2000 },
+    { "ftp-1x256m-seg4-interrupted","ftp", 1,  256 * MB, DEFAULT_READ_BUFSIZE, 4, false, "bandwidth=16m", 0, 0, false, false, 0, 2000 },
+    { "http-20x1m-metalink",    "http", 20,    1 * MB,  DEFAULT_READ_BUFSIZE, 1, true,  "status=404", 0, 0, false, false, 0, 0, true },
+    { "http-1x64m-corrupt",     "http", 1,     64 * MB, DEFAULT_READ_BUFSIZE, 1, true,  "corrupt=50% times=1", 0, 0, false, false, 0, 0, true },
+    { "http-1x64m-corrupt-pieces","http", 1,   64 * MB, DEFAULT_READ_BUFSIZE, 1, true,  "corrupt=50% times=1", 0, 0, false, false, 0, 0, true, 1 * MB },
+    { "http-1x64m-metalink-interrupted","http", 1, 64 * MB, DEFAULT_READ_BUFSIZE, 1, false, "bandwidth=4m", 0, 0, false, false, 0, 2000, true, 0, 2 },
+    { "http-1x64m-metalink-prefetch","http", 1, 64 * MB, DEFAULT_READ_BUFSIZE, 1, false, "bandwidth=4m", 0, 0, false, false, 2000, 0, true, 0, 2 },
+    { NULL }
+};
+
+struct Usage
+{
+    double    wall;
+    double    user;
+    double    sys;
+    long long syscalls; // Read & write-like system calls, -1 if unknown
+    long long peakRss;  // KB
+};
+
+static void getUsage(Usage *u)
+{
+#ifdef _WIN32
+    LARGE_INTEGER counter, freq;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&freq);
+    u->wall = (double)counter.QuadPart / freq.QuadPart;
+
+    FILETIME creation, exit, kernel, user;
+    GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user);
+    u->user = (((ULONGLONG)user.dwHighDateTime << 32) | user.dwLowDateTime) / 1e7;
+    u->sys  = (((ULONGLONG)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime) / 1e7;
+
+    IO_COUNTERS io;
+    GetProcessIoCounters(GetCurrentProcess(), &io);
+    u->syscalls = (long long)(io.ReadOperationCount + io.WriteOperationCount + io.OtherOperationCount);
+
+    PROCESS_MEMORY_COUNTERS mem;
+    GetProcessMemoryInfo(GetCurrentProcess(), &mem, sizeof(mem));
+    u->peakRss = (long long)(mem.PeakWorkingSetSize / 1024);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    u->wall = ts.tv_sec + ts.tv_nsec / 1e9;
+
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    u->user    = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6;
+    u->sys     = ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+    u->peakRss = ru.ru_maxrss;
+
+    // /proc/self/io counts read & write-like calls only (Linux)
+    u->syscalls = -1;
+    FILE *f = fopen("/proc/self/io", "r");
+
+    if(f)
+    {
+        char line[128];
+        long long value;
+
+        u->syscalls = 0;
+
+        while(fgets(line, sizeof(line), f))
+            if((sscanf(line, "syscr: %lld", &value) == 1) || (sscanf(line, "syscw: %lld", &value) == 1))
+                u->syscalls += value;
+
+        fclose(f);
+    }
+#endif
+}
+
+static unsigned long long scenarioSize(Scenario *sc, bool quick)
+{
+    if(!quick)
+        return sc->size;
+
+    unsigned long long size = sc->size / QUICK_SIZE_DIVIDER;
+    return (size < 4096) ? sc->size : size;
+}
+
+static int scenarioCount(Scenario *sc, bool quick)
+{
+    return (quick && (sc->count > 1000)) ? sc->count / QUICK_COUNT_DIVIDER : sc->count;
+}
+
+static string filePath(Scenario *sc, int index)
+{
+    char name[32];
+    sprintf(name, "/f%05d.bin", index);
+    return string("/") + sc->name + name;
+}
+
+static string faultSpec(Scenario *sc)
+{
+    string prefix = string("/") + sc->name;
+    return (sc->fault[0] == '/') ? prefix + sc->fault : prefix + "/ " + sc->fault;
+}
+
+static tstring localName(tstring dir, Scenario *sc, int index)
+{
+    return dir + _T("/") + tocurenc(sc->name) + tocurenc(filePath(sc, index).substr(strlen(sc->name) + 1));
+}
+
+static void addFiles(Downloader &d, TestServer &server, Scenario *sc, bool quick, tstring dir)
+{
+    unsigned long long size  = scenarioSize(sc, quick);
+    int                count = scenarioCount(sc, quick);
+    bool               http  = string(sc->protocol).compare("http") == 0;
+
+    for(int i = 0; i < count; i++)
+    {
+        string path = filePath(sc, i);
+        tstring url = tocurenc(http ? server.httpUrl(path) : server.ftpUrl(path));
+
+        d.addFile(url, localName(dir, sc, i), size);
+
+        if(sc->mirror)
+            d.addMirror(url, tocurenc(http ? server.httpUrl("/mirror" + path) : server.ftpUrl("/mirror" + path)));
+    }
+}
+
+static string fileHash(string path, unsigned long long start, unsigned long long end)
+{
+    Hash  hash(HASH_SHA256);
+    char *buffer = new char[MB];
+
+    for(unsigned long long offset = start; offset < end; offset += MB)
+    {
+        size_t n = (size_t)min(end - offset, MB);
+        TestServer::fill(path, offset, buffer, n);
+        hash.update(buffer, n);
+    }
+
+    delete[] buffer;
+    return hash.hex();
+}
+
+static tstring writeMetalink(TestServer &server, Scenario *sc, bool quick, tstring sdir)
+{
+    unsigned long long size  = scenarioSize(sc, quick);
+    int                count = scenarioCount(sc, quick);
+    bool               http  = string(sc->protocol).compare("http") == 0;
+    tstring            name  = sdir + _T("/files.meta4");
+    FILE              *f     = _tfopen(name.c_str(), _T("wb"));
+
+    fprintf(f, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<metalink xmlns=\"urn:ietf:params:xml:ns:metalink\">\n");
+
+    for(int i = 0; i < count; i++)
+    {
+        string path = filePath(sc, i);
+
+        fprintf(f, "  <file name=\"%s\">\n    <size>%llu</size>\n    <hash type=\"sha-256\">%s</hash>\n",
+                path.substr(strlen(sc->name) + 2).c_str(), size, fileHash(path, 0, size).c_str());
+
+        if(sc->pieceSize)
+        {
+            unsigned long long piece = quick ? sc->pieceSize / QUICK_SIZE_DIVIDER : sc->pieceSize;
+
+            fprintf(f, "    <pieces length=\"%llu\" type=\"sha-256\">\n", piece);
+
+            for(unsigned long long offset = 0; offset < size; offset += piece)
+                fprintf(f, "      <hash>%s</hash>\n", fileHash(path, offset, min(offset + piece, size)).c_str());
+
+            fprintf(f, "    </pieces>\n");
+        }
+
+        if(sc->mirror)
+            fprintf(f, "    <url priority=\"2\">%s</url>\n", (http ? server.httpUrl("/mirror" + path) : server.ftpUrl("/mirror" + path)).c_str());
+
+        fprintf(f, "    <url priority=\"1\">%s</url>\n  </file>\n", (http ? server.httpUrl(path) : server.ftpUrl(path)).c_str());
+    }
+
+    fprintf(f, "</metalink>\n");
+    fclose(f);
+    return name;
+}
+
+static bool runScenario(TestServer &server, Scenario *sc, bool quick, tstring dir, tstring traceDir, tstring reportDir)
+{
+    unsigned long long size  = scenarioSize(sc, quick);
+    int                count = scenarioCount(sc, quick);
+    tstring            sdir  = dir + _T("/") + tocurenc(sc->name);
+
+    _tmkdir(sdir.c_str());
+
+    Downloader d;
+    d.readBufferSize = sc->readBufferSize;
+    d.ftpSegments    = sc->ftpSegments;
+
+    if(sc->stallTimeout)
+        d.stallTimeout = sc->stallTimeout;
+
+    d.hedging = sc->hedge;
+
+    if(!reportDir.empty())
+        d.perfReportFile = reportDir + _T("/") + tocurenc(sc->name) + _T(".json");
+
+    if(sc->receiveTimeout)
+    {
+        InternetOptions opt;
+        opt.receiveTimeout = sc->receiveTimeout;
+        d.setInternetOptions(opt);
+    }
+
+    tstring metalink;
+
+    if(sc->metalink)
+        d.addMetalink(metalink = writeMetalink(server, sc, quick, sdir), sdir);
+    else
+        addFiles(d, server, sc, quick, dir);
+
+    TestServerStats before = server.stats();
+
+    if(sc->interrupt)
+    {
+        // Only resume journals on disk are left from first download
+        Downloader *first = new Downloader;
+        first->setOptions(&d);
+
+        if(sc->metalink)
+            first->addMetalink(metalink, sdir);
+        else
+            addFiles(*first, server, sc, quick, dir);
+
+        first->startDownload();
+        Sleep(quick ? sc->interrupt / QUICK_SIZE_DIVIDER : sc->interrupt);
+        first->stopDownload();
+        delete first;
+    }
+
+    if(sc->prefetch)
+    {
+        d.startPrefetch(_T(""));
+        Sleep(sc->prefetch);
+    }
+
+    Usage start, end;
+    getUsage(&start);
+
+    bool ok = d.downloadFiles() != sc->expectFail;
+
+    getUsage(&end);
+    TestServerStats after = server.stats();
+
+    if(!traceDir.empty())
+        d.dumpTrace(traceDir + _T("/") + tocurenc(sc->name) + _T(".trace"));
+
+    for(int i = 0; i < count; i++)
+    {
+        tstring name = localName(dir, sc, i);
+
+        if(ok && !sc->expectFail && !TestServer::verify(filePath(sc, i), name.c_str(), size))
+        {
+            fprintf(stderr, "%s: file %d is corrupted\n", sc->name, i);
+            ok = false;
+        }
+
+        _tremove(name.c_str());
+    }
+
+    if(!metalink.empty())
+        _tremove(metalink.c_str());
+
+    _trmdir(sdir.c_str());
+
+    if(!d.filesDownloaded() && !sc->expectFail)
+        fprintf(stderr, "%s: download failed: %s\n", sc->name, toansi(d.getLastErrorStr()).c_str());
+
+    double seconds = end.wall - start.wall;
+    unsigned long long bytes = size * count;
+    long long recoveries = after.recoveries - before.recoveries;
+    long long recoverMs  = recoveries ? (after.recoveryTime - before.recoveryTime) / recoveries : -1;
+    long long wasted     = (after.bodyBytes - before.bodyBytes) - (sc->expectFail ? 0 : (long long)bytes);
+
+    if(!quick && sc->maxWasted && (wasted * 100 > (long long)bytes * sc->maxWasted))
+    {
+        fprintf(stderr, "%s: %lld bytes wasted, limit is %d%%\n", sc->name, wasted, sc->maxWasted);
+        ok = false;
+    }
+
+    printf("{\"scenario\":\"%s\",\"transport\":\"%s\",\"protocol\":\"%s\",\"files\":%d,\"bytes\":%llu,"
+           "\"read_buffer\":%d,\"ftp_segments\":%d,\"seconds\":%.3f,\"mb_per_s\":%.1f,"
+           "\"cpu_user\":%.3f,\"cpu_sys\":%.3f,\"io_syscalls\":%lld,\"peak_rss_kb\":%lld,"
+           "\"server_connections\":%lld,\"server_requests\":%lld,\"server_bytes\":%lld,"
+           "\"faults\":%lld,\"recover_ms\":%lld,\"wasted_bytes\":%lld,\"ok\":%s}\n",
+           sc->name, toansi(defaultTransport()->name()).c_str(), sc->protocol, count, bytes,
+           sc->readBufferSize, sc->ftpSegments, seconds, (seconds > 0) ? bytes / (double)MB / seconds : 0.0,
+           end.user - start.user, end.sys - start.sys, (end.syscalls < 0) ? -1LL : end.syscalls - start.syscalls, end.peakRss,
+           after.connections - before.connections, after.requests - before.requests, after.bytesSent - before.bytesSent,
+           after.faults - before.faults, recoverMs, wasted,
+           ok ? "true" : "false");
+    fflush(stdout);
+
+    return ok;
+}
+
+int _tmain(int argc, _TCHAR *argv[])
+{
+    bool    quick = false;
+    tstring only;
+    tstring dir   = _T("idpbench.tmp");
+    tstring traceDir;
+    tstring reportDir;
+    TestServer server;
+
+    for(int i = 1; i < argc; i++)
+    {
+        tstring arg = argv[i];
+
+        if(arg.compare(_T("--quick")) == 0)
+        {
+            quick = true;
+        }
+        else if(arg.compare(_T("--list")) == 0)
+        {
+            for(Scenario *sc = scenarios; sc->name; sc++)
+                printf("%s\n", sc->name);
+
+            return 0;
+        }
+        else if((arg.compare(_T("--scenario")) == 0) && (i + 1 < argc))
+        {
+            only = argv[++i];
+        }
+        else if((arg.compare(_T("--dir")) == 0) && (i + 1 < argc))
+        {
+            dir = argv[++i];
+        }
+        else if((arg.compare(_T("--trace")) == 0) && (i + 1 < argc))
+        {
+            traceDir = argv[++i];
+        }
+        else if((arg.compare(_T("--report")) == 0) && (i + 1 < argc))
+        {
+            reportDir = argv[++i];
+        }
+        else if((arg.compare(_T("--fault")) == 0) && (i + 1 < argc))
+        {
+            if(!server.addFault(toansi(argv[++i])))
+            {
+                fprintf(stderr, "Invalid fault: %s\n", toansi(argv[i]).c_str());
+                return 2;
+            }
+        }
+        else if((arg.compare(_T("--transport")) == 0) && (i + 1 < argc))
+        {
+            Transport *transport = findTransport(argv[++i]);
+
+            if(!transport)
+            {
+                fprintf(stderr, "Unknown transport: %s\n", toansi(argv[i]).c_str());
+                return 2;
+            }
+
+            setDefaultTransport(transport);
+        }
+        else
+        {
+            fprintf(stderr, "Usage: idpbench [--quick] [--scenario name] [--transport name] [--dir path] [--list] [--fault spec] [--trace dir] [--report dir]\n");
+            return 2;
+        }
+    }
+
+    for(Scenario *sc = scenarios; sc->name; sc++)
+    {
+        for(int i = 0; i < scenarioCount(sc, quick); i++)
+        {
+            server.addFile(filePath(sc, i), scenarioSize(sc, quick));
+
+            if(sc->mirror)
+                server.addFile("/mirror" + filePath(sc, i), scenarioSize(sc, quick));
+        }
+
+        if(sc->fault)
+            server.addFault(faultSpec(sc));
+    }
+
+    if(!server.start())
+    {
+        fprintf(stderr, "Cannot start test server\n");
+        return 1;
+    }
+
+    _tmkdir(dir.c_str());
+
+    int failed = 0;
+    int ran    = 0;
+
+    for(Scenario *sc = scenarios; sc->name; sc++)
+    {
+        if(!only.empty() && only.compare(tocurenc(sc->name)))
+            continue;
+
+        ran++;
+
+        if(!runScenario(server, sc, quick, dir, traceDir, reportDir))
+            failed++;
+    }
+
+    _trmdir(dir.c_str());
+    server.stop();
+
+    if(!ran)
+    {
+        fprintf(stderr, "Unknown scenario: %s\n", toansi(only).c_str());
+        return 2;
+    }
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,1187 @@
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <signal.h>
+#include <unistd.h>
+#endif
+#include <process.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "testserver.h"
+
+#ifdef _WIN32
+    typedef int socklen_t;
+    #define atomicadd(var, val) InterlockedExchangeAdd64(&(var), (val))
+    #define atomicxchg(var, val) InterlockedExchange64(&(var), (val))
+#else
+    #define INVALID_SOCKET     (-1)
+    #define closesocket(s)     close(s)
+    #define atomicadd(var, val) __sync_fetch_and_add(&(var), (val))
+    #define atomicxchg(var, val) __sync_lock_test_and_set(&(var), (val))
+#endif
+
+#define PATTERN_PERIOD 65521  // prime, so files with different seeds do not look alike
+#define SEND_CHUNK     262144
+
+static unsigned char pattern[PATTERN_PERIOD + SEND_CHUNK];
+static bool          patternReady = false;
+
+static void initPattern()
+{
+    if(patternReady)
+        return;
+
+    unsigned long x = 2463534242UL;
+
+    for(size_t i = 0; i < PATTERN_PERIOD; i++)
+    {
+        x ^= (x << 13) & 0xFFFFFFFFUL;
+        x ^= x >> 17;
+        x ^= (x << 5) & 0xFFFFFFFFUL;
+        pattern[i] = (unsigned char)(x >> 8);
+    }
+
+    for(size_t i = PATTERN_PERIOD; i < sizeof(pattern); i++)
+        pattern[i] = pattern[i - PATTERN_PERIOD];
+
+    patternReady = true;
+}
+
+static size_t patternPos(string path, unsigned long long offset)
+{
+    unsigned long hash = 2166136261UL; // FNV-1a of file name
+
+    for(size_t i = path.rfind('/') + 1; i < path.length(); i++)
+        hash = ((hash ^ (unsigned char)path[i]) * 16777619UL) & 0xFFFFFFFFUL;
+
+    return (size_t)((hash + offset) % PATTERN_PERIOD);
+}
+
+static string u64str(unsigned long long d)
+{
+    char buf[32];
+    sprintf(buf, "%llu", d);
+    return buf;
+}
+
+static string parentDir(string path)
+{
+    size_t slash = path.rfind('/');
+    return (slash == 0 || slash == string::npos) ? "/" : path.substr(0, slash);
+}
+
+static string upper(string s)
+{
+    for(size_t i = 0; i < s.length(); i++)
+        if((s[i] >= 'a') && (s[i] <= 'z'))
+            s[i] = s[i] - 'a' + 'A';
+
+    return s;
+}
+
+static long long tick()
+{
+    return GetTickCount();
+}
+
+static string statusText(int status)
+{
+    switch(status)
+    {
+    case 401: return "Unauthorized";
+    case 403: return "Forbidden";
+    case 404: return "Not Found";
+    case 407: return "Proxy Authentication Required";
+    case 429: return "Too Many Requests";
+    case 500: return "Internal Server Error";
+    case 502: return "Bad Gateway";
+    case 503: return "Service Unavailable";
+    case 504: return "Gateway Timeout";
+    default:  return "Error";
+    }
+}
+
+// Closes connection with RST instead of FIN
+static void resetSocket(SOCKET s)
+{
+    struct linger l;
+    l.l_onoff  = 1;
+    l.l_linger = 0;
+    setsockopt(s, SOL_SOCKET, SO_LINGER, (const char *)&l, sizeof(l));
+}
+
+// Waits until client closes connection
+static void waitClose(SOCKET s)
+{
+    char buf[256];
+    while(recv(s, buf, sizeof(buf), 0) > 0);
+}
+
+// Buffered reader of CRLF-terminated lines
+class LineReader
+{
+public:
+    LineReader(SOCKET sock): s(sock), pos(0), len(0) {}
+
+    bool readLine(string &line)
+    {
+        line.clear();
+
+        for(;;)
+        {
+            while(pos < len)
+            {
+                char c = buf[pos++];
+
+                if(c == '\n')
+                {
+                    if(!line.empty() && (line[line.length() - 1] == '\r'))
+                        line.erase(line.length() - 1);
+
+                    return true;
+                }
+
+                line += c;
+            }
+
+            int n = recv(s, buf, sizeof(buf), 0);
+
+            if(n <= 0)
+                return false;
+
+            pos = 0;
+            len = n;
+        }
+    }
+
+protected:
+    SOCKET s;
+    char   buf[4096];
+    size_t pos;
+    size_t len;
+};
+
+struct AcceptParams
+{
+    TestServer *server;
+    SOCKET      s;
+    bool        ftp;
+};
+
+struct ConnectionParams
+{
+    TestServer *server;
+    SOCKET      s;
+    bool        ftp;
+};
+
+static SOCKET listenSocket(unsigned short *port)
+{
+    SOCKET s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+
+    if(s == INVALID_SOCKET)
+        return INVALID_SOCKET;
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port        = 0;
+
+    socklen_t addrlen = sizeof(addr);
+
+    if(bind(s, (sockaddr *)&addr, sizeof(addr)) || listen(s, 64) || getsockname(s, (sockaddr *)&addr, &addrlen))
+    {
+        closesocket(s);
+        return INVALID_SOCKET;
+    }
+
+    *port = ntohs(addr.sin_port);
+    return s;
+}
+
+void testServerConnectionProc(void *param)
+{
+    ConnectionParams *p = (ConnectionParams *)param;
+
+    int one = 1;
+    setsockopt(p->s, IPPROTO_TCP, TCP_NODELAY, (const char *)&one, sizeof(one));
+    atomicadd(p->server->counters->connections, 1);
+
+    if(p->ftp)
+        p->server->serveFtp(p->s);
+    else
+        p->server->serveHttp(p->s);
+
+    closesocket(p->s);
+    delete p;
+}
+
+unsigned __stdcall testServerAcceptProc(void *param)
+{
+    AcceptParams *p = (AcceptParams *)param;
+
+    for(;;)
+    {
+        SOCKET s = accept(p->s, NULL, NULL);
+
+        if(s == INVALID_SOCKET)
+            break;
+
+        ConnectionParams *c = new ConnectionParams;
+        c->server = p->server;
+        c->s      = s;
+        c->ftp    = p->ftp;
+
+        _beginthread(testServerConnectionProc, 0, c);
+    }
+
+    delete p;
+    return 0;
+}
+
+TestServer::TestServer()
+{
+    initPattern();
+
+    httpSocket     = INVALID_SOCKET;
+    ftpSocket      = INVALID_SOCKET;
+    httpListenPort = 0;
+    ftpListenPort  = 0;
+#ifdef _WIN32
+    threads[0] = threads[1] = NULL;
+    counters   = new TestServerStats;
+#else
+    pid        = 0;
+    counters   = (TestServerStats *)mmap(NULL, sizeof(TestServerStats), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+#endif
+    memset((void *)counters, 0, sizeof(TestServerStats));
+    faultsUsed = NULL;
+    dirs.insert("/");
+}
+
+TestServer::~TestServer()
+{
+    stop();
+#ifdef _WIN32
+    delete counters;
+#else
+    munmap(counters, sizeof(TestServerStats));
+#endif
+    delete[] faultsUsed;
+}
+
+void TestServer::addFile(string path, unsigned long long size, unsigned long long modified)
+{
+    if(path.empty() || (path[0] != '/'))
+        path = "/" + path;
+
+    TestFile f;
+    f.size     = size;
+    f.modified = modified;
+    files[path] = f;
+
+    for(string dir = parentDir(path); dirs.insert(dir).second; dir = parentDir(dir));
+}
+
+// Faults are checked in order of addition, first matching one is applied
+void TestServer::addFault(string prefix, TestFault fault)
+{
+    faultPrefixes.push_back(prefix);
+    faults.push_back(fault);
+}
+
+// Adds faults from script: one fault per line (or separated with ';')
+bool TestServer::addFault(string script)
+{
+    size_t pos = 0;
+
+    while(pos < script.length())
+    {
+        size_t end = script.find_first_of(";\n", pos);
+
+        if(end == string::npos)
+            end = script.length();
+
+        string    line = script.substr(pos, end - pos);
+        string    prefix;
+        TestFault fault;
+
+        if(line.find_first_not_of(" \t\r") != string::npos)
+        {
+            if(!parseFault(line, &prefix, &fault))
+                return false;
+
+            addFault(prefix, fault);
+        }
+
+        pos = end + 1;
+    }
+
+    return true;
+}
+
+static bool parseSize(string value, unsigned long long *size, int *percent)
+{
+    char *end;
+    unsigned long long n = strtoull(value.c_str(), &end, 10);
+
+    if(end == value.c_str())
+        return false;
+
+    switch(*end)
+    {
+    case 'k': case 'K': n *= 1024ULL;               end++; break;
+    case 'm': case 'M': n *= 1024ULL * 1024;        end++; break;
+    case 'g': case 'G': n *= 1024ULL * 1024 * 1024; end++; break;
+    case '%':
+        if(!percent)
+            return false;
+
+        *percent = (int)n;
+        return end[1] == 0;
+    }
+
+    *size = n;
+    return *end == 0;
+}
+
+bool TestServer::parseFault(string spec, string *prefix, TestFault *fault)
+{
+    *fault = TestFault();
+
+    size_t pos = spec.find_first_not_of(" \t");
+
+    if((pos == string::npos) || (spec[pos] != '/'))
+        return false;
+
+    size_t end = spec.find_first_of(" \t\r", pos);
+    *prefix = spec.substr(pos, end - pos);
+
+    while((end != string::npos) && ((pos = spec.find_first_not_of(" \t\r", end)) != string::npos))
+    {
+        end = spec.find_first_of(" \t\r", pos);
+
+        string item  = spec.substr(pos, end - pos);
+        size_t eq    = item.find('=');
+
+        if(eq == string::npos)
+            return false;
+
+        string key   = upper(item.substr(0, eq));
+        string value = item.substr(eq + 1);
+        unsigned long long n = 0;
+        bool ok;
+
+        if(key.compare("RESET") == 0)
+            ok = parseSize(value, &fault->resetAfter, &fault->resetPercent);
+        else if(key.compare("STALL") == 0)
+            ok = parseSize(value, &fault->stallAfter, &fault->stallPercent);
+        else if(key.compare("CORRUPT") == 0)
+            ok = parseSize(value, &fault->corruptAt, &fault->corruptPercent);
+        else if((key.compare("STALLTIME") == 0) && (upper(value).compare("INFINITE") == 0))
+            ok = (fault->stallTime = INFINITE) != 0;
+        else
+            ok = parseSize(value, &n, NULL);
+
+        if(!ok)
+            return false;
+
+        if(key.compare("HANDSHAKE") == 0)       fault->handshake  = (DWORD)n;
+        else if(key.compare("LATENCY") == 0)    fault->latency    = (DWORD)n;
+        else if(key.compare("BANDWIDTH") == 0)  fault->bandwidth  = n;
+        else if(key.compare("STATUS") == 0)     fault->status     = (int)n;
+        else if(key.compare("RETRYAFTER") == 0) fault->retryAfter = (DWORD)n;
+        else if(key.compare("STALLTIME") == 0)  { if(fault->stallTime != INFINITE) fault->stallTime = (DWORD)n; }
+        else if(key.compare("TIMES") == 0)      fault->times      = (int)n;
+        else if(key.compare("RESET") && key.compare("STALL") && key.compare("CORRUPT")) return false;
+    }
+
+    return true;
+}
+
+TestFault::TestFault()
+{
+    handshake      = 0;
+    latency        = 0;
+    bandwidth      = 0;
+    status         = 0;
+    retryAfter     = 0;
+    resetAfter     = TESTFAULT_NEVER;
+    resetPercent   = -1;
+    stallAfter     = TESTFAULT_NEVER;
+    stallPercent   = -1;
+    stallTime      = INFINITE;
+    corruptAt      = TESTFAULT_NEVER;
+    corruptPercent = -1;
+    times          = -1;
+}
+
+// Returns fault for next request of file, NULL if request must be served normally
+const TestFault *TestServer::findFault(string path)
+{
+    for(size_t i = 0; i < faults.size(); i++)
+    {
+        if(path.compare(0, faultPrefixes[i].length(), faultPrefixes[i]))
+            continue;
+
+        if((faults[i].times >= 0) && (atomicadd(faultsUsed[i], 1) >= faults[i].times))
+            continue;
+
+        return &faults[i];
+    }
+
+    return NULL;
+}
+
+// Tracks time between faulted request and next clean one (time to recover)
+void TestServer::noteRequest(const TestFault *fault)
+{
+    if(fault)
+    {
+        atomicadd(counters->faults, 1);
+        counters->lastFaultTick   = tick();
+        counters->pendingRecovery = 1;
+    }
+    else if(counters->pendingRecovery && (atomicxchg(counters->pendingRecovery, 0) == 1))
+    {
+        atomicadd(counters->recoveries, 1);
+        atomicadd(counters->recoveryTime, tick() - counters->lastFaultTick);
+    }
+}
+
+// Starts listening on loopback ports, chosen by system. When separateProcess is set
+// (POSIX only), server runs in forked child, so it does not affect CPU & memory
+// usage of calling process. Must be called before any other threads are started.
+bool TestServer::start(bool separateProcess)
+{
+#ifdef _WIN32
+    WSADATA wsa;
+    WSAStartup(MAKEWORD(2, 2), &wsa);
+#else
+    signal(SIGPIPE, SIG_IGN);
+#endif
+
+    delete[] faultsUsed;
+    faultsUsed = new long long[faults.size() + 1];
+    memset((void *)faultsUsed, 0, (faults.size() + 1) * sizeof(long long));
+
+    httpSocket = listenSocket(&httpListenPort);
+    ftpSocket  = listenSocket(&ftpListenPort);
+
+    if((httpSocket == INVALID_SOCKET) || (ftpSocket == INVALID_SOCKET))
+    {
+        stop();
+        return false;
+    }
+
+#ifndef _WIN32
+    if(separateProcess)
+    {
+        pid = fork();
+
+        if(pid < 0)
+        {
+            pid = 0;
+            stop();
+            return false;
+        }
+
+        if(pid > 0)
+        {
+            // Parent: child owns listening sockets now
+            closesocket(httpSocket);
+            closesocket(ftpSocket);
+            httpSocket = ftpSocket = INVALID_SOCKET;
+            return true;
+        }
+    }
+#endif
+
+    for(int i = 0; i < 2; i++)
+    {
+        AcceptParams *p = new AcceptParams;
+        p->server = this;
+        p->s      = i ? ftpSocket : httpSocket;
+        p->ftp    = i != 0;
+
+        HANDLE thread = (HANDLE)_beginthreadex(NULL, 0, testServerAcceptProc, p, 0, NULL);
+#ifdef _WIN32
+        threads[i] = thread;
+#else
+        CloseHandle(thread);
+#endif
+    }
+
+#ifndef _WIN32
+    if(separateProcess)
+    {
+        for(;;)
+            pause(); // Child is terminated by stop()
+    }
+#endif
+
+    return true;
+}
+
+void TestServer::stop()
+{
+#ifndef _WIN32
+    if(pid > 0)
+    {
+        kill(pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+        pid = 0;
+    }
+#endif
+
+    if(httpSocket != INVALID_SOCKET)
+    {
+        shutdown(httpSocket, 2); // unblocks accept()
+        closesocket(httpSocket);
+        httpSocket = INVALID_SOCKET;
+    }
+
+    if(ftpSocket != INVALID_SOCKET)
+    {
+        shutdown(ftpSocket, 2);
+        closesocket(ftpSocket);
+        ftpSocket = INVALID_SOCKET;
+    }
+
+#ifdef _WIN32
+    for(int i = 0; i < 2; i++)
+    {
+        if(threads[i])
+        {
+            WaitForSingleObject(threads[i], INFINITE);
+            CloseHandle(threads[i]);
+            threads[i] = NULL;
+        }
+    }
+#endif
+}
+
+unsigned short TestServer::httpPort()
+{
+    return httpListenPort;
+}
+
+unsigned short TestServer::ftpPort()
+{
+    return ftpListenPort;
+}
+
+string TestServer::httpUrl(string path)
+{
+    return "http://127.0.0.1:" + u64str(httpListenPort) + path;
+}
+
+string TestServer::ftpUrl(string path)
+{
+    return "ftp://127.0.0.1:" + u64str(ftpListenPort) + path;
+}
+
+TestServerStats TestServer::stats()
+{
+    TestServerStats s;
+    s.connections = counters->connections;
+    s.requests    = counters->requests;
+    s.bytesSent   = counters->bytesSent;
+    s.bodyBytes   = counters->bodyBytes;
+    s.faults      = counters->faults;
+    s.recoveries  = counters->recoveries;
+    s.recoveryTime    = counters->recoveryTime;
+    s.lastFaultTick   = counters->lastFaultTick;
+    s.pendingRecovery = counters->pendingRecovery;
+    return s;
+}
+
+// Fills buffer with expected content of file
+void TestServer::fill(string path, unsigned long long offset, void *buffer, size_t size)
+{
+    initPattern();
+
+    size_t pos = patternPos(path, offset);
+    unsigned char *p = (unsigned char *)buffer;
+
+    while(size)
+    {
+        size_t n = (size < SEND_CHUNK) ? size : SEND_CHUNK;
+        memcpy(p, pattern + pos, n);
+        p    += n;
+        size -= n;
+        pos   = (pos + n) % PATTERN_PERIOD;
+    }
+}
+
+// Checks size of downloaded file & its content at beginning and end
+bool TestServer::verify(string path, const _TCHAR *filename, unsigned long long size)
+{
+    FILE *f = _tfopen(filename, _T("rb"));
+
+    if(!f)
+        return false;
+
+    const size_t sample = 65536;
+    unsigned char *expected = new unsigned char[sample];
+    unsigned char *actual   = new unsigned char[sample];
+    bool ok = true;
+
+    unsigned long long offsets[2] = { 0, (size > sample) ? size - sample : 0 };
+
+    for(int i = 0; ok && (i < 2); i++)
+    {
+        size_t n = (size_t)((size - offsets[i] < sample) ? size - offsets[i] : sample);
+
+        fill(path, offsets[i], expected, n);
+
+        ok = (_fseeki64(f, offsets[i], SEEK_SET) == 0) &&
+             (fread(actual, 1, n, f) == n) &&
+             (memcmp(expected, actual, n) == 0);
+    }
+
+    // Must be no extra data after end of file
+    ok = ok && (_fseeki64(f, size, SEEK_SET) == 0) && (fgetc(f) == EOF);
+
+    delete[] expected;
+    delete[] actual;
+    fclose(f);
+    return ok;
+}
+
+const TestFile *TestServer::findFile(string path)
+{
+    map<string, TestFile>::iterator i = files.find(path);
+    return (i == files.end()) ? NULL : &i->second;
+}
+
+bool TestServer::dirExists(string path)
+{
+    return dirs.count(path) != 0;
+}
+
+bool TestServer::sendData(SOCKET s, const void *data, size_t size)
+{
+    const char *p = (const char *)data;
+
+    while(size)
+    {
+        int n = send(s, p, (int)size, 0);
+
+        if(n <= 0)
+            return false;
+
+        atomicadd(counters->bytesSent, n);
+        p    += n;
+        size -= n;
+    }
+
+    return true;
+}
+
+bool TestServer::sendText(SOCKET s, string text)
+{
+    return sendData(s, text.c_str(), text.length());
+}
+
+// Sends file content, applying bandwidth cap, stall, reset & corruption of fault.
+// Returns false if connection must be closed.
+bool TestServer::sendFile(SOCKET s, string path, unsigned long long offset, unsigned long long size, const TestFault *fault, unsigned long long fileSize)
+{
+    size_t pos = patternPos(path, offset);
+    size_t chunk = SEND_CHUNK;
+    unsigned long long resetAt   = TESTFAULT_NEVER;
+    unsigned long long stallAt   = TESTFAULT_NEVER;
+    unsigned long long corruptAt = TESTFAULT_NEVER;
+    unsigned long long sent      = 0;
+    long long          start     = tick();
+
+    if(fault)
+    {
+        resetAt   = (fault->resetPercent >= 0) ? fileSize * fault->resetPercent / 100 : fault->resetAfter;
+        stallAt   = (fault->stallPercent >= 0) ? fileSize * fault->stallPercent / 100 : fault->stallAfter;
+        corruptAt = (fault->corruptPercent >= 0) ? fileSize * fault->corruptPercent / 100 : fault->corruptAt;
+
+        // Send at least 20 chunks per second, so bandwidth cap is smooth
+        if(fault->bandwidth && (fault->bandwidth / 20 < chunk))
+            chunk = (fault->bandwidth / 20 < 1024) ? 1024 : (size_t)(fault->bandwidth / 20);
+    }
+
+    while(size)
+    {
+        size_t n = (size_t)((size < chunk) ? size : chunk);
+        const unsigned char *data = pattern + pos;
+        unsigned char        inverted;
+
+        // Do not cross reset, stall & corruption points
+        if((offset < resetAt) && (offset + n > resetAt)) n = (size_t)(resetAt - offset);
+        if((offset < stallAt) && (offset + n > stallAt)) n = (size_t)(stallAt - offset);
+        if((offset < corruptAt) && (offset + n > corruptAt)) n = (size_t)(corruptAt - offset);
+
+        if(offset == resetAt)
+        {
+            resetSocket(s);
+            return false;
+        }
+
+        if(offset == stallAt)
+        {
+            if(fault->stallTime == INFINITE)
+            {
+                waitClose(s);
+                return false;
+            }
+
+            Sleep(fault->stallTime);
+            stallAt = TESTFAULT_NEVER;
+            start   = tick() - (fault->bandwidth ? (long long)(sent * 1000 / fault->bandwidth) : 0);
+        }
+
+        if(offset == corruptAt)
+        {
+            inverted = (unsigned char)~pattern[pos];
+            data     = &inverted;
+            n        = 1;
+        }
+
+        if(!sendData(s, data, n))
+            return false;
+
+        atomicadd(counters->bodyBytes, (long long)n);
+        size   -= n;
+        offset += n;
+        sent   += n;
+        pos     = (pos + n) % PATTERN_PERIOD;
+
+        if(fault && fault->bandwidth)
+        {
+            long long ahead = (long long)(sent * 1000 / fault->bandwidth) - (tick() - start);
+
+            if(ahead > 0)
+                Sleep((DWORD)ahead);
+        }
+    }
+
+    return true;
+}
+
+void TestServer::serveHttp(SOCKET s)
+{
+    LineReader reader(s);
+    string     line;
+    bool       firstRequest = true;
+
+    while(reader.readLine(line))
+    {
+        if(line.empty())
+            continue;
+
+        string method = line.substr(0, line.find(' '));
+        string path   = line.substr(method.length() + 1);
+        path = path.substr(0, path.find(' '));
+        path = path.substr(0, path.find('?'));
+
+        bool keepAlive   = line.find("HTTP/1.0") == string::npos;
+        bool hasRange    = false;
+        string ifRange;
+        unsigned long long rangeStart = 0;
+        unsigned long long rangeEnd   = (unsigned long long)-1;
+
+        while(reader.readLine(line) && !line.empty())
+        {
+            string header = upper(line.substr(0, line.find(':')));
+            string value  = line.substr(line.find(':') + 1);
+
+            while(!value.empty() && (value[0] == ' '))
+                value.erase(0, 1);
+
+            if(header.compare("CONNECTION") == 0)
+            {
+                keepAlive = upper(value).compare("CLOSE") != 0;
+            }
+            else if((header.compare("RANGE") == 0) && (value.compare(0, 6, "bytes=") == 0))
+            {
+                const char *p = value.c_str() + 6;
+                char *end;
+                hasRange   = true;
+                rangeStart = strtoull(p, &end, 10);
+
+                if((*end == '-') && (end[1] >= '0') && (end[1] <= '9'))
+                    rangeEnd = strtoull(end + 1, NULL, 10);
+            }
+            else if(header.compare("IF-RANGE") == 0)
+            {
+                ifRange = value;
+            }
+        }
+
+        atomicadd(counters->requests, 1);
+
+        const TestFile  *file  = findFile(path);
+        const TestFault *fault = file ? findFault(path) : NULL;
+        bool head = method.compare("HEAD") == 0;
+
+        if(file)
+            noteRequest(fault);
+
+        if(fault)
+        {
+            if(firstRequest)
+                Sleep(fault->handshake);
+
+            Sleep(fault->latency);
+        }
+
+        firstRequest = false;
+
+        if(!file || (!head && method.compare("GET")))
+        {
+            string body = "Not Found";
+            sendText(s, "HTTP/1.1 404 Not Found\r\nContent-Type: text/plain\r\nContent-Length: " + u64str(body.length()) + "\r\n\r\n" + (head ? "" : body));
+        }
+        else if(fault && fault->status)
+        {
+            string body    = statusText(fault->status);
+            string headers = "HTTP/1.1 " + u64str(fault->status) + " " + body + "\r\nContent-Type: text/plain\r\nContent-Length: " + u64str(body.length()) + "\r\n";
+
+            if(fault->retryAfter)
+                headers += "Retry-After: " + u64str(fault->retryAfter) + "\r\n";
+
+            if(fault->status == 401)
+                headers += "WWW-Authenticate: Basic realm=\"idp\"\r\n";
+
+            if(fault->status == 407)
+                headers += "Proxy-Authenticate: Basic realm=\"idp\"\r\n";
+
+            if(!sendText(s, headers + "\r\n" + (head ? "" : body)))
+                break;
+        }
+        else if(hasRange && (rangeStart >= file->size))
+        {
+            sendText(s, "HTTP/1.1 416 Range Not Satisfiable\r\nContent-Range: bytes */" + u64str(file->size) + "\r\nContent-Length: 0\r\n\r\n");
+        }
+        else
+        {
+            // Changed file is sent whole, if client's copy is for other version
+            string etag = "\"" + u64str(file->modified) + "-" + u64str(file->size) + "\"";
+
+            if(!ifRange.empty() && ifRange.compare(etag))
+            {
+                hasRange = false;
+                rangeEnd = (unsigned long long)-1;
+            }
+
+            if(rangeEnd >= file->size)
+                rangeEnd = file->size - 1;
+
+            unsigned long long start  = hasRange ? rangeStart : 0;
+            unsigned long long length = hasRange ? rangeEnd - rangeStart + 1 : file->size;
+
+            string headers = hasRange ? "HTTP/1.1 206 Partial Content\r\nContent-Range: bytes " + u64str(start) + "-" + u64str(rangeEnd) + "/" + u64str(file->size) + "\r\n"
+                                      : "HTTP/1.1 200 OK\r\n";
+            headers += "Content-Type: application/octet-stream\r\nAccept-Ranges: bytes\r\nETag: " + etag + "\r\nContent-Length: " + u64str(length) + "\r\n";
+
+            if(!keepAlive)
+                headers += "Connection: close\r\n";
+
+            if(!sendText(s, headers + "\r\n"))
+                break;
+
+            if(!head && !sendFile(s, path, start, length, fault, file->size))
+                break;
+        }
+
+        if(!keepAlive)
+            break;
+    }
+}
+
+string TestServer::resolvePath(string cwd, string arg)
+{
+    string path = (!arg.empty() && (arg[0] == '/')) ? arg : ((cwd.compare("/") == 0) ? "/" : cwd + "/") + arg;
+
+    while((path.length() > 1) && (path[path.length() - 1] == '/'))
+        path.erase(path.length() - 1);
+
+    // Resolve "." & ".." components
+    string res;
+    size_t pos = 1;
+
+    while(pos <= path.length())
+    {
+        size_t next = path.find('/', pos);
+
+        if(next == string::npos)
+            next = path.length();
+
+        string part = path.substr(pos, next - pos);
+
+        if(part.compare("..") == 0)
+            res = res.substr(0, res.empty() ? 0 : res.rfind('/'));
+        else if(!part.empty() && part.compare("."))
+            res += "/" + part;
+
+        pos = next + 1;
+    }
+
+    return res.empty() ? "/" : res;
+}
+
+static const char *months[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+
+string TestServer::listDir(string dir, string format)
+{
+    string res;
+    string prefix = (dir.compare("/") == 0) ? "/" : dir + "/";
+    string mtime  = u64str(TESTSERVER_MODIFIED);
+    string date   = string(months[(mtime[4] - '0') * 10 + (mtime[5] - '0') - 1]) + " " + mtime.substr(6, 2) + "  " + mtime.substr(0, 4);
+
+    for(set<string>::iterator i = dirs.lower_bound(prefix); (i != dirs.end()) && (i->compare(0, prefix.length(), prefix) == 0); i++)
+    {
+        if(i->find('/', prefix.length()) != string::npos)
+            continue;
+
+        string name = i->substr(prefix.length());
+
+        if(format.compare("MLSD") == 0)
+            res += "type=dir;modify=" + mtime + "; " + name + "\r\n";
+        else if(format.compare("LIST") == 0)
+            res += "drwxr-xr-x    2 ftp      ftp             0 " + date + " " + name + "\r\n";
+        else
+            res += name + "\r\n";
+    }
+
+    for(map<string, TestFile>::iterator i = files.lower_bound(prefix); (i != files.end()) && (i->first.compare(0, prefix.length(), prefix) == 0); i++)
+    {
+        if(i->first.find('/', prefix.length()) != string::npos)
+            continue;
+
+        string name = i->first.substr(prefix.length());
+        string size = u64str(i->second.size);
+
+        if(format.compare("MLSD") == 0)
+        {
+            res += "type=file;size=" + size + ";modify=" + u64str(i->second.modified) + "; " + name + "\r\n";
+        }
+        else if(format.compare("LIST") == 0)
+        {
+            string t = u64str(i->second.modified);
+            string d = string(months[(t[4] - '0') * 10 + (t[5] - '0') - 1]) + " " + t.substr(6, 2) + "  " + t.substr(0, 4);
+            res += "-rw-r--r--    1 ftp      ftp      " + string(size.length() < 8 ? 8 - size.length() : 0, ' ') + size + " " + d + " " + name + "\r\n";
+        }
+        else
+        {
+            res += name + "\r\n";
+        }
+    }
+
+    return res;
+}
+
+void TestServer::serveFtp(SOCKET s)
+{
+    LineReader reader(s);
+    string     line;
+    string     cwd    = "/";
+    SOCKET     pasv   = INVALID_SOCKET;
+    bool       firstRetr = true;
+    unsigned long long rest = 0;
+
+    sendText(s, "220 IDP test server\r\n");
+
+    while(reader.readLine(line))
+    {
+        size_t space = line.find(' ');
+        string cmd   = upper(line.substr(0, space));
+        string arg   = (space == string::npos) ? "" : line.substr(space + 1);
+
+        atomicadd(counters->requests, 1);
+
+        if(cmd.compare("USER") == 0)
+        {
+            sendText(s, "331 Password required\r\n");
+        }
+        else if(cmd.compare("PASS") == 0)
+        {
+            sendText(s, "230 Logged in\r\n");
+        }
+        else if(cmd.compare("SYST") == 0)
+        {
+            sendText(s, "215 UNIX Type: L8\r\n");
+        }
+        else if(cmd.compare("FEAT") == 0)
+        {
+            sendText(s, "211-Features:\r\n MDTM\r\n MLST type*;size*;modify*;\r\n REST STREAM\r\n SIZE\r\n EPSV\r\n PASV\r\n211 End\r\n");
+        }
+        else if((cmd.compare("TYPE") == 0) || (cmd.compare("OPTS") == 0) || (cmd.compare("MODE") == 0) || (cmd.compare("STRU") == 0))
+        {
+            sendText(s, "200 OK\r\n");
+        }
+        else if(cmd.compare("NOOP") == 0)
+        {
+            sendText(s, "200 NOOP ok\r\n");
+        }
+        else if((cmd.compare("PWD") == 0) || (cmd.compare("XPWD") == 0))
+        {
+            sendText(s, "257 \"" + cwd + "\" is current directory\r\n");
+        }
+        else if((cmd.compare("CWD") == 0) || (cmd.compare("CDUP") == 0))
+        {
+            string dir = resolvePath(cwd, (cmd.compare("CDUP") == 0) ? ".." : arg);
+
+            if(dirExists(dir))
+            {
+                cwd = dir;
+                sendText(s, "250 Directory changed\r\n");
+            }
+            else
+            {
+                sendText(s, "550 No such directory\r\n");
+            }
+        }
+        else if((cmd.compare("PASV") == 0) || (cmd.compare("EPSV") == 0))
+        {
+            if(pasv != INVALID_SOCKET)
+                closesocket(pasv);
+
+            unsigned short port;
+            pasv = listenSocket(&port);
+
+            if(pasv == INVALID_SOCKET)
+            {
+                sendText(s, "425 Cannot open data connection\r\n");
+            }
+            else if(cmd.compare("EPSV") == 0)
+            {
+                sendText(s, "229 Entering Extended Passive Mode (|||" + u64str(port) + "|)\r\n");
+            }
+            else
+            {
+                sendText(s, "227 Entering Passive Mode (127,0,0,1," + u64str(port >> 8) + "," + u64str(port & 0xFF) + ")\r\n");
+            }
+        }
+        else if(cmd.compare("SIZE") == 0)
+        {
+            const TestFile *file = findFile(resolvePath(cwd, arg));
+
+            if(file)
+                sendText(s, "213 " + u64str(file->size) + "\r\n");
+            else
+                sendText(s, "550 No such file\r\n");
+        }
+        else if(cmd.compare("MDTM") == 0)
+        {
+            const TestFile *file = findFile(resolvePath(cwd, arg));
+
+            if(file)
+                sendText(s, "213 " + u64str(file->modified) + "\r\n");
+            else
+                sendText(s, "550 No such file\r\n");
+        }
+        else if(cmd.compare("REST") == 0)
+        {
+            rest = strtoull(arg.c_str(), NULL, 10);
+            sendText(s, "350 Restarting at " + u64str(rest) + "\r\n");
+        }
+        else if((cmd.compare("RETR") == 0) || (cmd.compare("LIST") == 0) || (cmd.compare("NLST") == 0) || (cmd.compare("MLSD") == 0))
+        {
+            string path = resolvePath(cwd, ((cmd.compare("RETR") == 0) || arg.empty() || (arg[0] != '-')) ? arg : "");
+            const TestFile  *file  = NULL;
+            const TestFault *fault = NULL;
+            string listing;
+
+            if(cmd.compare("RETR") == 0)
+            {
+                file = findFile(path);
+
+                if(!file || (rest > file->size))
+                {
+                    sendText(s, "550 No such file\r\n");
+                    rest = 0;
+                    continue;
+                }
+
+                fault = findFault(path);
+                noteRequest(fault);
+
+                if(fault)
+                {
+                    if(firstRetr)
+                        Sleep(fault->handshake);
+
+                    Sleep(fault->latency);
+                }
+
+                firstRetr = false;
+
+                if(fault && fault->status)
+                {
+                    sendText(s, u64str(fault->status) + " Injected fault\r\n");
+                    rest = 0;
+
+                    if(fault->status == 421)
+                        break; // Service not available, closing control connection
+
+                    continue;
+                }
+            }
+            else
+            {
+                if(!dirExists(path))
+                {
+                    sendText(s, "550 No such directory\r\n");
+                    continue;
+                }
+
+                listing = listDir(path, cmd);
+            }
+
+            if(pasv == INVALID_SOCKET)
+            {
+                sendText(s, "425 Use PASV first\r\n");
+                continue;
+            }
+
+            sendText(s, "150 Opening BINARY mode data connection\r\n");
+
+            SOCKET data = accept(pasv, NULL, NULL);
+            closesocket(pasv);
+            pasv = INVALID_SOCKET;
+
+            bool ok = (data != INVALID_SOCKET) &&
+                      (file ? sendFile(data, path, rest, file->size - rest, fault, file->size) : sendText(data, listing));
+
+            if(data != INVALID_SOCKET)
+                closesocket(data);
+
+            rest = 0;
+            sendText(s, ok ? "226 Transfer complete\r\n" : "426 Connection closed, transfer aborted\r\n");
+        }
+        else if(cmd.compare("ABOR") == 0)
+        {
+            sendText(s, "226 Abort successful\r\n");
+        }
+        else if(cmd.compare("QUIT") == 0)
+        {
+            sendText(s, "221 Goodbye\r\n");
+            break;
+        }
+        else
+        {
+            sendText(s, "502 Command not implemented\r\n");
+        }
+    }
+
+    if(pasv != INVALID_SOCKET)
+        closesocket(pasv);
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+// Loopback HTTP & FTP stand-in server for tests and benchmarks.
+// Serves synthetic files: content is generated from file name, so nothing is
+// stored on disk and any downloaded file can be verified with TestServer::fill().
+// Files with same name in different directories (mirrors) have same content.
+// HTTP responses carry ETag, made of modification time & size, If-Range is supported.
+// Network conditions & failures are scripted per URL with TestServer::addFault().
+
+#ifdef _WIN32
+#include <winsock2.h>
+#endif
+#include <windows.h>
+#include <string>
+#include <map>
+#include <set>
+#include <vector>
+
+using namespace std;
+
+#ifndef _WIN32
+typedef int SOCKET;
+#endif
+
+#define TESTSERVER_MODIFIED 20200101000000ULL
+#define TESTFAULT_NEVER     ((unsigned long long)-1)
+
+struct TestFile
+{
+    unsigned long long size;
+    unsigned long long modified; // YYYYMMDDHHMMSS
+};
+
+// Condition, applied to requests of files with matching path prefix.
+// Text form (see parseFault): "/prefix key=value ...", keys are handshake, latency,
+// bandwidth, status, retryafter, reset, stall, stalltime, corrupt, times. Sizes accept
+// k/m/g suffixes, reset, stall & corrupt positions also accept percent of file size ("50%").
+struct TestFault
+{
+    TestFault();
+
+    DWORD              handshake;      // ms before first response on connection (emulates slow TLS handshake)
+    DWORD              latency;        // ms before each response
+    unsigned long long bandwidth;      // bytes per second, 0 - unlimited
+    int                status;         // Respond with this status instead of file (HTTP code or FTP reply)
+    DWORD              retryAfter;     // seconds for Retry-After header of 429/503 responses, 0 - none
+    unsigned long long resetAfter;     // Reset connection, when this file offset is reached
+    int                resetPercent;   // ... or this percent of file, -1 - not used
+    unsigned long long stallAfter;     // Stop sending, when this file offset is reached
+    int                stallPercent;   // ... or this percent of file, -1 - not used
+    DWORD              stallTime;      // ms to stall, INFINITE - until client disconnects
+    unsigned long long corruptAt;      // Send inverted byte at this file offset
+    int                corruptPercent; // ... or at this percent of file, -1 - not used
+    int                times;          // Apply to first N matching requests, -1 - to all
+};
+
+// Counters are placed in memory, shared with server process
+struct TestServerStats
+{
+    volatile long long connections;
+    volatile long long requests;
+    volatile long long bytesSent;
+    volatile long long bodyBytes;     // File content bytes, sent to clients
+    volatile long long faults;        // Requests, affected by faults
+    volatile long long recoveries;    // Clean requests, which followed faulted one
+    volatile long long recoveryTime;  // Sum of ms between fault and next clean request
+    volatile long long lastFaultTick;
+    volatile long long pendingRecovery;
+};
+
+class TestServer
+{
+public:
+    TestServer();
+    ~TestServer();
+
+    void addFile(string path, unsigned long long size, unsigned long long modified = TESTSERVER_MODIFIED);
+    void addFault(string prefix, TestFault fault);
+    bool addFault(string script);
+    bool start(bool separateProcess = true);
+    void stop();
+
+    unsigned short httpPort();
+    unsigned short ftpPort();
+    string         httpUrl(string path);
+    string         ftpUrl(string path);
+    TestServerStats stats();
+
+    static void fill(string path, unsigned long long offset, void *buffer, size_t size);
+    static bool verify(string path, const _TCHAR *filename, unsigned long long size);
+    static bool parseFault(string spec, string *prefix, TestFault *fault);
+
+protected:
+    void serveHttp(SOCKET s);
+    void serveFtp(SOCKET s);
+    bool sendFile(SOCKET s, string path, unsigned long long offset, unsigned long long size, const TestFault *fault = NULL, unsigned long long fileSize = 0);
+    const TestFault *findFault(string path);
+    void noteRequest(const TestFault *fault);
+    bool sendData(SOCKET s, const void *data, size_t size);
+    bool sendText(SOCKET s, string text);
+    string listDir(string dir, string format);
+    string resolvePath(string cwd, string arg);
+    const TestFile *findFile(string path);
+    bool dirExists(string path);
+
+    map<string, TestFile> files;
+    set<string>           dirs;
+    vector<string>        faultPrefixes;
+    vector<TestFault>     faults;
+    volatile long long    *faultsUsed;
+    SOCKET                httpSocket;
+    SOCKET                ftpSocket;
+    unsigned short        httpListenPort;
+    unsigned short        ftpListenPort;
+    TestServerStats      *counters;
+#ifdef _WIN32
+    HANDLE                threads[2];
+#else
+    int                   pid;
+#endif
+
+    friend unsigned __stdcall testServerAcceptProc(void *param);
+    friend void testServerConnectionProc(void *param);
+};
@@ -14,6 +14,7 @@ class DownloadTask extends Task
     private $registryfolder;
     private $downloadfolder;
     private $wpnxmversion;
+    private $downloader;
 
     function setRegistryFolder($registryfolder)
     {
@@ -30,15 +31,69 @@ class DownloadTask extends Task
         $this->wpnxmversion = $wpnxmversion;
     }
 
+    function setDownloader($downloader)
+    {
+        $this->downloader = $downloader;
+    }
+
     function main()
     {
         defined('DS') || define('DS', DIRECTORY_SEPARATOR);
 
-        $this->log('Downloading Components using Aria2');
-
         // get aria download description files
         $files = glob($this->registryfolder . DS . 'downloads-for-{full,literc}-' . $this->wpnxmversion . '*.txt', GLOB_BRACE);
 
+        if($this->hasIdpget()) {
+            $this->downloadUsingIdpget($files);
+        } else {
+            $this->downloadUsingAria($files);
+        }
+    }
+
+    function hasIdpget()
+    {
+        if(empty($this->downloader)) {
+            return false;
+        }
+
+        if(is_file($this->downloader)) {
+            return true;
+        }
+
+        // idpget is built from source on Linux and found in PATH
+        return (DS === '/') && (trim(shell_exec('command -v ' . escapeshellarg($this->downloader))) !== '');
+    }
+
+    /**
+     * idpget - command-line front end of the Inno Download Plugin (bin/innosetup-download-plugin).
+     * It reads the aria download lists, downloads files concurrently, checks their sizes,
+     * skips files, which were already downloaded, and prints one line per file.
+     * All lists are passed at once, so components shared by installers are downloaded once.
+     */
+    function downloadUsingIdpget($files)
+    {
+        $this->log('Downloading Components using idpget');
+
+        foreach($files as $file) {
+            $this->log('Using ' . $file);
+        }
+
+        $cmd = escapeshellarg($this->downloader)
+        . ' --jobs 4 --split 4 --retries 5 --min-size 2k --no-check-certificate'
+        . ' --user-agent "WPN-XM Server Stack Downloader"'
+        . ' ' . implode(' ', array_map('escapeshellarg', $files));
+
+        passthru($cmd, $exitCode);
+
+        if($exitCode !== 0) {
+            throw new BuildException('Some components were not downloaded. See the report above.');
+        }
+    }
+
+    function downloadUsingAria($files)
+    {
+        $this->log('Downloading Components using Aria2');
+
         foreach($files as $file)
         {
             $this->log('Using ' . $file);
@@ -140,6 +140,7 @@ class GenerateAriaDownloadListsTask extends Task
         $txt .= '# Download Links for the Installation Wizard "' . $installerName . '".' . PHP_EOL;
         $txt .= '#' . PHP_EOL;
         $txt .= '# This aria2c input file contains a list of URIs for parallel downloading.' . PHP_EOL;
+        $txt .= '# It is read by idpget (see DownloadTask) or aria2c.' . PHP_EOL;
         $txt .= '# The file is auto-generated. Do not modify.' . PHP_EOL;
         $txt .= '#' . PHP_EOL;
         $txt .= '# For syntax, see:' . PHP_EOL;